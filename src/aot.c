@@ -0,0 +1,1439 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "aot.h"
+#include "segment.h"
+#include "sbuf.h"
+#include "gc.h"
+#include "utils.h"
+
+/* Every function is run over abstract values, which only hold the depth of
+ * the stack and what is known about each entry. The first runs repeat until
+ * nothing changes and infer the kind of the locals and of the stack entries
+ * at every jump target: a local only ever set to integers, on every path
+ * before it is read, becomes an int64_t variable and the comparisons feeding
+ * conditional jumps stay C booleans. The last run writes the C code, boxing
+ * the unboxed values where they meet code that needs objects. */
+
+// Locals tracked by the definite assignment bit set, the others stay objects
+#define AOT_MAX_TYPED_LOCALS 64
+
+// Buffers of the variable names and of the short expressions around them
+#define AOT_VAR_LEN 16
+#define AOT_NAME_LEN 64
+
+typedef enum AotKind {
+    AOT_UNDEFINED,  // nothing stored yet, while the kinds are inferred
+    AOT_INTEGER,    // in the int64_t variable
+    AOT_BOOLEAN,    // in the bool variable
+    AOT_OBJECT,
+} AotKind_t;
+
+typedef enum AotCallee {
+    AOT_CALLEE_UNKNOWN,
+    AOT_CALLEE_SELF,        // closure of the running function
+    AOT_CALLEE_FUNCTION,    // a closure of functions[index]
+    AOT_CALLEE_BUILTIN,
+} AotCallee_t;
+
+typedef struct AotSlot {
+    AotKind_t kind;
+    bool boxed; // an unboxed value whose object is in the slot variable too
+    int32_t constant; // constants[] index of a boxed integer of the same value, -1 if none
+    AotCallee_t callee;
+    uint32_t index;
+} AotSlot_t;
+
+typedef struct AotState {
+    bool reached;
+    uint32_t depth;
+    uint64_t assigned; // the first locals, set on every path to here
+    AotSlot_t* slots;
+} AotState_t;
+
+// Shared by the functions of a program
+typedef struct AotEmitter {
+    bool failed;
+    CompiledFunction_t** functions;
+    uint32_t numFunctions;
+    uint32_t functionCapacity;
+    HashMap_t* constantIndex; // integer or string key -> constants[] index + 1
+    Strbuf_t* setup;
+    uint32_t numConstants;
+    uint32_t numGlobals;
+} AotEmitter_t;
+
+typedef struct AotCompiler {
+    AotEmitter_t* e;
+    CompiledFunction_t* fn;
+    int32_t id; // in functions, -1 for main
+    const CodeWord_t* code;
+    uint32_t length;
+
+    bool* labels; // jump targets, the end included
+    bool* reachable;
+    uint32_t maxDepth;
+    uint32_t* successors;
+    uint32_t successorCapacity;
+
+    AotState_t* entries; // at the labels
+    AotState_t current;
+    AotKind_t* locals;
+    bool changed;
+
+    // main only, the end of the program is reachable from there without
+    // another pop: the value popped right before is the result
+    bool* endsClean;
+
+    Strbuf_t* body; // NULL while inferring
+    uint8_t* used; // per stack entry, which of its variables appear
+    uint32_t indent; // nesting of the lines written
+} AotCompiler_t;
+
+#define AOT_USED_OBJECT 1
+#define AOT_USED_INTEGER 2
+#define AOT_USED_BOOLEAN 4
+
+/************************************
+ *        INSTRUCTION LAYOUT        *
+ ************************************/
+
+static uint32_t aotLength(const CodeWord_t* code, uint32_t ip) {
+    return 1 + opLookup(code[ip])->argCount;
+}
+
+static void aotStackEffect(const CodeWord_t* code, uint32_t ip, uint32_t* pops, uint32_t* pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch (code[ip]) {
+        case OP_CONSTANT:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NULL:
+        case OP_GET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_MOVE_LOCAL:
+        case OP_GET_BUILTIN:
+        case OP_GET_FREE:
+        case OP_CURRENT_CLOSURE:
+        case OP_PUSH_INT8:
+        case OP_PUSH_INT16:
+            *pushes = 1;
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER_THAN:
+        case OP_INDEX:
+        case OP_ADD_I64:
+        case OP_SUB_I64:
+        case OP_MUL_I64:
+        case OP_EQUAL_I64:
+        case OP_NOT_EQUAL_I64:
+        case OP_GREATER_THAN_I64:
+            *pops = 2;
+            *pushes = 1;
+            break;
+        case OP_MINUS:
+        case OP_BANG:
+        case OP_MINUS_I64:
+        case OP_ADD_IMM:
+        case OP_SUB_IMM:
+        case OP_GREATER_THAN_IMM:
+            *pops = 1;
+            *pushes = 1;
+            break;
+        case OP_JUMP_NOT_TRUTHY:
+        case OP_SET_GLOBAL:
+        case OP_SET_LOCAL:
+        case OP_POP:
+        case OP_SWITCH_TABLE:
+        case OP_RETURN_VALUE:
+            *pops = 1;
+            break;
+        case OP_JUMP_NOT_EQUAL_I64:
+        case OP_JUMP_NOT_GREATER_THAN_I64:
+            *pops = 2;
+            break;
+        case OP_ARRAY:
+        case OP_HASH:
+            *pops = code[ip + 1];
+            *pushes = 1;
+            break;
+        case OP_CLOSURE:
+            *pops = code[ip + 2];
+            *pushes = 1;
+            break;
+        case OP_CALL:
+            *pops = code[ip + 1] + 1;
+            *pushes = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+// Whether the instruction pops anything the vm would leave as the last
+// popped object. Calls don't count, their result is popped after them.
+static bool aotPops(const CodeWord_t* code, uint32_t ip) {
+    switch (code[ip]) {
+        case OP_ARRAY:
+        case OP_HASH:
+            return code[ip + 1] > 0;
+        case OP_CLOSURE:
+            return code[ip + 2] > 0;
+        case OP_CALL:
+            return false;
+        default: {
+            uint32_t pops, pushes;
+            aotStackEffect(code, ip, &pops, &pushes);
+            return pops > 0;
+        }
+    }
+}
+
+static void aotAddSuccessor(AotCompiler_t* c, uint32_t* count, uint32_t ip) {
+    if (*count == c->successorCapacity) {
+        c->successorCapacity = c->successorCapacity ? c->successorCapacity * 2 : 16;
+        c->successors = realloc(c->successors, c->successorCapacity * sizeof(uint32_t));
+        if (!c->successors) HANDLE_OOM();
+    }
+    c->successors[(*count)++] = ip;
+}
+
+// Fills c->successors with where the instruction at ip continues,
+// c->length being the end of main. Returns their count.
+static uint32_t aotSuccessors(AotCompiler_t* c, uint32_t ip) {
+    const CodeWord_t* code = c->code;
+    uint32_t count = 0;
+    switch (code[ip]) {
+        case OP_JUMP:
+            aotAddSuccessor(c, &count, code[ip + 1]);
+            break;
+        case OP_JUMP_NOT_TRUTHY:
+        case OP_JUMP_NOT_EQUAL_I64:
+        case OP_JUMP_NOT_GREATER_THAN_I64:
+            aotAddSuccessor(c, &count, ip + aotLength(code, ip));
+            aotAddSuccessor(c, &count, code[ip + 1]);
+            break;
+        case OP_SWITCH_TABLE: {
+            // see compiler.h for the layout
+            Array_t* table = (Array_t*)c->fn->constants[code[ip + 1]];
+            int64_t* entries = arrayGetInts(table);
+            uint32_t numEntries = arrayGetElementCount(table);
+            aotAddSuccessor(c, &count, entries[0]);
+            bool dense = entries[1] == SWITCH_TABLE_DENSE;
+            for (uint32_t i = 3; i < numEntries; i += dense ? 1 : 2) {
+                aotAddSuccessor(c, &count, entries[i]);
+            }
+            break;
+        }
+        case OP_RETURN_VALUE:
+        case OP_RETURN:
+            if (c->id < 0) aotAddSuccessor(c, &count, c->length);
+            break;
+        default:
+            aotAddSuccessor(c, &count, ip + aotLength(code, ip));
+            break;
+    }
+    return count;
+}
+
+/************************************
+ *          CODE OUTPUT             *
+ ************************************/
+
+static char* aotFormatV(const char* fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, fmt, copy);
+    va_end(copy);
+    char* str = mallocChk(len + 1);
+    vsnprintf(str, len + 1, fmt, args);
+    return str;
+}
+
+static void aotWriteTo(Strbuf_t* out, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    strbufConsume(out, aotFormatV(fmt, args));
+    va_end(args);
+}
+
+// Empty buffers have no string yet
+static void aotWriteBuffer(Strbuf_t* out, Strbuf_t* buf) {
+    if (buf->len > 0) strbufWrite(out, buf->str);
+}
+
+// A line of the function body, nothing while inferring
+static void aotWrite(AotCompiler_t* c, const char* fmt, ...) {
+    if (!c->body) return;
+    for (uint32_t i = 0; i <= c->indent; i++) {
+        strbufWrite(c->body, "    ");
+    }
+    va_list args;
+    va_start(args, fmt);
+    strbufConsume(c->body, aotFormatV(fmt, args));
+    va_end(args);
+    strbufWriteChar(c->body, '\n');
+}
+
+static const char* aotOpName(OpCode_t op) {
+    switch (op) {
+        case OP_ADD: return "OP_ADD";
+        case OP_SUB: return "OP_SUB";
+        case OP_MUL: return "OP_MUL";
+        case OP_DIV: return "OP_DIV";
+        case OP_EQUAL: return "OP_EQUAL";
+        case OP_NOT_EQUAL: return "OP_NOT_EQUAL";
+        case OP_GREATER_THAN: return "OP_GREATER_THAN";
+        case OP_ADD_IMM: return "OP_ADD_IMM";
+        case OP_SUB_IMM: return "OP_SUB_IMM";
+        case OP_GREATER_THAN_IMM: return "OP_GREATER_THAN_IMM";
+        default: return "";
+    }
+}
+
+static const char* aotIntegerLiteral(int64_t value, char* buf) {
+    if (value == INT64_MIN) {
+        snprintf(buf, AOT_NAME_LEN, "INT64_MIN");
+    } else if (value >= INT32_MIN && value <= INT32_MAX) {
+        snprintf(buf, AOT_NAME_LEN, "%" PRId64, value);
+    } else {
+        snprintf(buf, AOT_NAME_LEN, "INT64_C(%" PRId64 ")", value);
+    }
+    return buf;
+}
+
+// Octal escapes for anything but printable characters, question marks
+// included so no trigraph comes out
+static void aotWriteStringLiteral(Strbuf_t* out, const char* str, uint32_t len) {
+    strbufWriteChar(out, '"');
+    for (uint32_t i = 0; i < len; i++) {
+        unsigned char ch = str[i];
+        if (ch >= ' ' && ch <= '~' && ch != '"' && ch != '\\' && ch != '?') {
+            strbufWriteChar(out, ch);
+        } else {
+            aotWriteTo(out, "\\%03o", ch);
+        }
+    }
+    strbufWriteChar(out, '"');
+}
+
+/************************************
+ *      FUNCTIONS AND CONSTANTS     *
+ ************************************/
+
+static uint32_t aotFunctionId(AotEmitter_t* e, CompiledFunction_t* fn) {
+    for (uint32_t i = 0; i < e->numFunctions; i++) {
+        if (e->functions[i] == fn) return i;
+    }
+    if (e->numFunctions == e->functionCapacity) {
+        e->functionCapacity = e->functionCapacity ? e->functionCapacity * 2 : 16;
+        e->functions = realloc(e->functions, e->functionCapacity * sizeof(CompiledFunction_t*));
+        if (!e->functions) HANDLE_OOM();
+    }
+    e->functions[e->numFunctions] = fn;
+    aotWriteTo(e->setup, "    functions[%u] = aotCreateFunction(function%uEntry, %u, %u);\n",
+        e->numFunctions, e->numFunctions, fn->numLocals, fn->numParameters);
+    return e->numFunctions++;
+}
+
+// Index of the object in the constants of the generated program, -1 if it
+// has no C form
+static int32_t aotConstantIndex(AotEmitter_t* e, Object_t* obj) {
+    char* key;
+    switch (obj->type) {
+        case OBJECT_INTEGER:
+            key = strFormat("i%" PRId64, ((Integer_t*)obj)->value);
+            break;
+        case OBJECT_STRING:
+            key = strFormat("s%p", (void*)obj);
+            break;
+        default:
+            return -1;
+    }
+
+    void* found = hashMapGet(e->constantIndex, key);
+    if (found) {
+        free(key);
+        return (int32_t)(uintptr_t)found - 1;
+    }
+
+    uint32_t index = e->numConstants++;
+    hashMapInsert(e->constantIndex, key, (void*)(uintptr_t)(index + 1));
+    free(key);
+
+    if (obj->type == OBJECT_INTEGER) {
+        char literal[AOT_NAME_LEN];
+        aotWriteTo(e->setup, "    constants[%u] = aotInteger(%s);\n", index,
+            aotIntegerLiteral(((Integer_t*)obj)->value, literal));
+    } else {
+        String_t* str = (String_t*)obj;
+        aotWriteTo(e->setup, "    constants[%u] = (Object_t*)%screateStringWithLength(", index,
+            str->interned ? "stringIntern(" : "");
+        aotWriteStringLiteral(e->setup, stringGetValue(str), stringGetLength(str));
+        aotWriteTo(e->setup, ", %u)%s;\n", stringGetLength(str), str->interned ? ")" : "");
+    }
+    gcSetRef(obj, GC_REF_COMPILE_CONSTANT);
+    return index;
+}
+
+static int32_t aotIntegerConstant(AotEmitter_t* e, int64_t value) {
+    Integer_t* obj = createInteger(value);
+    int32_t index = aotConstantIndex(e, (Object_t*)obj);
+    gcClearRef(obj, GC_REF_COMPILE_CONSTANT);
+    return index;
+}
+
+/************************************
+ *           STACK ENTRIES          *
+ ************************************/
+
+static AotSlot_t* aotSlot(AotCompiler_t* c, uint32_t d) {
+    return &c->current.slots[d];
+}
+
+static uint32_t aotPush(AotCompiler_t* c, AotKind_t kind) {
+    uint32_t d = c->current.depth++;
+    c->current.slots[d] = (AotSlot_t) {
+        .kind = kind,
+        .boxed = false,
+        .constant = -1,
+        .callee = AOT_CALLEE_UNKNOWN,
+        .index = 0,
+    };
+    return d;
+}
+
+static void aotPop(AotCompiler_t* c, uint32_t count) {
+    c->current.depth -= count;
+}
+
+static const char* aotName(AotCompiler_t* c, char prefix, uint32_t d, char* buf) {
+    if (c->body) {
+        c->used[d] |= prefix == 's' ? AOT_USED_OBJECT : (prefix == 'i' ? AOT_USED_INTEGER : AOT_USED_BOOLEAN);
+    }
+    snprintf(buf, AOT_VAR_LEN, "%c%u", prefix, d);
+    return buf;
+}
+
+// Object of the entry, without storing it: a boxed unboxed value
+static const char* aotObjectOf(AotCompiler_t* c, AotSlot_t slot, uint32_t d, char* buf) {
+    char name[AOT_VAR_LEN];
+    if (slot.kind == AOT_INTEGER && !slot.boxed) {
+        if (slot.constant >= 0) {
+            snprintf(buf, AOT_NAME_LEN, "constants[%d]", slot.constant);
+        } else {
+            snprintf(buf, AOT_NAME_LEN, "aotInteger(%s)", aotName(c, 'i', d, name));
+        }
+        return buf;
+    }
+    if (slot.kind == AOT_BOOLEAN && !slot.boxed) {
+        snprintf(buf, AOT_NAME_LEN, "aotBoolean(%s)", aotName(c, 'b', d, name));
+        return buf;
+    }
+    return aotName(c, 's', d, buf);
+}
+
+// Object of the entry, boxed into its variable first if needed
+static const char* aotObject(AotCompiler_t* c, uint32_t d, char* buf) {
+    AotSlot_t* slot = aotSlot(c, d);
+    if ((slot->kind == AOT_INTEGER || slot->kind == AOT_BOOLEAN) && !slot->boxed) {
+        char value[AOT_NAME_LEN];
+        aotWrite(c, "%s = %s;", aotName(c, 's', d, buf), aotObjectOf(c, *slot, d, value));
+        slot->boxed = true;
+    }
+    return aotName(c, 's', d, buf);
+}
+
+// The integer in the entry, objects are trusted to be integers like the
+// unchecked instructions do
+static const char* aotIntegerValue(AotCompiler_t* c, uint32_t d, char* buf) {
+    char name[AOT_VAR_LEN];
+    if (aotSlot(c, d)->kind == AOT_INTEGER) {
+        return aotName(c, 'i', d, buf);
+    }
+    snprintf(buf, AOT_NAME_LEN, "((Integer_t*)%s)->value", aotObject(c, d, name));
+    return buf;
+}
+
+// While inferring undefined entries are whatever the operation would like
+static bool aotIsInteger(AotKind_t kind) {
+    return kind == AOT_INTEGER || kind == AOT_UNDEFINED;
+}
+
+static bool aotIsBoolean(AotKind_t kind) {
+    return kind == AOT_BOOLEAN || kind == AOT_UNDEFINED;
+}
+
+static AotKind_t aotJoin(AotKind_t a, AotKind_t b) {
+    if (a == AOT_UNDEFINED) return b;
+    if (b == AOT_UNDEFINED || a == b) return a;
+    return AOT_OBJECT;
+}
+
+/************************************
+ *        JUMPS AND LABELS          *
+ ************************************/
+
+static void aotMerge(AotCompiler_t* c, uint32_t target) {
+    AotState_t* entry = &c->entries[target];
+    AotState_t* cur = &c->current;
+    if (!entry->reached) {
+        entry->reached = true;
+        entry->depth = cur->depth;
+        entry->assigned = cur->assigned;
+        for (uint32_t d = 0; d < cur->depth; d++) {
+            entry->slots[d] = cur->slots[d];
+            entry->slots[d].boxed = false;
+        }
+        c->changed = true;
+        return;
+    }
+
+    if (entry->depth != cur->depth) {
+        c->e->failed = true;
+        return;
+    }
+    if ((entry->assigned & cur->assigned) != entry->assigned) {
+        entry->assigned &= cur->assigned;
+        c->changed = true;
+    }
+    for (uint32_t d = 0; d < cur->depth; d++) {
+        AotSlot_t* slot = &entry->slots[d];
+        AotSlot_t* from = &cur->slots[d];
+        AotKind_t kind = aotJoin(slot->kind, from->kind);
+        bool sameConstant = slot->constant == from->constant;
+        bool sameCallee = slot->callee == from->callee && slot->index == from->index;
+        if (kind != slot->kind || (!sameConstant && slot->constant >= 0) || (!sameCallee && slot->callee != AOT_CALLEE_UNKNOWN)) {
+            slot->kind = kind;
+            if (!sameConstant) slot->constant = -1;
+            if (!sameCallee) slot->callee = AOT_CALLEE_UNKNOWN;
+            c->changed = true;
+        }
+    }
+}
+
+// Boxes what the target keeps as objects, the current state is left as is
+static void aotConvert(AotCompiler_t* c, uint32_t target) {
+    AotState_t* entry = &c->entries[target];
+    for (uint32_t d = 0; d < entry->depth; d++) {
+        AotSlot_t slot = *aotSlot(c, d);
+        if (entry->slots[d].kind == AOT_OBJECT && slot.kind != AOT_OBJECT && !slot.boxed) {
+            char name[AOT_NAME_LEN], value[AOT_NAME_LEN];
+            aotWrite(c, "%s = %s;", aotName(c, 's', d, name), aotObjectOf(c, slot, d, value));
+        }
+    }
+}
+
+// Control continues at target with the current stack
+static void aotBranch(AotCompiler_t* c, uint32_t target) {
+    if (!c->body) {
+        aotMerge(c, target);
+        return;
+    }
+    aotConvert(c, target);
+    aotWrite(c, "goto L%u;", target);
+}
+
+// Writes the entry popped last to the result of main, if the end of the
+// program follows on the way to next
+static void aotLastPopped(AotCompiler_t* c, uint32_t d, uint32_t next) {
+    if (!c->endsClean || !c->endsClean[next]) return;
+    char value[AOT_NAME_LEN];
+    aotWrite(c, "last = %s;", aotObjectOf(c, *aotSlot(c, d), d, value));
+}
+
+// Jumps to target unless cond holds, popped is the entry the jump popped last
+static void aotConditionalJump(AotCompiler_t* c, const char* cond, uint32_t target, uint32_t next, uint32_t popped) {
+    aotWrite(c, "if (!(%s)) {", cond);
+    c->indent++;
+    aotLastPopped(c, popped, target);
+    aotBranch(c, target);
+    c->indent--;
+    aotWrite(c, "}");
+    aotLastPopped(c, popped, next);
+}
+
+/************************************
+ *           INSTRUCTIONS           *
+ ************************************/
+
+static void aotEmitConstant(AotCompiler_t* c, uint32_t index) {
+    char name[AOT_NAME_LEN], literal[AOT_NAME_LEN];
+    Object_t* obj = c->fn->constants[index];
+    int32_t constant = aotConstantIndex(c->e, obj);
+    if (constant < 0) {
+        c->e->failed = true;
+        return;
+    }
+
+    if (obj->type == OBJECT_INTEGER) {
+        uint32_t d = aotPush(c, AOT_INTEGER);
+        aotSlot(c, d)->constant = constant;
+        aotWrite(c, "%s = %s;", aotName(c, 'i', d, name), aotIntegerLiteral(((Integer_t*)obj)->value, literal));
+    } else {
+        uint32_t d = aotPush(c, AOT_OBJECT);
+        aotWrite(c, "%s = constants[%d];", aotName(c, 's', d, name), constant);
+    }
+}
+
+static void aotEmitPushInteger(AotCompiler_t* c, int32_t value) {
+    char name[AOT_NAME_LEN];
+    int32_t constant = aotIntegerConstant(c->e, value);
+    uint32_t d = aotPush(c, AOT_INTEGER);
+    aotSlot(c, d)->constant = constant;
+    aotWrite(c, "%s = %d;", aotName(c, 'i', d, name), value);
+}
+
+static void aotEmitArithmetic(AotCompiler_t* c, OpCode_t op) {
+    char result[AOT_NAME_LEN], left[AOT_NAME_LEN], right[AOT_NAME_LEN];
+    uint32_t l = c->current.depth - 2;
+    uint32_t r = l + 1;
+
+    if (aotIsInteger(aotSlot(c, l)->kind) && aotIsInteger(aotSlot(c, r)->kind)) {
+        aotIntegerValue(c, l, left);
+        aotIntegerValue(c, r, right);
+        aotPop(c, 2);
+        aotPush(c, AOT_INTEGER);
+        aotName(c, 'i', l, result);
+        switch (op) {
+            case OP_ADD: aotWrite(c, "%s = aotAddInt(%s, %s);", result, left, right); break;
+            case OP_SUB: aotWrite(c, "%s = aotSubInt(%s, %s);", result, left, right); break;
+            case OP_MUL: aotWrite(c, "%s = aotMulInt(%s, %s);", result, left, right); break;
+            default: aotWrite(c, "%s = %s / %s;", result, left, right); break;
+        }
+        return;
+    }
+
+    aotObject(c, l, left);
+    aotObject(c, r, right);
+    aotPop(c, 2);
+    aotPush(c, AOT_OBJECT);
+    aotWrite(c, "%s = aotBinary(%s, %s, %s);", aotName(c, 's', l, result), aotOpName(op), left, right);
+}
+
+static void aotEmitComparison(AotCompiler_t* c, OpCode_t op) {
+    char result[AOT_NAME_LEN], left[AOT_NAME_LEN], right[AOT_NAME_LEN];
+    uint32_t l = c->current.depth - 2;
+    uint32_t r = l + 1;
+    AotKind_t leftKind = aotSlot(c, l)->kind;
+    AotKind_t rightKind = aotSlot(c, r)->kind;
+    const char* cmp = op == OP_EQUAL ? "==" : (op == OP_NOT_EQUAL ? "!=" : ">");
+
+    if (aotIsInteger(leftKind) && aotIsInteger(rightKind)) {
+        aotIntegerValue(c, l, left);
+        aotIntegerValue(c, r, right);
+    } else if (op != OP_GREATER_THAN && aotIsBoolean(leftKind) && aotIsBoolean(rightKind)) {
+        aotName(c, 'b', l, left);
+        aotName(c, 'b', r, right);
+    } else {
+        aotObject(c, l, left);
+        aotObject(c, r, right);
+        aotPop(c, 2);
+        aotPush(c, AOT_BOOLEAN);
+        aotWrite(c, "%s = aotCompare(%s, %s, %s);", aotName(c, 'b', l, result), aotOpName(op), left, right);
+        return;
+    }
+    aotPop(c, 2);
+    aotPush(c, AOT_BOOLEAN);
+    aotWrite(c, "%s = %s %s %s;", aotName(c, 'b', l, result), left, cmp, right);
+}
+
+// The unchecked forms, the compiler proved the operands are integers
+static void aotEmitIntegerOperation(AotCompiler_t* c, OpCode_t op) {
+    char result[AOT_NAME_LEN], left[AOT_NAME_LEN], right[AOT_NAME_LEN];
+    if (op == OP_MINUS_I64) {
+        uint32_t d = c->current.depth - 1;
+        aotIntegerValue(c, d, right);
+        aotPop(c, 1);
+        aotPush(c, AOT_INTEGER);
+        aotWrite(c, "%s = aotNegInt(%s);", aotName(c, 'i', d, result), right);
+        return;
+    }
+
+    uint32_t l = c->current.depth - 2;
+    aotIntegerValue(c, l, left);
+    aotIntegerValue(c, l + 1, right);
+    aotPop(c, 2);
+    switch (op) {
+        case OP_ADD_I64:
+        case OP_SUB_I64:
+        case OP_MUL_I64:
+            aotPush(c, AOT_INTEGER);
+            aotWrite(c, "%s = aot%sInt(%s, %s);", aotName(c, 'i', l, result),
+                op == OP_ADD_I64 ? "Add" : (op == OP_SUB_I64 ? "Sub" : "Mul"), left, right);
+            break;
+        default:
+            aotPush(c, AOT_BOOLEAN);
+            aotWrite(c, "%s = %s %s %s;", aotName(c, 'b', l, result), left,
+                op == OP_EQUAL_I64 ? "==" : (op == OP_NOT_EQUAL_I64 ? "!=" : ">"), right);
+            break;
+    }
+}
+
+static void aotEmitImmediateOperation(AotCompiler_t* c, OpCode_t op, int32_t right) {
+    char result[AOT_NAME_LEN], left[AOT_NAME_LEN];
+    uint32_t d = c->current.depth - 1;
+    if (aotIsInteger(aotSlot(c, d)->kind)) {
+        aotIntegerValue(c, d, left);
+    } else {
+        char obj[AOT_VAR_LEN];
+        snprintf(left, AOT_NAME_LEN, "aotImmediateOperand(%s, %s)", aotOpName(op), aotObject(c, d, obj));
+    }
+    aotPop(c, 1);
+
+    switch (op) {
+        case OP_ADD_IMM:
+        case OP_SUB_IMM:
+            aotPush(c, AOT_INTEGER);
+            aotWrite(c, "%s = aot%sInt(%s, %d);", aotName(c, 'i', d, result), op == OP_ADD_IMM ? "Add" : "Sub", left, right);
+            break;
+        default:
+            aotPush(c, AOT_BOOLEAN);
+            aotWrite(c, "%s = %s > %d;", aotName(c, 'b', d, result), left, right);
+            break;
+    }
+}
+
+static void aotEmitMinus(AotCompiler_t* c) {
+    char result[AOT_NAME_LEN], operand[AOT_NAME_LEN];
+    uint32_t d = c->current.depth - 1;
+    if (aotSlot(c, d)->kind == AOT_INTEGER) {
+        aotName(c, 'i', d, operand);
+        aotPop(c, 1);
+        aotPush(c, AOT_INTEGER);
+        aotWrite(c, "%s = aotNegInt(%s);", aotName(c, 'i', d, result), operand);
+        return;
+    }
+    aotObject(c, d, operand);
+    aotPop(c, 1);
+    aotPush(c, AOT_INTEGER);
+    aotWrite(c, "%s = aotNegate(%s);", aotName(c, 'i', d, result), operand);
+}
+
+static void aotEmitBang(AotCompiler_t* c) {
+    char result[AOT_NAME_LEN], operand[AOT_NAME_LEN];
+    uint32_t d = c->current.depth - 1;
+    AotKind_t kind = aotSlot(c, d)->kind;
+    if (kind == AOT_BOOLEAN) {
+        aotName(c, 'b', d, operand);
+    } else if (kind != AOT_INTEGER) {
+        aotObject(c, d, operand);
+    }
+    aotPop(c, 1);
+    aotPush(c, AOT_BOOLEAN);
+    aotName(c, 'b', d, result);
+    switch (kind) {
+        case AOT_BOOLEAN: aotWrite(c, "%s = !%s;", result, operand); break;
+        case AOT_INTEGER: aotWrite(c, "%s = false;", result); break;
+        default: aotWrite(c, "%s = aotBang(%s);", result, operand); break;
+    }
+}
+
+static void aotEmitJumpNotTruthy(AotCompiler_t* c, uint32_t target, uint32_t next) {
+    char cond[AOT_NAME_LEN], name[AOT_VAR_LEN];
+    uint32_t d = c->current.depth - 1;
+    switch (aotSlot(c, d)->kind) {
+        case AOT_BOOLEAN:
+            aotName(c, 'b', d, cond);
+            break;
+        case AOT_INTEGER:
+            snprintf(cond, AOT_NAME_LEN, "true");
+            break;
+        default:
+            snprintf(cond, AOT_NAME_LEN, "aotIsTruthy(%s)", aotName(c, 's', d, name));
+            break;
+    }
+    // popped entries stay readable above the depth for the result of main
+    aotPop(c, 1);
+    aotConditionalJump(c, cond, target, next, d);
+}
+
+static void aotEmitIntegerJump(AotCompiler_t* c, OpCode_t op, uint32_t target, uint32_t next) {
+    char cond[2 * AOT_NAME_LEN + 8], left[AOT_NAME_LEN], right[AOT_NAME_LEN];
+    uint32_t l = c->current.depth - 2;
+    aotIntegerValue(c, l, left);
+    aotIntegerValue(c, l + 1, right);
+    snprintf(cond, sizeof(cond), "%s %s %s", left, op == OP_JUMP_NOT_EQUAL_I64 ? "==" : ">", right);
+    aotPop(c, 2);
+    aotConditionalJump(c, cond, target, next, l);
+}
+
+static void aotEmitSwitchTable(AotCompiler_t* c, uint32_t constIndex) {
+    char key[AOT_NAME_LEN], literal[AOT_NAME_LEN];
+    uint32_t d = c->current.depth - 1;
+    if (aotSlot(c, d)->kind == AOT_INTEGER) {
+        aotName(c, 'i', d, key);
+    } else {
+        char obj[AOT_VAR_LEN];
+        snprintf(key, AOT_NAME_LEN, "aotSwitchKey(%s)", aotObject(c, d, obj));
+    }
+    aotPop(c, 1);
+
+    Array_t* table = (Array_t*)c->fn->constants[constIndex];
+    int64_t* entries = arrayGetInts(table);
+    uint32_t numEntries = arrayGetElementCount(table);
+    bool dense = entries[1] == SWITCH_TABLE_DENSE;
+
+    aotWrite(c, "switch (%s) {", key);
+    for (uint32_t i = 3; i < numEntries; i += dense ? 1 : 2) {
+        uint32_t target = entries[i];
+        if (target == entries[0]) continue;
+        int64_t caseKey = dense ? entries[2] + (i - 3) : entries[i - 1];
+        aotWrite(c, "case %s:", aotIntegerLiteral(caseKey, literal));
+        c->indent++;
+        aotLastPopped(c, d, target);
+        aotBranch(c, target);
+        c->indent--;
+    }
+    aotWrite(c, "default:");
+    c->indent++;
+    aotLastPopped(c, d, entries[0]);
+    aotBranch(c, entries[0]);
+    c->indent--;
+    aotWrite(c, "}");
+    c->current.reached = false;
+}
+
+// The entries from the one at first on as a compound literal array
+static char* aotObjectList(AotCompiler_t* c, uint32_t first, uint32_t count) {
+    if (count == 0) return cloneString("NULL");
+    char name[AOT_NAME_LEN];
+    Strbuf_t* list = createStrbuf();
+    strbufWrite(list, "(Object_t*[]){");
+    for (uint32_t i = 0; i < count; i++) {
+        if (i > 0) strbufWrite(list, ", ");
+        strbufWrite(list, aotObject(c, first + i, name));
+    }
+    strbufWrite(list, "}");
+    return detachStrbuf(&list);
+}
+
+static void aotEmitCollection(AotCompiler_t* c, OpCode_t op, uint32_t count) {
+    char result[AOT_NAME_LEN];
+    uint32_t first = c->current.depth - count;
+    char* elements = aotObjectList(c, first, count);
+    aotPop(c, count);
+    uint32_t d = aotPush(c, AOT_OBJECT);
+    aotWrite(c, "%s = %s(%s, %u);", aotName(c, 's', d, result), op == OP_ARRAY ? "aotArray" : "aotHash", elements, count);
+    free(elements);
+}
+
+static void aotEmitIndex(AotCompiler_t* c) {
+    char result[AOT_NAME_LEN], left[AOT_NAME_LEN], index[AOT_NAME_LEN];
+    uint32_t l = c->current.depth - 2;
+    aotObject(c, l, left);
+    aotObject(c, l + 1, index);
+    aotPop(c, 2);
+    aotPush(c, AOT_OBJECT);
+    aotWrite(c, "%s = aotIndex(%s, %s);", aotName(c, 's', l, result), left, index);
+}
+
+// Known closures with the right number of arguments are called directly,
+// builtins without their object
+static void aotEmitCall(AotCompiler_t* c, uint32_t numArgs) {
+    char callee[AOT_NAME_LEN];
+    uint32_t f = c->current.depth - 1 - numArgs;
+    // where the arguments start in the vm stack
+    uint32_t base = c->fn->numLocals + f + 1;
+    AotSlot_t slot = *aotSlot(c, f);
+    aotObject(c, f, callee);
+
+    Strbuf_t* args = createStrbuf();
+    char name[AOT_NAME_LEN];
+    for (uint32_t i = 0; i < numArgs; i++) {
+        strbufWrite(args, ", ");
+        strbufWrite(args, aotObject(c, f + 1 + i, name));
+    }
+    const char* directArgs = args->len > 0 ? args->str : "";
+    char* argList = aotObjectList(c, f + 1, numArgs);
+
+    CompiledFunction_t* target = NULL;
+    if (slot.callee == AOT_CALLEE_SELF && c->id >= 0) {
+        target = c->fn;
+    } else if (slot.callee == AOT_CALLEE_FUNCTION) {
+        target = c->e->functions[slot.index];
+    }
+
+    if (target && target->numParameters == numArgs) {
+        if (slot.callee == AOT_CALLEE_SELF) {
+            aotWrite(c, "%s = function%d(cl, base + %u%s);", callee, c->id, base, directArgs);
+        } else {
+            aotWrite(c, "%s = function%u((Closure_t*)%s, base + %u%s);", callee, slot.index, callee, base, directArgs);
+        }
+    } else if (slot.callee == AOT_CALLEE_BUILTIN) {
+        aotWrite(c, "%s = aotCallBuiltin(%u, %s, %u);", callee, slot.index, argList, numArgs);
+    } else {
+        aotWrite(c, "%s = aotCall(%s, %s, %u, base + %u);", callee, callee, argList, numArgs, base);
+    }
+    cleanupStrbuf(&args);
+    free(argList);
+
+    aotPop(c, numArgs + 1);
+    aotPush(c, AOT_OBJECT);
+}
+
+static void aotEmitReturn(AotCompiler_t* c, bool value) {
+    char result[AOT_NAME_LEN];
+    if (c->id < 0) {
+        // a return in main ends the program with the value popped last
+        if (value) {
+            aotLastPopped(c, c->current.depth - 1, c->length);
+            aotPop(c, 1);
+        }
+        aotBranch(c, c->length);
+    } else if (value) {
+        aotWrite(c, "return %s;", aotObject(c, c->current.depth - 1, result));
+    } else {
+        aotWrite(c, "return aotNull;");
+    }
+    c->current.reached = false;
+}
+
+static bool aotLocalTyped(AotCompiler_t* c, uint32_t index) {
+    return index < AOT_MAX_TYPED_LOCALS && index >= c->fn->numParameters;
+}
+
+static void aotEmitGetLocal(AotCompiler_t* c, uint32_t index, bool move) {
+    char name[AOT_NAME_LEN];
+    uint64_t bit = (uint64_t)1 << (index % AOT_MAX_TYPED_LOCALS);
+    if (aotLocalTyped(c, index) && !(c->current.assigned & bit) && c->locals[index] != AOT_OBJECT) {
+        // may be read unset, as NULL
+        c->locals[index] = AOT_OBJECT;
+        c->changed = true;
+    }
+
+    AotKind_t kind = c->locals[index];
+    uint32_t d = aotPush(c, kind);
+    switch (kind) {
+        case AOT_INTEGER:
+            aotWrite(c, "%s = l%u;", aotName(c, 'i', d, name), index);
+            break;
+        case AOT_BOOLEAN:
+            aotWrite(c, "%s = l%u;", aotName(c, 'b', d, name), index);
+            break;
+        default:
+            aotWrite(c, "%s = l%u;", aotName(c, 's', d, name), index);
+            if (move) aotWrite(c, "l%u = NULL;", index);
+            break;
+    }
+    if (move && index < AOT_MAX_TYPED_LOCALS) c->current.assigned &= ~bit;
+}
+
+static void aotEmitSetLocal(AotCompiler_t* c, uint32_t index) {
+    char value[AOT_NAME_LEN];
+    uint32_t d = c->current.depth - 1;
+    AotKind_t kind = aotSlot(c, d)->kind;
+    if (aotLocalTyped(c, index)) {
+        AotKind_t joined = aotJoin(c->locals[index], kind);
+        if (joined != c->locals[index]) {
+            c->locals[index] = joined;
+            c->changed = true;
+        }
+        c->current.assigned |= (uint64_t)1 << index;
+    }
+
+    switch (c->locals[index]) {
+        case AOT_INTEGER:
+            aotWrite(c, "l%u = %s;", index, aotName(c, 'i', d, value));
+            break;
+        case AOT_BOOLEAN:
+            aotWrite(c, "l%u = %s;", index, aotName(c, 'b', d, value));
+            break;
+        default:
+            aotWrite(c, "l%u = %s;", index, aotObject(c, d, value));
+            break;
+    }
+    aotPop(c, 1);
+}
+
+static void aotEmitClosure(AotCompiler_t* c, uint32_t constIndex, uint32_t numFree) {
+    char result[AOT_NAME_LEN];
+    Object_t* constant = c->fn->constants[constIndex];
+    if (constant->type != OBJECT_COMPILED_FUNCTION) {
+        c->e->failed = true;
+        return;
+    }
+    uint32_t id = aotFunctionId(c->e, (CompiledFunction_t*)constant);
+
+    uint32_t first = c->current.depth - numFree;
+    char* freeVars = aotObjectList(c, first, numFree);
+    aotPop(c, numFree);
+    uint32_t d = aotPush(c, AOT_OBJECT);
+    aotSlot(c, d)->callee = AOT_CALLEE_FUNCTION;
+    aotSlot(c, d)->index = id;
+    if (numFree == 0) {
+        aotWrite(c, "%s = (Object_t*)compiledFunctionGetClosure(functions[%u]);", aotName(c, 's', d, result), id);
+    } else {
+        aotWrite(c, "%s = aotClosure(functions[%u], %s, %u);", aotName(c, 's', d, result), id, freeVars, numFree);
+    }
+    free(freeVars);
+}
+
+static void aotStep(AotCompiler_t* c, uint32_t ip) {
+    char name[AOT_NAME_LEN];
+    const CodeWord_t* code = c->code;
+    OpCode_t op = code[ip];
+    uint32_t next = ip + aotLength(code, ip);
+    uint32_t depth = c->current.depth;
+    uint32_t d;
+
+    switch (op) {
+        case OP_CONSTANT:
+            aotEmitConstant(c, code[ip + 1]);
+            break;
+
+        case OP_PUSH_INT8:
+        case OP_PUSH_INT16:
+            aotEmitPushInteger(c, code[ip + 1]);
+            break;
+
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            aotLastPopped(c, depth - 2, next);
+            aotEmitArithmetic(c, op);
+            break;
+
+        case OP_TRUE:
+        case OP_FALSE:
+            d = aotPush(c, AOT_BOOLEAN);
+            aotWrite(c, "%s = %s;", aotName(c, 'b', d, name), op == OP_TRUE ? "true" : "false");
+            break;
+
+        case OP_NULL:
+            d = aotPush(c, AOT_OBJECT);
+            aotWrite(c, "%s = aotNull;", aotName(c, 's', d, name));
+            break;
+
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER_THAN:
+            aotLastPopped(c, depth - 2, next);
+            aotEmitComparison(c, op);
+            break;
+
+        case OP_MINUS:
+            aotLastPopped(c, depth - 1, next);
+            aotEmitMinus(c);
+            break;
+
+        case OP_BANG:
+            aotLastPopped(c, depth - 1, next);
+            aotEmitBang(c);
+            break;
+
+        case OP_JUMP_NOT_TRUTHY:
+            aotEmitJumpNotTruthy(c, code[ip + 1], next);
+            break;
+
+        case OP_JUMP:
+            aotBranch(c, code[ip + 1]);
+            c->current.reached = false;
+            break;
+
+        case OP_GET_GLOBAL:
+            if ((uint32_t)code[ip + 1] >= c->e->numGlobals) c->e->numGlobals = code[ip + 1] + 1;
+            d = aotPush(c, AOT_OBJECT);
+            aotWrite(c, "%s = globals[%d];", aotName(c, 's', d, name), code[ip + 1]);
+            break;
+
+        case OP_SET_GLOBAL:
+            if ((uint32_t)code[ip + 1] >= c->e->numGlobals) c->e->numGlobals = code[ip + 1] + 1;
+            aotLastPopped(c, depth - 1, next);
+            aotWrite(c, "globals[%d] = %s;", code[ip + 1], aotObject(c, depth - 1, name));
+            aotPop(c, 1);
+            break;
+
+        case OP_ARRAY:
+        case OP_HASH:
+            if (code[ip + 1] > 0) aotLastPopped(c, depth - code[ip + 1], next);
+            aotEmitCollection(c, op, code[ip + 1]);
+            break;
+
+        case OP_INDEX:
+            aotLastPopped(c, depth - 2, next);
+            aotEmitIndex(c);
+            break;
+
+        case OP_CALL:
+            aotEmitCall(c, code[ip + 1]);
+            break;
+
+        case OP_RETURN_VALUE:
+            aotEmitReturn(c, true);
+            break;
+
+        case OP_RETURN:
+            aotEmitReturn(c, false);
+            break;
+
+        case OP_GET_LOCAL:
+            aotEmitGetLocal(c, code[ip + 1], false);
+            break;
+
+        case OP_MOVE_LOCAL:
+            aotEmitGetLocal(c, code[ip + 1], true);
+            break;
+
+        case OP_SET_LOCAL:
+            aotLastPopped(c, depth - 1, next);
+            aotEmitSetLocal(c, code[ip + 1]);
+            break;
+
+        case OP_GET_BUILTIN:
+            d = aotPush(c, AOT_OBJECT);
+            aotSlot(c, d)->callee = AOT_CALLEE_BUILTIN;
+            aotSlot(c, d)->index = code[ip + 1];
+            aotWrite(c, "%s = aotBuiltin(%d);", aotName(c, 's', d, name), code[ip + 1]);
+            break;
+
+        case OP_CLOSURE:
+            if (code[ip + 2] > 0) aotLastPopped(c, depth - code[ip + 2], next);
+            aotEmitClosure(c, code[ip + 1], code[ip + 2]);
+            break;
+
+        case OP_GET_FREE:
+            d = aotPush(c, AOT_OBJECT);
+            aotWrite(c, "%s = cl->free[%d];", aotName(c, 's', d, name), code[ip + 1]);
+            break;
+
+        case OP_CURRENT_CLOSURE:
+            d = aotPush(c, AOT_OBJECT);
+            aotSlot(c, d)->callee = AOT_CALLEE_SELF;
+            aotWrite(c, "%s = (Object_t*)cl;", aotName(c, 's', d, name));
+            break;
+
+        case OP_POP:
+            aotLastPopped(c, depth - 1, next);
+            aotPop(c, 1);
+            break;
+
+        case OP_ADD_I64:
+        case OP_SUB_I64:
+        case OP_MUL_I64:
+        case OP_EQUAL_I64:
+        case OP_NOT_EQUAL_I64:
+        case OP_GREATER_THAN_I64:
+            aotLastPopped(c, depth - 2, next);
+            aotEmitIntegerOperation(c, op);
+            break;
+
+        case OP_MINUS_I64:
+            aotLastPopped(c, depth - 1, next);
+            aotEmitIntegerOperation(c, op);
+            break;
+
+        case OP_JUMP_NOT_EQUAL_I64:
+        case OP_JUMP_NOT_GREATER_THAN_I64:
+            aotEmitIntegerJump(c, op, code[ip + 1], next);
+            break;
+
+        case OP_SWITCH_TABLE:
+            aotEmitSwitchTable(c, code[ip + 1]);
+            break;
+
+        case OP_ADD_IMM:
+        case OP_SUB_IMM:
+        case OP_GREATER_THAN_IMM:
+            aotLastPopped(c, depth - 1, next);
+            aotEmitImmediateOperation(c, op, code[ip + 1]);
+            break;
+
+        default:
+            c->e->failed = true;
+            break;
+    }
+}
+
+/************************************
+ *            FUNCTIONS             *
+ ************************************/
+
+// Finds the reachable instructions, the jump targets and the deepest stack
+static bool aotScan(AotCompiler_t* c) {
+    int32_t* depths = mallocChk((c->length + 1) * sizeof(int32_t));
+    uint32_t* work = mallocChk((c->length + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i <= c->length; i++) depths[i] = -1;
+    uint32_t numWork = 0;
+    bool ok = true;
+
+    if (c->length > 0) {
+        depths[0] = 0;
+        work[numWork++] = 0;
+    }
+    while (numWork > 0 && ok) {
+        uint32_t ip = work[--numWork];
+        c->reachable[ip] = true;
+        uint32_t pops, pushes;
+        aotStackEffect(c->code, ip, &pops, &pushes);
+        if ((uint32_t)depths[ip] < pops) {
+            ok = false;
+            break;
+        }
+        int32_t depth = depths[ip] - pops + pushes;
+        if ((uint32_t)depth > c->maxDepth) c->maxDepth = depth;
+
+        OpCode_t op = c->code[ip];
+        uint32_t count = aotSuccessors(c, ip);
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t next = c->successors[i];
+            if (next > c->length) {
+                ok = false;
+                break;
+            }
+            // the first successor of a conditional jump is the next instruction
+            bool conditional = op == OP_JUMP_NOT_TRUTHY || op == OP_JUMP_NOT_EQUAL_I64 ||
+                op == OP_JUMP_NOT_GREATER_THAN_I64;
+            bool jump = op == OP_JUMP || op == OP_SWITCH_TABLE || op == OP_RETURN_VALUE || op == OP_RETURN;
+            if (jump || (conditional && i > 0)) {
+                c->labels[next] = true;
+            }
+            if (depths[next] < 0) {
+                depths[next] = depth;
+                if (next < c->length) work[numWork++] = next;
+            }
+        }
+    }
+
+    free(depths);
+    free(work);
+    return ok;
+}
+
+// Backwards from the end, the instructions after which the program can end
+// without another pop
+static void aotFindEnds(AotCompiler_t* c) {
+    c->endsClean = callocChk((c->length + 1) * sizeof(bool));
+    c->endsClean[c->length] = true;
+
+    uint32_t numStarts = 0;
+    uint32_t* starts = mallocChk((c->length + 1) * sizeof(uint32_t));
+    for (uint32_t ip = 0; ip < c->length; ip += aotLength(c->code, ip)) {
+        if (c->reachable[ip]) starts[numStarts++] = ip;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t i = numStarts; i-- > 0;) {
+            uint32_t ip = starts[i];
+            if (c->endsClean[ip] || aotPops(c->code, ip)) continue;
+            uint32_t count = aotSuccessors(c, ip);
+            for (uint32_t j = 0; j < count; j++) {
+                if (c->endsClean[c->successors[j]]) {
+                    c->endsClean[ip] = true;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    free(starts);
+}
+
+static void aotResetState(AotCompiler_t* c) {
+    c->current.reached = true;
+    c->current.depth = 0;
+    uint32_t params = c->fn->numParameters < AOT_MAX_TYPED_LOCALS ? c->fn->numParameters : AOT_MAX_TYPED_LOCALS;
+    c->current.assigned = params == AOT_MAX_TYPED_LOCALS ? UINT64_MAX : ((uint64_t)1 << params) - 1;
+}
+
+// One run over the function, writing the code when c->body is set
+static void aotRun(AotCompiler_t* c) {
+    aotResetState(c);
+    for (uint32_t ip = 0; ip <= c->length && !c->e->failed; ip += aotLength(c->code, ip)) {
+        if (c->labels[ip]) {
+            AotState_t* entry = &c->entries[ip];
+            if (c->current.reached) {
+                if (c->body) {
+                    aotConvert(c, ip);
+                } else {
+                    aotMerge(c, ip);
+                }
+            }
+            c->current.reached = entry->reached;
+            c->current.depth = entry->depth;
+            c->current.assigned = entry->assigned;
+            memcpy(c->current.slots, entry->slots, entry->depth * sizeof(AotSlot_t));
+            if (c->body && entry->reached) strbufConsume(c->body, strFormat("L%u:;\n", ip));
+        }
+        if (ip == c->length) break;
+        if (c->current.reached && c->reachable[ip]) aotStep(c, ip);
+    }
+}
+
+static void aotInfer(AotCompiler_t* c) {
+    do {
+        c->changed = false;
+        aotRun(c);
+    } while (c->changed && !c->e->failed);
+
+    // never set, only read where they may be NULL
+    for (uint32_t i = 0; i < c->fn->numLocals; i++) {
+        if (c->locals[i] == AOT_UNDEFINED) c->locals[i] = AOT_OBJECT;
+    }
+    do {
+        c->changed = false;
+        aotRun(c);
+    } while (c->changed && !c->e->failed);
+}
+
+static void aotWriteDeclarations(AotCompiler_t* c, Strbuf_t* out) {
+    for (uint32_t i = c->fn->numParameters; i < c->fn->numLocals; i++) {
+        switch (c->locals[i]) {
+            case AOT_INTEGER: aotWriteTo(out, "    int64_t l%u = 0;\n", i); break;
+            case AOT_BOOLEAN: aotWriteTo(out, "    bool l%u = false;\n", i); break;
+            default: aotWriteTo(out, "    Object_t* l%u = NULL;\n", i); break;
+        }
+    }
+    for (uint32_t d = 0; d < c->maxDepth; d++) {
+        if (c->used[d] & AOT_USED_OBJECT) aotWriteTo(out, "    Object_t* s%u;\n", d);
+        if (c->used[d] & AOT_USED_INTEGER) aotWriteTo(out, "    int64_t i%u;\n", d);
+        if (c->used[d] & AOT_USED_BOOLEAN) aotWriteTo(out, "    bool b%u;\n", d);
+    }
+}
+
+static void aotWriteSignature(Strbuf_t* out, uint32_t id, CompiledFunction_t* fn) {
+    aotWriteTo(out, "static Object_t* function%u(Closure_t* cl, uint32_t base", id);
+    for (uint32_t i = 0; i < fn->numParameters; i++) {
+        aotWriteTo(out, ", Object_t* l%u", i);
+    }
+    strbufWrite(out, ")");
+}
+
+// Writes the C function of fn, or main
+static void aotEmitFunction(AotEmitter_t* e, Strbuf_t* out, CompiledFunction_t* fn, int32_t id) {
+    AotCompiler_t c = {
+        .e = e,
+        .fn = fn,
+        .id = id,
+        .code = fn->code,
+        .length = fn->codeLength,
+        .labels = callocChk((fn->codeLength + 1) * sizeof(bool)),
+        .reachable = callocChk((fn->codeLength + 1) * sizeof(bool)),
+        .locals = callocChk((fn->numLocals + 1) * sizeof(AotKind_t)),
+    };
+    for (uint32_t i = 0; i < fn->numLocals; i++) {
+        c.locals[i] = aotLocalTyped(&c, i) ? AOT_UNDEFINED : AOT_OBJECT;
+    }
+
+    if (!aotScan(&c)) {
+        e->failed = true;
+        goto cleanup;
+    }
+    c.current.slots = callocChk((c.maxDepth + 1) * sizeof(AotSlot_t));
+    c.entries = callocChk((c.length + 1) * sizeof(AotState_t));
+    for (uint32_t ip = 0; ip <= c.length; ip++) {
+        if (c.labels[ip]) c.entries[ip].slots = callocChk((c.maxDepth + 1) * sizeof(AotSlot_t));
+    }
+    if (id < 0) aotFindEnds(&c);
+
+    aotInfer(&c);
+    if (e->failed) goto cleanup;
+
+    c.used = callocChk(c.maxDepth + 1);
+    c.body = createStrbuf();
+    aotRun(&c);
+
+    if (id < 0) {
+        strbufWrite(out, "int main(void) {\n");
+        strbufWrite(out, "    aotInit();\n");
+        strbufWrite(out, "    setup();\n");
+        strbufWrite(out, "    uint32_t base = 0;\n");
+        strbufWrite(out, "    Object_t* last = NULL;\n");
+        aotWriteDeclarations(&c, out);
+        aotWriteTo(out, "    aotCheckStack(base, 0, %u, %u);\n", fn->numLocals, c.maxDepth);
+        aotWriteBuffer(out, c.body);
+        strbufWrite(out, "    aotPrintResult(last);\n");
+        strbufWrite(out, "    return 0;\n");
+        strbufWrite(out, "}\n");
+    } else {
+        aotWriteSignature(out, id, fn);
+        strbufWrite(out, " {\n");
+        aotWriteDeclarations(&c, out);
+        aotWriteTo(out, "    aotCheckStack(base, %u, %u, %u);\n", fn->numParameters, fn->numLocals, c.maxDepth);
+        aotWriteBuffer(out, c.body);
+        strbufWrite(out, "    return aotNull;\n");
+        strbufWrite(out, "}\n\n");
+
+        aotWriteTo(out, "static Object_t* function%uEntry(Closure_t* cl, Object_t** args, uint32_t base) {\n", id);
+        if (fn->numParameters == 0) strbufWrite(out, "    (void)args;\n");
+        aotWriteTo(out, "    return function%u(cl, base", id);
+        for (uint32_t i = 0; i < fn->numParameters; i++) {
+            aotWriteTo(out, ", args[%u]", i);
+        }
+        strbufWrite(out, ");\n}\n\n");
+    }
+    cleanupStrbuf(&c.body);
+
+cleanup:
+    if (c.entries) {
+        for (uint32_t ip = 0; ip <= c.length; ip++) free(c.entries[ip].slots);
+    }
+    free(c.entries);
+    free(c.current.slots);
+    free(c.labels);
+    free(c.reachable);
+    free(c.locals);
+    free(c.successors);
+    free(c.endsClean);
+    free(c.used);
+}
+
+char* aotEmitC(Bytecode_t* bytecode) {
+    CompiledFunction_t* main = compilerCreateFunction(bytecode->constants, bytecode->instructions, bytecode->numLocals, 0);
+    linkCodeSegment(main, bytecode->constants);
+
+    AotEmitter_t e = {
+        .failed = false,
+        .constantIndex = createHashMap(),
+        .setup = createStrbuf(),
+    };
+    Strbuf_t* mainCode = createStrbuf();
+    Strbuf_t* functionCode = createStrbuf();
+
+    // functions are numbered as main and the ones before create closures of them
+    aotEmitFunction(&e, mainCode, main, -1);
+    for (uint32_t i = 0; i < e.numFunctions && !e.failed; i++) {
+        aotEmitFunction(&e, functionCode, e.functions[i], i);
+    }
+
+    char* source = NULL;
+    if (!e.failed) {
+        Strbuf_t* out = createStrbuf();
+        strbufWrite(out, "/* Generated by capuchin --emit-c, build it against the runtime objects */\n");
+        strbufWrite(out, "#include \"aot.h\"\n\n");
+        if (e.numFunctions > 0) aotWriteTo(out, "static CompiledFunction_t* functions[%u];\n", e.numFunctions);
+        if (e.numConstants > 0) aotWriteTo(out, "static Object_t* constants[%u];\n", e.numConstants);
+        if (e.numGlobals > 0) aotWriteTo(out, "static Object_t* globals[%u];\n", e.numGlobals);
+        strbufWrite(out, "\n");
+        for (uint32_t i = 0; i < e.numFunctions; i++) {
+            aotWriteSignature(out, i, e.functions[i]);
+            strbufWrite(out, ";\n");
+            aotWriteTo(out, "static Object_t* function%uEntry(Closure_t* cl, Object_t** args, uint32_t base);\n", i);
+        }
+        strbufWrite(out, "\n");
+        aotWriteBuffer(out, functionCode);
+        strbufWrite(out, "static void setup(void) {\n");
+        aotWriteBuffer(out, e.setup);
+        strbufWrite(out, "}\n\n");
+        aotWriteBuffer(out, mainCode);
+        source = detachStrbuf(&out);
+    }
+
+    cleanupStrbuf(&mainCode);
+    cleanupStrbuf(&functionCode);
+    cleanupStrbuf(&e.setup);
+    cleanupHashMap(&e.constantIndex, NULL);
+    free(e.functions);
+    return source;
+}
@@ -0,0 +1,101 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+#include "object.h"
+#include "compiler.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Ahead-of-time compilation to C. Every function of a program becomes a C
+ * function and the main program becomes main, with an operand stack entry
+ * or local per C variable and jumps turned into gotos. Values keep the
+ * object model of the vm, except for the integers and booleans the bytecode
+ * proves, which stay unboxed. The generated file includes this header and
+ * links against the runtime objects, it prints what capuchin prints for the
+ * program. Unlike the vm, a function whose operand stack would overflow
+ * fails on entry. */
+
+// Translates the program to C like createVm links it, the instructions are
+// consumed. Returns the source, NULL if the program uses a constant that
+// has no C form.
+char* aotEmitC(Bytecode_t* bytecode);
+
+/* Runtime of the generated programs (aot_runtime.c), it only needs the 
+ * object model and the builtins. The operations behave like the vm and fail
+ * with its messages, which ends the program. */
+
+#if defined(__GNUC__)
+#define AOT_NORETURN __attribute__((noreturn))
+#else
+#define AOT_NORETURN
+#endif
+
+extern Object_t* aotBooleans[2];
+extern Object_t* aotNull;
+
+void aotInit(void);
+CompiledFunction_t* aotCreateFunction(AotFunction_t native, uint32_t numLocals, uint32_t numParameters);
+// Prints the last popped object the way the REPL does
+void aotPrintResult(Object_t* lastPopped);
+AOT_NORETURN void aotFail(char* message);
+
+// Fails unless a frame of the function fits in the vm stack from base
+void aotCheckStack(uint32_t base, uint32_t numParameters, uint32_t numLocals, uint32_t maxDepth);
+
+Object_t* aotBinary(OpCode_t op, Object_t* left, Object_t* right);
+bool aotCompare(OpCode_t op, Object_t* left, Object_t* right);
+bool aotBang(Object_t* operand);
+int64_t aotNegate(Object_t* operand);
+// Left operand of OP_ADD_IMM, OP_SUB_IMM or OP_GREATER_THAN_IMM, which
+// fail on anything but an integer
+int64_t aotImmediateOperand(OpCode_t op, Object_t* left);
+int64_t aotSwitchKey(Object_t* value);
+
+Object_t* aotArray(Object_t** elements, uint32_t count);
+Object_t* aotHash(Object_t** elements, uint32_t count);
+Object_t* aotIndex(Object_t* left, Object_t* index);
+
+Object_t* aotClosure(CompiledFunction_t* fn, Object_t** freeVars, uint32_t numFree);
+// Builtin objects are shared, created on first use
+Object_t* aotBuiltin(uint32_t index);
+Object_t* aotCallBuiltin(uint32_t index, Object_t** args, uint32_t numArgs);
+// base is where the arguments start in the vm stack
+Object_t* aotCall(Object_t* callee, Object_t** args, uint32_t numArgs, uint32_t base);
+
+static inline Object_t* aotInteger(int64_t value) {
+    return (Object_t*)createInteger(value);
+}
+
+static inline Object_t* aotBoolean(bool value) {
+    return aotBooleans[value];
+}
+
+static inline bool aotIsTruthy(Object_t* obj) {
+    switch (obj->type) {
+        case OBJECT_BOOLEAN:
+            return ((Boolean_t*)obj)->value;
+        case OBJECT_NULL:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// Integer arithmetic wraps around like the vm's does in practice
+static inline int64_t aotAddInt(int64_t left, int64_t right) {
+    return (int64_t)((uint64_t)left + (uint64_t)right);
+}
+
+static inline int64_t aotSubInt(int64_t left, int64_t right) {
+    return (int64_t)((uint64_t)left - (uint64_t)right);
+}
+
+static inline int64_t aotMulInt(int64_t left, int64_t right) {
+    return (int64_t)((uint64_t)left * (uint64_t)right);
+}
+
+static inline int64_t aotNegInt(int64_t value) {
+    return (int64_t)(0 - (uint64_t)value);
+}
+
+#endif
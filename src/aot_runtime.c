@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "aot.h"
+#include "builtin.h"
+#include "gc.h"
+#include "utils.h"
+
+/************************************
+ *             RUNTIME              *
+ ************************************/
+
+Object_t* aotBooleans[2];
+Object_t* aotNull;
+
+static Object_t* aotBuiltins[UINT8_MAX + 1];
+
+void aotInit(void) {
+    aotBooleans[0] = (Object_t*)createBoolean(false);
+    aotBooleans[1] = (Object_t*)createBoolean(true);
+    aotNull = (Object_t*)createNull();
+    gcSetRef(aotBooleans[0], GC_REF_COMPILE_CONSTANT);
+    gcSetRef(aotBooleans[1], GC_REF_COMPILE_CONSTANT);
+    gcSetRef(aotNull, GC_REF_COMPILE_CONSTANT);
+}
+
+CompiledFunction_t* aotCreateFunction(AotFunction_t native, uint32_t numLocals, uint32_t numParameters) {
+    CompiledFunction_t* fn = createCompiledFunction(createSliceByte(0), NULL, 0, numLocals, numParameters);
+    fn->native = native;
+    gcSetRef(fn, GC_REF_COMPILE_CONSTANT);
+    return fn;
+}
+
+void aotPrintResult(Object_t* lastPopped) {
+    char* res = objectInspect(lastPopped);
+    printf("%s\n", res);
+    free(res);
+}
+
+void aotFail(char* message) {
+    printf("Woops! Executing bytecode failed:\n %s\n", message);
+    free(message);
+    exit(EXIT_FAILURE);
+}
+
+void aotCheckStack(uint32_t base, uint32_t numParameters, uint32_t numLocals, uint32_t maxDepth) {
+    if (base + numLocals > STACK_SIZE) {
+        aotFail(strFormat("stack overflow sp(%d)", base + numParameters));
+    }
+    if (base + numLocals + maxDepth > STACK_SIZE) {
+        aotFail(strFormat("stack overflow sp(%d)", STACK_SIZE));
+    }
+}
+
+Object_t* aotBinary(OpCode_t op, Object_t* left, Object_t* right) {
+    if (left->type == OBJECT_INTEGER && right->type == OBJECT_INTEGER) {
+        int64_t leftValue = ((Integer_t*)left)->value;
+        int64_t rightValue = ((Integer_t*)right)->value;
+        switch (op) {
+            case OP_ADD:
+                return aotInteger(aotAddInt(leftValue, rightValue));
+            case OP_SUB:
+                return aotInteger(aotSubInt(leftValue, rightValue));
+            case OP_MUL:
+                return aotInteger(aotMulInt(leftValue, rightValue));
+            case OP_DIV:
+                return aotInteger(leftValue / rightValue);
+            default:
+                aotFail(strFormat("unknown integer operator: %d", op));
+        }
+    }
+
+    if (left->type == OBJECT_STRING && right->type == OBJECT_STRING) {
+        if (op != OP_ADD) {
+            aotFail(strFormat("unknown string operator: %d", op));
+        }
+        return (Object_t*)createStringConcat((String_t*)left, (String_t*)right);
+    }
+
+    aotFail(strFormat("unsupported types for binary operation: %s %s",
+        objectTypeToString(left->type), objectTypeToString(right->type)));
+}
+
+bool aotCompare(OpCode_t op, Object_t* left, Object_t* right) {
+    if (left->type == OBJECT_INTEGER && right->type == OBJECT_INTEGER) {
+        int64_t leftValue = ((Integer_t*)left)->value;
+        int64_t rightValue = ((Integer_t*)right)->value;
+        switch (op) {
+            case OP_EQUAL:
+                return leftValue == rightValue;
+            case OP_NOT_EQUAL:
+                return leftValue != rightValue;
+            case OP_GREATER_THAN:
+                return leftValue > rightValue;
+            default:
+                aotFail(strFormat("unknown operator: %d", op));
+        }
+    }
+
+    if (left->type == OBJECT_BOOLEAN && right->type == OBJECT_BOOLEAN) {
+        bool leftValue = ((Boolean_t*)left)->value;
+        bool rightValue = ((Boolean_t*)right)->value;
+        switch (op) {
+            case OP_EQUAL:
+                return leftValue == rightValue;
+            case OP_NOT_EQUAL:
+                return leftValue != rightValue;
+            default:
+                aotFail(strFormat("unknown operator: %dd", op));
+        }
+    }
+
+    if (left->type == OBJECT_STRING && right->type == OBJECT_STRING) {
+        switch (op) {
+            case OP_EQUAL:
+                return stringEquals((String_t*)left, (String_t*)right);
+            case OP_NOT_EQUAL:
+                return !stringEquals((String_t*)left, (String_t*)right);
+            default:
+                aotFail(strFormat("unknown string operator: %d", op));
+        }
+    }
+
+    aotFail(strFormat("unknown operator: %d (%s %s)",
+        op, objectTypeToString(left->type), objectTypeToString(right->type)));
+}
+
+bool aotBang(Object_t* operand) {
+    switch (operand->type) {
+        case OBJECT_BOOLEAN:
+            return !((Boolean_t*)operand)->value;
+        case OBJECT_NULL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int64_t aotNegate(Object_t* operand) {
+    if (operand->type != OBJECT_INTEGER) {
+        aotFail(strFormat("unsupported type for negation: %s", objectTypeToString(operand->type)));
+    }
+    return aotNegInt(((Integer_t*)operand)->value);
+}
+
+int64_t aotImmediateOperand(OpCode_t op, Object_t* left) {
+    if (left->type == OBJECT_INTEGER) {
+        return ((Integer_t*)left)->value;
+    }
+
+    // the errors of the generic operation with an integer on the right
+    if (op == OP_GREATER_THAN_IMM) {
+        aotFail(strFormat("unknown operator: %d (%s %s)",
+            OP_GREATER_THAN, objectTypeToString(left->type), objectTypeToString(OBJECT_INTEGER)));
+    }
+    aotFail(strFormat("unsupported types for binary operation: %s %s",
+        objectTypeToString(left->type), objectTypeToString(OBJECT_INTEGER)));
+}
+
+int64_t aotSwitchKey(Object_t* value) {
+    if (value->type != OBJECT_INTEGER) {
+        // same error as the first comparison of the if-else chain
+        aotFail(strFormat("unknown operator: %d (%s %s)",
+            OP_EQUAL, objectTypeToString(value->type), objectTypeToString(OBJECT_INTEGER)));
+    }
+    return ((Integer_t*)value)->value;
+}
+
+Object_t* aotArray(Object_t** elements, uint32_t count) {
+    Array_t* arr = createArrayWithCapacity(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (elements[i]->type != OBJECT_INTEGER) {
+            arrayUnpack(arr);
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        arrayAppend(arr, elements[i]);
+    }
+    return (Object_t*)arr;
+}
+
+Object_t* aotHash(Object_t** elements, uint32_t count) {
+    Hash_t* hash = createHash();
+    for (uint32_t i = 0; i < count; i += 2) {
+        if (!objectIsHashable(elements[i])) {
+            aotFail(strFormat("unusable as hash key: %s", objectTypeToString(elements[i]->type)));
+        }
+        hashInsertPair(hash, createHashPair(elements[i], elements[i + 1]));
+    }
+    return (Object_t*)hash;
+}
+
+Object_t* aotIndex(Object_t* left, Object_t* index) {
+    if (left->type == OBJECT_ARRAY && index->type == OBJECT_INTEGER) {
+        Array_t* array = (Array_t*)left;
+        int64_t i = ((Integer_t*)index)->value;
+        if (i < 0 || i >= arrayGetElementCount(array)) {
+            return aotNull;
+        }
+        return arrayGetElement(array, i);
+    }
+
+    if (left->type == OBJECT_HASH) {
+        if (!objectIsHashable(index)) {
+            aotFail(strFormat("unusable as hash key: %s", objectTypeToString(index->type)));
+        }
+        HashPair_t* pair = hashGetPair((Hash_t*)left, index);
+        return pair ? pair->value : aotNull;
+    }
+
+    aotFail(strFormat("index operator not supported: %s", objectTypeToString(left->type)));
+}
+
+Object_t* aotClosure(CompiledFunction_t* fn, Object_t** freeVars, uint32_t numFree) {
+    if (numFree == 0) {
+        return (Object_t*)compiledFunctionGetClosure(fn);
+    }
+    return (Object_t*)createClosure(fn, freeVars, numFree);
+}
+
+Object_t* aotBuiltin(uint32_t index) {
+    if (!aotBuiltins[index]) {
+        aotBuiltins[index] = (Object_t*)createBuiltin(getBuiltinByIndex(index));
+        gcSetRef(aotBuiltins[index], GC_REF_COMPILE_CONSTANT);
+    }
+    return aotBuiltins[index];
+}
+
+static Object_t* aotCallBuiltinFunction(BuiltinFunction_t func, Object_t** args, uint32_t numArgs) {
+    VectorObjects_t* argVector = createVectorObjects();
+    for (uint32_t i = 0; i < numArgs; i++) {
+        vectorObjectsAppend(argVector, args[i]);
+    }
+    Object_t* result = func(argVector);
+    cleanupVectorObjects(&argVector, NULL);
+    return result;
+}
+
+Object_t* aotCallBuiltin(uint32_t index, Object_t** args, uint32_t numArgs) {
+    return aotCallBuiltinFunction(getBuiltinByIndex(index), args, numArgs);
+}
+
+Object_t* aotCall(Object_t* callee, Object_t** args, uint32_t numArgs, uint32_t base) {
+    if (!callee) {
+        aotFail(strFormat("calling non function object: NULL"));
+    }
+
+    switch (callee->type) {
+        case OBJECT_CLOSURE: {
+            Closure_t* cl = (Closure_t*)callee;
+            if (numArgs != cl->fn->numParameters) {
+                aotFail(strFormat("wrong number of arguments: want=%d, got=%d", cl->fn->numParameters, numArgs));
+            }
+            return cl->fn->native(cl, args, base);
+        }
+        case OBJECT_BUILTIN:
+            return aotCallBuiltinFunction(((Builtin_t*)callee)->func, args, numArgs);
+        default:
+            aotFail(strFormat("calling non function object: %s", objectTypeToString(callee->type)));
+    }
+}
@@ -741,6 +741,8 @@ static StatementCleanupFn_t statementCleanupFns[] = {
     [STATEMENT_RETURN]=(StatementCleanupFn_t)cleanupReturnStatement,
     [STATEMENT_EXPRESSION]=(StatementCleanupFn_t)cleanupExpressionStatement,
     [STATEMENT_BLOCK]=(StatementCleanupFn_t)cleanupBlockStatement,
+    [STATEMENT_ASSIGN]=(StatementCleanupFn_t)cleanupAssignStatement,
+    [STATEMENT_WHILE]=(StatementCleanupFn_t)cleanupWhileStatement,
     [STATEMENT_INVALID]=NULL
 };
 
@@ -749,6 +751,8 @@ static StatementCopyFn_t statementCopyFns[] = {
     [STATEMENT_RETURN]=(StatementCopyFn_t)copyReturnStatement,
     [STATEMENT_EXPRESSION]=(StatementCopyFn_t)copyExpressionStatement,
     [STATEMENT_BLOCK]=(StatementCopyFn_t)copyBlockStatement,
+    [STATEMENT_ASSIGN]=(StatementCopyFn_t)copyAssignStatement,
+    [STATEMENT_WHILE]=(StatementCopyFn_t)copyWhileStatement,
     [STATEMENT_INVALID]=NULL
 };
 
@@ -758,6 +762,8 @@ static StatementToStringFn_t statementToStringFns[] = {
     [STATEMENT_RETURN]=(StatementToStringFn_t)returnStatementToString,
     [STATEMENT_EXPRESSION]=(StatementToStringFn_t)expressionStatementToString,
     [STATEMENT_BLOCK]=(StatementToStringFn_t)blockStatementToString,
+    [STATEMENT_ASSIGN]=(StatementToStringFn_t)assignStatementToString,
+    [STATEMENT_WHILE]=(StatementToStringFn_t)whileStatementToString,
     [STATEMENT_INVALID]=NULL
 };
 
@@ -986,6 +992,102 @@ void blockStatementAppendStatement(BlockStatement_t* block, const Statement_t* s
 }
 
 
+/************************************ 
+ *       ASSIGN STATEMENT           *
+ ************************************/
+
+AssignStatement_t* createAssignStatement(const Token_t* token) {
+    AssignStatement_t* st = mallocChk(sizeof(AssignStatement_t));
+
+    *st = (AssignStatement_t) {
+        .type = STATEMENT_ASSIGN, 
+        .token = copyToken(token),
+        .name = NULL,
+        .value = NULL
+    };
+
+    return st;
+}
+
+AssignStatement_t* copyAssignStatement(const AssignStatement_t* st) {
+    AssignStatement_t* newSt = createAssignStatement(st->token);
+    newSt->name = copyIdentifier(st->name);
+    newSt->value = copyExpression(st->value);
+    return newSt;
+}
+
+void cleanupAssignStatement(AssignStatement_t** st) {
+    if (!(*st)) return;
+
+    cleanupToken(&(*st)->token);
+    cleanupIdentifier(&(*st)->name);
+    cleanupExpression(&(*st)->value);
+    
+    free(*st);
+    *st = NULL;
+}
+
+char* assignStatementToString(const AssignStatement_t* st) {
+    Strbuf_t* sbuf = createStrbuf();
+    
+    strbufConsume(sbuf, identifierToString(st->name));
+    strbufWrite(sbuf, " = ");
+    if (st->value != NULL) {
+        strbufConsume(sbuf, expressionToString(st->value));
+    }
+    strbufWrite(sbuf, ";");
+
+    return detachStrbuf(&sbuf);
+}
+
+
+/************************************ 
+ *        WHILE STATEMENT           *
+ ************************************/
+
+WhileStatement_t* createWhileStatement(const Token_t* token) {
+    WhileStatement_t* st = mallocChk(sizeof(WhileStatement_t));
+
+    *st = (WhileStatement_t) {
+        .type = STATEMENT_WHILE, 
+        .token = copyToken(token),
+        .condition = NULL,
+        .body = NULL
+    };
+
+    return st;
+}
+
+WhileStatement_t* copyWhileStatement(const WhileStatement_t* st) {
+    WhileStatement_t* newSt = createWhileStatement(st->token);
+    newSt->condition = copyExpression(st->condition);
+    newSt->body = st->body ? copyBlockStatement(st->body) : NULL;
+    return newSt;
+}
+
+void cleanupWhileStatement(WhileStatement_t** st) {
+    if (!(*st)) return;
+
+    cleanupToken(&(*st)->token);
+    cleanupExpression(&(*st)->condition);
+    cleanupBlockStatement(&(*st)->body);
+
+    free(*st);
+    *st = NULL;
+}
+
+char* whileStatementToString(const WhileStatement_t* st) {
+    Strbuf_t* sbuf = createStrbuf();
+
+    strbufWrite(sbuf, "while");
+    strbufConsume(sbuf, expressionToString(st->condition));
+    strbufWrite(sbuf, " ");
+    strbufConsume(sbuf, blockStatementToString(st->body));
+
+    return detachStrbuf(&sbuf);
+}
+
+
 /************************************ 
  *      PROGRAM NODE                *
  ************************************/
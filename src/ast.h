@@ -288,6 +288,8 @@ typedef enum StatementType
     STATEMENT_RETURN,
     STATEMENT_EXPRESSION,
     STATEMENT_BLOCK,
+    STATEMENT_ASSIGN,
+    STATEMENT_WHILE,
     STATEMENT_INVALID
 } StatementType_t;
 
@@ -380,6 +382,42 @@ uint32_t blockStatementGetStatementCount(const BlockStatement_t *st);
 Statement_t **blockStatementGetStatements(const BlockStatement_t *st);
 void blockStatementAppendStatement(BlockStatement_t *block, const Statement_t *st);
 
+/************************************
+ *       ASSIGN STATEMENT           *
+ ************************************/
+
+typedef struct AssignStatement
+{
+    StatementType_t type;
+    Token_t *token;
+    Identifier_t *name;
+    Expression_t *value;
+} AssignStatement_t;
+
+AssignStatement_t *createAssignStatement(const Token_t *token);
+AssignStatement_t *copyAssignStatement(const AssignStatement_t *st);
+void cleanupAssignStatement(AssignStatement_t **st);
+
+char *assignStatementToString(const AssignStatement_t *st);
+
+/************************************
+ *        WHILE STATEMENT           *
+ ************************************/
+
+typedef struct WhileStatement
+{
+    StatementType_t type;
+    Token_t *token;
+    Expression_t *condition;
+    BlockStatement_t *body;
+} WhileStatement_t;
+
+WhileStatement_t *createWhileStatement(const Token_t *token);
+WhileStatement_t *copyWhileStatement(const WhileStatement_t *st);
+void cleanupWhileStatement(WhileStatement_t **st);
+
+char *whileStatementToString(const WhileStatement_t *st);
+
 /************************************
  *      PROGRAM NODE                *
  ************************************/
@@ -2,6 +2,8 @@
 #include "builtin.h"
 #include "sbuf.h"
 #include "utils.h"
+#include "gc.h"
+#include "simd.h"
 
 Object_t* lenBuiltin(VectorObjects_t* args);
 Object_t* firstBuiltin(VectorObjects_t* args);
@@ -10,6 +12,13 @@ Object_t* restBuiltin(VectorObjects_t* args);
 Object_t* pushBuiltin(VectorObjects_t* args);
 Object_t* putsBuiltin(VectorObjects_t* args);
 Object_t* printfBuiltin(VectorObjects_t* args);
+Object_t* sliceBuiltin(VectorObjects_t* args);
+Object_t* sumBuiltin(VectorObjects_t* args);
+Object_t* minBuiltin(VectorObjects_t* args);
+Object_t* maxBuiltin(VectorObjects_t* args);
+Object_t* dotBuiltin(VectorObjects_t* args);
+Object_t* rangeBuiltin(VectorObjects_t* args);
+Object_t* internBuiltin(VectorObjects_t* args);
 
 static BuiltinFunctionDef_t builtinDefs[] = {
     {"len", lenBuiltin},
@@ -19,6 +28,13 @@ static BuiltinFunctionDef_t builtinDefs[] = {
     {"rest", restBuiltin},
     {"push", pushBuiltin},
     {"printf", printfBuiltin},
+    {"slice", sliceBuiltin},
+    {"sum", sumBuiltin},
+    {"min", minBuiltin},
+    {"max", maxBuiltin},
+    {"dot", dotBuiltin},
+    {"range", rangeBuiltin},
+    {"intern", internBuiltin},
     {NULL, NULL}
 };
 
@@ -55,7 +71,7 @@ Object_t* lenBuiltin(VectorObjects_t* args) {
         case OBJECT_ARRAY: 
             return (Object_t*)createInteger(arrayGetElementCount((Array_t*)argBuf[0]));
         case OBJECT_STRING:
-            return (Object_t*)createInteger(strlen(((String_t*)argBuf[0])->value));
+            return (Object_t*)createInteger(stringGetLength((String_t*)argBuf[0]));
         default:
             char* err = strFormat("argument to `len` not supported, got %s", 
                                     objectTypeToString(argBuf[0]->type));
@@ -80,7 +96,7 @@ Object_t* firstBuiltin(VectorObjects_t* args) {
 
     Array_t* arr = (Array_t*)argBuf[0];
     if (arrayGetElementCount(arr) > 0) {
-        return arrayGetElements(arr)[0];
+        return arrayGetElement(arr, 0);
     }
 
     return (Object_t*) createNull();
@@ -103,7 +119,7 @@ Object_t* lastBuiltin(VectorObjects_t* args) {
     Array_t* arr = (Array_t*)argBuf[0];
     uint32_t len = arrayGetElementCount(arr); 
     if (len > 0) {
-        return arrayGetElements(arr)[len - 1];
+        return arrayGetElement(arr, len - 1);
     }
 
     return (Object_t*) createNull();
@@ -126,20 +142,46 @@ Object_t* restBuiltin(VectorObjects_t* args) {
 
     Array_t* arr = (Array_t*)argBuf[0];
     uint32_t len = arrayGetElementCount(arr); 
-    Object_t** elems = arrayGetElements(arr);
     if (len > 0) {
-        VectorObjects_t* newElements = createVectorObjects();
-        for (uint32_t i = 1; i < len; i++) {
-            vectorObjectsAppend(newElements, copyObject(elems[i]));
-        } 
-        Array_t* newArr = createArray();
-        newArr->elements = newElements;
-        return (Object_t*)newArr;
+        // arrays are immutable, share elements instead of copying them 
+        return (Object_t*)createArrayView(arr, 1, len - 1);
     }
 
     return (Object_t*) createNull();
 }
 
+Object_t* sliceBuiltin(VectorObjects_t* args) {
+    if (vectorObjectsGetCount(args) != 3) {
+        char* err = strFormat("wrong number of arguments. got=%d, want=3", 
+                                vectorObjectsGetCount(args));
+        return (Object_t*)createError(err); 
+    }
+    
+    Object_t** argBuf = vectorObjectsGetBuffer(args);
+    if (argBuf[0]->type != OBJECT_ARRAY) {
+        char* err = strFormat("argument to `slice` must be ARRAY, got %s", 
+                                objectTypeToString(argBuf[0]->type));
+        return (Object_t*)createError(err);                      
+    }
+
+    if (argBuf[1]->type != OBJECT_INTEGER || argBuf[2]->type != OBJECT_INTEGER) {
+        char* err = strFormat("bounds of `slice` must be INTEGER, got %s %s", 
+                                objectTypeToString(argBuf[1]->type),
+                                objectTypeToString(argBuf[2]->type));
+        return (Object_t*)createError(err);                      
+    }
+
+    // clamp bounds to [0, len] 
+    Array_t* arr = (Array_t*)argBuf[0];
+    int64_t len = arrayGetElementCount(arr); 
+    int64_t start = ((Integer_t*)argBuf[1])->value;
+    int64_t end = ((Integer_t*)argBuf[2])->value;
+    start = start < 0 ? 0 : (start > len ? len : start);
+    end = end < start ? start : (end > len ? len : end);
+
+    return (Object_t*)createArrayView(arr, start, end - start);
+}
+
 Object_t* pushBuiltin(VectorObjects_t* args) {
     if (vectorObjectsGetCount(args) != 2) {
         char* err = strFormat("wrong number of arguments. got=%d, want=2", 
@@ -157,17 +199,30 @@ Object_t* pushBuiltin(VectorObjects_t* args) {
     Array_t* arr = (Array_t*)argBuf[0];
     Object_t* obj = (Object_t*)argBuf[1];
 
+    // nobody else can observe the array, safe to append in place 
+    if (!arrayIsView(arr) && gcIsUniquelyOwned(arr)) {
+        arrayAppend(arr, obj);
+        return (Object_t*)arr;
+    }
+
     uint32_t len = arrayGetElementCount(arr); 
-    Object_t** elems = arrayGetElements(arr);
     
-    VectorObjects_t* newElements = createVectorObjects();
-    for (uint32_t i = 0; i < len; i++) {
-        vectorObjectsAppend(newElements, copyObject(elems[i]));
-    } 
+    // elements are immutable (or shared), a shallow copy is enough 
+    Array_t* newArr = createArrayWithCapacity(len + 1);
+    if (arrayIsPacked(arr)) {
+        int64_t* ints = arrayGetInts(arr);
+        for (uint32_t i = 0; i < len; i++) {
+            arrayAppendInt(newArr, ints[i]);
+        } 
+    } else {
+        arrayUnpack(newArr);
+        Object_t** elems = arrayGetElements(arr);
+        for (uint32_t i = 0; i < len; i++) {
+            arrayAppend(newArr, elems[i]);
+        } 
+    }
     // add new element 
-    vectorObjectsAppend(newElements, obj);
-    Array_t* newArr = createArray();
-    newArr->elements = newElements;
+    arrayAppend(newArr, obj);
     return (Object_t*)newArr;
 
 }
@@ -276,3 +331,157 @@ Object_t* printfBuiltin(VectorObjects_t* args) {
 
     return retValue;
 }
+
+// Returns the unboxed elements of an integer array argument or an error.
+static Error_t* getIntsArgument(Object_t* arg, const char* name, int64_t** ints, uint32_t* cnt) {
+    if (arg->type != OBJECT_ARRAY) {
+        return createError(strFormat("argument to `%s` must be ARRAY, got %s", 
+                                name, objectTypeToString(arg->type)));
+    }
+
+    Array_t* arr = (Array_t*)arg;
+    *cnt = arrayGetElementCount(arr);
+    if (!arrayIsPacked(arr)) {
+        // generic arrays are packed into a temporary when they only hold integers 
+        Object_t** elems = arrayGetElements(arr);
+        Array_t* packed = createArrayWithCapacity(*cnt);
+        for (uint32_t i = 0; i < *cnt; i++) {
+            if (elems[i]->type != OBJECT_INTEGER) {
+                return createError(strFormat("elements of `%s` must be INTEGER, got %s", 
+                                        name, objectTypeToString(elems[i]->type)));
+            }
+            arrayAppendInt(packed, ((Integer_t*)elems[i])->value);
+        }
+        arr = packed;
+    }
+    *ints = arrayGetInts(arr);
+    return NULL;
+}
+
+Object_t* sumBuiltin(VectorObjects_t* args) {
+    if (vectorObjectsGetCount(args) != 1) {
+        char* err = strFormat("wrong number of arguments. got=%d, want=1", 
+                                vectorObjectsGetCount(args));
+        return (Object_t*)createError(err); 
+    }
+
+    int64_t* ints;
+    uint32_t cnt;
+    Error_t* err = getIntsArgument(vectorObjectsGetBuffer(args)[0], "sum", &ints, &cnt);
+    if (err) return (Object_t*)err;
+
+    return (Object_t*)createInteger(simdSumInt64(ints, cnt));
+}
+
+Object_t* minBuiltin(VectorObjects_t* args) {
+    if (vectorObjectsGetCount(args) != 1) {
+        char* err = strFormat("wrong number of arguments. got=%d, want=1", 
+                                vectorObjectsGetCount(args));
+        return (Object_t*)createError(err); 
+    }
+
+    int64_t* ints;
+    uint32_t cnt;
+    Error_t* err = getIntsArgument(vectorObjectsGetBuffer(args)[0], "min", &ints, &cnt);
+    if (err) return (Object_t*)err;
+
+    if (cnt > 0) {
+        return (Object_t*)createInteger(simdMinInt64(ints, cnt));
+    }
+    return (Object_t*)createNull();
+}
+
+Object_t* maxBuiltin(VectorObjects_t* args) {
+    if (vectorObjectsGetCount(args) != 1) {
+        char* err = strFormat("wrong number of arguments. got=%d, want=1", 
+                                vectorObjectsGetCount(args));
+        return (Object_t*)createError(err); 
+    }
+
+    int64_t* ints;
+    uint32_t cnt;
+    Error_t* err = getIntsArgument(vectorObjectsGetBuffer(args)[0], "max", &ints, &cnt);
+    if (err) return (Object_t*)err;
+
+    if (cnt > 0) {
+        return (Object_t*)createInteger(simdMaxInt64(ints, cnt));
+    }
+    return (Object_t*)createNull();
+}
+
+Object_t* dotBuiltin(VectorObjects_t* args) {
+    if (vectorObjectsGetCount(args) != 2) {
+        char* err = strFormat("wrong number of arguments. got=%d, want=2", 
+                                vectorObjectsGetCount(args));
+        return (Object_t*)createError(err); 
+    }
+
+    Object_t** argBuf = vectorObjectsGetBuffer(args);
+    int64_t* a;
+    int64_t* b;
+    uint32_t cntA, cntB;
+    Error_t* err = getIntsArgument(argBuf[0], "dot", &a, &cntA);
+    if (err) return (Object_t*)err;
+    err = getIntsArgument(argBuf[1], "dot", &b, &cntB);
+    if (err) return (Object_t*)err;
+
+    if (cntA != cntB) {
+        char* err = strFormat("arguments to `dot` must have the same length, got %d %d", 
+                                cntA, cntB);
+        return (Object_t*)createError(err); 
+    }
+
+    return (Object_t*)createInteger(simdDotInt64(a, b, cntA));
+}
+
+Object_t* rangeBuiltin(VectorObjects_t* args) {
+    uint32_t argCnt = vectorObjectsGetCount(args);
+    if (argCnt != 1 && argCnt != 2) {
+        char* err = strFormat("wrong number of arguments. got=%d, want=1 or 2", argCnt);
+        return (Object_t*)createError(err); 
+    }
+
+    Object_t** argBuf = vectorObjectsGetBuffer(args);
+    for (uint32_t i = 0; i < argCnt; i++) {
+        if (argBuf[i]->type != OBJECT_INTEGER) {
+            char* err = strFormat("argument to `range` must be INTEGER, got %s", 
+                                    objectTypeToString(argBuf[i]->type));
+            return (Object_t*)createError(err);                      
+        }
+    }
+
+    // range(end) or range(start, end), end is exclusive 
+    int64_t start = argCnt == 2 ? ((Integer_t*)argBuf[0])->value : 0;
+    int64_t end = ((Integer_t*)argBuf[argCnt - 1])->value;
+
+    // the difference of extreme bounds doesn't fit an int64_t
+    uint64_t len = end > start ? (uint64_t)end - (uint64_t)start : 0;
+    if (len > UINT32_MAX) {
+        char* err = strFormat("`range` too long: %llu elements, want at most %u",
+                                (unsigned long long)len, UINT32_MAX);
+        return (Object_t*)createError(err);
+    }
+
+    Array_t* arr = createArrayWithCapacity(len);
+    for (uint32_t i = 0; i < len; i++) {
+        arrayAppendInt(arr, start + i);
+    }
+    return (Object_t*)arr;
+}
+
+Object_t* internBuiltin(VectorObjects_t* args) {
+    if (vectorObjectsGetCount(args) != 1) {
+        char* err = strFormat("wrong number of arguments. got=%d, want=1", 
+                                vectorObjectsGetCount(args));
+        return (Object_t*)createError(err); 
+    }
+
+    Object_t** argBuf = vectorObjectsGetBuffer(args);
+    if (argBuf[0]->type != OBJECT_STRING) {
+        char* err = strFormat("argument to `intern` must be STRING, got %s", 
+                                objectTypeToString(argBuf[0]->type));
+        return (Object_t*)createError(err);                      
+    }
+
+    return (Object_t*)stringIntern((String_t*)argBuf[0]);
+}
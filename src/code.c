@@ -1,4 +1,6 @@
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
 #include <assert.h>
 #include "sbuf.h"
@@ -7,6 +9,8 @@
 
 
 static char* fmtInstruction(const OpDefinition_t* def, SliceInt_t operands);
+static SliceByte_t makeInstruction(OpCode_t op, const int operands[], bool wide);
+static SliceInt_t readOperands(const OpDefinition_t* def, Instructions_t ins, uint8_t* bytesRead, bool wide);
 
 static OpDefinition_t definitions[_OP_COUNT] = {
     [OP_CONSTANT] = {"OpConstant", .argCount=1, .argWidths={2}},
@@ -27,8 +31,8 @@ static OpDefinition_t definitions[_OP_COUNT] = {
     [OP_MINUS] = {"OpMinus", .argCount=0, .argWidths={0}},
     [OP_BANG] = {"OpBang", .argCount=0, .argWidths={0}},
 
-    [OP_JUMP_NOT_TRUTHY] = {"OpJumpNotTruthy", .argCount=1, .argWidths={2}},
-    [OP_JUMP] = {"OpJump", .argCount=1, .argWidths={2}},
+    [OP_JUMP_NOT_TRUTHY] = {"OpJumpNotTruthy", .argCount=1, .argWidths={2}, .signedArgs=true, .jump=true},
+    [OP_JUMP] = {"OpJump", .argCount=1, .argWidths={2}, .signedArgs=true, .jump=true},
 
     [OP_GET_GLOBAL] = {"OpGetGlobal", .argCount=1, .argWidths={2}},
     [OP_SET_GLOBAL] = {"OpSetGlobal", .argCount=1, .argWidths={2}},
@@ -43,6 +47,7 @@ static OpDefinition_t definitions[_OP_COUNT] = {
 
     [OP_SET_LOCAL] = {"OpSetLocal", .argCount=1, .argWidths={1}},
     [OP_GET_LOCAL] = {"OpGetLocal", .argCount=1, .argWidths={1}},
+    [OP_MOVE_LOCAL] = {"OpMoveLocal", .argCount=1, .argWidths={1}},
 
     [OP_GET_BUILTIN] = {"OpGetBuiltin", .argCount=1, .argWidths={1}},
     [OP_CLOSURE] = {"OpClosure", .argCount=2, .argWidths={2, 1}},
@@ -51,6 +56,26 @@ static OpDefinition_t definitions[_OP_COUNT] = {
     [OP_CURRENT_CLOSURE] = {"OpCurrentClosure", .argCount=0, .argWidths={0}},
 
     [OP_POP] = {"OpPop", .argCount=0, .argWidths={0}},
+
+    [OP_ADD_I64] = {"OpAddI64", .argCount=0, .argWidths={0}},
+    [OP_SUB_I64] = {"OpSubI64", .argCount=0, .argWidths={0}},
+    [OP_MUL_I64] = {"OpMulI64", .argCount=0, .argWidths={0}},
+    [OP_EQUAL_I64] = {"OpEqualI64", .argCount=0, .argWidths={0}},
+    [OP_NOT_EQUAL_I64] = {"OpNotEqualI64", .argCount=0, .argWidths={0}},
+    [OP_GREATER_THAN_I64] = {"OpGreaterThanI64", .argCount=0, .argWidths={0}},
+    [OP_MINUS_I64] = {"OpMinusI64", .argCount=0, .argWidths={0}},
+    [OP_JUMP_NOT_EQUAL_I64] = {"OpJumpNotEqualI64", .argCount=1, .argWidths={2}, .signedArgs=true, .jump=true},
+    [OP_JUMP_NOT_GREATER_THAN_I64] = {"OpJumpNotGreaterThanI64", .argCount=1, .argWidths={2}, .signedArgs=true, .jump=true},
+
+    [OP_SWITCH_TABLE] = {"OpSwitchTable", .argCount=1, .argWidths={2}},
+
+    [OP_PUSH_INT8] = {"OpPushInt8", .argCount=1, .argWidths={1}, .signedArgs=true},
+    [OP_PUSH_INT16] = {"OpPushInt16", .argCount=1, .argWidths={2}, .signedArgs=true},
+    [OP_ADD_IMM] = {"OpAddImm", .argCount=1, .argWidths={2}, .signedArgs=true},
+    [OP_SUB_IMM] = {"OpSubImm", .argCount=1, .argWidths={2}, .signedArgs=true},
+    [OP_GREATER_THAN_IMM] = {"OpGreaterThanImm", .argCount=1, .argWidths={2}, .signedArgs=true},
+
+    [OP_WIDE] = {"OpWide", .argCount=0, .argWidths={0}},
 };
 
 
@@ -82,6 +107,39 @@ SliceByte_t codeMakeV(OpCode_t op, ...) {
     return ret;
 }
 
+static bool operandFits(const OpDefinition_t* def, uint8_t width, int value) {
+    switch (width) {
+        case 2:
+            return def->signedArgs ? (value >= INT16_MIN && value <= INT16_MAX) : (value >= 0 && value <= UINT16_MAX);
+        case 1:
+            return def->signedArgs ? (value >= INT8_MIN && value <= INT8_MAX) : (value >= 0 && value <= UINT8_MAX);
+        default:
+            assert(0 && "Unreachable");
+            return false;
+    }
+}
+
+static void writeOperand(uint8_t* dst, uint8_t width, int value) {
+    switch(width) {
+        case 4:
+            dst[0] = ((uint32_t)value & 0xFF000000) >> 24;
+            dst[1] = (value & 0x00FF0000) >> 16;
+            dst[2] = (value & 0x0000FF00) >> 8;
+            dst[3] = (value & 0x000000FF);
+            break;
+        case 2:
+            dst[0] = (value & 0xFF00) >> 8;
+            dst[1] = (value & 0x00FF);  
+            break;
+        case 1:
+            dst[0] = value;
+            break;
+        default:
+            assert(0 && "Unreachable"); 
+            break;
+    }
+}
+
 SliceByte_t codeMake(OpCode_t op, const int operands[]) {
     const OpDefinition_t* def = opLookup(op);
     if (!def) {
@@ -89,36 +147,235 @@ SliceByte_t codeMake(OpCode_t op, const int operands[]) {
         return createSliceByte(0);
     }
 
-    uint8_t instructionLen = 1; 
+    bool wide = false;
+    for (uint8_t i = 0; i < def->argCount; i++) {
+        if (!operandFits(def, def->argWidths[i], operands[i])) wide = true;
+    }
+    return makeInstruction(op, operands, wide);
+}
+
+SliceByte_t codeMakeWide(OpCode_t op, const int operands[]) {
+    const OpDefinition_t* def = opLookup(op);
+    if (!def || def->argCount == 0) {
+        return createSliceByte(0);
+    }
+    return makeInstruction(op, operands, true);
+}
+
+static SliceByte_t makeInstruction(OpCode_t op, const int operands[], bool wide) {
+    const OpDefinition_t* def = opLookup(op);
+
+    uint8_t instructionLen = wide ? 2 : 1; 
     for (uint8_t i = 0; i < def->argCount; i++) {
-        instructionLen += def->argWidths[i];
+        instructionLen += def->argWidths[i] << wide;
     }
 
     // create slice of correct size 
     SliceByte_t instruction = createSliceByte(instructionLen);
-    instruction[0] = (uint8_t)op;
+    uint8_t offset = 0;
+    if (wide) instruction[offset++] = OP_WIDE;
+    instruction[offset++] = (uint8_t)op;
 
-    uint8_t offset = 1;
     for (uint8_t i = 0; i < def->argCount; i++) {
-        uint8_t width = def->argWidths[i];
-        switch(width) {
-            case 2:
-                instruction[offset] = (operands[i] & 0xFF00) >> 8;
-                instruction[offset + 1] = (operands[i] & 0x00FF);  
-                break;
-            case 1:
-                instruction[offset] = operands[i];
-                break;
-            default:
-                assert(0 && "Unreachable"); 
-                break;
-        }
+        uint8_t width = def->argWidths[i] << wide;
+        writeOperand(&instruction[offset], width, operands[i]);
         offset += width;
     }
 
     return instruction;
 }
 
+SliceInt_t codeReadInstruction(Instructions_t ins, uint32_t pos, OpCode_t* op, uint32_t* len) {
+    bool wide = ins[pos] == OP_WIDE;
+    if (wide) pos++;
+
+    *op = ins[pos];
+    uint8_t bytesRead = 0;
+    SliceInt_t operands = readOperands(opLookup(*op), &ins[pos + 1], &bytesRead, wide);
+    *len = 1 + wide + bytesRead;
+    return operands;
+}
+
+bool codePatchOperand(Instructions_t ins, uint32_t pos, int value) {
+    const OpDefinition_t* def = opLookup(ins[pos]);
+    assert(def && def->argCount > 0);
+
+    if (def->jump) value -= pos;
+    if (!operandFits(def, def->argWidths[0], value)) return false;
+
+    writeOperand(&ins[pos + 1], def->argWidths[0], value);
+    return true;
+}
+
+typedef struct DecodedInstruction {
+    uint32_t start;
+    OpCode_t op;
+    int operands[OP_MAX_ARGS];
+    bool wide;
+} DecodedInstruction_t;
+
+static uint32_t decodedLen(const DecodedInstruction_t* in) {
+    const OpDefinition_t* def = opLookup(in->op);
+    uint32_t len = in->wide ? 2 : 1;
+    for (uint8_t i = 0; i < def->argCount; i++) {
+        len += def->argWidths[i] << in->wide;
+    }
+    return len;
+}
+
+static bool operandsNeedWide(const DecodedInstruction_t* in) {
+    const OpDefinition_t* def = opLookup(in->op);
+    for (uint8_t i = 0; i < def->argCount; i++) {
+        if (!operandFits(def, def->argWidths[i], in->operands[i])) return true;
+    }
+    return false;
+}
+
+Instructions_t codeRewriteOperands(Instructions_t ins, const uint32_t* newOperands, uint32_t numNew, uint32_t** positionMap) {
+    uint32_t insLen = sliceByteGetLen(ins);
+    uint32_t* map = calloc(insLen + 1, sizeof(uint32_t));
+    uint32_t* index = malloc((insLen + 1) * sizeof(uint32_t));
+
+    // decode with jump operands turned into the old target positions
+    DecodedInstruction_t* decoded = malloc((insLen + 1) * sizeof(DecodedInstruction_t));
+    uint32_t count = 0;
+    for (uint32_t pos = 0; pos < insLen; ) {
+        DecodedInstruction_t* in = &decoded[count];
+        uint32_t len = 0;
+        SliceInt_t operands = codeReadInstruction(ins, pos, &in->op, &len);
+        const OpDefinition_t* def = opLookup(in->op);
+        for (uint8_t i = 0; i < def->argCount; i++) {
+            in->operands[i] = operands[i];
+        }
+        cleanupSliceInt(operands);
+
+        in->start = pos;
+        in->wide = ins[pos] == OP_WIDE;
+        if (def->jump) in->operands[0] += pos;
+
+        for (uint32_t i = pos; i < pos + len; i++) {
+            index[i] = count;
+        }
+        count++;
+        pos += len;
+    }
+    index[insLen] = count;
+
+    for (uint32_t i = 0; i < numNew; i++) {
+        DecodedInstruction_t* in = &decoded[index[newOperands[2 * i]]];
+        assert(in->start == newOperands[2 * i]);
+        in->operands[0] = newOperands[2 * i + 1];
+        if (!opLookup(in->op)->jump) {
+            // jumps are sized by the layout below
+            in->wide = operandsNeedWide(in);
+        }
+    }
+
+    // lay out until every narrow jump reaches its target, only the rewritten 
+    // instructions shrink and jumps only ever grow so this settles
+    uint32_t* newStart = malloc((count + 1) * sizeof(uint32_t));
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        uint32_t pos = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            newStart[i] = pos;
+            pos += decodedLen(&decoded[i]);
+        }
+        newStart[count] = pos;
+
+        for (uint32_t i = 0; i < count; i++) {
+            DecodedInstruction_t* in = &decoded[i];
+            if (in->wide || !opLookup(in->op)->jump) continue;
+
+            int offset = (int)newStart[index[in->operands[0]]] - (int)newStart[i];
+            if (!operandFits(opLookup(in->op), opLookup(in->op)->argWidths[0], offset)) {
+                in->wide = true;
+                changed = true;
+            }
+        }
+    }
+
+    Instructions_t out = createSliceByte(0);
+    for (uint32_t i = 0; i < count; i++) {
+        DecodedInstruction_t* in = &decoded[i];
+        int operands[OP_MAX_ARGS];
+        memcpy(operands, in->operands, sizeof(operands));
+        if (opLookup(in->op)->jump) {
+            operands[0] = (int)newStart[index[in->operands[0]]] - (int)newStart[i];
+        }
+
+        SliceByte_t instruction = makeInstruction(in->op, operands, in->wide);
+        sliceByteAppend(&out, instruction, sliceByteGetLen(instruction));
+        cleanupSliceByte(instruction);
+    }
+
+    for (uint32_t pos = 0; pos <= insLen; pos++) {
+        map[pos] = newStart[index[pos]];
+    }
+
+    free(newStart);
+    free(decoded);
+    free(index);
+    *positionMap = map;
+    return out;
+}
+
+
+uint32_t codeDecodedLength(Instructions_t ins) {
+    uint32_t insLen = sliceByteGetLen(ins);
+    uint32_t numWords = 0;
+    for (uint32_t pos = 0; pos < insLen; ) {
+        bool wide = ins[pos] == OP_WIDE;
+        const OpDefinition_t* def = opLookup(ins[pos + wide]);
+        uint32_t len = 1 + wide;
+        for (uint8_t i = 0; i < def->argCount; i++) {
+            len += def->argWidths[i] << wide;
+        }
+        numWords += 1 + def->argCount;
+        pos += len;
+    }
+    return numWords;
+}
+
+void codeDecodeInstructions(Instructions_t ins, CodeWord_t* words, uint32_t* positionMap) {
+    uint32_t insLen = sliceByteGetLen(ins);
+    uint32_t* map = positionMap ? positionMap : malloc((insLen + 1) * sizeof(uint32_t));
+
+    // jumps may go forward, every target needs its word index first
+    uint32_t numWords = 0;
+    for (uint32_t pos = 0; pos < insLen; ) {
+        OpCode_t op;
+        uint32_t len = 0;
+        SliceInt_t operands = codeReadInstruction(ins, pos, &op, &len);
+        cleanupSliceInt(operands);
+        map[pos] = numWords;
+        numWords += 1 + opLookup(op)->argCount;
+        pos += len;
+    }
+    map[insLen] = numWords;
+
+    CodeWord_t* word = words;
+    for (uint32_t pos = 0; pos < insLen; ) {
+        OpCode_t op;
+        uint32_t len = 0;
+        SliceInt_t operands = codeReadInstruction(ins, pos, &op, &len);
+        const OpDefinition_t* def = opLookup(op);
+
+        *word++ = op;
+        for (uint8_t i = 0; i < def->argCount; i++) {
+            *word++ = operands[i];
+        }
+        if (def->jump) {
+            word[-1] = map[pos + operands[0]];
+        }
+
+        cleanupSliceInt(operands);
+        pos += len;
+    }
+
+    if (!positionMap) free(map);
+}
 
 char* instructionsToString(Instructions_t ins) {
     Strbuf_t* sbuf = createStrbuf(); 
@@ -126,38 +383,52 @@ char* instructionsToString(Instructions_t ins) {
     uint32_t i = 0; 
     
     while (i < insLen) {
-        const OpDefinition_t* def = opLookup(ins[i]);
-        if (!def) {
+        bool wide = ins[i] == OP_WIDE;
+        const OpDefinition_t* def = opLookup(ins[i + wide]);
+        if (!def || (wide && (i + 1 >= insLen || ins[i + 1] == OP_WIDE))) {
             strbufConsume(sbuf, 
                 strFormat("ERROR: opcode %d undefined\n", ins[i]));
             break;
         }
 
         uint8_t bytesRead = 0;
-        SliceInt_t operands = codeReadOperands(def, &ins[i+1], &bytesRead);
+        SliceInt_t operands = readOperands(def, &ins[i + wide + 1], &bytesRead, wide);
         char *operandsStr = fmtInstruction(def, operands);
-        strbufConsume(sbuf, strFormat("%04d %s\n", i, operandsStr));
+        strbufConsume(sbuf, strFormat(wide ? "%04d OpWide %s\n" : "%04d %s\n", i, operandsStr));
     
         cleanupSliceInt(operands);
         free(operandsStr);
-        i += 1 + bytesRead;
+        i += 1 + wide + bytesRead;
     }
 
     return detachStrbuf(&sbuf);
 }
 
 SliceInt_t codeReadOperands(const OpDefinition_t* def, Instructions_t ins, uint8_t* bytesRead) {
+    return readOperands(def, ins, bytesRead, false);
+}
+
+SliceInt_t codeReadWideOperands(const OpDefinition_t* def, Instructions_t ins, uint8_t* bytesRead) {
+    return readOperands(def, ins, bytesRead, true);
+}
+
+static SliceInt_t readOperands(const OpDefinition_t* def, Instructions_t ins, uint8_t* bytesRead, bool wide) {
     SliceInt_t operands = createSliceInt(def->argCount);
     uint8_t offset = 0;
 
     for (uint8_t i = 0; i < def->argCount; i++) {
-        uint8_t width = def->argWidths[i];
+        uint8_t width = def->argWidths[i] << wide;
         switch(width) {
+            case 4:
+                operands[i] = (int)(((uint32_t)ins[offset] << 24) | (ins[offset+1] << 16) | (ins[offset+2] << 8) | ins[offset+3]);
+                break;
             case 2: 
                 operands[i] = (ins[offset] << 8) | ins[offset+1];
+                if (def->signedArgs) operands[i] = (int16_t)operands[i];
                 break;
             case 1: 
                 operands[i] = ins[offset];
+                if (def->signedArgs) operands[i] = (int8_t)operands[i];
                 break;
             default: 
                 assert(0 && "Unreachable");
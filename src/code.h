@@ -3,6 +3,7 @@
 #include "slice.h"
 #include "vector.h"
 #include <stdint.h> 
+#include <stdbool.h>
 
 /* List of supported in instructions (check c file for op structure)*/
 typedef enum OpCode {
@@ -40,6 +41,7 @@ typedef enum OpCode {
 
     OP_GET_LOCAL,
     OP_SET_LOCAL, 
+    OP_MOVE_LOCAL,
 
     OP_GET_BUILTIN, 
     OP_CLOSURE, 
@@ -48,17 +50,49 @@ typedef enum OpCode {
     OP_CURRENT_CLOSURE,
     
     OP_POP,
+
+    // unchecked variants for operands proven to be integers at compile time
+    OP_ADD_I64,
+    OP_SUB_I64,
+    OP_MUL_I64,
+    OP_EQUAL_I64,
+    OP_NOT_EQUAL_I64,
+    OP_GREATER_THAN_I64,
+    OP_MINUS_I64,
+    OP_JUMP_NOT_EQUAL_I64,
+    OP_JUMP_NOT_GREATER_THAN_I64,
+
+    // pops an integer and jumps through a table constant (see compiler.h)
+    OP_SWITCH_TABLE,
+
+    // integers in the immediate range are encoded in the instruction, the
+    // arithmetic forms take it as right operand
+    OP_PUSH_INT8,
+    OP_PUSH_INT16,
+    OP_ADD_IMM,
+    OP_SUB_IMM,
+    OP_GREATER_THAN_IMM,
+
+    // prefix doubling the operand widths of the next instruction, emitted by
+    // codeMake for operands that don't fit the narrow encoding
+    OP_WIDE,
     _OP_COUNT,
 } OpCode_t;
 
 /* Maximum number of operands any instruction for a given instruction */
 #define OP_MAX_ARGS 3 
 
+/* Range of the signed immediate operands */
+#define IMMEDIATE_MIN INT16_MIN
+#define IMMEDIATE_MAX INT16_MAX
+
 /* Defines the structure a of a given instruction*/
 typedef struct OpDefinition {
     const char* name; 
     uint8_t argCount;
     uint8_t argWidths[OP_MAX_ARGS];
+    bool signedArgs; // operands are read back sign extended
+    bool jump; // the operand is an offset from the start of the instruction (prefix included)
 } OpDefinition_t;
 
 
@@ -71,6 +105,40 @@ char* instructionsToString(Instructions_t ins);
 
 const OpDefinition_t*  opLookup(OpCode_t op);
 SliceByte_t codeMake(OpCode_t op, const int operands[]);
+SliceByte_t codeMakeWide(OpCode_t op, const int operands[]);
 SliceByte_t codeMakeV(OpCode_t op, ...);
 SliceInt_t codeReadOperands(const OpDefinition_t*def, Instructions_t ins, uint8_t* bytesRead);
+SliceInt_t codeReadWideOperands(const OpDefinition_t*def, Instructions_t ins, uint8_t* bytesRead);
+
+// Reads the instruction at ins[pos] looking through an OP_WIDE prefix, op is
+// set to the prefixed opcode and len to the length including the prefix
+SliceInt_t codeReadInstruction(Instructions_t ins, uint32_t pos, OpCode_t* op, uint32_t* len);
+
+// Sets the single operand of the narrow instruction at ins[pos], jump targets
+// are given as positions. Returns false and leaves the instruction as is when
+// the value needs the wide encoding.
+bool codePatchOperand(Instructions_t ins, uint32_t pos, int value);
+
+// Re-encodes ins with the first operand of the instructions at the given
+// (position, value) pairs replaced, jump targets given as positions. Each of
+// them takes the narrowest encoding its operands fit, along with the jumps
+// pushed out of range. positionMap is set to the new position of every old
+// one up to the length of ins, and has to be freed.
+Instructions_t codeRewriteOperands(Instructions_t ins, const uint32_t* newOperands, uint32_t numNew, uint32_t** positionMap);
+
+/* Execution format the vm runs: every instruction is decoded to its opcode 
+ * word followed by one native word per operand, OP_WIDE prefixes are folded
+ * into the operands. Jump operands hold the word index of their target. */
+typedef int32_t CodeWord_t;
+
+// Follows the decoded words of every linked function, not a valid opcode
+#define CODE_END_MARKER _OP_COUNT
+
+// Number of words ins decodes to
+uint32_t codeDecodedLength(Instructions_t ins);
+
+// Decodes ins into words, which has room for codeDecodedLength(ins) of them.
+// positionMap may be NULL, otherwise it is set to the word index of every
+// instruction start and of the end, up to the length of ins.
+void codeDecodeInstructions(Instructions_t ins, CodeWord_t* words, uint32_t* positionMap);
 #endif
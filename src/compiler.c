@@ -2,8 +2,12 @@
 #include "compiler.h"
 #include "builtin.h"
 #include "gc.h"
+#include "ir.h"
+
+static char* compilerConstantKey(Object_t* obj);
 
 IMPL_VECTOR_TYPE(CompilationScope, CompilationScope_t);
+IMPL_VECTOR_TYPE(LocalUsage, LocalUsage_t);
 
 Compiler_t createCompiler() {
     VectorCompilationScope_t* scopes = createVectorCompilationScope();
@@ -11,6 +15,8 @@ Compiler_t createCompiler() {
         .instructions = createSliceByte(0),
         .lastInstruction = {0},
         .previousInstruction = {0},
+        .localUsages = createVectorLocalUsage(),
+        .farOperands = createVector(),
     });
 
     SymbolTable_t* symbolTable = createSymbolTable();
@@ -24,6 +30,7 @@ Compiler_t createCompiler() {
 
     return (Compiler_t) {
         .constants = createVectorObjects(),
+        .constantIndex = createHashMap(),
         .symbolTable = symbolTable,
         .externalStorage = false,
         .scopes = scopes, 
@@ -37,9 +44,23 @@ Compiler_t createCompilerWithState(SymbolTable_t* sym, VectorObjects_t* constant
         .instructions = createSliceByte(0),
         .lastInstruction = {0},
         .previousInstruction = {0},
+        .localUsages = createVectorLocalUsage(),
+        .farOperands = createVector(),
     });
+
+    // rebuild the dedup table for constants of earlier compilations
+    HashMap_t* constantIndex = createHashMap();
+    Object_t** objs = vectorObjectsGetBuffer(constants);
+    for (uint32_t i = 0; i < vectorObjectsGetCount(constants); i++) {
+        char* key = compilerConstantKey(objs[i]);
+        if (!key) continue;
+        hashMapInsert(constantIndex, key, (void*)(uintptr_t)(i + 1));
+        free(key);
+    }
+
     return (Compiler_t) {
         .constants = constants,
+        .constantIndex = constantIndex,
         .symbolTable = sym,
         .externalStorage = true,
         .scopes = scopes, 
@@ -51,12 +72,15 @@ Compiler_t createCompilerWithState(SymbolTable_t* sym, VectorObjects_t* constant
 void cleanupCompilationScope(CompilationScope_t* scope) {
     if (!scope) return;
     cleanupSliceByte(scope->instructions);
+    cleanupVectorLocalUsage(&scope->localUsages, NULL);
+    cleanupVector(&scope->farOperands, NULL);
 }
 
 void cleanupCompiler(Compiler_t* comp) {
     if(!comp) return;
 
     cleanupVectorCompilationScope(&comp->scopes, cleanupCompilationScope);
+    cleanupHashMap(&comp->constantIndex, NULL);
     
     // cleanup symtable and constants only if owned 
     if (!comp->externalStorage) {
@@ -77,6 +101,8 @@ static CompError_t compilerCompileExpressionStatement(Compiler_t* comp, Expressi
 static CompError_t compilerCompileBlockStatement(Compiler_t* comp, BlockStatement_t* statement);
 static CompError_t compilerCompileLetStatement(Compiler_t* comp, LetStatement_t* statement); 
 static CompError_t compilerCompileReturnStatement(Compiler_t* comp, ReturnStatement_t* statement);
+static CompError_t compilerCompileAssignStatement(Compiler_t* comp, AssignStatement_t* statement);
+static CompError_t compilerCompileWhileStatement(Compiler_t* comp, WhileStatement_t* statement);
 
 static CompError_t compilerCompileExpression(Compiler_t* comp, Expression_t* expression);
 static CompError_t compilerCompileInfixExpression(Compiler_t* comp, InfixExpression_t* expression); 
@@ -93,14 +119,17 @@ static CompError_t compilerCompileFunctionLiteral(Compiler_t* comp, FunctionLite
 static CompError_t compilerCompileCallExpression(Compiler_t* comp, CallExpression_t* expression);
 
 static void compilerLoadSymbol(Compiler_t* comp, Symbol_t* sym);
+static void compilerEmitInteger(Compiler_t* comp, int64_t value);
+static bool compilerTakeImmediate(Compiler_t* comp, uint32_t start, int* value);
+static LocalUsage_t* compilerGetLocalUsage(Compiler_t* comp, uint32_t index);
+static void compilerMoveLastLocalUses(Compiler_t* comp);
 
 static SliceByte_t* compilerCurrentInstructions(Compiler_t* comp);
 static uint32_t compilerAddInstruction(Compiler_t* comp, SliceByte_t ins); 
-static uint32_t compilerAddConstant(Compiler_t* comp, Object_t* obj); 
 
 static void compilerSetLastInstruction(Compiler_t* comp, OpCode_t op, uint32_t pos); 
 static bool compilerLastInstructionIs(Compiler_t* comp, OpCode_t op); 
-static void compilerRemoveLastPop(Compiler_t* comp); 
+static void compilerRemoveLastInstruction(Compiler_t* comp); 
 static void compilerReplaceInstruction(Compiler_t* comp, uint32_t pos, SliceByte_t newInstruction);
 static void compilerReplaceLastPopWithReturn(Compiler_t* comp); 
 static void compilerChangeOperand(Compiler_t* comp, uint32_t pos, int operand); 
@@ -109,6 +138,7 @@ Bytecode_t compilerGetBytecode(Compiler_t* comp) {
     Bytecode_t bytecode = {
         .instructions = copySliceByte(*compilerCurrentInstructions(comp)),
         .constants = (!comp->externalStorage) ? copyVectorObjects(comp->constants, NULL) : comp->constants,
+        .numLocals = comp->numMainLocals,
     };
 
     return bytecode;
@@ -119,6 +149,8 @@ void compilerEnterScope(Compiler_t* comp) {
         .instructions = createSliceByte(0), 
         .lastInstruction ={0},
         .previousInstruction = {0}, 
+        .localUsages = createVectorLocalUsage(),
+        .farOperands = createVector(),
     };
     vectorCompilationScopeAppend(comp->scopes, scope); 
     comp->scopeIndex ++; 
@@ -127,8 +159,10 @@ void compilerEnterScope(Compiler_t* comp) {
 }
 
 Instructions_t compilerLeaveScope(Compiler_t* comp) {
-    Instructions_t instructions = *compilerCurrentInstructions(comp);   
-    (void) vectorCompilationScopePop(comp->scopes);
+    CompilationScope_t scope = vectorCompilationScopePop(comp->scopes);
+    Instructions_t instructions = compilerWidenOperands(comp, scope.instructions, scope.farOperands, NULL);
+    cleanupVectorLocalUsage(&scope.localUsages, NULL);
+    cleanupVector(&scope.farOperands, NULL);
     comp->scopeIndex--;
     
     SymbolTable_t* inner = comp->symbolTable; 
@@ -141,12 +175,29 @@ Instructions_t compilerLeaveScope(Compiler_t* comp) {
 
 static void compilerLoadSymbol(Compiler_t* comp, Symbol_t* sym) {
     switch(sym->scope) {
-        case SCOPE_LOCAL:
-            compilerEmit(comp, OP_GET_LOCAL, (const int[]) {sym->index});
+        case SCOPE_LOCAL: {
+            uint32_t pos = compilerEmit(comp, OP_GET_LOCAL, (const int[]) {sym->index});
+            *compilerGetLocalUsage(comp, sym->index) = (LocalUsage_t) {
+                .lastLoad = pos,
+                .movable = false,
+                .captured = compilerGetLocalUsage(comp, sym->index)->captured,
+                .inLoop = comp->scopes->buf[comp->scopeIndex].loopDepth > 0
+            };
             break;
-        case SCOPE_GLOBAL:
-            compilerEmit(comp, OP_GET_GLOBAL, (const int[]) {sym->index});
+        }
+        case SCOPE_GLOBAL: {
+            int32_t constant = compilerGlobalConstant(comp, sym, comp->scopeIndex == 0);
+            if (constant < 0) {
+                compilerEmit(comp, OP_GET_GLOBAL, (const int[]) {sym->index});
+            } else if (objectGetType(vectorObjectsGetBuffer(comp->constants)[constant]) == OBJECT_COMPILED_FUNCTION) {
+                compilerEmit(comp, OP_CLOSURE, (const int[]) {constant, 0});
+            } else if (objectGetType(vectorObjectsGetBuffer(comp->constants)[constant]) == OBJECT_INTEGER) {
+                compilerEmitInteger(comp, ((Integer_t*)vectorObjectsGetBuffer(comp->constants)[constant])->value);
+            } else {
+                compilerEmit(comp, OP_CONSTANT, (const int[]) {constant});
+            }
             break;
+        }
         case SCOPE_BUILTIN:
             compilerEmit(comp, OP_GET_BUILTIN, (const int[]) {sym->index}); 
             break;
@@ -161,16 +212,120 @@ static void compilerLoadSymbol(Compiler_t* comp, Symbol_t* sym) {
     }
 }
 
+static LocalUsage_t* compilerGetLocalUsage(Compiler_t* comp, uint32_t index) {
+    VectorLocalUsage_t* usages = comp->scopes->buf[comp->scopeIndex].localUsages;
+    while (vectorLocalUsageGetCount(usages) <= index) {
+        vectorLocalUsageAppend(usages, (LocalUsage_t) {.lastLoad = -1});
+    }
+    return &vectorLocalUsageGetBuffer(usages)[index];
+}
+
+// Turn the last load of a local into a move when it is passed directly as a call 
+// argument. Bytecode is laid out in source order and loads inside loops are left 
+// alone, so the last load in the instruction stream is the last use on every path. 
+// Captured locals are also referenced by closures and are never moved.
+static void compilerMoveLastLocalUses(Compiler_t* comp) {
+    VectorLocalUsage_t* usages = comp->scopes->buf[comp->scopeIndex].localUsages;
+    uint32_t cnt = vectorLocalUsageGetCount(usages);
+    LocalUsage_t* buf = vectorLocalUsageGetBuffer(usages);
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (buf[i].lastLoad >= 0 && buf[i].movable && !buf[i].captured && !buf[i].inLoop) {
+            uint8_t* op = &(*compilerCurrentInstructions(comp))[buf[i].lastLoad];
+            op[*op == OP_WIDE] = OP_MOVE_LOCAL;
+        }
+    }
+}
+
+// A local passed to a call within the value assigned back to it is not read 
+// again before that store when it is the last load since start, so the load 
+// can move it even inside a loop, `acc = push(acc, x)` then appends in place
+static void compilerMoveReassignedLocal(Compiler_t* comp, uint32_t index, uint32_t start) {
+    LocalUsage_t* usage = compilerGetLocalUsage(comp, index);
+    if (usage->lastLoad >= (int32_t)start && usage->movable && !usage->captured) {
+        uint8_t* op = &(*compilerCurrentInstructions(comp))[usage->lastLoad];
+        op[*op == OP_WIDE] = OP_MOVE_LOCAL;
+    }
+}
+
 static SliceByte_t* compilerCurrentInstructions(Compiler_t* comp) {
     return &(comp->scopes->buf[comp->scopeIndex].instructions);
 }
 
-static uint32_t compilerAddConstant(Compiler_t* comp, Object_t* obj) {
+uint32_t compilerAddConstant(Compiler_t* comp, Object_t* obj) {
     gcSetRef(obj, GC_REF_COMPILE_CONSTANT);
     vectorObjectsAppend(comp->constants, obj);
     return vectorObjectsGetCount(comp->constants) - 1; 
 }
 
+// Integers and strings are keyed by type and value, other constants are 
+// never shared 
+static char* compilerConstantKey(Object_t* obj) {
+    switch (objectGetType(obj)) {
+        case OBJECT_INTEGER:
+            return strFormat("i%lld", (long long)((Integer_t*)obj)->value);
+        case OBJECT_STRING:
+            return strFormat("s%s", stringGetValue((String_t*)obj));
+        default: 
+            return NULL;
+    }
+}
+
+uint32_t compilerAddIntegerConstant(Compiler_t* comp, int64_t value) {
+    char* key = strFormat("i%lld", (long long)value);
+    uintptr_t idx = (uintptr_t)hashMapGet(comp->constantIndex, key);
+    if (!idx) {
+        idx = compilerAddConstant(comp, (Object_t*)createInteger(value)) + 1;
+        hashMapInsert(comp->constantIndex, key, (void*)idx);
+    }
+    free(key);
+    return idx - 1;
+}
+
+uint32_t compilerAddStringConstant(Compiler_t* comp, const char* value) {
+    char* key = strFormat("s%s", value);
+    uintptr_t idx = (uintptr_t)hashMapGet(comp->constantIndex, key);
+    if (!idx) {
+        // equal literals share one interned string 
+        String_t* str = stringIntern(createString(value));
+        idx = compilerAddConstant(comp, (Object_t*)str) + 1;
+        hashMapInsert(comp->constantIndex, key, (void*)idx);
+    }
+    free(key);
+    return idx - 1;
+}
+
+static int compareSwitchCases(const void* a, const void* b) {
+    int64_t left = ((const SwitchCase_t*)a)->key;
+    int64_t right = ((const SwitchCase_t*)b)->key;
+    return (left > right) - (left < right);
+}
+
+uint32_t compilerAddSwitchTable(Compiler_t* comp, SwitchCase_t* cases, uint32_t numCases, uint32_t defaultTarget) {
+    qsort(cases, numCases, sizeof(SwitchCase_t), compareSwitchCases);
+    uint64_t span = (uint64_t)cases[numCases - 1].key - (uint64_t)cases[0].key;
+
+    Array_t* table = createArray();
+    arrayAppendInt(table, defaultTarget);
+    if (span < 2 * (uint64_t)numCases) {
+        arrayAppendInt(table, SWITCH_TABLE_DENSE);
+        arrayAppendInt(table, cases[0].key);
+        for (uint32_t i = 0, key = 0; key <= span; key++) {
+            if ((uint64_t)cases[i].key - (uint64_t)cases[0].key == key) {
+                arrayAppendInt(table, cases[i++].target);
+            } else {
+                arrayAppendInt(table, defaultTarget);
+            }
+        }
+    } else {
+        arrayAppendInt(table, SWITCH_TABLE_SPARSE);
+        for (uint32_t i = 0; i < numCases; i++) {
+            arrayAppendInt(table, cases[i].key);
+            arrayAppendInt(table, cases[i].target);
+        }
+    }
+    return compilerAddConstant(comp, (Object_t*)table);
+}
+
 static uint32_t compilerAddInstruction(Compiler_t* comp, SliceByte_t ins) {
     uint32_t posNewInstruction = sliceByteGetLen(*compilerCurrentInstructions(comp));
     sliceByteAppend(compilerCurrentInstructions(comp), ins, sliceByteGetLen(ins));
@@ -201,7 +356,7 @@ static bool compilerLastInstructionIs(Compiler_t* comp, OpCode_t op) {
     return comp->scopes->buf[comp->scopeIndex].lastInstruction.opcode == op;
 }
 
-static void compilerRemoveLastPop(Compiler_t* comp) {
+static void compilerRemoveLastInstruction(Compiler_t* comp) {
     EmittedInstruction_t last = comp->scopes->buf[comp->scopeIndex].lastInstruction;
     EmittedInstruction_t previous = comp->scopes->buf[comp->scopeIndex].previousInstruction;
 
@@ -224,31 +379,146 @@ static void compilerReplaceLastPopWithReturn(Compiler_t* comp) {
     cleanupSliceByte(tmpInstr);
 }
 
+// Jump operands are given as the target position. Operands that need the
+// wide encoding are kept until the scope is done, see compilerWidenOperands.
 static void compilerChangeOperand(Compiler_t* comp, uint32_t pos, int operand) {
-    OpCode_t op = (*compilerCurrentInstructions(comp))[pos];
-    SliceByte_t newInstruction = codeMake(op, (const int[]) {operand});
+    if (!codePatchOperand(*compilerCurrentInstructions(comp), pos, operand)) {
+        Vector_t* farOperands = comp->scopes->buf[comp->scopeIndex].farOperands;
+        vectorAppend(farOperands, (void*)(uintptr_t)pos);
+        vectorAppend(farOperands, (void*)(uintptr_t)operand);
+    }
+}
+
+void compilerMoveSwitchTable(Array_t* table, const uint32_t* positionMap) {
+    int64_t* entries = arrayGetInts(table);
+    uint32_t count = arrayGetElementCount(table);
+    entries[0] = positionMap[entries[0]];
+    uint32_t step = entries[1] == SWITCH_TABLE_DENSE ? 1 : 2;
+    for (uint32_t i = 3; i < count; i += step) {
+        entries[i] = positionMap[entries[i]];
+    }
+}
+
+// The tables of the switches in ins hold positions as well
+static void compilerMoveSwitchTargets(Object_t** constants, Instructions_t ins, const uint32_t* positionMap) {
+    for (uint32_t pos = 0, len = 0; pos < sliceByteGetLen(ins); pos += len) {
+        OpCode_t op;
+        SliceInt_t operands = codeReadInstruction(ins, pos, &op, &len);
+        if (op == OP_SWITCH_TABLE) {
+            compilerMoveSwitchTable((Array_t*)constants[operands[0]], positionMap);
+        }
+        cleanupSliceInt(operands);
+    }
+}
+
+Instructions_t compilerWidenOperands(Compiler_t* comp, Instructions_t ins, Vector_t* farOperands, uint32_t** positionMap) {
+    uint32_t numFar = vectorGetCount(farOperands) / 2;
+    if (numFar == 0) {
+        if (positionMap) *positionMap = NULL;
+        return ins;
+    }
 
-    compilerReplaceInstruction(comp, pos, newInstruction);
-    cleanupSliceByte(newInstruction);
+    uint32_t* far = mallocChk(2 * numFar * sizeof(uint32_t));
+    for (uint32_t i = 0; i < 2 * numFar; i++) {
+        far[i] = (uintptr_t)vectorGetBuffer(farOperands)[i];
+    }
+    uint32_t* map = NULL;
+    Instructions_t widened = codeRewriteOperands(ins, far, numFar, &map);
+    free(far);
+    compilerMoveSwitchTargets(vectorObjectsGetBuffer(comp->constants), widened, map);
+
+    cleanupSliceByte(ins);
+    if (positionMap) {
+        *positionMap = map;
+    } else {
+        free(map);
+    }
+    return widened;
 }
 
 
 
+void compilerSetOptLevel(Compiler_t* comp, uint8_t optLevel) {
+    comp->optLevel = optLevel;
+}
+
 CompError_t compilerCompile(Compiler_t* comp, Program_t* program) {
-    return compilerCompileProgram(comp, program);
+    if (comp->optLevel == 0) {
+        return compilerCompileProgram(comp, program);
+    }
+
+    Instructions_t instructions = NULL;
+    uint32_t numLocals = 0;
+    CompError_t err = irCompileProgram(comp, program, &instructions, &numLocals);
+    if (err != COMP_NO_ERROR) {
+        return err;
+    }
+
+    compilerAddInstruction(comp, instructions);
+    cleanupSliceByte(instructions);
+    if (numLocals > comp->numMainLocals) {
+        comp->numMainLocals = numLocals;
+    }
+    return COMP_NO_ERROR;
+}
+
+int32_t compilerGlobalConstant(Compiler_t* comp, Symbol_t* symbol, bool inMain) {
+    if (symbol->scope != SCOPE_GLOBAL || (!inMain && comp->optLevel < 2)) {
+        return -1;
+    }
+    return symbol->constant;
+}
+
+// Binds the global of a top level let whose value compiled to a single
+// constant load, see compilerGlobalConstant
+static void compilerBindGlobal(Compiler_t* comp, LetStatement_t* let, uint32_t start) {
+    CompilationScope_t* scope = &comp->scopes->buf[comp->scopeIndex];
+    OpCode_t op = scope->previousInstruction.opcode;
+    bool immediate = op == OP_PUSH_INT8 || op == OP_PUSH_INT16;
+    if (scope->previousInstruction.position != start || (op != OP_CONSTANT && op != OP_CLOSURE && !immediate)) {
+        return;
+    }
+
+    uint32_t len = 0;
+    SliceInt_t operands = codeReadInstruction(scope->instructions, start, &op, &len);
+    Symbol_t* symbol = symbolTableResolve(comp->symbolTable, let->name->value);
+    if (immediate) {
+        symbol->constant = compilerAddIntegerConstant(comp, operands[0]);
+    } else if (op == OP_CONSTANT || operands[1] == 0) {
+        symbol->constant = operands[0];
+    }
+    cleanupSliceInt(operands);
 }
 
 CompError_t compilerCompileProgram(Compiler_t* comp, Program_t* program) {
     uint32_t stmtCnt = programGetStatementCount(program);
     Statement_t** stmts = programGetStatements(program);
-    for (uint32_t i = 0; i < stmtCnt; i++) {
-        CompError_t ret = compilerCompileStatement(comp, stmts[i]);
-        if (ret != COMP_NO_ERROR) {
-            return ret;
+    HashMap_t* assigned = irAssignedNames(program);
+
+    CompError_t ret = COMP_NO_ERROR;
+    for (uint32_t i = 0; i < stmtCnt && ret == COMP_NO_ERROR; i++) {
+        uint32_t start = sliceByteGetLen(*compilerCurrentInstructions(comp));
+        ret = compilerCompileStatement(comp, stmts[i]);
+
+        LetStatement_t* let = (LetStatement_t*)stmts[i];
+        if (ret == COMP_NO_ERROR && stmts[i]->type == STATEMENT_LET && !hashMapGet(assigned, let->name->value)) {
+            compilerBindGlobal(comp, let, start);
         }
     }
 
-    return COMP_NO_ERROR;
+    cleanupHashMap(&assigned, NULL);
+    symbolTableUnbindConstants(comp->symbolTable);
+
+    CompilationScope_t* scope = &comp->scopes->buf[comp->scopeIndex];
+    uint32_t* map = NULL;
+    scope->instructions = compilerWidenOperands(comp, scope->instructions, scope->farOperands, &map);
+    if (map) {
+        scope->lastInstruction.position = map[scope->lastInstruction.position];
+        scope->previousInstruction.position = map[scope->previousInstruction.position];
+        free(map);
+    }
+    scope->farOperands->cnt = 0;
+    return ret;
 }
 
 
@@ -267,6 +537,12 @@ CompError_t compilerCompileStatement(Compiler_t* comp, Statement_t* statement) {
         case STATEMENT_RETURN:
             err = compilerCompileReturnStatement(comp, (ReturnStatement_t*) statement);
             break;
+        case STATEMENT_ASSIGN:
+            err = compilerCompileAssignStatement(comp, (AssignStatement_t*) statement);
+            break;
+        case STATEMENT_WHILE:
+            err = compilerCompileWhileStatement(comp, (WhileStatement_t*) statement);
+            break;
         default: 
             assert(0 && "Unreachable: Unhandled statement type"); 
     }
@@ -292,7 +568,7 @@ static CompError_t compilerCompileBlockStatement(Compiler_t* comp, BlockStatemen
     for (uint32_t i = 0; i < stmtCnt; i++) {
         CompError_t err = compilerCompileStatement(comp, stmts[i]);
         if (err != COMP_NO_ERROR) {
-            break;
+            return err;
         } 
     }
 
@@ -301,6 +577,10 @@ static CompError_t compilerCompileBlockStatement(Compiler_t* comp, BlockStatemen
 
 static CompError_t compilerCompileLetStatement(Compiler_t* comp, LetStatement_t* statement) {
     Symbol_t* symbol = symbolTableDefine(comp->symbolTable, statement->name->value);
+    if (symbol->index > UINT16_MAX) {
+        // the vm has a fixed store of UINT16_MAX + 1 globals, wide local operands are 16 bit
+        return symbol->scope == SCOPE_GLOBAL ? COMP_TOO_MANY_GLOBALS : COMP_TOO_MANY_LOCALS;
+    }
 
     CompError_t err = compilerCompileExpression(comp, statement->value);
     if (err != COMP_NO_ERROR) {
@@ -326,6 +606,66 @@ static CompError_t compilerCompileReturnStatement(Compiler_t* comp, ReturnStatem
     return COMP_NO_ERROR;
 }
 
+static CompError_t compilerCompileAssignStatement(Compiler_t* comp, AssignStatement_t* statement) {
+    Symbol_t* symbol = symbolTableResolve(comp->symbolTable, statement->name->value);
+    if (!symbol) return COMP_UNDEFINED_VARIABLE;
+
+    // closures hold a copy of their free values, they can't be written back
+    if (symbol->scope != SCOPE_GLOBAL && symbol->scope != SCOPE_LOCAL) {
+        return COMP_NOT_ASSIGNABLE;
+    }
+
+    uint32_t start = sliceByteGetLen(*compilerCurrentInstructions(comp));
+    CompError_t err = compilerCompileExpression(comp, statement->value);
+    if (err != COMP_NO_ERROR) {
+        return err;
+    }
+
+    if (symbol->scope == SCOPE_GLOBAL) {
+        compilerEmit(comp, OP_SET_GLOBAL, (const int[]) {symbol->index});    
+    } else {
+        compilerMoveReassignedLocal(comp, symbol->index, start);
+        compilerEmit(comp, OP_SET_LOCAL, (const int[]) {symbol->index});    
+    }
+
+    return COMP_NO_ERROR;
+}
+
+static CompError_t compilerCompileWhileStatement(Compiler_t* comp, WhileStatement_t* statement) {
+    uint32_t loopStartPos = sliceByteGetLen(*compilerCurrentInstructions(comp));
+
+    // the condition runs again on every iteration too, its locals can't be moved out
+    comp->scopes->buf[comp->scopeIndex].loopDepth++;
+    CompError_t err = compilerCompileExpression(comp, statement->condition);
+    if (err != COMP_NO_ERROR) {
+        comp->scopes->buf[comp->scopeIndex].loopDepth--;
+        return err;
+    }
+
+    uint32_t jumpNotTruthyPos = compilerEmit(comp, OP_JUMP_NOT_TRUTHY, (const int[]) {9999});
+
+    err = compilerCompileBlockStatement(comp, statement->body);
+    comp->scopes->buf[comp->scopeIndex].loopDepth--;
+    if (err != COMP_NO_ERROR) {
+        return err;
+    }
+
+    // the body keeps its pops, a loop leaves nothing on the stack
+    uint32_t jumpPos = compilerEmit(comp, OP_JUMP, (const int[]) {9999});
+    compilerChangeOperand(comp, jumpPos, loopStartPos);
+
+    uint32_t afterLoopPos = sliceByteGetLen(*compilerCurrentInstructions(comp));
+    compilerChangeOperand(comp, jumpNotTruthyPos, afterLoopPos);
+
+    // the main program leaves null for the REPL, not the last condition
+    if (comp->scopeIndex == 0) {
+        compilerEmit(comp, OP_NULL, NULL);
+        compilerEmit(comp, OP_POP, NULL);
+    }
+
+    return COMP_NO_ERROR;
+}
+
 CompError_t compilerCompileExpression(Compiler_t* comp, Expression_t* expression) {
     CompError_t err = COMP_NO_ERROR;
 
@@ -391,11 +731,21 @@ static CompError_t compilerCompileInfixExpression(Compiler_t* comp, InfixExpress
         return ret;
     }
 
+    uint32_t rightStart = sliceByteGetLen(*compilerCurrentInstructions(comp));
     ret = compilerCompileExpression(comp, operandRight);
     if (ret != COMP_NO_ERROR) {
         return ret;
     }
 
+    // an immediate right operand is folded into the operation
+    int immediate = 0;
+    if ((operator == TOKEN_PLUS || operator == TOKEN_MINUS || operator == TOKEN_GT) &&
+        compilerTakeImmediate(comp, rightStart, &immediate)) {
+        OpCode_t op = (operator == TOKEN_PLUS) ? OP_ADD_IMM : (operator == TOKEN_MINUS) ? OP_SUB_IMM : OP_GREATER_THAN_IMM;
+        compilerEmit(comp, op, (const int[]) {immediate});
+        return COMP_NO_ERROR;
+    }
+
     switch(operator) { 
         case TOKEN_PLUS: 
             compilerEmit(comp, OP_ADD, NULL);
@@ -425,12 +775,37 @@ static CompError_t compilerCompileInfixExpression(Compiler_t* comp, InfixExpress
     return COMP_NO_ERROR;
 }
 
-static CompError_t compilerCompileIntegerLiteral(Compiler_t* comp, IntegerLiteral_t* intLit) {
-    Integer_t* integer = createInteger(intLit->value);
-    
-    const int operands[] = {compilerAddConstant(comp, (Object_t*)integer)};
-    compilerEmit(comp, OP_CONSTANT, operands);
+// Integers in the immediate range are encoded in the instruction
+static void compilerEmitInteger(Compiler_t* comp, int64_t value) {
+    if (value >= INT8_MIN && value <= INT8_MAX) {
+        compilerEmit(comp, OP_PUSH_INT8, (const int[]) {value});
+    } else if (value >= IMMEDIATE_MIN && value <= IMMEDIATE_MAX) {
+        compilerEmit(comp, OP_PUSH_INT16, (const int[]) {value});
+    } else {
+        compilerEmit(comp, OP_CONSTANT, (const int[]) {compilerAddIntegerConstant(comp, value)});
+    }
+}
+
+// Removes the last instruction if it pushes an immediate and is all the
+// code emitted since start
+static bool compilerTakeImmediate(Compiler_t* comp, uint32_t start, int* value) {
+    EmittedInstruction_t last = comp->scopes->buf[comp->scopeIndex].lastInstruction;
+    if (last.position != start || (last.opcode != OP_PUSH_INT8 && last.opcode != OP_PUSH_INT16)) {
+        return false;
+    }
 
+    OpCode_t op;
+    uint32_t len = 0;
+    SliceInt_t operands = codeReadInstruction(*compilerCurrentInstructions(comp), start, &op, &len);
+    *value = operands[0];
+    cleanupSliceInt(operands);
+
+    compilerRemoveLastInstruction(comp);
+    return true;
+}
+
+static CompError_t compilerCompileIntegerLiteral(Compiler_t* comp, IntegerLiteral_t* intLit) {
+    compilerEmitInteger(comp, intLit->value);
     return COMP_NO_ERROR;
 }
 
@@ -465,7 +840,127 @@ static CompError_t compilerCompilePrefixExpression(Compiler_t* comp, PrefixExpre
 }
 
 
+// Leaves the value of an if branch on the stack: the last expression keeps its 
+// value, an empty branch or one ending with a let, an assignment or a loop 
+// evaluates to null
+static void compilerKeepBlockValue(Compiler_t* comp, BlockStatement_t* block) {
+    uint32_t stmtCnt = blockStatementGetStatementCount(block);
+    StatementType_t lastType = stmtCnt > 0 ? blockStatementGetStatements(block)[stmtCnt - 1]->type : STATEMENT_INVALID;
+
+    if (lastType == STATEMENT_EXPRESSION) {
+        compilerRemoveLastInstruction(comp);
+    } else if (lastType != STATEMENT_RETURN) {
+        compilerEmit(comp, OP_NULL, NULL);
+    }
+}
+
+// Identifier compared to an integer literal by a switch case condition, `x == 3`
+static Identifier_t* compilerSwitchCondition(Expression_t* condition, int64_t* key) {
+    if (condition->type != EXPRESSION_INFIX_EXPRESSION) return NULL;
+    InfixExpression_t* infix = (InfixExpression_t*)condition;
+    if (infix->token->type != TOKEN_EQ || infix->left->type != EXPRESSION_IDENTIFIER) return NULL;
+
+    Expression_t* right = infix->right;
+    bool negated = false;
+    if (right->type == EXPRESSION_PREFIX_EXPRESSION && strcmp(((PrefixExpression_t*)right)->operator, "-") == 0) {
+        right = ((PrefixExpression_t*)right)->right;
+        negated = true;
+    }
+    if (right->type != EXPRESSION_INTEGER_LITERAL) return NULL;
+
+    *key = ((IntegerLiteral_t*)right)->value;
+    if (negated) *key = -*key;
+    return (Identifier_t*)infix->left;
+}
+
+// Collects the links of `if (x == 1) {..} else { if (x == 2) {..} else {..} }`
+// while they compare the same identifier to distinct integer literals
+static void compilerCollectSwitchCases(IfExpression_t* expression, Vector_t* links) {
+    int64_t key;
+    Identifier_t* ident = compilerSwitchCondition(expression->condition, &key);
+    if (!ident) return;
+
+    while (true) {
+        for (uint32_t i = 0; i < vectorGetCount(links); i++) {
+            int64_t otherKey = 0;
+            Expression_t* other = ((IfExpression_t*)vectorGetBuffer(links)[i])->condition;
+            if (compilerSwitchCondition(other, &otherKey) && otherKey == key) return;
+        }
+        vectorAppend(links, expression);
+
+        BlockStatement_t* alt = expression->alternative;
+        if (!alt || blockStatementGetStatementCount(alt) != 1) return;
+        Statement_t* stmt = blockStatementGetStatements(alt)[0];
+        if (stmt->type != STATEMENT_EXPRESSION) return;
+        Expression_t* next = ((ExpressionStatement_t*)stmt)->expression;
+        if (next->type != EXPRESSION_IF_EXPRESSION) return;
+
+        expression = (IfExpression_t*)next;
+        Identifier_t* nextIdent = compilerSwitchCondition(expression->condition, &key);
+        if (!nextIdent || strcmp(nextIdent->value, ident->value) != 0) return;
+    }
+}
+
+// The identifier is loaded once, every case and the final alternative jump
+// to the end. A case body can't shadow the identifier for the later cases.
+static CompError_t compilerCompileSwitch(Compiler_t* comp, Vector_t* links) {
+    IfExpression_t** ifs = (IfExpression_t**)vectorGetBuffer(links);
+    uint32_t numCases = vectorGetCount(links);
+
+    int64_t key;
+    CompError_t err = compilerCompileIdentifier(comp, compilerSwitchCondition(ifs[0]->condition, &key));
+    if (err != COMP_NO_ERROR) {
+        return err;
+    }
+    uint32_t switchPos = compilerEmit(comp, OP_SWITCH_TABLE, (const int[]) {9999});
+
+    SwitchCase_t* cases = mallocChk(numCases * sizeof(SwitchCase_t));
+    uint32_t* jumpPos = mallocChk(numCases * sizeof(uint32_t));
+    for (uint32_t i = 0; i < numCases && err == COMP_NO_ERROR; i++) {
+        compilerSwitchCondition(ifs[i]->condition, &cases[i].key);
+        cases[i].target = sliceByteGetLen(*compilerCurrentInstructions(comp));
+
+        err = compilerCompileBlockStatement(comp, ifs[i]->consequence);
+        if (err == COMP_NO_ERROR) {
+            compilerKeepBlockValue(comp, ifs[i]->consequence);
+            jumpPos[i] = compilerEmit(comp, OP_JUMP, (const int[]) {9999});
+        }
+    }
+
+    uint32_t defaultTarget = sliceByteGetLen(*compilerCurrentInstructions(comp));
+    BlockStatement_t* alternative = ifs[numCases - 1]->alternative;
+    if (err == COMP_NO_ERROR && alternative == NULL) {
+        compilerEmit(comp, OP_NULL, NULL);
+    } else if (err == COMP_NO_ERROR) {
+        err = compilerCompileBlockStatement(comp, alternative);
+        if (err == COMP_NO_ERROR) {
+            compilerKeepBlockValue(comp, alternative);
+        }
+    }
+
+    if (err == COMP_NO_ERROR) {
+        uint32_t afterSwitchPos = sliceByteGetLen(*compilerCurrentInstructions(comp));
+        for (uint32_t i = 0; i < numCases; i++) {
+            compilerChangeOperand(comp, jumpPos[i], afterSwitchPos);
+        }
+        compilerChangeOperand(comp, switchPos, compilerAddSwitchTable(comp, cases, numCases, defaultTarget));
+    }
+
+    free(cases);
+    free(jumpPos);
+    return err;
+}
+
 static CompError_t compilerCompileIfExpression(Compiler_t* comp, IfExpression_t* expression) {
+    Vector_t* links = createVector();
+    compilerCollectSwitchCases(expression, links);
+    if (vectorGetCount(links) >= SWITCH_MIN_CASES) {
+        CompError_t err = compilerCompileSwitch(comp, links);
+        cleanupVector(&links, NULL);
+        return err;
+    }
+    cleanupVector(&links, NULL);
+
     CompError_t err = compilerCompileExpression(comp, expression->condition);
     if (err != COMP_NO_ERROR) {
         return err;
@@ -479,9 +974,7 @@ static CompError_t compilerCompileIfExpression(Compiler_t* comp, IfExpression_t*
         return err; 
     }
 
-    if (compilerLastInstructionIs(comp, OP_POP)) {
-        compilerRemoveLastPop(comp);
-    }
+    compilerKeepBlockValue(comp, expression->consequence);
 
     // Emit an `OpJump` with a bogus value 
     uint32_t jumpPos = compilerEmit(comp, OP_JUMP, (const int[]) {9999});
@@ -498,9 +991,7 @@ static CompError_t compilerCompileIfExpression(Compiler_t* comp, IfExpression_t*
             return err;
         }
 
-        if (compilerLastInstructionIs(comp, OP_POP)) {
-            compilerRemoveLastPop(comp);
-        }
+        compilerKeepBlockValue(comp, expression->alternative);
 
     }
 
@@ -518,8 +1009,7 @@ static CompError_t compilerCompileIdentifier(Compiler_t* comp, Identifier_t* ide
 }
 
 static CompError_t compilerCompileStringLiteral(Compiler_t* comp, StringLiteral_t* strLit) {
-    String_t* str = createString(strLit->value);
-    int constIdx = compilerAddConstant(comp, (Object_t*)str);
+    int constIdx = compilerAddStringConstant(comp, strLit->value);
     compilerEmit(comp, OP_CONSTANT, (const int[]){constIdx});
     return COMP_NO_ERROR;
 }
@@ -605,6 +1095,8 @@ static CompError_t compilerCompileFunctionLiteral(Compiler_t* comp, FunctionLite
         compilerEmit(comp, OP_RETURN, NULL);
     }
 
+    compilerMoveLastLocalUses(comp);
+
     VectorSymbol_t* freeSymbols = copyVectorSymbol(comp->symbolTable->freeSymbols, NULL);    
     uint32_t numLocals = comp->symbolTable->numDefinitions; 
     Instructions_t instr = compilerLeaveScope(comp);
@@ -612,10 +1104,13 @@ static CompError_t compilerCompileFunctionLiteral(Compiler_t* comp, FunctionLite
     uint32_t numFreeSymbols = vectorSymbolGetCount(freeSymbols);
     for (uint32_t i = 0; i < numFreeSymbols; i++) {
         compilerLoadSymbol(comp, freeSymbols->buf[i]);
+        if (freeSymbols->buf[i]->scope == SCOPE_LOCAL) {
+            compilerGetLocalUsage(comp, freeSymbols->buf[i]->index)->captured = true;
+        }
     }
     cleanupVectorSymbol(&freeSymbols, NULL);
 
-    CompiledFunction_t* compiledFn = createCompiledFunction(instr, numLocals, numParams);
+    CompiledFunction_t* compiledFn = compilerCreateFunction(comp->constants, instr, numLocals, numParams);
     const int args[] = {compilerAddConstant(comp, (Object_t*) compiledFn), numFreeSymbols}; 
     compilerEmit(comp, OP_CLOSURE, args);
     
@@ -635,8 +1130,218 @@ static CompError_t compilerCompileCallExpression(Compiler_t* comp, CallExpressio
         if (err != COMP_NO_ERROR) {
             return err;
         }
+
+        // plain local arguments are candidates for moves
+        if (args[i]->type == EXPRESSION_IDENTIFIER && compilerLastInstructionIs(comp, OP_GET_LOCAL)) {
+            uint32_t pos = comp->scopes->buf[comp->scopeIndex].lastInstruction.position;
+            OpCode_t op;
+            uint32_t len = 0;
+            SliceInt_t operands = codeReadInstruction(*compilerCurrentInstructions(comp), pos, &op, &len);
+            compilerGetLocalUsage(comp, operands[0])->movable = true;
+            cleanupSliceInt(operands);
+        }
     }
 
     compilerEmit(comp, OP_CALL, (const int[]) {numArgs});
     return COMP_NO_ERROR; 
-}
\ No newline at end of file
+}
+
+/* Function constant pools */
+
+static int compareConstantIndices(const void* a, const void* b) {
+    uint32_t left = *(const uint32_t*)a;
+    uint32_t right = *(const uint32_t*)b;
+    return (left > right) - (left < right);
+}
+
+static bool isConstantOperand(OpCode_t op) {
+    return op == OP_CONSTANT || op == OP_CLOSURE || op == OP_SWITCH_TABLE;
+}
+
+CompiledFunction_t* compilerCreateFunction(VectorObjects_t* constants, Instructions_t instr, uint32_t numLocals, uint32_t numParameters) {
+    uint32_t len = sliceByteGetLen(instr);
+    uint32_t* indices = mallocChk((len + 1) * sizeof(uint32_t));
+    uint32_t numIndices = 0;
+    for (uint32_t ip = 0; ip < len;) {
+        OpCode_t op;
+        uint32_t insLen = 0;
+        SliceInt_t operands = codeReadInstruction(instr, ip, &op, &insLen);
+        if (isConstantOperand(op)) {
+            indices[numIndices++] = operands[0];
+        }
+        cleanupSliceInt(operands);
+        ip += insLen;
+    }
+
+    qsort(indices, numIndices, sizeof(uint32_t), compareConstantIndices);
+    uint32_t numPool = 0;
+    for (uint32_t i = 0; i < numIndices; i++) {
+        if (numPool == 0 || indices[numPool - 1] != indices[i]) {
+            indices[numPool++] = indices[i];
+        }
+    }
+
+    // pool indices never exceed the global ones, wide operands that now fit 
+    // the narrow encoding need the code re-encoded, the rest are patched in place
+    uint32_t* rewrites = mallocChk((2 * numIndices + 1) * sizeof(uint32_t));
+    uint32_t numRewrites = 0;
+    for (uint32_t ip = 0; ip < len;) {
+        OpCode_t op;
+        uint32_t insLen = 0;
+        SliceInt_t operands = codeReadInstruction(instr, ip, &op, &insLen);
+        if (isConstantOperand(op)) {
+            uint32_t key = operands[0];
+            uint32_t* found = bsearch(&key, indices, numPool, sizeof(uint32_t), compareConstantIndices);
+            operands[0] = found - indices;
+            SliceByte_t newInstruction = codeMake(op, operands);
+            if (sliceByteGetLen(newInstruction) < insLen) {
+                rewrites[numRewrites++] = ip;
+                rewrites[numRewrites++] = operands[0];
+            } else if (key != (uint32_t)operands[0]) {
+                memcpy(&instr[ip], newInstruction, insLen);
+            }
+            cleanupSliceByte(newInstruction);
+        }
+        cleanupSliceInt(operands);
+        ip += insLen;
+    }
+
+    Object_t** pool = mallocChk((numPool + 1) * sizeof(Object_t*));
+    for (uint32_t i = 0; i < numPool; i++) {
+        pool[i] = vectorObjectsGetBuffer(constants)[indices[i]];
+    }
+    if (numRewrites > 0) {
+        uint32_t* map = NULL;
+        Instructions_t rewritten = codeRewriteOperands(instr, rewrites, numRewrites / 2, &map);
+        compilerMoveSwitchTargets(pool, rewritten, map);
+        cleanupSliceByte(instr);
+        instr = rewritten;
+        free(map);
+    }
+    CompiledFunction_t* fn = createCompiledFunction(instr, pool, numPool, numLocals, numParameters);
+    free(rewrites);
+    free(pool);
+    free(indices);
+    return fn;
+}
+
+/* Constant pool compaction */
+
+typedef struct ConstantAddress {
+    Object_t* obj;
+    uint32_t index;
+} ConstantAddress_t;
+
+typedef struct ConstantMarker {
+    Object_t** constants;
+    uint32_t count;
+    ConstantAddress_t* byAddress; // constants sorted by address
+    bool* live;
+    uint32_t* pending; // live functions whose pool is not scanned yet
+    uint32_t pendingCnt;
+} ConstantMarker_t;
+
+static void compactMarkIndex(ConstantMarker_t* m, uint32_t index) {
+    if (index >= m->count || m->live[index]) return;
+    m->live[index] = true;
+    if (objectGetType(m->constants[index]) == OBJECT_COMPILED_FUNCTION) {
+        m->pending[m->pendingCnt++] = index;
+    }
+}
+
+static int compareConstantAddresses(const void* a, const void* b) {
+    uintptr_t left = (uintptr_t)((const ConstantAddress_t*)a)->obj;
+    uintptr_t right = (uintptr_t)((const ConstantAddress_t*)b)->obj;
+    return (left > right) - (left < right);
+}
+
+// Marks the given object if it is one of the constants
+static void compactMarkConstant(ConstantMarker_t* m, Object_t* obj) {
+    ConstantAddress_t key = {.obj = obj};
+    ConstantAddress_t* found = bsearch(&key, m->byAddress, m->count, sizeof(ConstantAddress_t), compareConstantAddresses);
+    if (found) {
+        compactMarkIndex(m, found->index);
+    }
+}
+
+static void compactMarkObject(ConstantMarker_t* m, Object_t* obj) {
+    if (!obj) return;
+    switch (objectGetType(obj)) {
+        case OBJECT_COMPILED_FUNCTION: 
+            compactMarkConstant(m, obj);
+            break;
+        case OBJECT_CLOSURE: {
+            Closure_t* closure = (Closure_t*)obj;
+            compactMarkConstant(m, (Object_t*)closure->fn);
+            for (uint32_t i = 0; i < closure->numFree; i++) {
+                compactMarkObject(m, closure->free[i]);
+            }
+            break;
+        }
+        case OBJECT_ARRAY: {
+            Array_t* arr = (Array_t*)obj;
+            if (arrayIsPacked(arr)) break;
+            Object_t** elems = arrayGetElements(arr);
+            for (uint32_t i = 0; i < arrayGetElementCount(arr); i++) {
+                compactMarkObject(m, elems[i]);
+            }
+            break;
+        }
+        case OBJECT_HASH: {
+            HashMap_t* pairs = ((Hash_t*)obj)->pairs;
+            HashMapIter_t iter = createHashMapIter(pairs);
+            for (HashMapEntry_t* e = hashMapIterGetNext(pairs, &iter); e; e = hashMapIterGetNext(pairs, &iter)) {
+                compactMarkObject(m, ((HashPair_t*)e->value)->value);
+            }
+            break;
+        }
+        default: 
+            break;
+    }
+}
+
+uint32_t compilerCompactConstants(VectorObjects_t* constants, Object_t** globals, uint32_t numGlobals) {
+    uint32_t count = vectorObjectsGetCount(constants);
+    Object_t** objs = vectorObjectsGetBuffer(constants);
+    if (count == 0) return 0;
+
+    ConstantMarker_t m = {
+        .constants = objs,
+        .count = count, 
+        .byAddress = mallocChk(count * sizeof(ConstantAddress_t)),
+        .live = callocChk(count * sizeof(bool)),
+        .pending = mallocChk(count * sizeof(uint32_t)),
+        .pendingCnt = 0,
+    };
+    for (uint32_t i = 0; i < count; i++) {
+        m.byAddress[i] = (ConstantAddress_t) {.obj = objs[i], .index = i};
+    }
+    qsort(m.byAddress, count, sizeof(ConstantAddress_t), compareConstantAddresses);
+
+    // functions reachable from globals are live, so is everything in their pools
+    for (uint32_t i = 0; i < numGlobals; i++) {
+        compactMarkObject(&m, globals[i]);
+    }
+    while (m.pendingCnt > 0) {
+        CompiledFunction_t* fn = (CompiledFunction_t*)objs[m.pending[--m.pendingCnt]];
+        for (uint32_t i = 0; i < fn->numConstants; i++) {
+            compactMarkConstant(&m, fn->constants[i]);
+        }
+    }
+
+    // pools hold the objects themselves, dropping the dead ones renumbers nothing else
+    uint32_t numLive = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (m.live[i]) {
+            objs[numLive++] = objs[i];
+        } else {
+            gcClearRef(objs[i], GC_REF_COMPILE_CONSTANT);
+        }
+    }
+    constants->cnt = numLive;
+
+    free(m.byAddress);
+    free(m.pending);
+    free(m.live);
+    return count - numLive;
+}
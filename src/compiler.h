@@ -13,33 +13,54 @@ typedef struct EmittedInstruction {
     uint32_t position; 
 } EmittedInstruction_t; 
 
+// Tracks the last load of a local, used to turn it into a move
+typedef struct LocalUsage {
+    int32_t lastLoad; 
+    bool movable;
+    bool captured;
+    bool inLoop;
+} LocalUsage_t;
+
+DEFINE_VECTOR_TYPE(LocalUsage, LocalUsage_t)
+
 typedef struct CompilationScope {
     Instructions_t instructions;
     EmittedInstruction_t lastInstruction;
     EmittedInstruction_t previousInstruction;
+    VectorLocalUsage_t* localUsages;
+    Vector_t* farOperands; // (position, operand) pairs that need the wide encoding
+    uint32_t loopDepth;
 } CompilationScope_t;
 
 DEFINE_VECTOR_TYPE(CompilationScope, CompilationScope_t)
 
 typedef struct Compiler {
     VectorObjects_t* constants; 
+    HashMap_t* constantIndex; // integer/string key -> constant index + 1 
 
     bool externalStorage; 
     SymbolTable_t* symbolTable;
 
     VectorCompilationScope_t* scopes;
     uint32_t scopeIndex; 
+
+    uint8_t optLevel; // 0 compiles straight from the AST, 1 goes through the IR, 2 also assumes the program is complete
+    uint32_t numMainLocals; // slots of the main program, only used above -O0 
 } Compiler_t;
 
 typedef enum CompError {
     COMP_NO_ERROR = 0,
     COMP_UNKNOWN_OPERATOR,
     COMP_UNDEFINED_VARIABLE,
+    COMP_TOO_MANY_LOCALS,
+    COMP_TOO_MANY_GLOBALS,
+    COMP_NOT_ASSIGNABLE, // builtins, the enclosing function name and captured values
 } CompError_t;
 
 typedef struct Bytecode {
     Instructions_t instructions;
     VectorObjects_t* constants; 
+    uint32_t numLocals; // slots reserved for the main program 
 } Bytecode_t; 
 
 void cleanupBytecode(Bytecode_t* bytecode);
@@ -48,6 +69,7 @@ Compiler_t createCompiler();
 Compiler_t createCompilerWithState(SymbolTable_t* s, VectorObjects_t* constants); 
 void cleanupCompiler(Compiler_t* comp); 
 
+void compilerSetOptLevel(Compiler_t* comp, uint8_t optLevel);
 CompError_t compilerCompile(Compiler_t* comp, Program_t* program); 
 Bytecode_t compilerGetBytecode(Compiler_t* comp);
 
@@ -55,4 +77,57 @@ uint32_t compilerEmit(Compiler_t* comp, OpCode_t op,const int operands[]);
 void compilerEnterScope(Compiler_t* comp);
 Instructions_t compilerLeaveScope(Compiler_t* comp);
 
+// Re-encodes ins with the far operands widened (see codeRewriteOperands) 
+// and moves the targets of its switch tables along. Returns ins itself when
+// there is nothing to widen, ins is freed otherwise. positionMap may be NULL.
+Instructions_t compilerWidenOperands(Compiler_t* comp, Instructions_t ins, Vector_t* farOperands, uint32_t** positionMap);
+
+uint32_t compilerAddConstant(Compiler_t* comp, Object_t* obj); 
+uint32_t compilerAddIntegerConstant(Compiler_t* comp, int64_t value);
+uint32_t compilerAddStringConstant(Compiler_t* comp, const char* value);
+
+// A top level let of a name the input never assigns binds its global to the
+// constant it is set to, if that is a literal or a function capturing
+// nothing. Loads in the main program, and anywhere once the program is
+// known to be complete (-O2), use the constant instead of the global.
+// Returns -1 when the global has to be read. Bindings are dropped once the
+// input is compiled, the REPL renumbers constants and later inputs may
+// assign the global while functions compiled now still run.
+int32_t compilerGlobalConstant(Compiler_t* comp, Symbol_t* symbol, bool inMain);
+
+// if-else chains comparing the same value to this many distinct integer
+// constants or more are compiled to a single OP_SWITCH_TABLE
+#define SWITCH_MIN_CASES 3
+
+typedef struct SwitchCase {
+    int64_t key;
+    uint32_t target;
+} SwitchCase_t;
+
+// Jump tables are packed integer array constants, targets are bytecode offsets:
+// dense:  [default target, SWITCH_TABLE_DENSE, min key, target of min key, target of min key + 1, ...]
+// sparse: [default target, SWITCH_TABLE_SPARSE, key, target, key, target, ...] sorted by key
+typedef enum SwitchTableKind {
+    SWITCH_TABLE_DENSE,
+    SWITCH_TABLE_SPARSE,
+} SwitchTableKind_t;
+
+// Sorts the cases and adds their table, dense when the keys cover at least
+// half of their range. Returns the constant index.
+uint32_t compilerAddSwitchTable(Compiler_t* comp, SwitchCase_t* cases, uint32_t numCases, uint32_t defaultTarget);
+
+// Sets every target of the table to its entry in positionMap
+void compilerMoveSwitchTable(Array_t* table, const uint32_t* positionMap);
+
+// Creates a function owning the constants its instructions refer to. The
+// operands are renumbered from indices into constants to indices into the
+// function's own pool, so they stay narrow no matter how many constants the
+// whole program has. instr is consumed.
+CompiledFunction_t* compilerCreateFunction(VectorObjects_t* constants, Instructions_t instr, uint32_t numLocals, uint32_t numParameters);
+
+// Drops the constants not referenced by any function reachable from the 
+// given globals and moves the remaining ones down in place. Meant to be run 
+// between REPL inputs, returns the number of dropped constants.
+uint32_t compilerCompactConstants(VectorObjects_t* constants, Object_t** globals, uint32_t numGlobals);
+
 #endif
\ No newline at end of file
@@ -10,7 +10,12 @@ Frame_t createFrame(Closure_t *cl, uint32_t basePointer)
     };
 }
 
-Instructions_t frameGetInstructions(Frame_t *frame)
+const CodeWord_t* frameGetCode(Frame_t *frame)
 {
-    return frame->cl->fn->instructions;
+    return frame->cl->fn->code;
+}
+
+Object_t** frameGetConstants(Frame_t *frame)
+{
+    return frame->cl->fn->constants;
 }
@@ -12,5 +12,6 @@ typedef struct Frame {
 
 
 Frame_t createFrame(Closure_t* cl, uint32_t basePointer);
-Instructions_t frameGetInstructions(Frame_t* frame);
+const CodeWord_t* frameGetCode(Frame_t* frame);
+Object_t** frameGetConstants(Frame_t* frame);
 #endif
\ No newline at end of file
@@ -23,10 +23,11 @@ typedef struct GCDataHeader {
 } GCDataHeader_t;
 
 // Mark bits significance 
-// *-----------*-----+-----+-----+
-// | 31-4 SRC  | CRB | GRB | IRB |
-// *-----------*-----+-----+-----+
+// *-----------*-----+-----+-----+-----+
+// | 31-4 SRC  | ORB | CRB | GRB | IRB |
+// *-----------*-----+-----+-----+-----+
 // SRC - stack ref counter
+// ORB - container ref bit (sticky, object stored inside another object)
 // CRB - constant ref bit
 // GRB - global ref bit
 // IRB - internal ref bit
@@ -35,12 +36,16 @@ typedef struct GCDataHeader {
 #define INTERNAL_REF_BIT 0x01 
 #define GLOBAL_REF_BIT 0x02
 #define CONSTANT_REF_BIT 0x04
+#define CONTAINER_REF_BIT 0x08
 
-#define STACK_REF_SHIFT 3u
-#define STACK_REF_MASK 0xFFFFFFF8
+#define STACK_REF_SHIFT 4u
+#define STACK_REF_MASK 0xFFFFFFF0
 
 // Used to check if stack, global, constant  references exist
-#define EXTERNAL_REF_MASK 0xFFFFFFFE
+#define EXTERNAL_REF_MASK 0xFFFFFFF6
+
+// Used to check if any reference other than the stack counter exists 
+#define SHARED_REF_MASK (GLOBAL_REF_BIT | CONSTANT_REF_BIT | CONTAINER_REF_BIT)
 
 /* External definitions */
 extern void gcCleanupObject(Object_t** obj);
@@ -60,6 +65,7 @@ static inline bool isBitSet(GCDataHeader_t* header, uint32_t bitmask);
 static inline void incStackRef(GCDataHeader_t* header);
 static inline void decStackRef(GCDataHeader_t* header);
 static inline bool hasStackRef(GCDataHeader_t* header);
+static inline uint32_t getStackRefCount(GCDataHeader_t* header);
 
 static void gcMark();
 static void gcSweep();
@@ -102,6 +108,9 @@ void gcSetRef(void* ptr, GCRefType_t refType) {
         case GC_REF_STACK:
             incStackRef(header); 
             break; 
+        case GC_REF_CONTAINER:
+            setBit(header, CONTAINER_REF_BIT);
+            break;
     }
 }
 
@@ -121,6 +130,9 @@ void gcClearRef(void* ptr, GCRefType_t refType) {
         case GC_REF_STACK:
             decStackRef(header); 
             break; 
+        case GC_REF_CONTAINER:
+            clearBit(header, CONTAINER_REF_BIT);
+            break;
     }
 }
 
@@ -137,10 +149,18 @@ bool gcHasRef(void* ptr, GCRefType_t refType) {
             return isBitSet(header, CONSTANT_REF_BIT);
         case GC_REF_STACK:
             return hasStackRef(header); 
+        case GC_REF_CONTAINER:
+            return isBitSet(header, CONTAINER_REF_BIT);
     }
     return false;
 }
 
+bool gcIsUniquelyOwned(void* ptr) {
+    if (!ptr) return false;
+    GCDataHeader_t* header = getHeader(ptr);
+    return !isBitSet(header, SHARED_REF_MASK) && getStackRefCount(header) == 1;
+}
+
 
 void gcForceRun() {
     // perform mark & sweep round
@@ -253,3 +273,7 @@ static inline bool hasStackRef(GCDataHeader_t* header) {
     return (header->mark >> STACK_REF_SHIFT) != 0; 
 }
 
+static inline uint32_t getStackRefCount(GCDataHeader_t* header) {
+    return header->mark >> STACK_REF_SHIFT;
+}
+
@@ -9,6 +9,7 @@ typedef enum GCRefType{
     GC_REF_COMPILE_CONSTANT, 
     GC_REF_GLOBAL, 
     GC_REF_STACK,
+    GC_REF_CONTAINER,
 } GCRefType_t;
 
 void* gcMalloc(size_t size);
@@ -17,6 +18,7 @@ void gcFree(void* ptr);
 void gcSetRef(void* ptr, GCRefType_t refType);
 void gcClearRef(void* ptr, GCRefType_t refType);
 bool gcHasRef(void* ptr, GCRefType_t refType);
+bool gcIsUniquelyOwned(void* ptr);
 
 void gcForceRun();
 #endif
\ No newline at end of file
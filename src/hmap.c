@@ -7,10 +7,13 @@
 // Number of buckets allocated at has map creation.
 #define DEFAULT_NUM_BUCKETS 4 
 
-static HashMapEntry_t* createHashMapEntry(const char* key, void* value); 
+static HashMapEntry_t* createHashMapEntry(const char* key, uint64_t hash, bool borrowKey, void* value); 
+static void hashMapEntrySetKey(HashMapEntry_t* entry, const char* key, bool borrowKey); 
+static void* hashMapInsertEntry(HashMap_t* map, const char* key, uint64_t hash, bool borrowKey, void* value); 
+static bool hashMapKeyEquals(HashMapEntry_t* entry, const char* key, uint64_t hash); 
 static void cleanupHashMapEntry(HashMapEntry_t** entry, HashMapElemCleanupFn_t clenaupFn); 
 static uint64_t computeHash(const char* key); 
-static uint32_t getBucketIndex(HashMap_t* map, const char* key); 
+static uint32_t getBucketIndex(HashMap_t* map, uint64_t hash); 
 static void hashMapReinsertEntry(HashMap_t* map, HashMapEntry_t* entry); 
 static void hashMapResize(HashMap_t* map);  
 static uint32_t getResizeTriggerLimit(HashMap_t* map); 
@@ -37,7 +40,7 @@ HashMap_t* copyHashMap(const HashMap_t* map, HashMapElemCopyFn_t copyFn) {
     HashMapIter_t iter = createHashMapIter(map);
     HashMapEntry_t* entry = hashMapIterGetNext(map, &iter);
     while (entry)  {
-        hashMapInsert(newMap, entry->key, copyFn(entry->value));
+        hashMapInsertHashed(newMap, entry->key, entry->hash, copyFn(entry->value));
         entry = hashMapIterGetNext(map, &iter);
     }
     return newMap;
@@ -104,23 +107,77 @@ HashMapEntry_t* hashMapIterGetNext(const HashMap_t* map, HashMapIter_t* iter) {
 
 
 void* hashMapInsert(HashMap_t* map, const char* key, void* value) {  
-    uint32_t index = getBucketIndex(map, key);
+    return hashMapInsertHashed(map, key, computeHash(key), value);
+}
+
+void* hashMapGet(HashMap_t* map, const char* key) {
+    return hashMapGetHashed(map, key, computeHash(key));
+}
+
+uint64_t hashMapHashKey(const char* key) {
+    return computeHash(key);
+}
+
+void* hashMapInsertHashed(HashMap_t* map, const char* key, uint64_t hash, void* value) {  
+    return hashMapInsertEntry(map, key, hash, false, value);
+}
+
+void* hashMapInsertBorrowed(HashMap_t* map, const char* key, uint64_t hash, void* value) {  
+    return hashMapInsertEntry(map, key, hash, true, value);
+}
+
+void* hashMapGetHashed(HashMap_t* map, const char* key, uint64_t hash) {
+    uint32_t index = getBucketIndex(map, hash);
+    HashMapEntry_t* cur = map->buckets[index];
+
+    while (cur) {
+        if (hashMapKeyEquals(cur, key, hash))
+            return cur->value;
+        cur = cur->next;
+    }
+
+    return NULL;
+}
+
+void* hashMapRemoveHashed(HashMap_t* map, const char* key, uint64_t hash) {
+    uint32_t index = getBucketIndex(map, hash);
+    HashMapEntry_t** link = &map->buckets[index];
+
+    while (*link) {
+        HashMapEntry_t* cur = *link;
+        if (hashMapKeyEquals(cur, key, hash)) {
+            void* value = cur->value;
+            *link = cur->next;
+            cleanupHashMapEntry(&cur, NULL);
+            map->itemCnt--;
+            return value;
+        }
+        link = &cur->next;
+    }
+
+    return NULL;
+}
+
+static void* hashMapInsertEntry(HashMap_t* map, const char* key, uint64_t hash, bool borrowKey, void* value) {  
+    uint32_t index = getBucketIndex(map, hash);
     void* ret = NULL; // holds previous value in case of key collision.
     if (!map->buckets[index]){
-        map->buckets[index] = createHashMapEntry(key, value);
+        map->buckets[index] = createHashMapEntry(key, hash, borrowKey, value);
         map->itemCnt++;
     } else {
         HashMapEntry_t* cur = map->buckets[index];
         bool found = false;
-        while (!(found = (strcmp(cur->key, key) == 0)) && cur->next) {
+        while (!(found = hashMapKeyEquals(cur, key, hash)) && cur->next) {
             cur = cur->next;
         }
         if (!found) {
-            cur->next = createHashMapEntry(key, value);
+            cur->next = createHashMapEntry(key, hash, borrowKey, value);
             map->itemCnt++;
         } else {
+            // key belongs to the new value, a borrowed key may not outlive it
             ret = cur->value;
             cur->value = value;
+            hashMapEntrySetKey(cur, key, borrowKey);
         }
     }
 
@@ -128,17 +185,8 @@ void* hashMapInsert(HashMap_t* map, const char* key, void* value) {
     return ret;
 }
 
-void* hashMapGet(HashMap_t* map, const char* key) {
-    uint32_t index = getBucketIndex(map, key);
-    HashMapEntry_t* cur = map->buckets[index];
-
-    while (cur) {
-        if (strcmp(cur->key, key) == 0)
-            return cur->value;
-        cur = cur->next;
-    }
-
-    return NULL;
+static bool hashMapKeyEquals(HashMapEntry_t* entry, const char* key, uint64_t hash) {
+    return entry->key == key || (entry->hash == hash && strcmp(entry->key, key) == 0);
 }
 
 static void hashMapResize(HashMap_t* map)  {
@@ -167,7 +215,7 @@ static void hashMapResize(HashMap_t* map)  {
 }
 
 static void hashMapReinsertEntry(HashMap_t* map, HashMapEntry_t* entry) {
-    uint32_t index = getBucketIndex(map, entry->key);
+    uint32_t index = getBucketIndex(map, entry->hash);
     
     if (!map->buckets[index]){
         map->buckets[index] = entry;
@@ -185,8 +233,7 @@ static uint32_t getResizeTriggerLimit(HashMap_t* map) {
     return ((3 * map->numBuckets) / 4); 
 }
 
-static uint32_t getBucketIndex(HashMap_t* map, const char* key) {
-    uint64_t hash = computeHash(key);
+static uint32_t getBucketIndex(HashMap_t* map, uint64_t hash) {
     return (uint32_t)(hash & (uint64_t)(map->numBuckets - 1)); 
 }
 
@@ -204,25 +251,41 @@ static uint64_t computeHash(const char* key) {
     return hash;
 }
 
-static HashMapEntry_t* createHashMapEntry(const char* key, void* value) {
+static HashMapEntry_t* createHashMapEntry(const char* key, uint64_t hash, bool borrowKey, void* value) {
     HashMapEntry_t* entry = (HashMapEntry_t*)malloc(sizeof(HashMapEntry_t));
     if (!entry) HANDLE_OOM();
      
     *entry = (HashMapEntry_t) {
-        .key = cloneString(key),
+        .key = NULL,
         .value = value,
+        .hash = hash,
+        .borrowedKey = false,
         .next = NULL
     };
+    hashMapEntrySetKey(entry, key, borrowKey);
 
     return entry;
 }
 
+static void hashMapEntrySetKey(HashMapEntry_t* entry, const char* key, bool borrowKey) {
+    // an owned copy of an equal key can be kept 
+    if (entry->key && !entry->borrowedKey && !borrowKey) return;
+
+    char* newKey = borrowKey ? (char*)key : cloneString(key);
+    if (!entry->borrowedKey) {
+        free(entry->key);
+    }
+    entry->key = newKey;
+    entry->borrowedKey = borrowKey;
+}
+
 
 static void cleanupHashMapEntry(HashMapEntry_t** entry, HashMapElemCleanupFn_t cleanupFn) {
     if (!(*entry))
         return;
         
-    free((*entry)->key);
+    if (!(*entry)->borrowedKey)
+        free((*entry)->key);
     if (cleanupFn)
         cleanupFn(&(*entry)->value);
     
@@ -3,10 +3,13 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef struct HashMapEntry {
-    char* key; // local ownership 
+    char* key; // local ownership unless borrowed 
     void* value; // local ownership 
+    uint64_t hash;
+    bool borrowedKey;
     struct HashMapEntry* next; 
 } HashMapEntry_t;
 
@@ -35,4 +38,14 @@ HashMapEntry_t* hashMapIterGetNext(const HashMap_t* map, HashMapIter_t* iter);
 void* hashMapInsert(HashMap_t* map, const char* key , void* value);
 void* hashMapGet(HashMap_t* map, const char* key);
 
+// Variants taking a precomputed hashMapHashKey(key), for callers caching it 
+uint64_t hashMapHashKey(const char* key);
+void* hashMapInsertHashed(HashMap_t* map, const char* key, uint64_t hash, void* value);
+void* hashMapGetHashed(HashMap_t* map, const char* key, uint64_t hash);
+void* hashMapRemoveHashed(HashMap_t* map, const char* key, uint64_t hash);
+
+// Key is referenced instead of copied and must outlive the entry. Lookups 
+// with the very same key pointer skip the string comparison.
+void* hashMapInsertBorrowed(HashMap_t* map, const char* key, uint64_t hash, void* value);
+
 #endif 
\ No newline at end of file
@@ -0,0 +1,2630 @@
+#include <assert.h>
+#include <string.h>
+#include "ir.h"
+#include "hmap.h"
+#include "sbuf.h"
+#include "utils.h"
+#include "gc.h"
+
+IMPL_VECTOR_TYPE(IrValues, IrValue_t*);
+IMPL_VECTOR_TYPE(IrBlocks, IrBlock_t*);
+IMPL_VECTOR_TYPE(IrFunctions, IrFunction_t*);
+
+typedef struct IrOpInfo {
+    const char* name;
+    OpCode_t opcode;
+    bool remat;     // pure and can't fail, emitted again at every use
+    bool removable; // no side effect and can't fail, dropped when unused
+    bool cse;       // equal operands give an equivalent result
+    bool hasValue;
+} IrOpInfo_t;
+
+static const IrOpInfo_t irOpInfos[_IR_OP_COUNT] = {
+    [IR_CONST]           = {"const",      OP_CONSTANT,         true,  true,  true,  true},
+    [IR_TRUE]            = {"true",       OP_TRUE,             true,  true,  true,  true},
+    [IR_FALSE]           = {"false",      OP_FALSE,            true,  true,  true,  true},
+    [IR_NULL]            = {"null",       OP_NULL,             true,  true,  true,  true},
+    [IR_PARAM]           = {"param",      OP_GET_LOCAL,        true,  true,  true,  true},
+    [IR_GET_FREE]        = {"getfree",    OP_GET_FREE,         true,  true,  true,  true},
+    [IR_GET_BUILTIN]     = {"builtin",    OP_GET_BUILTIN,      true,  true,  true,  true},
+    [IR_CURRENT_CLOSURE] = {"curclosure", OP_CURRENT_CLOSURE,  true,  true,  true,  true},
+    [IR_GET_GLOBAL]      = {"getglobal",  OP_GET_GLOBAL,       false, true,  false, true},
+    [IR_SET_GLOBAL]      = {"setglobal",  OP_SET_GLOBAL,       false, false, false, false},
+    [IR_ADD]             = {"add",        OP_ADD,              false, false, true,  true},
+    [IR_SUB]             = {"sub",        OP_SUB,              false, false, true,  true},
+    [IR_MUL]             = {"mul",        OP_MUL,              false, false, true,  true},
+    [IR_DIV]             = {"div",        OP_DIV,              false, false, true,  true},
+    [IR_EQUAL]           = {"eq",         OP_EQUAL,            false, false, true,  true},
+    [IR_NOT_EQUAL]       = {"neq",        OP_NOT_EQUAL,        false, false, true,  true},
+    [IR_GREATER_THAN]    = {"gt",         OP_GREATER_THAN,     false, false, true,  true},
+    [IR_MINUS]           = {"minus",      OP_MINUS,            false, false, true,  true},
+    [IR_BANG]            = {"bang",       OP_BANG,             false, true,  true,  true},
+    [IR_ARRAY]           = {"array",      OP_ARRAY,            false, true,  false, true},
+    [IR_HASH]            = {"hash",       OP_HASH,             false, false, false, true},
+    [IR_INDEX]           = {"index",      OP_INDEX,            false, false, true,  true},
+    [IR_CALL]            = {"call",       OP_CALL,             false, false, false, true},
+    [IR_CLOSURE]         = {"closure",    OP_CLOSURE,          false, true,  false, true},
+    [IR_PHI]             = {"phi",        OP_POP,              false, true,  false, true},
+    [IR_POP]             = {"pop",        OP_POP,              false, false, false, false},
+    [IR_JUMP]            = {"jump",       OP_JUMP,             false, false, false, false},
+    [IR_BRANCH]          = {"branch",     OP_JUMP_NOT_TRUTHY,  false, false, false, false},
+    [IR_RETURN]          = {"return",     OP_RETURN_VALUE,     false, false, false, false},
+    [IR_RETURN_NONE]     = {"return",     OP_RETURN,           false, false, false, false},
+    [IR_END]             = {"end",        OP_POP,              false, false, false, false},
+};
+
+static void irFree(void** ptr) {
+    free(*ptr);
+}
+
+static bool irIsTerminator(IrOp_t op) {
+    return op >= IR_JUMP;
+}
+
+/* Construction */
+
+IrFunction_t* createIrFunction(uint32_t numParams, bool isMain) {
+    IrFunction_t* fn = mallocChk(sizeof(IrFunction_t));
+    *fn = (IrFunction_t) {
+        .blocks = createVectorIrBlocks(),
+        .allBlocks = createVectorIrBlocks(),
+        .values = createVectorIrValues(),
+        .numParams = numParams,
+        .isMain = isMain,
+        .constIndex = -1,
+        .paramTypes = callocChk(numParams + 1),
+    };
+    return fn;
+}
+
+static void cleanupIrValue(IrValue_t** value) {
+    cleanupVectorIrValues(&(*value)->args, NULL);
+    free(*value);
+    *value = NULL;
+}
+
+static void cleanupIrBlock(IrBlock_t** block) {
+    cleanupVectorIrValues(&(*block)->values, NULL);
+    cleanupVectorIrBlocks(&(*block)->preds, NULL);
+    free(*block);
+    *block = NULL;
+}
+
+void cleanupIrFunction(IrFunction_t** fn) {
+    if (!*fn) return;
+
+    cleanupVectorIrValues(&(*fn)->values, cleanupIrValue);
+    cleanupVectorIrBlocks(&(*fn)->allBlocks, cleanupIrBlock);
+    cleanupVectorIrBlocks(&(*fn)->blocks, NULL);
+    free((*fn)->paramTypes);
+    free(*fn);
+    *fn = NULL;
+}
+
+static IrValue_t* createIrValue(IrFunction_t* fn, IrOp_t op, int32_t imm) {
+    IrValue_t* value = callocChk(sizeof(IrValue_t));
+    value->op = op;
+    value->imm = imm;
+    value->id = vectorIrValuesGetCount(fn->values);
+    value->args = createVectorIrValues();
+    value->slot = -1;
+    vectorIrValuesAppend(fn->values, value);
+    return value;
+}
+
+static IrBlock_t* createIrBlock(IrFunction_t* fn) {
+    IrBlock_t* block = callocChk(sizeof(IrBlock_t));
+    block->id = vectorIrBlocksGetCount(fn->allBlocks);
+    block->values = createVectorIrValues();
+    block->preds = createVectorIrBlocks();
+    vectorIrBlocksAppend(fn->allBlocks, block);
+    return block;
+}
+
+static void irAddArg(IrValue_t* value, IrValue_t* arg) {
+    vectorIrValuesAppend(value->args, arg);
+}
+
+static IrValue_t* irBlockTerminator(IrBlock_t* block) {
+    uint32_t cnt = vectorIrValuesGetCount(block->values);
+    if (cnt == 0) return NULL;
+    IrValue_t* last = block->values->buf[cnt - 1];
+    return irIsTerminator(last->op) ? last : NULL;
+}
+
+static uint32_t irNumSuccessors(IrValue_t* term) {
+    if (!term) return 0;
+    if (term->op == IR_JUMP) return 1;
+    if (term->op == IR_BRANCH) return 2;
+    return 0;
+}
+
+static int32_t irPredIndex(IrBlock_t* block, IrBlock_t* pred) {
+    for (uint32_t i = 0; i < vectorIrBlocksGetCount(block->preds); i++) {
+        if (block->preds->buf[i] == pred) return i;
+    }
+    return -1;
+}
+
+static IrValue_t* irResolve(IrValue_t* value) {
+    while (value->replacement) {
+        value = value->replacement;
+    }
+    return value;
+}
+
+static void irReplace(IrValue_t* value, IrValue_t* with) {
+    value->replacement = with;
+    value->removed = true;
+}
+
+// Drops the pred edge along with the matching phi arguments
+static void irRemovePred(IrBlock_t* block, IrBlock_t* pred) {
+    int32_t idx = irPredIndex(block, pred);
+    if (idx < 0) return;
+
+    uint32_t cnt = vectorIrBlocksGetCount(block->preds);
+    memmove(&block->preds->buf[idx], &block->preds->buf[idx + 1], (cnt - idx - 1) * sizeof(IrBlock_t*));
+    block->preds->cnt--;
+
+    for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+        IrValue_t* phi = block->values->buf[i];
+        if (phi->op != IR_PHI) break;
+        memmove(&phi->args->buf[idx], &phi->args->buf[idx + 1], (cnt - idx - 1) * sizeof(IrValue_t*));
+        phi->args->cnt--;
+    }
+}
+
+// Removes dropped values from the blocks and points all arguments to
+// their replacements
+static void irCompact(IrFunction_t* fn) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        uint32_t cnt = 0;
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->removed) continue;
+            for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+                value->args->buf[a] = irResolve(value->args->buf[a]);
+            }
+            block->values->buf[cnt++] = value;
+        }
+        block->values->cnt = cnt;
+    }
+}
+
+/* Printing */
+
+char* irFunctionToString(IrFunction_t* fn) {
+    Strbuf_t* sbuf = createStrbuf();
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        strbufConsume(sbuf, strFormat("b%u:", block->id));
+        for (uint32_t p = 0; p < vectorIrBlocksGetCount(block->preds); p++) {
+            strbufConsume(sbuf, strFormat(" b%u", block->preds->buf[p]->id));
+        }
+        strbufWrite(sbuf, "\n");
+
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->removed) continue;
+
+            strbufWrite(sbuf, "\t");
+            if (irOpInfos[value->op].hasValue) {
+                strbufConsume(sbuf, strFormat("v%u = ", value->id));
+            }
+            strbufWrite(sbuf, irOpInfos[value->op].name);
+            switch (value->op) {
+                case IR_CONST: case IR_PARAM: case IR_GET_FREE: case IR_GET_BUILTIN:
+                case IR_GET_GLOBAL: case IR_SET_GLOBAL: case IR_CLOSURE:
+                    strbufConsume(sbuf, strFormat(" %d", value->imm));
+                    break;
+                default:
+                    break;
+            }
+            for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+                strbufConsume(sbuf, strFormat(" v%u", irResolve(value->args->buf[a])->id));
+            }
+            for (uint32_t t = 0; t < irNumSuccessors(value); t++) {
+                strbufConsume(sbuf, strFormat(" b%u", value->targets[t]->id));
+            }
+            strbufWrite(sbuf, "\n");
+        }
+    }
+    return detachStrbuf(&sbuf);
+}
+
+/* Building */
+
+// Calls to small function literals bound to a global are built in place
+#define IR_INLINE_MAX_COST 32
+#define IR_INLINE_MAX_DEPTH 3
+
+typedef struct IrInlineCandidate {
+    FunctionLiteral_t* func;
+    SymbolTable_t* globals;
+    uint32_t numGlobals; // globals defined when the literal was bound
+} IrInlineCandidate_t;
+
+typedef struct IrBuilder {
+    Compiler_t* comp;
+    IrFunction_t* fn;
+    IrBlock_t* current; // NULL after a return
+    VectorIrValues_t* locals; // local symbol index -> current value
+    CompError_t err;
+
+    HashMap_t* inlineCandidates; // global index -> IrInlineCandidate_t, shared with nested builders
+    HashMap_t* assignedNames; // names reassigned anywhere in the program, never inlined
+    Statement_t* topLevel; // statement of the main program being built
+    uint32_t inlineDepth;
+
+    VectorIrFunctions_t* functions; // built literals, lowered once the whole program is typed
+} IrBuilder_t;
+
+static void irBuildStatement(IrBuilder_t* b, Statement_t* statement);
+static void irBuildWhileStatement(IrBuilder_t* b, WhileStatement_t* loop);
+static IrValue_t* irBuildExpression(IrBuilder_t* b, Expression_t* expression);
+static void irAddInlineCandidate(IrBuilder_t* b, Symbol_t* symbol, FunctionLiteral_t* func);
+static FunctionLiteral_t* irFindInlineCandidate(IrBuilder_t* b, CallExpression_t* call);
+static IrValue_t* irBuildInlinedCall(IrBuilder_t* b, FunctionLiteral_t* func, CallExpression_t* call);
+
+static IrBuilder_t createIrBuilder(Compiler_t* comp, IrFunction_t* fn) {
+    IrBuilder_t b = {
+        .comp = comp,
+        .fn = fn,
+        .locals = createVectorIrValues(),
+        .err = COMP_NO_ERROR,
+    };
+    b.current = createIrBlock(fn);
+    vectorIrBlocksAppend(fn->blocks, b.current);
+    return b;
+}
+
+static void cleanupIrBuilder(IrBuilder_t* b) {
+    cleanupVectorIrValues(&b->locals, NULL);
+}
+
+static void irStartBlock(IrBuilder_t* b, IrBlock_t* block) {
+    vectorIrBlocksAppend(b->fn->blocks, block);
+    b->current = block;
+}
+
+static IrValue_t* irEmit(IrBuilder_t* b, IrOp_t op, int32_t imm) {
+    // code following a return is collected in a block nothing jumps to
+    if (!b->current) {
+        irStartBlock(b, createIrBlock(b->fn));
+    }
+
+    IrValue_t* value = createIrValue(b->fn, op, imm);
+    value->block = b->current;
+    vectorIrValuesAppend(b->current->values, value);
+    return value;
+}
+
+static void irTerminate(IrBuilder_t* b, IrOp_t op, IrValue_t* arg, IrBlock_t* target, IrBlock_t* otherTarget) {
+    IrValue_t* term = irEmit(b, op, 0);
+    if (arg) irAddArg(term, arg);
+
+    term->targets[0] = target;
+    term->targets[1] = otherTarget;
+    if (target) vectorIrBlocksAppend(target->preds, b->current);
+    if (otherTarget) vectorIrBlocksAppend(otherTarget->preds, b->current);
+
+    b->current = NULL;
+}
+
+// Places a leaf value right before the terminator of an already finished block
+static IrValue_t* irEmitBeforeTerminator(IrFunction_t* fn, IrBlock_t* block, IrOp_t op) {
+    IrValue_t* value = createIrValue(fn, op, 0);
+    value->block = block;
+
+    uint32_t cnt = vectorIrValuesGetCount(block->values);
+    vectorIrValuesAppend(block->values, value);
+    block->values->buf[cnt] = block->values->buf[cnt - 1];
+    block->values->buf[cnt - 1] = value;
+    return value;
+}
+
+static IrValue_t* irCreatePhi(IrFunction_t* fn, IrBlock_t* block) {
+    IrValue_t* phi = createIrValue(fn, IR_PHI, 0);
+    phi->block = block;
+    vectorIrValuesAppend(block->values, phi);
+    return phi;
+}
+
+static IrValue_t* irGetLocal(IrBuilder_t* b, uint32_t index) {
+    if (index >= vectorIrValuesGetCount(b->locals) || !b->locals->buf[index]) {
+        return irEmit(b, IR_NULL, 0);
+    }
+    return b->locals->buf[index];
+}
+
+static void irSetLocal(VectorIrValues_t* locals, uint32_t index, IrValue_t* value) {
+    while (vectorIrValuesGetCount(locals) <= index) {
+        vectorIrValuesAppend(locals, NULL);
+    }
+    locals->buf[index] = value;
+}
+
+static IrValue_t* irLoadSymbol(IrBuilder_t* b, Symbol_t* sym) {
+    switch (sym->scope) {
+        case SCOPE_LOCAL:
+            return irGetLocal(b, sym->index);
+        case SCOPE_GLOBAL: {
+            int32_t constant = compilerGlobalConstant(b->comp, sym, b->fn->isMain);
+            if (constant < 0) {
+                return irEmit(b, IR_GET_GLOBAL, sym->index);
+            }
+            Object_t* obj = vectorObjectsGetBuffer(b->comp->constants)[constant];
+            return irEmit(b, objectGetType(obj) == OBJECT_COMPILED_FUNCTION ? IR_CLOSURE : IR_CONST, constant);
+        }
+        case SCOPE_BUILTIN:
+            return irEmit(b, IR_GET_BUILTIN, sym->index);
+        case SCOPE_FREE:
+            return irEmit(b, IR_GET_FREE, sym->index);
+        case SCOPE_FUNCTION:
+            return irEmit(b, IR_CURRENT_CLOSURE, 0);
+        default:
+            assert(0 && "Unreachable: Unhandled symbol scope");
+            return NULL;
+    }
+}
+
+// Value of a block used as if branch, the last expression statement or null
+static IrValue_t* irBuildBlockValue(IrBuilder_t* b, BlockStatement_t* block) {
+    Statement_t** stmts = blockStatementGetStatements(block);
+    uint32_t stmtCnt = blockStatementGetStatementCount(block);
+
+    for (uint32_t i = 0; i + 1 < stmtCnt; i++) {
+        irBuildStatement(b, stmts[i]);
+        if (b->err != COMP_NO_ERROR) return NULL;
+    }
+
+    if (stmtCnt > 0) {
+        Statement_t* last = stmts[stmtCnt - 1];
+        if (last->type == STATEMENT_EXPRESSION) {
+            return irBuildExpression(b, ((ExpressionStatement_t*)last)->expression);
+        }
+
+        irBuildStatement(b, last);
+        if (b->err != COMP_NO_ERROR) return NULL;
+    }
+
+    return irEmit(b, IR_NULL, 0);
+}
+
+static void irBuildStatement(IrBuilder_t* b, Statement_t* statement) {
+    switch (statement->type) {
+        case STATEMENT_EXPRESSION: {
+            IrValue_t* value = irBuildExpression(b, ((ExpressionStatement_t*)statement)->expression);
+            // the main program keeps the value of expression statements for the REPL
+            if (value && b->fn->isMain && b->inlineDepth == 0) {
+                irAddArg(irEmit(b, IR_POP, 0), value);
+            }
+            break;
+        }
+        case STATEMENT_BLOCK: {
+            BlockStatement_t* block = (BlockStatement_t*)statement;
+            Statement_t** stmts = blockStatementGetStatements(block);
+            for (uint32_t i = 0; i < blockStatementGetStatementCount(block) && b->err == COMP_NO_ERROR; i++) {
+                irBuildStatement(b, stmts[i]);
+            }
+            break;
+        }
+        case STATEMENT_LET: {
+            LetStatement_t* let = (LetStatement_t*)statement;
+            Symbol_t* symbol = symbolTableDefine(b->comp->symbolTable, let->name->value);
+            if (symbol->scope == SCOPE_GLOBAL && symbol->index > UINT16_MAX) {
+                b->err = COMP_TOO_MANY_GLOBALS;
+                break;
+            }
+            IrValue_t* value = irBuildExpression(b, let->value);
+            if (!value) break;
+
+            if (symbol->scope == SCOPE_GLOBAL) {
+                irAddArg(irEmit(b, IR_SET_GLOBAL, symbol->index), value);
+                if (let->value->type == EXPRESSION_FUNCTION_LITERAL) {
+                    irAddInlineCandidate(b, symbol, (FunctionLiteral_t*)let->value);
+                }
+                // see compilerGlobalConstant
+                bool constant = value->op == IR_CONST || (value->op == IR_CLOSURE && vectorIrValuesGetCount(value->args) == 0);
+                if (statement == b->topLevel && constant && !hashMapGet(b->assignedNames, let->name->value)) {
+                    symbol->constant = value->imm;
+                }
+            } else {
+                irSetLocal(b->locals, symbol->index, value);
+            }
+            break;
+        }
+        case STATEMENT_RETURN: {
+            IrValue_t* value = irBuildExpression(b, ((ReturnStatement_t*)statement)->returnValue);
+            if (value) {
+                irTerminate(b, IR_RETURN, value, NULL, NULL);
+            }
+            break;
+        }
+        case STATEMENT_ASSIGN: {
+            AssignStatement_t* assign = (AssignStatement_t*)statement;
+            Symbol_t* symbol = symbolTableResolve(b->comp->symbolTable, assign->name->value);
+            if (!symbol) {
+                b->err = COMP_UNDEFINED_VARIABLE;
+                break;
+            }
+            if (symbol->scope != SCOPE_GLOBAL && symbol->scope != SCOPE_LOCAL) {
+                b->err = COMP_NOT_ASSIGNABLE;
+                break;
+            }
+
+            IrValue_t* value = irBuildExpression(b, assign->value);
+            if (!value) break;
+
+            if (symbol->scope == SCOPE_GLOBAL) {
+                irAddArg(irEmit(b, IR_SET_GLOBAL, symbol->index), value);
+            } else {
+                irSetLocal(b->locals, symbol->index, value);
+            }
+            break;
+        }
+        case STATEMENT_WHILE:
+            irBuildWhileStatement(b, (WhileStatement_t*)statement);
+            // like at -O0 a loop leaves null for the REPL, not its condition
+            if (b->err == COMP_NO_ERROR && b->fn->isMain && b->inlineDepth == 0) {
+                irAddArg(irEmit(b, IR_POP, 0), irEmit(b, IR_NULL, 0));
+            }
+            break;
+        default:
+            assert(0 && "Unreachable: Unhandled statement type");
+    }
+}
+
+static IrValue_t* irBuildIfExpression(IrBuilder_t* b, IfExpression_t* expression) {
+    IrValue_t* cond = irBuildExpression(b, expression->condition);
+    if (!cond) return NULL;
+
+    IrBlock_t* thenBlock = createIrBlock(b->fn);
+    IrBlock_t* elseBlock = createIrBlock(b->fn);
+    IrBlock_t* joinBlock = createIrBlock(b->fn);
+    irTerminate(b, IR_BRANCH, cond, thenBlock, elseBlock);
+
+    VectorIrValues_t* elseLocals = copyVectorIrValues(b->locals, NULL);
+
+    irStartBlock(b, thenBlock);
+    // a block value is always emitted last, so the branches end in a live block
+    IrValue_t* thenValue = irBuildBlockValue(b, expression->consequence);
+    IrBlock_t* thenEnd = b->current;
+    VectorIrValues_t* thenLocals = b->locals;
+    if (thenValue) {
+        irTerminate(b, IR_JUMP, NULL, joinBlock, NULL);
+    }
+
+    b->locals = elseLocals;
+    IrValue_t* elseValue = NULL;
+    IrBlock_t* elseEnd = NULL;
+    if (thenValue) {
+        irStartBlock(b, elseBlock);
+        elseValue = expression->alternative ? irBuildBlockValue(b, expression->alternative) : irEmit(b, IR_NULL, 0);
+        elseEnd = b->current;
+        // a nested if replaces the locals vector
+        elseLocals = b->locals;
+        if (elseValue) {
+            irTerminate(b, IR_JUMP, NULL, joinBlock, NULL);
+        }
+    }
+
+    b->locals = createVectorIrValues();
+    if (!elseValue) {
+        cleanupVectorIrValues(&thenLocals, NULL);
+        cleanupVectorIrValues(&elseLocals, NULL);
+        return NULL;
+    }
+
+    // the if value and the locals differing between the branches meet in phis
+    irStartBlock(b, joinBlock);
+    IrValue_t* result = irCreatePhi(b->fn, joinBlock);
+    irAddArg(result, thenValue);
+    irAddArg(result, elseValue);
+
+    uint32_t numThen = vectorIrValuesGetCount(thenLocals);
+    uint32_t numElse = vectorIrValuesGetCount(elseLocals);
+    uint32_t numLocals = numThen > numElse ? numThen : numElse;
+    for (uint32_t i = 0; i < numLocals; i++) {
+        IrValue_t* thenLocal = i < numThen ? thenLocals->buf[i] : NULL;
+        IrValue_t* elseLocal = i < numElse ? elseLocals->buf[i] : NULL;
+        if (thenLocal == elseLocal) {
+            irSetLocal(b->locals, i, thenLocal);
+            continue;
+        }
+
+        IrValue_t* phi = irCreatePhi(b->fn, joinBlock);
+        irAddArg(phi, thenLocal ? thenLocal : irEmitBeforeTerminator(b->fn, thenEnd, IR_NULL));
+        irAddArg(phi, elseLocal ? elseLocal : irEmitBeforeTerminator(b->fn, elseEnd, IR_NULL));
+        irSetLocal(b->locals, i, phi);
+    }
+
+    cleanupVectorIrValues(&thenLocals, NULL);
+    cleanupVectorIrValues(&elseLocals, NULL);
+    return result;
+}
+
+/* Loops */
+
+typedef struct IrAstScan {
+    uint32_t numLets; // outside of function literals
+    uint32_t functionDepth;
+    HashMap_t* assigned; // assignment targets, function literals are only entered when set
+} IrAstScan_t;
+
+static void irScanStatement(IrAstScan_t* scan, Statement_t* statement);
+
+static void irScanExpression(IrAstScan_t* scan, Expression_t* expression) {
+    if (!expression) return;
+
+    switch (expression->type) {
+        case EXPRESSION_PREFIX_EXPRESSION:
+            irScanExpression(scan, ((PrefixExpression_t*)expression)->right);
+            break;
+        case EXPRESSION_INFIX_EXPRESSION:
+            irScanExpression(scan, ((InfixExpression_t*)expression)->left);
+            irScanExpression(scan, ((InfixExpression_t*)expression)->right);
+            break;
+        case EXPRESSION_IF_EXPRESSION: {
+            IfExpression_t* ifExpr = (IfExpression_t*)expression;
+            irScanExpression(scan, ifExpr->condition);
+            irScanStatement(scan, (Statement_t*)ifExpr->consequence);
+            irScanStatement(scan, (Statement_t*)ifExpr->alternative);
+            break;
+        }
+        case EXPRESSION_ARRAY_LITERAL: {
+            ArrayLiteral_t* arrayLit = (ArrayLiteral_t*)expression;
+            for (uint32_t i = 0; i < arrayLiteralGetElementCount(arrayLit); i++) {
+                irScanExpression(scan, arrayLiteralGetElements(arrayLit)[i]);
+            }
+            break;
+        }
+        case EXPRESSION_HASH_LITERAL: {
+            HashLiteral_t* hashLit = (HashLiteral_t*)expression;
+            for (uint32_t i = 0; i < hashLiteralGetPairsCount(hashLit); i++) {
+                Expression_t *key, *value;
+                hashLiteralGetPair(hashLit, i, &key, &value);
+                irScanExpression(scan, key);
+                irScanExpression(scan, value);
+            }
+            break;
+        }
+        case EXPRESSION_INDEX_EXPRESSION:
+            irScanExpression(scan, ((IndexExpression_t*)expression)->left);
+            irScanExpression(scan, ((IndexExpression_t*)expression)->right);
+            break;
+        case EXPRESSION_FUNCTION_LITERAL:
+            if (scan->assigned) {
+                scan->functionDepth++;
+                irScanStatement(scan, (Statement_t*)((FunctionLiteral_t*)expression)->body);
+                scan->functionDepth--;
+            }
+            break;
+        case EXPRESSION_CALL_EXPRESSION: {
+            CallExpression_t* call = (CallExpression_t*)expression;
+            irScanExpression(scan, call->function);
+            for (uint32_t i = 0; i < callExpresionGetArgumentCount(call); i++) {
+                irScanExpression(scan, callExpressionGetArguments(call)[i]);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void irScanStatement(IrAstScan_t* scan, Statement_t* statement) {
+    if (!statement) return;
+
+    switch (statement->type) {
+        case STATEMENT_LET:
+            if (scan->functionDepth == 0) scan->numLets++;
+            irScanExpression(scan, ((LetStatement_t*)statement)->value);
+            break;
+        case STATEMENT_RETURN:
+            irScanExpression(scan, ((ReturnStatement_t*)statement)->returnValue);
+            break;
+        case STATEMENT_EXPRESSION:
+            irScanExpression(scan, ((ExpressionStatement_t*)statement)->expression);
+            break;
+        case STATEMENT_BLOCK: {
+            BlockStatement_t* block = (BlockStatement_t*)statement;
+            for (uint32_t i = 0; i < blockStatementGetStatementCount(block); i++) {
+                irScanStatement(scan, blockStatementGetStatements(block)[i]);
+            }
+            break;
+        }
+        case STATEMENT_ASSIGN: {
+            AssignStatement_t* assign = (AssignStatement_t*)statement;
+            if (scan->assigned) hashMapInsert(scan->assigned, assign->name->value, (void*)1);
+            irScanExpression(scan, assign->value);
+            break;
+        }
+        case STATEMENT_WHILE:
+            irScanExpression(scan, ((WhileStatement_t*)statement)->condition);
+            irScanStatement(scan, (Statement_t*)((WhileStatement_t*)statement)->body);
+            break;
+        default:
+            break;
+    }
+}
+
+HashMap_t* irAssignedNames(Program_t* program) {
+    IrAstScan_t scan = {.assigned = createHashMap()};
+    for (uint32_t i = 0; i < programGetStatementCount(program); i++) {
+        irScanStatement(&scan, programGetStatements(program)[i]);
+    }
+    return scan.assigned;
+}
+
+// Any local may be reassigned by the body, so all of them get a phi in the
+// loop header before the body is built, including the ones its lets are
+// about to define. The back edge arguments are added once the body is done,
+// phis left unchanged are removed as trivial.
+static void irBuildWhileStatement(IrBuilder_t* b, WhileStatement_t* loop) {
+    IrBlock_t* header = createIrBlock(b->fn);
+    IrBlock_t* body = createIrBlock(b->fn);
+    IrBlock_t* exit = createIrBlock(b->fn);
+
+    if (!b->current) {
+        irStartBlock(b, createIrBlock(b->fn));
+    }
+    IrBlock_t* preheader = b->current;
+    irTerminate(b, IR_JUMP, NULL, header, NULL);
+    irStartBlock(b, header);
+
+    uint32_t numLocals = vectorIrValuesGetCount(b->locals);
+    if (b->comp->symbolTable->outer) {
+        IrAstScan_t scan = {0};
+        irScanExpression(&scan, loop->condition);
+        irScanStatement(&scan, (Statement_t*)loop->body);
+        numLocals = b->comp->symbolTable->numDefinitions + scan.numLets;
+    }
+
+    VectorIrValues_t* phis = createVectorIrValues();
+    for (uint32_t i = 0; i < numLocals; i++) {
+        IrValue_t* entry = i < vectorIrValuesGetCount(b->locals) ? b->locals->buf[i] : NULL;
+        IrValue_t* phi = irCreatePhi(b->fn, header);
+        irAddArg(phi, entry ? entry : irEmitBeforeTerminator(b->fn, preheader, IR_NULL));
+        irSetLocal(b->locals, i, phi);
+        vectorIrValuesAppend(phis, phi);
+    }
+
+    IrValue_t* cond = irBuildExpression(b, loop->condition);
+    if (!cond) {
+        cleanupVectorIrValues(&phis, NULL);
+        return;
+    }
+    irTerminate(b, IR_BRANCH, cond, body, exit);
+    VectorIrValues_t* exitLocals = copyVectorIrValues(b->locals, NULL);
+
+    irStartBlock(b, body);
+    irBuildStatement(b, (Statement_t*)loop->body);
+
+    // a body ending with a return doesn't loop
+    if (b->err == COMP_NO_ERROR && b->current) {
+        IrBlock_t* latch = b->current;
+        irTerminate(b, IR_JUMP, NULL, header, NULL);
+        for (uint32_t i = 0; i < numLocals; i++) {
+            IrValue_t* value = i < vectorIrValuesGetCount(b->locals) ? b->locals->buf[i] : NULL;
+            irAddArg(phis->buf[i], value ? value : irEmitBeforeTerminator(b->fn, latch, IR_NULL));
+        }
+    }
+    cleanupVectorIrValues(&phis, NULL);
+
+    cleanupVectorIrValues(&b->locals, NULL);
+    b->locals = exitLocals;
+    irStartBlock(b, exit);
+}
+
+static void irBuildFunctionBody(IrBuilder_t* b, BlockStatement_t* body) {
+    Statement_t** stmts = blockStatementGetStatements(body);
+    uint32_t stmtCnt = blockStatementGetStatementCount(body);
+
+    for (uint32_t i = 0; i + 1 < stmtCnt; i++) {
+        irBuildStatement(b, stmts[i]);
+        if (b->err != COMP_NO_ERROR) return;
+    }
+
+    if (stmtCnt > 0 && stmts[stmtCnt - 1]->type == STATEMENT_EXPRESSION) {
+        IrValue_t* value = irBuildExpression(b, ((ExpressionStatement_t*)stmts[stmtCnt - 1])->expression);
+        if (value) {
+            irTerminate(b, IR_RETURN, value, NULL, NULL);
+        }
+        return;
+    }
+
+    if (stmtCnt > 0) {
+        irBuildStatement(b, stmts[stmtCnt - 1]);
+    }
+    if (b->err == COMP_NO_ERROR && b->current) {
+        irTerminate(b, IR_RETURN_NONE, NULL, NULL, NULL);
+    }
+}
+
+static IrValue_t* irBuildFunctionLiteral(IrBuilder_t* b, FunctionLiteral_t* func) {
+    SymbolTable_t* outer = b->comp->symbolTable;
+    b->comp->symbolTable = createEnclosedSymbolTable(outer);
+
+    if (func->name) {
+        symbolTableDefineFunctionName(b->comp->symbolTable, func->name);
+    }
+
+    uint32_t numParams = functionLiteralGetParameterCount(func);
+    IrFunction_t* fn = createIrFunction(numParams, false);
+    IrBuilder_t inner = createIrBuilder(b->comp, fn);
+    inner.inlineCandidates = b->inlineCandidates;
+    inner.inlineDepth = b->inlineDepth;
+    inner.functions = b->functions;
+
+    Identifier_t** params = functionLiteralGetParameters(func);
+    for (uint32_t i = 0; i < numParams; i++) {
+        Symbol_t* symbol = symbolTableDefine(b->comp->symbolTable, params[i]->value);
+        irSetLocal(inner.locals, symbol->index, irEmit(&inner, IR_PARAM, symbol->index));
+    }
+
+    irBuildFunctionBody(&inner, func->body);
+    CompError_t err = inner.err;
+    cleanupIrBuilder(&inner);
+
+    VectorSymbol_t* freeSymbols = copyVectorSymbol(b->comp->symbolTable->freeSymbols, NULL);
+    cleanupSymbolTable(b->comp->symbolTable);
+    b->comp->symbolTable = outer;
+
+    if (err != COMP_NO_ERROR) {
+        cleanupIrFunction(&fn);
+        cleanupVectorSymbol(&freeSymbols, NULL);
+        b->err = err;
+        return NULL;
+    }
+
+    // the constant is replaced by the lowered function in irFinishFunctions
+    CompiledFunction_t* placeholder = createCompiledFunction(createSliceByte(0), NULL, 0, 0, numParams);
+    fn->constIndex = compilerAddConstant(b->comp, (Object_t*)placeholder);
+    vectorIrFunctionsAppend(b->functions, fn);
+
+    IrValue_t* closure = irEmit(b, IR_CLOSURE, fn->constIndex);
+    for (uint32_t i = 0; i < vectorSymbolGetCount(freeSymbols); i++) {
+        irAddArg(closure, irLoadSymbol(b, freeSymbols->buf[i]));
+    }
+    cleanupVectorSymbol(&freeSymbols, NULL);
+    return closure;
+}
+
+// Builds the expressions in order as arguments of a value created afterwards
+static bool irBuildArgs(IrBuilder_t* b, VectorIrValues_t* args, Expression_t** exprs, uint32_t cnt) {
+    for (uint32_t i = 0; i < cnt; i++) {
+        IrValue_t* arg = irBuildExpression(b, exprs[i]);
+        if (!arg) return false;
+        vectorIrValuesAppend(args, arg);
+    }
+    return true;
+}
+
+static IrValue_t* irEmitWithArgs(IrBuilder_t* b, IrOp_t op, int32_t imm, VectorIrValues_t* args) {
+    IrValue_t* value = irEmit(b, op, imm);
+    cleanupVectorIrValues(&value->args, NULL);
+    value->args = args;
+    return value;
+}
+
+/* Inlining */
+
+typedef struct IrInlineCheck {
+    IrInlineCandidate_t* candidate;
+    uint32_t cost;
+    bool ok;
+} IrInlineCheck_t;
+
+static void irInlineCheckStatement(IrInlineCheck_t* check, Statement_t* statement);
+
+// Counts the nodes of the body. Returns are not allowed, neither are
+// references to the function itself or to globals bound after it, which
+// would resolve differently at the call site.
+static void irInlineCheckExpression(IrInlineCheck_t* check, Expression_t* expression) {
+    check->cost++;
+    switch (expression->type) {
+        case EXPRESSION_IDENTIFIER: {
+            const char* name = ((Identifier_t*)expression)->value;
+            Symbol_t* symbol = symbolTableResolve(check->candidate->globals, name);
+            if (strcmp(name, check->candidate->func->name) == 0 ||
+                (symbol && symbol->scope == SCOPE_GLOBAL && symbol->index >= check->candidate->numGlobals)) {
+                check->ok = false;
+            }
+            break;
+        }
+        case EXPRESSION_PREFIX_EXPRESSION:
+            irInlineCheckExpression(check, ((PrefixExpression_t*)expression)->right);
+            break;
+        case EXPRESSION_INFIX_EXPRESSION:
+            irInlineCheckExpression(check, ((InfixExpression_t*)expression)->left);
+            irInlineCheckExpression(check, ((InfixExpression_t*)expression)->right);
+            break;
+        case EXPRESSION_IF_EXPRESSION: {
+            IfExpression_t* ifExpr = (IfExpression_t*)expression;
+            irInlineCheckExpression(check, ifExpr->condition);
+            irInlineCheckStatement(check, (Statement_t*)ifExpr->consequence);
+            if (ifExpr->alternative) {
+                irInlineCheckStatement(check, (Statement_t*)ifExpr->alternative);
+            }
+            break;
+        }
+        case EXPRESSION_ARRAY_LITERAL: {
+            ArrayLiteral_t* arrayLit = (ArrayLiteral_t*)expression;
+            for (uint32_t i = 0; i < arrayLiteralGetElementCount(arrayLit); i++) {
+                irInlineCheckExpression(check, arrayLiteralGetElements(arrayLit)[i]);
+            }
+            break;
+        }
+        case EXPRESSION_HASH_LITERAL: {
+            HashLiteral_t* hashLit = (HashLiteral_t*)expression;
+            for (uint32_t i = 0; i < hashLiteralGetPairsCount(hashLit); i++) {
+                Expression_t *key, *value;
+                hashLiteralGetPair(hashLit, i, &key, &value);
+                irInlineCheckExpression(check, key);
+                irInlineCheckExpression(check, value);
+            }
+            break;
+        }
+        case EXPRESSION_INDEX_EXPRESSION:
+            irInlineCheckExpression(check, ((IndexExpression_t*)expression)->left);
+            irInlineCheckExpression(check, ((IndexExpression_t*)expression)->right);
+            break;
+        case EXPRESSION_FUNCTION_LITERAL:
+            irInlineCheckStatement(check, (Statement_t*)((FunctionLiteral_t*)expression)->body);
+            break;
+        case EXPRESSION_CALL_EXPRESSION: {
+            CallExpression_t* call = (CallExpression_t*)expression;
+            irInlineCheckExpression(check, call->function);
+            for (uint32_t i = 0; i < callExpresionGetArgumentCount(call); i++) {
+                irInlineCheckExpression(check, callExpressionGetArguments(call)[i]);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void irInlineCheckStatement(IrInlineCheck_t* check, Statement_t* statement) {
+    check->cost++;
+    switch (statement->type) {
+        case STATEMENT_EXPRESSION:
+            irInlineCheckExpression(check, ((ExpressionStatement_t*)statement)->expression);
+            break;
+        case STATEMENT_LET:
+            irInlineCheckExpression(check, ((LetStatement_t*)statement)->value);
+            break;
+        case STATEMENT_BLOCK: {
+            BlockStatement_t* block = (BlockStatement_t*)statement;
+            for (uint32_t i = 0; i < blockStatementGetStatementCount(block); i++) {
+                irInlineCheckStatement(check, blockStatementGetStatements(block)[i]);
+            }
+            break;
+        }
+        default:
+            check->ok = false;
+            break;
+    }
+}
+
+static void irAddInlineCandidate(IrBuilder_t* b, Symbol_t* symbol, FunctionLiteral_t* func) {
+    if (!b->inlineCandidates || !func->name) return;
+    if (b->assignedNames && hashMapGet(b->assignedNames, func->name)) return;
+
+    IrInlineCandidate_t* candidate = mallocChk(sizeof(IrInlineCandidate_t));
+    *candidate = (IrInlineCandidate_t) {
+        .func = func,
+        .globals = b->comp->symbolTable,
+        .numGlobals = b->comp->symbolTable->numDefinitions,
+    };
+
+    char* key = strFormat("%u", symbol->index);
+    hashMapInsert(b->inlineCandidates, key, candidate);
+    free(key);
+}
+
+static FunctionLiteral_t* irFindInlineCandidate(IrBuilder_t* b, CallExpression_t* call) {
+    if (!b->inlineCandidates || b->inlineDepth >= IR_INLINE_MAX_DEPTH) return NULL;
+    // functions may run after a later REPL input reassigned the global
+    if (!b->fn->isMain && b->comp->optLevel < 2) return NULL;
+    if (call->function->type != EXPRESSION_IDENTIFIER) return NULL;
+
+    Symbol_t* symbol = symbolTableResolve(b->comp->symbolTable, ((Identifier_t*)call->function)->value);
+    if (!symbol || symbol->scope != SCOPE_GLOBAL) return NULL;
+
+    char* key = strFormat("%u", symbol->index);
+    IrInlineCandidate_t* candidate = hashMapGet(b->inlineCandidates, key);
+    free(key);
+
+    // a wrong argument count is left for the vm to report
+    if (!candidate || functionLiteralGetParameterCount(candidate->func) != callExpresionGetArgumentCount(call)) {
+        return NULL;
+    }
+
+    IrInlineCheck_t check = {.candidate = candidate, .cost = 0, .ok = true};
+    irInlineCheckStatement(&check, (Statement_t*)candidate->func->body);
+    return (check.ok && check.cost <= IR_INLINE_MAX_COST) ? candidate->func : NULL;
+}
+
+// The body is built in a scope enclosed by the globals, as the literal was,
+// with its parameters bound to the argument values of the caller
+static IrValue_t* irBuildInlinedCall(IrBuilder_t* b, FunctionLiteral_t* func, CallExpression_t* call) {
+    uint32_t numArgs = callExpresionGetArgumentCount(call);
+    VectorIrValues_t* args = createVectorIrValues();
+    if (!irBuildArgs(b, args, callExpressionGetArguments(call), numArgs)) {
+        cleanupVectorIrValues(&args, NULL);
+        return NULL;
+    }
+
+    SymbolTable_t* callerTable = b->comp->symbolTable;
+    SymbolTable_t* globals = callerTable;
+    while (globals->outer) {
+        globals = globals->outer;
+    }
+    b->comp->symbolTable = createEnclosedSymbolTable(globals);
+
+    VectorIrValues_t* callerLocals = b->locals;
+    b->locals = createVectorIrValues();
+    Identifier_t** params = functionLiteralGetParameters(func);
+    for (uint32_t i = 0; i < numArgs; i++) {
+        Symbol_t* symbol = symbolTableDefine(b->comp->symbolTable, params[i]->value);
+        irSetLocal(b->locals, symbol->index, args->buf[i]);
+    }
+    cleanupVectorIrValues(&args, NULL);
+
+    b->inlineDepth++;
+    IrValue_t* value = irBuildBlockValue(b, func->body);
+    b->inlineDepth--;
+
+    cleanupVectorIrValues(&b->locals, NULL);
+    b->locals = callerLocals;
+    cleanupSymbolTable(b->comp->symbolTable);
+    b->comp->symbolTable = callerTable;
+    return value;
+}
+
+static IrValue_t* irBuildInfixExpression(IrBuilder_t* b, InfixExpression_t* expression) {
+    static const struct { const char* operator; IrOp_t op; } infixOps[] = {
+        {"+", IR_ADD}, {"-", IR_SUB}, {"*", IR_MUL}, {"/", IR_DIV},
+        {">", IR_GREATER_THAN}, {"<", IR_GREATER_THAN}, {"==", IR_EQUAL}, {"!=", IR_NOT_EQUAL},
+    };
+
+    for (uint32_t i = 0; i < sizeof(infixOps) / sizeof(infixOps[0]); i++) {
+        if (strcmp(expression->operator, infixOps[i].operator) != 0) continue;
+
+        // `a < b` is evaluated as `b > a`
+        bool swap = strcmp(expression->operator, "<") == 0;
+        IrValue_t* left = irBuildExpression(b, swap ? expression->right : expression->left);
+        if (!left) return NULL;
+        IrValue_t* right = irBuildExpression(b, swap ? expression->left : expression->right);
+        if (!right) return NULL;
+
+        IrValue_t* value = irEmit(b, infixOps[i].op, 0);
+        irAddArg(value, left);
+        irAddArg(value, right);
+        return value;
+    }
+
+    b->err = COMP_UNKNOWN_OPERATOR;
+    return NULL;
+}
+
+static IrValue_t* irBuildExpression(IrBuilder_t* b, Expression_t* expression) {
+    switch (expression->type) {
+        case EXPRESSION_INTEGER_LITERAL:
+            return irEmit(b, IR_CONST, compilerAddIntegerConstant(b->comp, ((IntegerLiteral_t*)expression)->value));
+        case EXPRESSION_STRING_LITERAL:
+            return irEmit(b, IR_CONST, compilerAddStringConstant(b->comp, ((StringLiteral_t*)expression)->value));
+        case EXPRESSION_BOOLEAN_LITERAL:
+            return irEmit(b, ((BooleanLiteral_t*)expression)->value ? IR_TRUE : IR_FALSE, 0);
+        case EXPRESSION_IDENTIFIER: {
+            Symbol_t* symbol = symbolTableResolve(b->comp->symbolTable, ((Identifier_t*)expression)->value);
+            if (!symbol) {
+                b->err = COMP_UNDEFINED_VARIABLE;
+                return NULL;
+            }
+            return irLoadSymbol(b, symbol);
+        }
+        case EXPRESSION_PREFIX_EXPRESSION: {
+            PrefixExpression_t* prefix = (PrefixExpression_t*)expression;
+            IrOp_t op;
+            if (strcmp(prefix->operator, "!") == 0) {
+                op = IR_BANG;
+            } else if (strcmp(prefix->operator, "-") == 0) {
+                op = IR_MINUS;
+            } else {
+                b->err = COMP_UNKNOWN_OPERATOR;
+                return NULL;
+            }
+
+            IrValue_t* right = irBuildExpression(b, prefix->right);
+            if (!right) return NULL;
+            IrValue_t* value = irEmit(b, op, 0);
+            irAddArg(value, right);
+            return value;
+        }
+        case EXPRESSION_INFIX_EXPRESSION:
+            return irBuildInfixExpression(b, (InfixExpression_t*)expression);
+        case EXPRESSION_IF_EXPRESSION:
+            return irBuildIfExpression(b, (IfExpression_t*)expression);
+        case EXPRESSION_ARRAY_LITERAL: {
+            ArrayLiteral_t* arrayLit = (ArrayLiteral_t*)expression;
+            uint32_t cnt = arrayLiteralGetElementCount(arrayLit);
+            VectorIrValues_t* elems = createVectorIrValues();
+            if (!irBuildArgs(b, elems, arrayLiteralGetElements(arrayLit), cnt)) {
+                cleanupVectorIrValues(&elems, NULL);
+                return NULL;
+            }
+            return irEmitWithArgs(b, IR_ARRAY, cnt, elems);
+        }
+        case EXPRESSION_HASH_LITERAL: {
+            HashLiteral_t* hashLit = (HashLiteral_t*)expression;
+            uint32_t pairsCnt = hashLiteralGetPairsCount(hashLit);
+            VectorIrValues_t* elems = createVectorIrValues();
+            for (uint32_t i = 0; i < pairsCnt; i++) {
+                Expression_t* pair[2];
+                hashLiteralGetPair(hashLit, i, &pair[0], &pair[1]);
+                if (!irBuildArgs(b, elems, pair, 2)) {
+                    cleanupVectorIrValues(&elems, NULL);
+                    return NULL;
+                }
+            }
+            return irEmitWithArgs(b, IR_HASH, 2 * pairsCnt, elems);
+        }
+        case EXPRESSION_INDEX_EXPRESSION: {
+            IndexExpression_t* indExpr = (IndexExpression_t*)expression;
+            IrValue_t* left = irBuildExpression(b, indExpr->left);
+            if (!left) return NULL;
+            IrValue_t* index = irBuildExpression(b, indExpr->right);
+            if (!index) return NULL;
+
+            IrValue_t* value = irEmit(b, IR_INDEX, 0);
+            irAddArg(value, left);
+            irAddArg(value, index);
+            return value;
+        }
+        case EXPRESSION_FUNCTION_LITERAL:
+            return irBuildFunctionLiteral(b, (FunctionLiteral_t*)expression);
+        case EXPRESSION_CALL_EXPRESSION: {
+            CallExpression_t* call = (CallExpression_t*)expression;
+            uint32_t numArgs = callExpresionGetArgumentCount(call);
+            FunctionLiteral_t* inlined = irFindInlineCandidate(b, call);
+            if (inlined) {
+                return irBuildInlinedCall(b, inlined, call);
+            }
+
+            VectorIrValues_t* args = createVectorIrValues();
+            if (!irBuildArgs(b, args, &call->function, 1) ||
+                !irBuildArgs(b, args, callExpressionGetArguments(call), numArgs)) {
+                cleanupVectorIrValues(&args, NULL);
+                return NULL;
+            }
+            return irEmitWithArgs(b, IR_CALL, numArgs, args);
+        }
+        default:
+            assert(0 && "Unreachable: Unhandled expression type");
+            return NULL;
+    }
+}
+
+// Optimizes and types every function of the program, then lowers the nested
+// ones into the constants reserved for them. Functions come after the ones
+// they create closures of, so pools never pick up a placeholder.
+static CompError_t irFinishFunctions(Compiler_t* comp, IrFunction_t* main, VectorIrFunctions_t* functions) {
+    irOptimize(comp, main);
+    for (uint32_t i = 0; i < vectorIrFunctionsGetCount(functions); i++) {
+        irOptimize(comp, functions->buf[i]);
+    }
+    irLiftLambdas(main, functions);
+    irInferTypes(comp, main, functions, comp->optLevel >= 2);
+
+    for (uint32_t i = 0; i < vectorIrFunctionsGetCount(functions); i++) {
+        IrFunction_t* fn = functions->buf[i];
+        Instructions_t instr = NULL;
+        uint32_t numLocals = 0;
+        CompError_t err = irLower(comp, fn, &instr, &numLocals);
+        if (err != COMP_NO_ERROR) {
+            return err;
+        }
+
+        Object_t** constants = vectorObjectsGetBuffer(comp->constants);
+        gcClearRef(constants[fn->constIndex], GC_REF_COMPILE_CONSTANT);
+        constants[fn->constIndex] = (Object_t*)compilerCreateFunction(comp->constants, instr, numLocals, fn->numParams);
+        gcSetRef(constants[fn->constIndex], GC_REF_COMPILE_CONSTANT);
+    }
+    return COMP_NO_ERROR;
+}
+
+IrFunction_t* irBuildProgram(Compiler_t* comp, Program_t* program, CompError_t* err) {
+    IrFunction_t* fn = createIrFunction(0, true);
+    IrBuilder_t b = createIrBuilder(comp, fn);
+    b.inlineCandidates = createHashMap();
+    b.assignedNames = irAssignedNames(program);
+    b.functions = createVectorIrFunctions();
+
+    Statement_t** stmts = programGetStatements(program);
+    for (uint32_t i = 0; i < programGetStatementCount(program) && b.err == COMP_NO_ERROR; i++) {
+        b.topLevel = stmts[i];
+        irBuildStatement(&b, stmts[i]);
+    }
+    if (b.current) {
+        irTerminate(&b, IR_END, NULL, NULL, NULL);
+    }
+    symbolTableUnbindConstants(comp->symbolTable);
+
+    *err = b.err;
+    if (*err == COMP_NO_ERROR) {
+        *err = irFinishFunctions(comp, fn, b.functions);
+    }
+
+    cleanupHashMap(&b.inlineCandidates, irFree);
+    cleanupHashMap(&b.assignedNames, NULL);
+    cleanupVectorIrFunctions(&b.functions, cleanupIrFunction);
+    cleanupIrBuilder(&b);
+    if (*err != COMP_NO_ERROR) {
+        cleanupIrFunction(&fn);
+    }
+    return fn;
+}
+
+/* Optimization passes */
+
+// Phis whose arguments all resolve to one value are copies of it
+static void irRemoveTrivialPhis(IrFunction_t* fn) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+            IrBlock_t* block = fn->blocks->buf[b];
+            for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+                IrValue_t* phi = block->values->buf[i];
+                if (phi->op != IR_PHI) break;
+                if (phi->removed) continue;
+
+                IrValue_t* unique = NULL;
+                bool trivial = true;
+                for (uint32_t a = 0; a < vectorIrValuesGetCount(phi->args); a++) {
+                    IrValue_t* arg = irResolve(phi->args->buf[a]);
+                    if (arg == phi || arg == unique) continue;
+                    if (unique) {
+                        trivial = false;
+                        break;
+                    }
+                    unique = arg;
+                }
+
+                if (trivial && unique) {
+                    irReplace(phi, unique);
+                    changed = true;
+                }
+            }
+        }
+    }
+    irCompact(fn);
+}
+
+static Object_t* irConstantObject(Compiler_t* comp, IrValue_t* value) {
+    if (value->op != IR_CONST) return NULL;
+    return vectorObjectsGetBuffer(comp->constants)[value->imm];
+}
+
+static bool irIntegerValue(Compiler_t* comp, IrValue_t* value, int64_t* out) {
+    Object_t* obj = irConstantObject(comp, value);
+    if (!obj || objectGetType(obj) != OBJECT_INTEGER) return false;
+    *out = ((Integer_t*)obj)->value;
+    return true;
+}
+
+// Truthiness of leaves known at compile time, -1 if unknown
+static int irKnownTruthiness(IrValue_t* value) {
+    switch (value->op) {
+        case IR_TRUE: return 1;
+        case IR_FALSE: case IR_NULL: return 0;
+        case IR_CONST: return 1;
+        default: return -1;
+    }
+}
+
+static void irMakeLeaf(IrValue_t* value, IrOp_t op, int32_t imm) {
+    value->op = op;
+    value->imm = imm;
+    value->args->cnt = 0;
+}
+
+static void irMakeBoolean(IrValue_t* value, bool b) {
+    irMakeLeaf(value, b ? IR_TRUE : IR_FALSE, 0);
+}
+
+// Mirrors the AST folding for values only known to be constant after
+// propagation, integer division by zero is left for the vm to raise
+static void irFoldValue(Compiler_t* comp, IrValue_t* value) {
+    int64_t left, right;
+    IrValue_t** args = value->args->buf;
+
+    switch (value->op) {
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+        case IR_GREATER_THAN: case IR_EQUAL: case IR_NOT_EQUAL: {
+            if (irIntegerValue(comp, args[0], &left) && irIntegerValue(comp, args[1], &right)) {
+                uint64_t l = (uint64_t)left, r = (uint64_t)right;
+                switch (value->op) {
+                    case IR_ADD: irMakeLeaf(value, IR_CONST, compilerAddIntegerConstant(comp, (int64_t)(l + r))); break;
+                    case IR_SUB: irMakeLeaf(value, IR_CONST, compilerAddIntegerConstant(comp, (int64_t)(l - r))); break;
+                    case IR_MUL: irMakeLeaf(value, IR_CONST, compilerAddIntegerConstant(comp, (int64_t)(l * r))); break;
+                    case IR_DIV:
+                        if (right == 0 || (left == INT64_MIN && right == -1)) break;
+                        irMakeLeaf(value, IR_CONST, compilerAddIntegerConstant(comp, left / right));
+                        break;
+                    case IR_GREATER_THAN: irMakeBoolean(value, left > right); break;
+                    case IR_EQUAL: irMakeBoolean(value, left == right); break;
+                    case IR_NOT_EQUAL: irMakeBoolean(value, left != right); break;
+                    default: break;
+                }
+                break;
+            }
+
+            bool leftBool = args[0]->op == IR_TRUE || args[0]->op == IR_FALSE;
+            bool rightBool = args[1]->op == IR_TRUE || args[1]->op == IR_FALSE;
+            if (leftBool && rightBool && (value->op == IR_EQUAL || value->op == IR_NOT_EQUAL)) {
+                irMakeBoolean(value, (args[0]->op == args[1]->op) == (value->op == IR_EQUAL));
+            }
+            break;
+        }
+        case IR_MINUS:
+            if (irIntegerValue(comp, args[0], &left)) {
+                irMakeLeaf(value, IR_CONST, compilerAddIntegerConstant(comp, (int64_t)(0 - (uint64_t)left)));
+            }
+            break;
+        case IR_BANG: {
+            // only false and null are negated to true
+            int truthy = irKnownTruthiness(args[0]);
+            if (truthy >= 0) {
+                irMakeBoolean(value, !truthy);
+            }
+            break;
+        }
+        case IR_BRANCH: {
+            int truthy = irKnownTruthiness(args[0]);
+            if (truthy < 0) break;
+
+            IrBlock_t* live = value->targets[truthy ? 0 : 1];
+            IrBlock_t* dead = value->targets[truthy ? 1 : 0];
+            irRemovePred(dead, value->block);
+            irMakeLeaf(value, IR_JUMP, 0);
+            value->targets[0] = live;
+            value->targets[1] = NULL;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void irFoldConstants(Compiler_t* comp, IrFunction_t* fn) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            irFoldValue(comp, block->values->buf[i]);
+        }
+    }
+}
+
+static void irRemoveUnreachableBlocks(IrFunction_t* fn) {
+    uint32_t numBlocks = vectorIrBlocksGetCount(fn->allBlocks);
+    bool* reachable = callocChk(numBlocks * sizeof(bool));
+    IrBlock_t** stack = mallocChk(numBlocks * sizeof(IrBlock_t*));
+    uint32_t sp = 0;
+
+    IrBlock_t* entry = fn->blocks->buf[0];
+    reachable[entry->id] = true;
+    stack[sp++] = entry;
+    while (sp > 0) {
+        IrValue_t* term = irBlockTerminator(stack[--sp]);
+        for (uint32_t t = 0; t < irNumSuccessors(term); t++) {
+            IrBlock_t* succ = term->targets[t];
+            if (!reachable[succ->id]) {
+                reachable[succ->id] = true;
+                stack[sp++] = succ;
+            }
+        }
+    }
+
+    uint32_t cnt = 0;
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        if (reachable[block->id]) {
+            fn->blocks->buf[cnt++] = block;
+            continue;
+        }
+
+        IrValue_t* term = irBlockTerminator(block);
+        for (uint32_t t = 0; t < irNumSuccessors(term); t++) {
+            irRemovePred(term->targets[t], block);
+        }
+    }
+    fn->blocks->cnt = cnt;
+
+    free(stack);
+    free(reachable);
+}
+
+// Appends a block to its only predecessor when that one jumps to it unconditionally
+static void irMergeBlocks(IrFunction_t* fn) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        IrValue_t* term = irBlockTerminator(block);
+        if (!term || term->op != IR_JUMP) continue;
+
+        IrBlock_t* succ = term->targets[0];
+        if (succ == block || vectorIrBlocksGetCount(succ->preds) != 1) continue;
+
+        term->removed = true;
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(succ->values); i++) {
+            IrValue_t* value = succ->values->buf[i];
+            if (value->removed) continue;
+            if (value->op == IR_PHI) {
+                irReplace(value, irResolve(value->args->buf[0]));
+                continue;
+            }
+            value->block = block;
+            vectorIrValuesAppend(block->values, value);
+        }
+        succ->values->cnt = 0;
+
+        IrValue_t* succTerm = irBlockTerminator(block);
+        for (uint32_t t = 0; t < irNumSuccessors(succTerm); t++) {
+            IrBlock_t* next = succTerm->targets[t];
+            next->preds->buf[irPredIndex(next, succ)] = block;
+        }
+
+        uint32_t cnt = 0;
+        for (uint32_t i = 0; i < vectorIrBlocksGetCount(fn->blocks); i++) {
+            if (fn->blocks->buf[i] != succ) fn->blocks->buf[cnt++] = fn->blocks->buf[i];
+        }
+        fn->blocks->cnt = cnt;
+
+        irCompact(fn);
+        b--; // the merged block may continue into another one
+    }
+}
+
+static void irPostorder(IrBlock_t* block, bool* visited, VectorIrBlocks_t* order) {
+    visited[block->id] = true;
+    IrValue_t* term = irBlockTerminator(block);
+    for (uint32_t t = 0; t < irNumSuccessors(term); t++) {
+        if (!visited[term->targets[t]->id]) {
+            irPostorder(term->targets[t], visited, order);
+        }
+    }
+    vectorIrBlocksAppend(order, block);
+}
+
+static IrBlock_t* irIntersectDominators(IrBlock_t* a, IrBlock_t* b) {
+    while (a != b) {
+        while (a->order > b->order) a = a->idom;
+        while (b->order > a->order) b = b->idom;
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm on the reverse postorder,
+// returns the blocks in that order
+static VectorIrBlocks_t* irComputeDominators(IrFunction_t* fn) {
+    bool* visited = callocChk(vectorIrBlocksGetCount(fn->allBlocks) * sizeof(bool));
+    VectorIrBlocks_t* postorder = createVectorIrBlocks();
+    irPostorder(fn->blocks->buf[0], visited, postorder);
+    free(visited);
+
+    uint32_t cnt = vectorIrBlocksGetCount(postorder);
+    VectorIrBlocks_t* rpo = createVectorIrBlocks();
+    for (uint32_t i = 0; i < cnt; i++) {
+        IrBlock_t* block = postorder->buf[cnt - 1 - i];
+        block->order = i;
+        block->idom = NULL;
+        vectorIrBlocksAppend(rpo, block);
+    }
+    cleanupVectorIrBlocks(&postorder, NULL);
+
+    IrBlock_t* entry = rpo->buf[0];
+    entry->idom = entry;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t i = 1; i < cnt; i++) {
+            IrBlock_t* block = rpo->buf[i];
+            IrBlock_t* idom = NULL;
+            for (uint32_t p = 0; p < vectorIrBlocksGetCount(block->preds); p++) {
+                IrBlock_t* pred = block->preds->buf[p];
+                if (!pred->idom) continue;
+                idom = idom ? irIntersectDominators(pred, idom) : pred;
+            }
+            if (idom != block->idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+    return rpo;
+}
+
+static char* irValueKey(IrValue_t* value) {
+    Strbuf_t* sbuf = createStrbuf();
+    strbufConsume(sbuf, strFormat("%d:%d", value->op, value->imm));
+    for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+        strbufConsume(sbuf, strFormat(":%u", irResolve(value->args->buf[a])->id));
+    }
+    return detachStrbuf(&sbuf);
+}
+
+// Values available in a block are the ones of its dominators, walk the
+// dominator tree and forget a block's values when leaving it
+static void irCseBlock(IrBlock_t* block, VectorIrBlocks_t* rpo, HashMap_t* available) {
+    Vector_t* keys = createVector();
+
+    for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+        IrValue_t* value = block->values->buf[i];
+        if (value->removed || !irOpInfos[value->op].cse) continue;
+
+        char* key = irValueKey(value);
+        IrValue_t* existing = hashMapGet(available, key);
+        if (existing) {
+            irReplace(value, existing);
+            free(key);
+        } else {
+            hashMapInsert(available, key, value);
+            vectorAppend(keys, key);
+        }
+    }
+
+    for (uint32_t i = block->order + 1; i < vectorIrBlocksGetCount(rpo); i++) {
+        if (rpo->buf[i]->idom == block) {
+            irCseBlock(rpo->buf[i], rpo, available);
+        }
+    }
+
+    for (uint32_t i = 0; i < vectorGetCount(keys); i++) {
+        char* key = vectorGetBuffer(keys)[i];
+        hashMapRemoveHashed(available, key, hashMapHashKey(key));
+    }
+    cleanupVector(&keys, irFree);
+}
+
+static void irEliminateCommonSubexpressions(IrFunction_t* fn) {
+    VectorIrBlocks_t* rpo = irComputeDominators(fn);
+    HashMap_t* available = createHashMap();
+    irCseBlock(rpo->buf[0], rpo, available);
+    cleanupHashMap(&available, NULL);
+    cleanupVectorIrBlocks(&rpo, NULL);
+    irCompact(fn);
+}
+
+static void* irSameValue(const void* value) {
+    return (void*)value;
+}
+
+// Loads of a global just stored are replaced by the stored value when it
+// is cheap to recompute, stores of the value already held are dropped, as
+// are stores overwritten before anything could observe them. What globals
+// hold is carried into blocks with a single predecessor, calls may run code
+// touching any global and forget everything.
+static void irForwardGlobals(IrFunction_t* fn) {
+    HashMap_t** knownAtEnd = callocChk(vectorIrBlocksGetCount(fn->allBlocks) * sizeof(HashMap_t*));
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        HashMap_t* known = NULL; // global -> value it holds
+        if (vectorIrBlocksGetCount(block->preds) == 1) {
+            known = copyHashMap(knownAtEnd[block->preds->buf[0]->id], irSameValue);
+        }
+        if (!known) known = createHashMap();
+        HashMap_t* stores = createHashMap(); // global -> store not observed yet
+
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->removed) continue;
+
+            if (value->op == IR_SET_GLOBAL || value->op == IR_GET_GLOBAL) {
+                char* key = strFormat("%d", value->imm);
+                IrValue_t* held = hashMapGet(known, key);
+
+                if (value->op == IR_SET_GLOBAL) {
+                    IrValue_t* stored = irResolve(value->args->buf[0]);
+                    if (held == stored) {
+                        value->removed = true;
+                    } else {
+                        IrValue_t* overwritten = hashMapGet(stores, key);
+                        if (overwritten) overwritten->removed = true;
+                        hashMapInsert(known, key, stored);
+                        hashMapInsert(stores, key, value);
+                    }
+                } else if (held && irOpInfos[held->op].remat) {
+                    irReplace(value, held);
+                } else {
+                    hashMapInsert(known, key, value);
+                    hashMapRemoveHashed(stores, key, hashMapHashKey(key));
+                }
+                free(key);
+                continue;
+            }
+
+            if (irOpInfos[value->op].removable) continue;
+
+            // the operation may fail or call out, pending stores must be done
+            cleanupHashMap(&stores, NULL);
+            stores = createHashMap();
+            if (value->op == IR_CALL) {
+                cleanupHashMap(&known, NULL);
+                known = createHashMap();
+            }
+        }
+
+        knownAtEnd[block->id] = known;
+        cleanupHashMap(&stores, NULL);
+    }
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->allBlocks); b++) {
+        cleanupHashMap(&knownAtEnd[b], NULL);
+    }
+    free(knownAtEnd);
+    irCompact(fn);
+}
+
+static void irCountUses(IrFunction_t* fn) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            block->values->buf[i]->numUses = 0;
+        }
+    }
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+                IrValue_t* arg = value->args->buf[a];
+                arg->numUses++;
+                arg->user = value;
+                arg->userArg = a;
+            }
+        }
+    }
+}
+
+static void irEliminateDeadCode(IrFunction_t* fn) {
+    irCountUses(fn);
+
+    Vector_t* worklist = createVector();
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            vectorAppend(worklist, block->values->buf[i]);
+        }
+    }
+
+    while (vectorGetCount(worklist) > 0) {
+        IrValue_t* value = vectorPop(worklist);
+        if (value->removed || value->numUses > 0 || !irOpInfos[value->op].removable) continue;
+
+        value->removed = true;
+        for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+            IrValue_t* arg = value->args->buf[a];
+            arg->numUses--;
+            vectorAppend(worklist, arg);
+        }
+    }
+
+    cleanupVector(&worklist, NULL);
+    irCompact(fn);
+}
+
+void irOptimize(Compiler_t* comp, IrFunction_t* fn) {
+    // merged blocks give forwarding and folding more to work with next round
+    for (uint32_t round = 0; round < 2; round++) {
+        irRemoveUnreachableBlocks(fn);
+        irCompact(fn);
+        irRemoveTrivialPhis(fn);
+        irForwardGlobals(fn);
+        irFoldConstants(comp, fn);
+        irRemoveUnreachableBlocks(fn);
+        irRemoveTrivialPhis(fn);
+        irMergeBlocks(fn);
+        irEliminateCommonSubexpressions(fn);
+        irEliminateDeadCode(fn);
+    }
+}
+
+/* Type inference */
+
+typedef struct IrTyping {
+    Compiler_t* comp;
+    HashMap_t* byConstant; // constant index -> IrFunction_t
+    HashMap_t* byGlobal;   // global index -> IrFunction_t, closed world only
+    bool changed;
+} IrTyping_t;
+
+static uint8_t irJoinTypes(uint8_t a, uint8_t b) {
+    if (a == IR_TYPE_NONE) return b;
+    if (b == IR_TYPE_NONE || a == b) return a;
+    return IR_TYPE_ANY;
+}
+
+static void irFunctionsAdd(HashMap_t* map, int32_t index, IrFunction_t* fn) {
+    char* key = strFormat("%d", index);
+    hashMapInsert(map, key, fn);
+    free(key);
+}
+
+static IrFunction_t* irFunctionsGet(HashMap_t* map, int32_t index) {
+    if (!map) return NULL;
+    char* key = strFormat("%d", index);
+    IrFunction_t* fn = hashMapGet(map, key);
+    free(key);
+    return fn;
+}
+
+// The function a closure value is known to be an instance of
+static IrFunction_t* irKnownFunction(IrTyping_t* t, IrFunction_t* fn, IrValue_t* value) {
+    switch (value->op) {
+        case IR_CLOSURE:
+            return irFunctionsGet(t->byConstant, value->imm);
+        case IR_CURRENT_CLOSURE:
+            return fn;
+        case IR_GET_GLOBAL:
+            return irFunctionsGet(t->byGlobal, value->imm);
+        default:
+            return NULL;
+    }
+}
+
+// Any use of a closure other than calling it, or binding it to a global in
+// a closed world, lets calls happen from code we don't type
+static void irMarkEscapes(IrTyping_t* t, IrFunction_t* fn) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+                IrFunction_t* known = irKnownFunction(t, fn, value->args->buf[a]);
+                bool called = value->op == IR_CALL && a == 0;
+                bool bound = value->op == IR_SET_GLOBAL && irFunctionsGet(t->byGlobal, value->imm) == known;
+                if (known && !called && !bound) {
+                    known->escapes = true;
+                }
+            }
+        }
+    }
+}
+
+// Subtraction, multiplication, division and negation are only defined on
+// integers, so their result is one whenever they don't fail. Addition also
+// concatenates strings but never mixes the two.
+static uint8_t irTransferType(IrTyping_t* t, IrFunction_t* fn, IrValue_t* value) {
+    uint32_t numArgs = vectorIrValuesGetCount(value->args);
+    switch (value->op) {
+        case IR_CONST:
+            return objectGetType(vectorObjectsGetBuffer(t->comp->constants)[value->imm]) == OBJECT_INTEGER ?
+                IR_TYPE_INT : IR_TYPE_ANY;
+        case IR_TRUE: case IR_FALSE: case IR_BANG:
+        case IR_EQUAL: case IR_NOT_EQUAL: case IR_GREATER_THAN:
+            return IR_TYPE_BOOL;
+        case IR_SUB: case IR_MUL: case IR_DIV: case IR_MINUS:
+            return IR_TYPE_INT;
+        case IR_ADD: {
+            uint8_t left = value->args->buf[0]->type;
+            uint8_t right = value->args->buf[1]->type;
+            if (left == IR_TYPE_INT || right == IR_TYPE_INT) return IR_TYPE_INT;
+            if (left == IR_TYPE_NONE || right == IR_TYPE_NONE) return IR_TYPE_NONE;
+            return IR_TYPE_ANY;
+        }
+        case IR_PHI: {
+            uint8_t type = IR_TYPE_NONE;
+            for (uint32_t a = 0; a < numArgs; a++) {
+                type = irJoinTypes(type, value->args->buf[a]->type);
+            }
+            return type;
+        }
+        case IR_PARAM:
+            return fn->paramTypes[value->imm];
+        case IR_CALL: {
+            IrFunction_t* callee = irKnownFunction(t, fn, value->args->buf[0]);
+            return (callee && callee->numParams == numArgs - 1) ? callee->returnType : IR_TYPE_ANY;
+        }
+        default:
+            return IR_TYPE_ANY;
+    }
+}
+
+static void irCountGlobalStores(HashMap_t* stores, IrFunction_t* fn) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->op != IR_SET_GLOBAL) continue;
+            char* key = strFormat("%d", value->imm);
+            hashMapInsert(stores, key, (void*)((uintptr_t)hashMapGet(stores, key) + 1));
+            free(key);
+        }
+    }
+}
+
+static void irCollectGlobalFunctions(IrTyping_t* t, IrFunction_t* main, VectorIrFunctions_t* functions) {
+    HashMap_t* stores = createHashMap(); // global index -> number of stores
+    irCountGlobalStores(stores, main);
+    for (uint32_t i = 0; i < vectorIrFunctionsGetCount(functions); i++) {
+        irCountGlobalStores(stores, functions->buf[i]);
+    }
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(main->blocks); b++) {
+        IrBlock_t* block = main->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->op != IR_SET_GLOBAL || value->args->buf[0]->op != IR_CLOSURE) continue;
+
+            char* key = strFormat("%d", value->imm);
+            uintptr_t numStores = (uintptr_t)hashMapGet(stores, key);
+            free(key);
+
+            IrFunction_t* fn = irFunctionsGet(t->byConstant, value->args->buf[0]->imm);
+            if (fn && numStores == 1) irFunctionsAdd(t->byGlobal, value->imm, fn);
+        }
+    }
+    cleanupHashMap(&stores, NULL);
+}
+
+static void irJoinInto(IrTyping_t* t, uint8_t* type, uint8_t with) {
+    uint8_t joined = irJoinTypes(*type, with);
+    if (joined != *type) {
+        *type = joined;
+        t->changed = true;
+    }
+}
+
+static void irTypeFunction(IrTyping_t* t, IrFunction_t* fn) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            irJoinInto(t, &value->type, irTransferType(t, fn, value));
+
+            if (value->op == IR_RETURN) {
+                irJoinInto(t, &fn->returnType, value->args->buf[0]->type);
+            } else if (value->op == IR_RETURN_NONE) {
+                irJoinInto(t, &fn->returnType, IR_TYPE_ANY);
+            } else if (value->op == IR_CALL) {
+                IrFunction_t* callee = irKnownFunction(t, fn, value->args->buf[0]);
+                uint32_t numArgs = vectorIrValuesGetCount(value->args) - 1;
+                if (callee && !callee->escapes && callee->numParams == numArgs) {
+                    for (uint32_t a = 0; a < numArgs; a++) {
+                        irJoinInto(t, &callee->paramTypes[a], value->args->buf[a + 1]->type);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void irInferTypes(Compiler_t* comp, IrFunction_t* main, VectorIrFunctions_t* functions, bool closedWorld) {
+    IrTyping_t t = {
+        .comp = comp,
+        .byConstant = createHashMap(),
+        .byGlobal = closedWorld ? createHashMap() : NULL,
+    };
+
+    uint32_t numFunctions = vectorIrFunctionsGetCount(functions);
+    for (uint32_t i = 0; i < numFunctions; i++) {
+        irFunctionsAdd(t.byConstant, functions->buf[i]->constIndex, functions->buf[i]);
+    }
+
+    // every let creates a new global, so a global bound to a closure and
+    // never assigned again is always bound to that one once set
+    if (closedWorld) {
+        irCollectGlobalFunctions(&t, main, functions);
+    }
+
+    irMarkEscapes(&t, main);
+    for (uint32_t i = 0; i < numFunctions; i++) {
+        irMarkEscapes(&t, functions->buf[i]);
+    }
+    for (uint32_t i = 0; i < numFunctions; i++) {
+        IrFunction_t* fn = functions->buf[i];
+        for (uint32_t p = 0; fn->escapes && p < fn->numParams; p++) {
+            fn->paramTypes[p] = IR_TYPE_ANY;
+        }
+    }
+
+    // types only ever grow, towards IR_TYPE_ANY
+    do {
+        t.changed = false;
+        irTypeFunction(&t, main);
+        for (uint32_t i = 0; i < numFunctions; i++) {
+            irTypeFunction(&t, functions->buf[i]);
+        }
+    } while (t.changed);
+
+    cleanupHashMap(&t.byConstant, NULL);
+    if (t.byGlobal) cleanupHashMap(&t.byGlobal, NULL);
+}
+
+/* Lambda lifting */
+
+static bool irCallsWithArity(IrValue_t* value, uint32_t argIndex, uint32_t numParams) {
+    return value->op == IR_CALL && argIndex == 0 && vectorIrValuesGetCount(value->args) == numParams + 1;
+}
+
+// The closure has to be called right where it is created and the function
+// can only refer to itself to call itself
+static bool irCanLift(IrFunction_t* parent, IrValue_t* closure, IrFunction_t* fn) {
+    uint32_t numFree = vectorIrValuesGetCount(closure->args);
+    if (numFree == 0 || fn->numParams + numFree > UINT8_MAX) return false;
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(parent->blocks); b++) {
+        IrBlock_t* block = parent->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+                if (value->args->buf[a] == closure && !irCallsWithArity(value, a, fn->numParams)) return false;
+            }
+        }
+    }
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+                if (value->args->buf[a]->op == IR_CURRENT_CLOSURE && !irCallsWithArity(value, a, fn->numParams)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Captured values become trailing parameters, every call passes them along
+static void irLift(IrFunction_t* parent, IrValue_t* closure, IrFunction_t* fn) {
+    uint32_t numFree = vectorIrValuesGetCount(closure->args);
+    uint32_t numParams = fn->numParams;
+
+    VectorIrValues_t* params = createVectorIrValues();
+    for (uint32_t i = 0; i < numFree; i++) {
+        IrValue_t* param = irEmitBeforeTerminator(fn, fn->blocks->buf[0], IR_PARAM);
+        param->imm = numParams + i;
+        vectorIrValuesAppend(params, param);
+    }
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->op == IR_GET_FREE) {
+                irMakeLeaf(value, IR_PARAM, numParams + value->imm);
+            } else if (value->op == IR_CALL && value->args->buf[0]->op == IR_CURRENT_CLOSURE) {
+                for (uint32_t f = 0; f < numFree; f++) {
+                    irAddArg(value, params->buf[f]);
+                }
+            }
+        }
+    }
+    cleanupVectorIrValues(&params, NULL);
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(parent->blocks); b++) {
+        IrBlock_t* block = parent->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->op == IR_CALL && value->args->buf[0] == closure) {
+                for (uint32_t f = 0; f < numFree; f++) {
+                    irAddArg(value, closure->args->buf[f]);
+                }
+            }
+        }
+    }
+    closure->args->cnt = 0;
+
+    fn->numParams += numFree;
+    free(fn->paramTypes);
+    fn->paramTypes = callocChk(fn->numParams + 1);
+}
+
+static void irLiftClosuresOf(IrFunction_t* parent, HashMap_t* byConstant) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(parent->blocks); b++) {
+        IrBlock_t* block = parent->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->op != IR_CLOSURE) continue;
+
+            IrFunction_t* fn = irFunctionsGet(byConstant, value->imm);
+            if (fn && irCanLift(parent, value, fn)) {
+                irLift(parent, value, fn);
+            }
+        }
+    }
+}
+
+void irLiftLambdas(IrFunction_t* main, VectorIrFunctions_t* functions) {
+    HashMap_t* byConstant = createHashMap();
+    for (uint32_t i = 0; i < vectorIrFunctionsGetCount(functions); i++) {
+        irFunctionsAdd(byConstant, functions->buf[i]->constIndex, functions->buf[i]);
+    }
+
+    irLiftClosuresOf(main, byConstant);
+    for (uint32_t i = 0; i < vectorIrFunctionsGetCount(functions); i++) {
+        irLiftClosuresOf(functions->buf[i], byConstant);
+    }
+    cleanupHashMap(&byConstant, NULL);
+}
+
+/* Lowering */
+
+enum {
+    IR_KIND_ROOT = 0, // emitted in block order, popped if unused
+    IR_KIND_REMAT,    // emitted again at every use
+    IR_KIND_INLINE,   // emitted right where its only user needs it
+    IR_KIND_SLOT,     // stored to a local slot and loaded at every use
+    IR_KIND_STACK,    // phi left on the stack by the predecessors
+};
+
+typedef struct IrLowering {
+    Instructions_t code;
+    Vector_t* jumps; // jump positions to patch, followed by their target block
+    int32_t* lastLoad;
+    bool* lastLoadIsArg;
+    Vector_t* loopMoves; // (position, slot) pairs of loads in loops that may move
+    bool* captured;
+    bool* inLoop; // block id -> part of a loop body
+    IrFunction_t* fn;
+    IrBlock_t* block;
+
+    Compiler_t* comp;
+    uint32_t* switchCases; // block id -> cases of the switch its branch starts
+    bool* inSwitch; // block id -> later link of a switch, emits nothing
+    Vector_t* switches; // switch positions to patch, followed by their first branch
+    Vector_t* farOperands; // (position, operand) pairs that need the wide encoding
+} IrLowering_t;
+
+static bool irIsLoopHeader(IrBlock_t* block) {
+    for (uint32_t p = 0; p < vectorIrBlocksGetCount(block->preds); p++) {
+        if (block->preds->buf[p]->order >= block->order) return true;
+    }
+    return false;
+}
+
+// Blocks of the natural loop of every back edge, found walking the
+// predecessors from the jumping block up to the header. Needs the reverse
+// postorder of irComputeDominators.
+static bool* irFindLoopBlocks(IrFunction_t* fn) {
+    uint32_t numBlocks = vectorIrBlocksGetCount(fn->allBlocks);
+    bool* inLoop = callocChk(numBlocks * sizeof(bool));
+    IrBlock_t** stack = mallocChk(numBlocks * sizeof(IrBlock_t*));
+
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* header = fn->blocks->buf[b];
+        for (uint32_t p = 0; p < vectorIrBlocksGetCount(header->preds); p++) {
+            IrBlock_t* latch = header->preds->buf[p];
+            if (latch->order < header->order) continue;
+
+            bool* visited = callocChk(numBlocks * sizeof(bool));
+            uint32_t sp = 0;
+            visited[header->id] = true;
+            inLoop[header->id] = true;
+            if (!visited[latch->id]) {
+                visited[latch->id] = true;
+                stack[sp++] = latch;
+            }
+            while (sp > 0) {
+                IrBlock_t* block = stack[--sp];
+                inLoop[block->id] = true;
+                for (uint32_t q = 0; q < vectorIrBlocksGetCount(block->preds); q++) {
+                    IrBlock_t* pred = block->preds->buf[q];
+                    if (!visited[pred->id]) {
+                        visited[pred->id] = true;
+                        stack[sp++] = pred;
+                    }
+                }
+            }
+            free(visited);
+        }
+    }
+
+    free(stack);
+    return inLoop;
+}
+
+// A value can stay on the stack until its only user in the same block if
+// everything emitted in between ends up in a later operand of that user.
+// Phi inputs are emitted right before the jump into the join.
+static bool irCanInline(IrValue_t* value, IrValue_t** list) {
+    if (value->numUses != 1) return false;
+    IrValue_t* user = value->user;
+
+    if (user->op == IR_PHI) {
+        IrValue_t* term = irBlockTerminator(value->block);
+        return term->op == IR_JUMP && term->targets[0] == user->block &&
+            user->block->preds->buf[value->userArg] == value->block && value->pos + 1 == term->pos;
+    }
+    if (user->block != value->block) return false;
+
+    for (uint32_t j = value->pos + 1; j < user->pos; j++) {
+        IrValue_t* between = list[j];
+        while (between->kind == IR_KIND_INLINE && between->user != user) {
+            between = between->user;
+        }
+        if (between->kind != IR_KIND_INLINE || between->userArg <= value->userArg) return false;
+    }
+    return true;
+}
+
+// One phi per join can be left on the stack when it is the very first
+// operand the join block consumes, or when the block only passes it on to
+// a phi of its successor. Loop headers keep all their phis in slots.
+static void irChooseStackPhi(IrBlock_t* block, IrValue_t** list, uint32_t cnt) {
+    if (irIsLoopHeader(block)) return;
+    for (uint32_t p = 0; p < vectorIrBlocksGetCount(block->preds); p++) {
+        IrValue_t* term = irBlockTerminator(block->preds->buf[p]);
+        if (term->op != IR_JUMP) return;
+    }
+
+    uint32_t first = 0;
+    while (list[first]->kind == IR_KIND_INLINE) first++;
+
+    IrValue_t* candidate = NULL;
+    for (IrValue_t* value = list[first]; vectorIrValuesGetCount(value->args) > 0; value = value->args->buf[0]) {
+        IrValue_t* operand = value->args->buf[0];
+        if (operand->op == IR_PHI && operand->block == block) {
+            candidate = operand;
+            break;
+        }
+        if (operand->kind != IR_KIND_INLINE) break;
+    }
+
+    if (!candidate && cnt == 1 && list[0]->op == IR_JUMP) {
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* phi = block->values->buf[i];
+            if (phi->op != IR_PHI) break;
+            if (phi->numUses == 1 && phi->user->op == IR_PHI && phi->user->block == list[0]->targets[0]) {
+                candidate = phi;
+                break;
+            }
+        }
+    }
+
+    if (candidate && candidate->numUses == 1) {
+        candidate->kind = IR_KIND_STACK;
+    }
+}
+
+static uint32_t irLowerEmit(IrLowering_t* l, OpCode_t op, const int operands[]) {
+    SliceByte_t ins = codeMake(op, operands);
+    uint32_t pos = sliceByteGetLen(l->code);
+    sliceByteAppend(&l->code, ins, sliceByteGetLen(ins));
+    cleanupSliceByte(ins);
+    return pos;
+}
+
+static void irLowerJump(IrLowering_t* l, OpCode_t op, IrBlock_t* target) {
+    uint32_t pos = irLowerEmit(l, op, (const int[]) {9999});
+    vectorAppend(l->jumps, (void*)(uintptr_t)pos);
+    vectorAppend(l->jumps, target);
+}
+
+static void irLowerLoad(IrLowering_t* l, int32_t slot, bool isArg) {
+    l->lastLoad[slot] = irLowerEmit(l, OP_GET_LOCAL, (const int[]) {slot});
+    l->lastLoadIsArg[slot] = isArg;
+    if (isArg && l->inLoop[l->block->id]) {
+        vectorAppend(l->loopMoves, (void*)(uintptr_t)l->lastLoad[slot]);
+        vectorAppend(l->loopMoves, (void*)(uintptr_t)slot);
+    }
+}
+
+static void irLowerValue(IrLowering_t* l, IrValue_t* value);
+
+static OpCode_t irLowerOpcode(IrValue_t* value) {
+    OpCode_t opcode = irOpInfos[value->op].opcode;
+    for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+        if (value->args->buf[a]->type != IR_TYPE_INT) return opcode;
+    }
+
+    switch (value->op) {
+        case IR_ADD: return OP_ADD_I64;
+        case IR_SUB: return OP_SUB_I64;
+        case IR_MUL: return OP_MUL_I64;
+        case IR_EQUAL: return OP_EQUAL_I64;
+        case IR_NOT_EQUAL: return OP_NOT_EQUAL_I64;
+        case IR_GREATER_THAN: return OP_GREATER_THAN_I64;
+        case IR_MINUS: return OP_MINUS_I64;
+        default: return opcode;
+    }
+}
+
+// An integer comparison only feeding the branch right after it jumps directly
+static OpCode_t irLowerBranchOpcode(IrValue_t* condition) {
+    if (condition->kind != IR_KIND_INLINE) return OP_JUMP_NOT_TRUTHY;
+
+    switch (irLowerOpcode(condition)) {
+        case OP_EQUAL_I64: return OP_JUMP_NOT_EQUAL_I64;
+        case OP_GREATER_THAN_I64: return OP_JUMP_NOT_GREATER_THAN_I64;
+        default: return OP_JUMP_NOT_TRUTHY;
+    }
+}
+
+static uint32_t irCountArg(IrValue_t* value, IrValue_t* arg) {
+    uint32_t cnt = 0;
+    for (uint32_t a = 0; a < vectorIrValuesGetCount(value->args); a++) {
+        cnt += value->args->buf[a] == arg;
+    }
+    return cnt;
+}
+
+// Whether a block reads a slot value before storing it again, scanning from
+// index from on. Phi arguments are read at the end of the incoming block,
+// skip is the phi whose own input is being loaded there.
+static bool irBlockReadsBeforeDef(IrBlock_t* block, IrValue_t* value, uint32_t from, IrValue_t* skip, bool* defined) {
+    for (uint32_t i = from; i < vectorIrValuesGetCount(block->values); i++) {
+        IrValue_t* other = block->values->buf[i];
+        if (other == value) {
+            *defined = true;
+            return false;
+        }
+        if (other->op != IR_PHI && irCountArg(other, value) > 0) return true;
+    }
+
+    IrValue_t* term = irBlockTerminator(block);
+    for (uint32_t t = 0; t < irNumSuccessors(term); t++) {
+        IrBlock_t* succ = term->targets[t];
+        for (uint32_t p = 0; p < vectorIrBlocksGetCount(succ->preds); p++) {
+            if (succ->preds->buf[p] != block) continue;
+            for (uint32_t i = 0; i < vectorIrValuesGetCount(succ->values); i++) {
+                IrValue_t* phi = succ->values->buf[i];
+                if (phi->op != IR_PHI) break;
+                if (phi != skip && phi->args->buf[p] == value) return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Whether the rest of the block of a call reads the value again once the
+// call loaded it. Inline values are emitted at their user, after the load
+// even when they come first.
+static bool irCallReadsAgain(IrValue_t* value, IrValue_t* call, uint32_t* from) {
+    if (irCountArg(call, value) > 1) return true;
+    IrBlock_t* block = call->block;
+    for (*from = 0; block->values->buf[*from] != call; (*from)++) {
+        IrValue_t* other = block->values->buf[*from];
+        if (other->kind == IR_KIND_INLINE && irCountArg(other, value) > 0) return true;
+    }
+    (*from)++;
+    return false;
+}
+
+// A value can be moved out of its slot by its last load unless that load is
+// in a loop, where the next iteration may load it again. There the load still
+// moves it when every path from its user stores the slot again before any
+// read, like the back edge does for the phi of `acc = push(acc, x)`. Phi
+// inputs are loaded at the end of the current block.
+static bool irLowerMovable(IrLowering_t* l, IrValue_t* value, IrValue_t* user) {
+    if (!l->inLoop[l->block->id]) return true;
+    if (value->kind != IR_KIND_SLOT) return false;
+
+    IrBlock_t* block = user->op == IR_PHI ? l->block : user->block;
+    uint32_t from = vectorIrValuesGetCount(block->values);
+    IrValue_t* skip = user;
+    if (user->op != IR_PHI) {
+        if (irCallReadsAgain(value, user, &from)) return false;
+        skip = NULL;
+    }
+
+    uint32_t numBlocks = vectorIrBlocksGetCount(l->fn->allBlocks);
+    bool* visited = callocChk(numBlocks * sizeof(bool));
+    IrBlock_t** stack = mallocChk(numBlocks * sizeof(IrBlock_t*));
+    uint32_t sp = 0;
+    bool movable = true;
+    for (;;) {
+        bool defined = false;
+        if (irBlockReadsBeforeDef(block, value, from, skip, &defined)) {
+            movable = false;
+            break;
+        }
+        IrValue_t* term = irBlockTerminator(block);
+        for (uint32_t t = 0; !defined && t < irNumSuccessors(term); t++) {
+            if (!visited[term->targets[t]->id]) {
+                visited[term->targets[t]->id] = true;
+                stack[sp++] = term->targets[t];
+            }
+        }
+        if (sp == 0) break;
+        block = stack[--sp];
+        from = 0;
+        skip = NULL;
+    }
+
+    free(visited);
+    free(stack);
+    return movable;
+}
+
+static void irLowerUse(IrLowering_t* l, IrValue_t* value, bool isArg) {
+    switch (value->kind) {
+        case IR_KIND_REMAT:
+            if (value->op == IR_PARAM) {
+                irLowerLoad(l, value->imm, isArg);
+            } else {
+                irLowerValue(l, value);
+            }
+            break;
+        case IR_KIND_INLINE:
+            irLowerValue(l, value);
+            break;
+        case IR_KIND_SLOT:
+            irLowerLoad(l, value->slot, isArg);
+            break;
+        default:
+            break;
+    }
+}
+
+// Integer constants in the immediate range are pushed directly, as right
+// operand of an addition, subtraction or comparison they are folded into it
+static bool irImmediateValue(IrLowering_t* l, IrValue_t* value, int64_t* out) {
+    return irIntegerValue(l->comp, value, out) && *out >= IMMEDIATE_MIN && *out <= IMMEDIATE_MAX;
+}
+
+static OpCode_t irLowerImmediateOpcode(IrLowering_t* l, IrValue_t* value, int64_t* immediate) {
+    switch (value->op) {
+        case IR_ADD: case IR_SUB: case IR_GREATER_THAN:
+            if (!irImmediateValue(l, value->args->buf[1], immediate)) return _OP_COUNT;
+            return value->op == IR_ADD ? OP_ADD_IMM : value->op == IR_SUB ? OP_SUB_IMM : OP_GREATER_THAN_IMM;
+        default:
+            return _OP_COUNT;
+    }
+}
+
+static void irLowerValue(IrLowering_t* l, IrValue_t* value) {
+    int64_t immediate = 0;
+    if (value->op == IR_CONST && irImmediateValue(l, value, &immediate)) {
+        irLowerEmit(l, immediate >= INT8_MIN && immediate <= INT8_MAX ? OP_PUSH_INT8 : OP_PUSH_INT16, (const int[]) {immediate});
+        return;
+    }
+    OpCode_t immediateOp = irLowerImmediateOpcode(l, value, &immediate);
+    if (immediateOp != _OP_COUNT) {
+        irLowerUse(l, value->args->buf[0], false);
+        irLowerEmit(l, immediateOp, (const int[]) {immediate});
+        return;
+    }
+
+    uint32_t numArgs = vectorIrValuesGetCount(value->args);
+    for (uint32_t a = 0; a < numArgs; a++) {
+        IrValue_t* arg = value->args->buf[a];
+        if (value->op == IR_CLOSURE) {
+            if (arg->kind == IR_KIND_SLOT) l->captured[arg->slot] = true;
+            if (arg->op == IR_PARAM) l->captured[arg->imm] = true;
+        }
+        irLowerUse(l, arg, value->op == IR_CALL && a > 0 && irLowerMovable(l, arg, value));
+    }
+
+    OpCode_t opcode = irLowerOpcode(value);
+    switch (value->op) {
+        case IR_CONST: case IR_GET_FREE: case IR_GET_BUILTIN: case IR_GET_GLOBAL: case IR_SET_GLOBAL:
+            irLowerEmit(l, opcode, (const int[]) {value->imm});
+            break;
+        case IR_ARRAY: case IR_HASH:
+            irLowerEmit(l, opcode, (const int[]) {numArgs});
+            break;
+        case IR_CALL:
+            irLowerEmit(l, opcode, (const int[]) {numArgs - 1});
+            break;
+        case IR_CLOSURE:
+            irLowerEmit(l, opcode, (const int[]) {value->imm, numArgs});
+            break;
+        default:
+            irLowerEmit(l, opcode, NULL);
+            break;
+    }
+}
+
+/* Switches */
+
+// A branch on `x == key` for an integer constant key, the comparison being
+// computed right before the branch for it only
+static bool irSwitchLink(IrLowering_t* l, IrValue_t* branch, IrValue_t* scrutinee, int64_t* key) {
+    if (branch->op != IR_BRANCH) return false;
+    IrValue_t* cond = branch->args->buf[0];
+    return cond->op == IR_EQUAL && cond->kind == IR_KIND_INLINE && cond->args->buf[0] == scrutinee &&
+        irIntegerValue(l->comp, cond->args->buf[1], key);
+}
+
+// Only the comparison and the branch of a later link are emitted, the rest
+// are leaves rematerialized at their uses
+static bool irSwitchContinues(IrLowering_t* l, IrBlock_t* block) {
+    if (vectorIrBlocksGetCount(block->preds) != 1 || l->switchCases[block->id] || l->inSwitch[block->id]) {
+        return false;
+    }
+    uint32_t numEmitted = 0;
+    for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+        if (!irOpInfos[block->values->buf[i]->op].remat) numEmitted++;
+    }
+    return numEmitted == 2;
+}
+
+// Number of links of the if-else chain comparing the same value to distinct
+// integer constants that starts with the given branch. The chain goes on
+// through the falsy targets.
+static uint32_t irSwitchChainLength(IrLowering_t* l, IrValue_t* branch) {
+    if (branch->op != IR_BRANCH || branch->args->buf[0]->op != IR_EQUAL) return 0;
+    IrValue_t* scrutinee = branch->args->buf[0]->args->buf[0];
+
+    uint32_t numCases = 0;
+    int64_t key, otherKey;
+    for (IrValue_t* link = branch; irSwitchLink(l, link, scrutinee, &key); ) {
+        IrValue_t* other = branch;
+        for (uint32_t i = 0; i < numCases; i++, other = irBlockTerminator(other->targets[1])) {
+            irSwitchLink(l, other, scrutinee, &otherKey);
+            if (otherKey == key) return numCases;
+        }
+        numCases++;
+
+        IrBlock_t* next = link->targets[1];
+        if (next == branch->block || !irSwitchContinues(l, next)) break;
+        link = irBlockTerminator(next);
+    }
+    return numCases;
+}
+
+static void irFindSwitches(IrLowering_t* l, IrFunction_t* fn) {
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        IrValue_t* branch = irBlockTerminator(block);
+        if (l->inSwitch[block->id]) continue;
+
+        uint32_t numCases = irSwitchChainLength(l, branch);
+        if (numCases < SWITCH_MIN_CASES) continue;
+
+        l->switchCases[block->id] = numCases;
+        for (uint32_t i = 1; i < numCases; i++) {
+            block = branch->targets[1];
+            l->inSwitch[block->id] = true;
+            branch = irBlockTerminator(block);
+        }
+    }
+}
+
+static void irLowerSwitch(IrLowering_t* l, IrValue_t* branch) {
+    irLowerUse(l, branch->args->buf[0]->args->buf[0], false);
+    uint32_t pos = irLowerEmit(l, OP_SWITCH_TABLE, (const int[]) {9999});
+    vectorAppend(l->switches, (void*)(uintptr_t)pos);
+    vectorAppend(l->switches, branch);
+}
+
+static void irPatchOperand(IrLowering_t* l, uint32_t pos, int operand) {
+    if (!codePatchOperand(l->code, pos, operand)) {
+        vectorAppend(l->farOperands, (void*)(uintptr_t)pos);
+        vectorAppend(l->farOperands, (void*)(uintptr_t)operand);
+    }
+}
+
+// Adds the tables once the case blocks are placed
+static void irPatchSwitches(IrLowering_t* l) {
+    void** switches = vectorGetBuffer(l->switches);
+    for (uint32_t s = 0; s < vectorGetCount(l->switches); s += 2) {
+        uint32_t pos = (uintptr_t)switches[s];
+        IrValue_t* link = switches[s + 1];
+        IrValue_t* scrutinee = link->args->buf[0]->args->buf[0];
+        uint32_t numCases = l->switchCases[link->block->id];
+
+        SwitchCase_t* cases = mallocChk(numCases * sizeof(SwitchCase_t));
+        for (uint32_t i = 0; i < numCases; i++) {
+            if (i > 0) link = irBlockTerminator(link->targets[1]);
+            irSwitchLink(l, link, scrutinee, &cases[i].key);
+            cases[i].target = link->targets[0]->start;
+        }
+        uint32_t constIndex = compilerAddSwitchTable(l->comp, cases, numCases, link->targets[1]->start);
+        free(cases);
+
+        irPatchOperand(l, pos, constIndex);
+    }
+}
+
+// Slot phis are assigned first, the stack phi is pushed last. The inputs of
+// a loop header can be its own phis, all of them are pushed before the
+// first slot is written.
+static void irLowerPhiInputs(IrLowering_t* l, IrBlock_t* block, IrBlock_t* target) {
+    int32_t idx = irPredIndex(target, block);
+    uint32_t numPhis = 0;
+    for (uint32_t i = 0; i < vectorIrValuesGetCount(target->values); i++) {
+        IrValue_t* phi = target->values->buf[i];
+        if (phi->op != IR_PHI) break;
+        numPhis++;
+        if (phi->kind != IR_KIND_SLOT) continue;
+        // in a loop the input can be moved into the phi slot, outside of
+        // loops the lowering only moves call arguments
+        IrValue_t* input = phi->args->buf[idx];
+        irLowerUse(l, input, l->inLoop[block->id] && irLowerMovable(l, input, phi));
+    }
+    for (uint32_t i = numPhis; i-- > 0;) {
+        IrValue_t* phi = target->values->buf[i];
+        if (phi->kind == IR_KIND_SLOT) irLowerEmit(l, OP_SET_LOCAL, (const int[]) {phi->slot});
+    }
+
+    for (uint32_t i = 0; i < vectorIrValuesGetCount(target->values); i++) {
+        IrValue_t* phi = target->values->buf[i];
+        if (phi->op != IR_PHI) break;
+        if (phi->kind == IR_KIND_STACK) irLowerUse(l, phi->args->buf[idx], false);
+    }
+}
+
+static void irLowerBlock(IrLowering_t* l, IrBlock_t* block, IrBlock_t* next) {
+    block->start = sliceByteGetLen(l->code);
+    l->block = block;
+    if (l->inSwitch[block->id]) return;
+
+    for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+        IrValue_t* value = block->values->buf[i];
+        if (value->op == IR_PHI || (value->kind != IR_KIND_ROOT && value->kind != IR_KIND_SLOT)) continue;
+
+        switch (value->op) {
+            case IR_JUMP:
+                irLowerPhiInputs(l, block, value->targets[0]);
+                if (value->targets[0] != next) {
+                    irLowerJump(l, OP_JUMP, value->targets[0]);
+                }
+                break;
+            case IR_BRANCH: {
+                if (l->switchCases[block->id]) {
+                    irLowerSwitch(l, value);
+                    break;
+                }
+                IrValue_t* condition = value->args->buf[0];
+                OpCode_t opcode = irLowerBranchOpcode(condition);
+                if (opcode == OP_JUMP_NOT_TRUTHY) {
+                    irLowerUse(l, condition, false);
+                } else {
+                    irLowerUse(l, condition->args->buf[0], false);
+                    irLowerUse(l, condition->args->buf[1], false);
+                }
+                irLowerJump(l, opcode, value->targets[1]);
+                if (value->targets[0] != next) {
+                    irLowerJump(l, OP_JUMP, value->targets[0]);
+                }
+                break;
+            }
+            case IR_END:
+                break;
+            default:
+                irLowerValue(l, value);
+                if (value->kind == IR_KIND_SLOT) {
+                    irLowerEmit(l, OP_SET_LOCAL, (const int[]) {value->slot});
+                } else if (irOpInfos[value->op].hasValue) {
+                    irLowerEmit(l, OP_POP, NULL);
+                }
+                break;
+        }
+    }
+}
+
+CompError_t irLower(Compiler_t* comp, IrFunction_t* fn, Instructions_t* instructions, uint32_t* numLocals) {
+    irCountUses(fn);
+    // the block order tells the back edges apart
+    VectorIrBlocks_t* rpo = irComputeDominators(fn);
+    cleanupVectorIrBlocks(&rpo, NULL);
+
+    Vector_t* list = createVector();
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        list->cnt = 0;
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            IrValue_t* value = block->values->buf[i];
+            if (value->op == IR_PHI) {
+                value->kind = IR_KIND_SLOT;
+            } else if (irOpInfos[value->op].remat) {
+                value->kind = IR_KIND_REMAT;
+            } else {
+                value->pos = vectorGetCount(list);
+                vectorAppend(list, value);
+            }
+        }
+
+        // decided backwards so that the users are classified already
+        IrValue_t** values = (IrValue_t**)vectorGetBuffer(list);
+        for (uint32_t j = vectorGetCount(list); j-- > 0;) {
+            IrValue_t* value = values[j];
+            if (!irOpInfos[value->op].hasValue || value->numUses == 0) {
+                value->kind = IR_KIND_ROOT;
+            } else {
+                value->kind = irCanInline(value, values) ? IR_KIND_INLINE : IR_KIND_SLOT;
+            }
+        }
+        irChooseStackPhi(block, values, vectorGetCount(list));
+    }
+    cleanupVector(&list, NULL);
+
+    uint32_t numSlots = fn->numParams;
+    for (uint32_t b = 0; b < vectorIrBlocksGetCount(fn->blocks); b++) {
+        IrBlock_t* block = fn->blocks->buf[b];
+        for (uint32_t i = 0; i < vectorIrValuesGetCount(block->values); i++) {
+            if (block->values->buf[i]->kind == IR_KIND_SLOT) {
+                block->values->buf[i]->slot = numSlots++;
+            }
+        }
+    }
+    if (numSlots > UINT16_MAX + 1) {
+        return COMP_TOO_MANY_LOCALS;
+    }
+
+    IrLowering_t l = {
+        .code = createSliceByte(0),
+        .jumps = createVector(),
+        .lastLoad = mallocChk((numSlots + 1) * sizeof(int32_t)),
+        .lastLoadIsArg = callocChk((numSlots + 1) * sizeof(bool)),
+        .loopMoves = createVector(),
+        .captured = callocChk((numSlots + 1) * sizeof(bool)),
+        .inLoop = irFindLoopBlocks(fn),
+        .fn = fn,
+        .comp = comp,
+        .switchCases = callocChk(vectorIrBlocksGetCount(fn->allBlocks) * sizeof(uint32_t)),
+        .inSwitch = callocChk(vectorIrBlocksGetCount(fn->allBlocks) * sizeof(bool)),
+        .switches = createVector(),
+        .farOperands = createVector(),
+    };
+    for (uint32_t i = 0; i < numSlots; i++) {
+        l.lastLoad[i] = -1;
+    }
+    irFindSwitches(&l, fn);
+
+    uint32_t numBlocks = vectorIrBlocksGetCount(fn->blocks);
+    for (uint32_t b = 0; b < numBlocks; b++) {
+        irLowerBlock(&l, fn->blocks->buf[b], b + 1 < numBlocks ? fn->blocks->buf[b + 1] : NULL);
+    }
+
+    void** jumps = vectorGetBuffer(l.jumps);
+    for (uint32_t i = 0; i < vectorGetCount(l.jumps); i += 2) {
+        irPatchOperand(&l, (uintptr_t)jumps[i], ((IrBlock_t*)jumps[i + 1])->start);
+    }
+    irPatchSwitches(&l);
+
+    // a local whose last load passes it to a call gives it away, and so does
+    // every call argument in a loop that irLowerMovable found stored again
+    for (uint32_t i = 0; i < numSlots; i++) {
+        if (l.lastLoad[i] >= 0 && l.lastLoadIsArg[i] && !l.captured[i]) {
+            uint8_t* op = &l.code[l.lastLoad[i]];
+            op[*op == OP_WIDE] = OP_MOVE_LOCAL;
+        }
+    }
+    void** loopMoves = vectorGetBuffer(l.loopMoves);
+    for (uint32_t i = 0; i < vectorGetCount(l.loopMoves); i += 2) {
+        if (!l.captured[(uintptr_t)loopMoves[i + 1]]) {
+            uint8_t* op = &l.code[(uintptr_t)loopMoves[i]];
+            op[*op == OP_WIDE] = OP_MOVE_LOCAL;
+        }
+    }
+    l.code = compilerWidenOperands(comp, l.code, l.farOperands, NULL);
+
+    cleanupVector(&l.jumps, NULL);
+    cleanupVector(&l.loopMoves, NULL);
+    free(l.lastLoad);
+    free(l.lastLoadIsArg);
+    free(l.captured);
+    free(l.inLoop);
+    free(l.switchCases);
+    free(l.inSwitch);
+    cleanupVector(&l.switches, NULL);
+    cleanupVector(&l.farOperands, NULL);
+
+    *instructions = l.code;
+    *numLocals = numSlots;
+    return COMP_NO_ERROR;
+}
+
+CompError_t irCompileProgram(Compiler_t* comp, Program_t* program, Instructions_t* instructions, uint32_t* numLocals) {
+    CompError_t err = COMP_NO_ERROR;
+    IrFunction_t* fn = irBuildProgram(comp, program, &err);
+    if (err != COMP_NO_ERROR) {
+        return err;
+    }
+
+    err = irLower(comp, fn, instructions, numLocals);
+    cleanupIrFunction(&fn);
+    return err;
+}
@@ -0,0 +1,159 @@
+#ifndef _IR_H_
+#define _IR_H_
+
+#include "compiler.h"
+
+/*
+    Mid-level intermediate representation used by the optimizing compiler
+    (-O1 and above).
+
+    A function is a list of basic blocks holding values in SSA form: every
+    value is defined exactly once and the values of if-expressions and of
+    locals assigned differently in the two branches meet in explicit phi
+    nodes at the join block. Locals only exist as SSA values, they are given
+    a stack slot again when the IR is lowered to bytecode.
+*/
+
+typedef enum IrOp {
+    // leaves, cheap to recompute at every use
+    IR_CONST,
+    IR_TRUE,
+    IR_FALSE,
+    IR_NULL,
+    IR_PARAM,
+    IR_GET_FREE,
+    IR_GET_BUILTIN,
+    IR_CURRENT_CLOSURE,
+
+    IR_GET_GLOBAL,
+    IR_SET_GLOBAL,
+
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_EQUAL,
+    IR_NOT_EQUAL,
+    IR_GREATER_THAN,
+    IR_MINUS,
+    IR_BANG,
+
+    IR_ARRAY,
+    IR_HASH,
+    IR_INDEX,
+    IR_CALL,
+    IR_CLOSURE,
+
+    IR_PHI,
+    IR_POP,
+
+    // block terminators
+    IR_JUMP,
+    IR_BRANCH,
+    IR_RETURN,
+    IR_RETURN_NONE,
+    IR_END,
+    _IR_OP_COUNT
+} IrOp_t;
+
+// Static types, IR_TYPE_NONE is the type of values never computed
+typedef enum IrType {
+    IR_TYPE_NONE = 0,
+    IR_TYPE_INT,
+    IR_TYPE_BOOL,
+    IR_TYPE_ANY,
+} IrType_t;
+
+typedef struct IrValue IrValue_t;
+typedef struct IrBlock IrBlock_t;
+typedef struct IrFunction IrFunction_t;
+
+DEFINE_VECTOR_TYPE(IrValues, IrValue_t*);
+DEFINE_VECTOR_TYPE(IrBlocks, IrBlock_t*);
+DEFINE_VECTOR_TYPE(IrFunctions, IrFunction_t*);
+
+struct IrValue {
+    IrOp_t op;
+    uint32_t id;
+    int32_t imm; // constant, global, free, builtin or parameter index
+    VectorIrValues_t* args; // phi arguments follow the order of the block predecessors
+    IrBlock_t* block;
+    IrBlock_t* targets[2]; // jump target, branch targets for truthy and falsy
+
+    IrValue_t* replacement; // set once all uses should refer to another value
+    bool removed;
+    uint8_t type;
+
+    // lowering state
+    uint32_t numUses;
+    IrValue_t* user; // only meaningful for a single use
+    uint32_t userArg;
+    uint32_t pos;
+    uint8_t kind;
+    int32_t slot;
+};
+
+struct IrBlock {
+    uint32_t id;
+    VectorIrValues_t* values; // phis first, terminator last
+    VectorIrBlocks_t* preds;
+    IrBlock_t* idom;
+    uint32_t order; // reverse postorder index
+    uint32_t start; // bytecode offset once lowered
+};
+
+struct IrFunction {
+    VectorIrBlocks_t* blocks; // live blocks in layout order, entry first
+    VectorIrBlocks_t* allBlocks;
+    VectorIrValues_t* values; // every value ever created, indexed by id
+    uint32_t numParams;
+    bool isMain;
+
+    // type inference state
+    int32_t constIndex; // compiled function constant, -1 for the main program
+    uint8_t* paramTypes;
+    uint8_t returnType;
+    bool escapes; // called from code the compiler doesn't see
+};
+
+IrFunction_t* createIrFunction(uint32_t numParams, bool isMain);
+void cleanupIrFunction(IrFunction_t** fn);
+char* irFunctionToString(IrFunction_t* fn);
+
+// Builds and optimizes the IR of the main program. Nested function literals
+// are built along, typed together with the main program once it is complete,
+// then lowered and stored as constants of the compiler.
+// Calls to small non-recursive function literals bound to a global are
+// inlined, their parameters becoming SSA values of the caller.
+IrFunction_t* irBuildProgram(Compiler_t* comp, Program_t* program, CompError_t* err);
+
+// Copy propagation through trivial phis, constant folding, unreachable
+// block removal, block merging, common subexpression elimination, redundant
+// global load/store removal and dead code elimination. Operations that can
+// fail at runtime are never removed so errors are still raised by the vm.
+void irOptimize(Compiler_t* comp, IrFunction_t* fn);
+
+// Closures only ever called where they are created get their captured
+// values as extra arguments instead, so that they capture nothing and
+// evaluate to the shared closure of their function.
+void irLiftLambdas(IrFunction_t* main, VectorIrFunctions_t* functions);
+
+// Flow based type inference over the main program and its nested functions.
+// Parameter types come from the call sites of functions whose closure
+// doesn't escape, return types from their return values. Globals are only
+// followed when closedWorld is set, i.e. no later REPL input can call them.
+void irInferTypes(Compiler_t* comp, IrFunction_t* main, VectorIrFunctions_t* functions, bool closedWorld);
+
+// Lowers to bytecode, values living across blocks or used more than once
+// get a local slot after the parameters. numLocals includes the parameters.
+// Arithmetic and comparisons on values typed IR_TYPE_INT use the unchecked
+// I64 opcodes. Chains of branches comparing one value to distinct integer
+// constants become an OP_SWITCH_TABLE whose table is added to the constants.
+CompError_t irLower(Compiler_t* comp, IrFunction_t* fn, Instructions_t* instructions, uint32_t* numLocals);
+
+// Names assigned anywhere in the program, function bodies included
+HashMap_t* irAssignedNames(Program_t* program);
+
+CompError_t irCompileProgram(Compiler_t* comp, Program_t* program, Instructions_t* instructions, uint32_t* numLocals);
+
+#endif
@@ -0,0 +1,443 @@
+#if defined(__unix__)
+#define _DEFAULT_SOURCE
+#include <sys/mman.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "jit.h"
+#include "utils.h"
+
+/* x86-64 templates. Jitted code keeps the vm in rbx and the error in r12,
+ * r13 holds a result across helper calls, or the locals base in traces.
+ * Integer templates unbox into rdx (left or only operand) and rsi (right 
+ * operand) and leave their result in rdx, where helpers take their first
+ * operand. Slot instructions work in rax and rcx. */
+
+typedef struct JitPatch {
+    uint32_t pos; // of a rel32 field
+    uint32_t label;
+} JitPatch_t;
+
+struct JitAssembler {
+    uint8_t* code;
+    size_t codeSize;
+    size_t codeCapacity;
+    int64_t* labels; // code offset of every label, -1 until bound
+    uint32_t numLabels;
+    uint32_t labelCapacity;
+    JitPatch_t* patches;
+    uint32_t numPatches;
+    uint32_t patchCapacity;
+    uint32_t numWords;
+    uint32_t exitLabel;
+    uint32_t frameSize; // in bytes, of the slots
+};
+
+#define REG_RAX 0
+#define REG_RCX 1
+#define REG_RDX 2
+
+static void jitEmit(JitAssembler_t* a, const uint8_t* bytes, size_t len) {
+    if (a->codeSize + len > a->codeCapacity) {
+        a->codeCapacity = a->codeCapacity ? a->codeCapacity * 2 : 4096;
+        a->code = realloc(a->code, a->codeCapacity);
+        if (!a->code) HANDLE_OOM();
+    }
+    memcpy(a->code + a->codeSize, bytes, len);
+    a->codeSize += len;
+}
+
+#define EMIT(a, ...) do { \
+    const uint8_t bytes_[] = { __VA_ARGS__ }; \
+    jitEmit(a, bytes_, sizeof(bytes_)); \
+} while (0)
+
+static void jitEmit32(JitAssembler_t* a, int32_t value) {
+    jitEmit(a, (const uint8_t*)&value, sizeof(value));
+}
+
+static void jitEmit64(JitAssembler_t* a, int64_t value) {
+    jitEmit(a, (const uint8_t*)&value, sizeof(value));
+}
+
+// rel32 to label, filled in by jitFinish
+static void jitEmitRel32(JitAssembler_t* a, uint32_t label) {
+    if (a->numPatches == a->patchCapacity) {
+        a->patchCapacity = a->patchCapacity ? a->patchCapacity * 2 : 64;
+        a->patches = realloc(a->patches, a->patchCapacity * sizeof(JitPatch_t));
+        if (!a->patches) HANDLE_OOM();
+    }
+    a->patches[a->numPatches++] = (JitPatch_t) {
+        .pos = a->codeSize,
+        .label = label,
+    };
+    jitEmit32(a, 0);
+}
+
+// mov reg, value
+static void jitEmitMovImm(JitAssembler_t* a, uint8_t reg, int64_t value) {
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+        EMIT(a, 0x48, 0xc7, 0xc0 + reg);
+        jitEmit32(a, (int32_t)value);
+    } else {
+        EMIT(a, 0x48, 0xb8 + reg);
+        jitEmit64(a, value);
+    }
+}
+
+// helper(vm, err, rdx, rcx) with rdx set by the caller
+static void jitEmitHelperCall(JitAssembler_t* a, void* helper, int64_t arg1) {
+    EMIT(a, 0x48, 0x89, 0xdf);          // mov rdi, rbx
+    EMIT(a, 0x4c, 0x89, 0xe6);          // mov rsi, r12
+    jitEmitMovImm(a, REG_RCX, arg1);
+    EMIT(a, 0x48, 0xb8);                // mov rax, helper
+    jitEmit64(a, (int64_t)(intptr_t)helper);
+    EMIT(a, 0xff, 0xd0);                // call rax
+}
+
+JitAssembler_t* createJitAssembler(uint32_t numWords) {
+    JitAssembler_t* a = callocChk(sizeof(JitAssembler_t));
+    a->numWords = numWords;
+    for (uint32_t i = 0; i < numWords; i++) {
+        jitNewLabel(a);
+    }
+    a->exitLabel = jitNewLabel(a);
+
+    EMIT(a, 0x53);                      // push rbx
+    EMIT(a, 0x41, 0x54);                // push r12
+    EMIT(a, 0x41, 0x55);                // push r13, the stack is aligned for calls
+    EMIT(a, 0x48, 0x89, 0xfb);          // mov rbx, rdi
+    EMIT(a, 0x49, 0x89, 0xf4);          // mov r12, rsi
+    return a;
+}
+
+uint32_t jitNewLabel(JitAssembler_t* a) {
+    if (a->numLabels == a->labelCapacity) {
+        a->labelCapacity = a->labelCapacity ? a->labelCapacity * 2 : 64;
+        a->labels = realloc(a->labels, a->labelCapacity * sizeof(int64_t));
+        if (!a->labels) HANDLE_OOM();
+    }
+    a->labels[a->numLabels] = -1;
+    return a->numLabels++;
+}
+
+void jitBind(JitAssembler_t* a, uint32_t label) {
+    a->labels[label] = a->codeSize;
+}
+
+void jitCall(JitAssembler_t* a, JitHelper_t helper, int64_t arg0, int64_t arg1) {
+    jitEmitMovImm(a, REG_RDX, arg0);
+    jitCallWithResult(a, helper, arg1);
+}
+
+void jitCallWithResult(JitAssembler_t* a, JitHelper_t helper, int64_t arg1) {
+    jitEmitHelperCall(a, (void*)helper, arg1);
+    EMIT(a, 0x84, 0xc0);                // test al, al
+    EMIT(a, 0x0f, 0x85);                // jnz exit
+    jitEmitRel32(a, a->exitLabel);
+}
+
+void jitCallTest(JitAssembler_t* a, JitHelper_t helper, int64_t arg0, int64_t arg1, uint32_t label) {
+    jitEmitMovImm(a, REG_RDX, arg0);
+    jitEmitHelperCall(a, (void*)helper, arg1);
+    EMIT(a, 0x84, 0xc0);                // test al, al
+    EMIT(a, 0x0f, 0x84);                // jz label
+    jitEmitRel32(a, label);
+}
+
+void jitCallJump(JitAssembler_t* a, JitJumpHelper_t helper, int64_t arg0, int64_t arg1) {
+    jitEmitMovImm(a, REG_RDX, arg0);
+    jitEmitHelperCall(a, (void*)helper, arg1);
+    EMIT(a, 0x48, 0x85, 0xc0);          // test rax, rax
+    EMIT(a, 0x0f, 0x84);                // jz exit
+    jitEmitRel32(a, a->exitLabel);
+    EMIT(a, 0xff, 0xe0);                // jmp rax
+}
+
+void jitJump(JitAssembler_t* a, uint32_t label) {
+    EMIT(a, 0xe9);                      // jmp label
+    jitEmitRel32(a, label);
+}
+
+void jitExit(JitAssembler_t* a) {
+    jitJump(a, a->exitLabel);
+}
+
+void jitLoadIntegers(JitAssembler_t* a, uint32_t count, uint32_t slow) {
+    EMIT(a, 0x0f, 0xb7, 0x83);          // movzx eax, word [rbx + sp]
+    jitEmit32(a, offsetof(Vm_t, sp));
+    EMIT(a, 0x48, 0x8b, 0x8b);          // mov rcx, [rbx + stack]
+    jitEmit32(a, offsetof(Vm_t, stack));
+
+    if (count == 2) {
+        EMIT(a, 0x48, 0x8b, 0x54, 0xc1, 0xf0);  // mov rdx, [rcx + rax * 8 - 16]
+        EMIT(a, 0x48, 0x8b, 0x74, 0xc1, 0xf8);  // mov rsi, [rcx + rax * 8 - 8]
+        EMIT(a, 0x81, 0x7e, offsetof(Object_t, type));  // cmp dword [rsi + type], OBJECT_INTEGER
+        jitEmit32(a, OBJECT_INTEGER);
+        EMIT(a, 0x0f, 0x85);                    // jne slow
+        jitEmitRel32(a, slow);
+    } else {
+        EMIT(a, 0x48, 0x8b, 0x54, 0xc1, 0xf8);  // mov rdx, [rcx + rax * 8 - 8]
+    }
+    EMIT(a, 0x81, 0x7a, offsetof(Object_t, type));  // cmp dword [rdx + type], OBJECT_INTEGER
+    jitEmit32(a, OBJECT_INTEGER);
+    EMIT(a, 0x0f, 0x85);                        // jne slow
+    jitEmitRel32(a, slow);
+
+    EMIT(a, 0x48, 0x8b, 0x52, offsetof(Integer_t, value));      // mov rdx, [rdx + value]
+    if (count == 2) {
+        EMIT(a, 0x48, 0x8b, 0x76, offsetof(Integer_t, value));  // mov rsi, [rsi + value]
+    }
+}
+
+void jitIntegerOperation(JitAssembler_t* a, OpCode_t op, int32_t imm) {
+    uint8_t setcc;
+    switch (op) {
+        case OP_ADD_I64:
+            EMIT(a, 0x48, 0x01, 0xf2);          // add rdx, rsi
+            return;
+        case OP_SUB_I64:
+            EMIT(a, 0x48, 0x29, 0xf2);          // sub rdx, rsi
+            return;
+        case OP_MUL_I64:
+            EMIT(a, 0x48, 0x0f, 0xaf, 0xd6);    // imul rdx, rsi
+            return;
+        case OP_MINUS_I64:
+            EMIT(a, 0x48, 0xf7, 0xda);          // neg rdx
+            return;
+        case OP_ADD_IMM:
+            EMIT(a, 0x48, 0x81, 0xc2);          // add rdx, imm
+            jitEmit32(a, imm);
+            return;
+        case OP_SUB_IMM:
+            EMIT(a, 0x48, 0x81, 0xea);          // sub rdx, imm
+            jitEmit32(a, imm);
+            return;
+        case OP_GREATER_THAN_IMM:
+            EMIT(a, 0x48, 0x81, 0xfa);          // cmp rdx, imm
+            jitEmit32(a, imm);
+            setcc = 0x9f;
+            break;
+        case OP_EQUAL_I64:
+        case OP_JUMP_NOT_EQUAL_I64:
+            EMIT(a, 0x48, 0x39, 0xf2);          // cmp rdx, rsi
+            setcc = 0x94;
+            break;
+        case OP_NOT_EQUAL_I64:
+            EMIT(a, 0x48, 0x39, 0xf2);
+            setcc = 0x95;
+            break;
+        default:
+            EMIT(a, 0x48, 0x39, 0xf2);
+            setcc = 0x9f;
+            break;
+    }
+    EMIT(a, 0x0f, setcc, 0xc2);                 // setcc dl
+    EMIT(a, 0x0f, 0xb6, 0xd2);                  // movzx edx, dl
+}
+
+void jitSaveResult(JitAssembler_t* a) {
+    EMIT(a, 0x49, 0x89, 0xd5);          // mov r13, rdx
+}
+
+void jitJumpIfSavedFalse(JitAssembler_t* a, uint32_t label) {
+    EMIT(a, 0x4d, 0x85, 0xed);          // test r13, r13
+    EMIT(a, 0x0f, 0x84);                // jz label
+    jitEmitRel32(a, label);
+}
+
+void jitReserveSlots(JitAssembler_t* a, uint32_t count) {
+    // an even count keeps the stack aligned for calls
+    a->frameSize = ((count + 1) & ~1u) * 8;
+    EMIT(a, 0x48, 0x81, 0xec);          // sub rsp, frameSize
+    jitEmit32(a, a->frameSize);
+}
+
+// op reg, [rsp + slot * 8] for the one byte opcodes, reg is rax or rcx
+static void jitEmitSlotAccess(JitAssembler_t* a, uint8_t opcode, uint8_t reg, uint32_t slot) {
+    EMIT(a, 0x48, opcode, 0x84 | (reg << 3), 0x24);
+    jitEmit32(a, slot * 8);
+}
+
+static void jitEmitLoad(JitAssembler_t* a, uint8_t reg, JitOperand_t src) {
+    if (src.constant) {
+        jitEmitMovImm(a, reg, src.value);
+    } else {
+        jitEmitSlotAccess(a, 0x8b, reg, src.value);     // mov reg, [slot]
+    }
+}
+
+static void jitEmitStore(JitAssembler_t* a, uint32_t dst) {
+    jitEmitSlotAccess(a, 0x89, REG_RAX, dst);           // mov [dst], rax
+}
+
+void jitMove(JitAssembler_t* a, uint32_t dst, JitOperand_t src) {
+    jitEmitLoad(a, REG_RAX, src);
+    jitEmitStore(a, dst);
+}
+
+void jitArithmetic(JitAssembler_t* a, JitArithmetic_t op, uint32_t dst, JitOperand_t left, JitOperand_t right) {
+    jitEmitLoad(a, REG_RAX, left);
+    if (op != JIT_NEG && op != JIT_NOT) {
+        jitEmitLoad(a, REG_RCX, right);
+    }
+    switch (op) {
+        case JIT_ADD:
+            EMIT(a, 0x48, 0x01, 0xc8);          // add rax, rcx
+            break;
+        case JIT_SUB:
+            EMIT(a, 0x48, 0x29, 0xc8);          // sub rax, rcx
+            break;
+        case JIT_MUL:
+            EMIT(a, 0x48, 0x0f, 0xaf, 0xc1);    // imul rax, rcx
+            break;
+        case JIT_DIV:
+            EMIT(a, 0x48, 0x99);                // cqo
+            EMIT(a, 0x48, 0xf7, 0xf9);          // idiv rcx
+            break;
+        case JIT_NEG:
+            EMIT(a, 0x48, 0xf7, 0xd8);          // neg rax
+            break;
+        case JIT_NOT:
+            EMIT(a, 0x83, 0xf0, 0x01);          // xor eax, 1
+            break;
+    }
+    jitEmitStore(a, dst);
+}
+
+// condition code nibble of setcc and jcc
+static uint8_t jitConditionCode(JitCondition_t cond) {
+    switch (cond) {
+        case JIT_EQUAL:
+            return 0x4;
+        case JIT_NOT_EQUAL:
+            return 0x5;
+        case JIT_GREATER:
+            return 0xf;
+        default:
+            return 0xe;
+    }
+}
+
+static void jitEmitCompare(JitAssembler_t* a, JitOperand_t left, JitOperand_t right) {
+    jitEmitLoad(a, REG_RAX, left);
+    jitEmitLoad(a, REG_RCX, right);
+    EMIT(a, 0x48, 0x39, 0xc8);                  // cmp rax, rcx
+}
+
+void jitCompare(JitAssembler_t* a, JitCondition_t cond, uint32_t dst, JitOperand_t left, JitOperand_t right) {
+    jitEmitCompare(a, left, right);
+    EMIT(a, 0x0f, 0x90 | jitConditionCode(cond), 0xc0);    // setcc al
+    EMIT(a, 0x0f, 0xb6, 0xc0);                  // movzx eax, al
+    jitEmitStore(a, dst);
+}
+
+void jitGuard(JitAssembler_t* a, JitCondition_t cond, JitOperand_t left, JitOperand_t right, uint32_t label) {
+    jitEmitCompare(a, left, right);
+    // the lowest bit of the code negates the condition
+    EMIT(a, 0x0f, 0x80 | (jitConditionCode(cond) ^ 1));    // jncc label
+    jitEmitRel32(a, label);
+}
+
+void jitLoadBase(JitAssembler_t* a, JitValueHelper_t helper) {
+    jitEmitMovImm(a, REG_RDX, 0);
+    jitEmitHelperCall(a, (void*)helper, 0);
+    EMIT(a, 0x49, 0x89, 0xc5);                  // mov r13, rax
+}
+
+void jitLoadObject(JitAssembler_t* a, int32_t index, int32_t type, JitUnbox_t unbox, uint32_t dst, bool check, uint32_t label) {
+    EMIT(a, 0x49, 0x8b, 0x85);                  // mov rax, [r13 + index * 8]
+    jitEmit32(a, index * 8);
+    if (check) {
+        EMIT(a, 0x48, 0x85, 0xc0);              // test rax, rax
+        EMIT(a, 0x0f, 0x84);                    // jz label
+        jitEmitRel32(a, label);
+        EMIT(a, 0x81, 0x78, offsetof(Object_t, type));  // cmp dword [rax + type], type
+        jitEmit32(a, type);
+        EMIT(a, 0x0f, 0x85);                    // jne label
+        jitEmitRel32(a, label);
+    }
+
+    switch (unbox) {
+        case JIT_UNBOX_INTEGER:
+            EMIT(a, 0x48, 0x8b, 0x40, offsetof(Integer_t, value));  // mov rax, [rax + value]
+            break;
+        case JIT_UNBOX_BOOLEAN:
+            EMIT(a, 0x0f, 0xb6, 0x40, offsetof(Boolean_t, value));  // movzx eax, byte [rax + value]
+            break;
+        default:
+            return;
+    }
+    jitEmitStore(a, dst);
+}
+
+void jitSetArgument(JitAssembler_t* a, JitOperand_t src) {
+    jitEmitLoad(a, REG_RDX, src);
+}
+
+void cleanupJitAssembler(JitAssembler_t* a) {
+    free(a->code);
+    free(a->labels);
+    free(a->patches);
+    free(a);
+}
+
+JitCode_t* jitFinish(JitAssembler_t* a) {
+    jitBind(a, a->exitLabel);
+    if (a->frameSize) {
+        EMIT(a, 0x48, 0x81, 0xc4);      // add rsp, frameSize
+        jitEmit32(a, a->frameSize);
+    }
+    EMIT(a, 0x41, 0x5d);                // pop r13
+    EMIT(a, 0x41, 0x5c);                // pop r12
+    EMIT(a, 0x5b);                      // pop rbx
+    EMIT(a, 0xc3);                      // ret
+
+    for (uint32_t i = 0; i < a->numPatches; i++) {
+        int64_t target = a->labels[a->patches[i].label];
+        if (target < 0) {
+            cleanupJitAssembler(a);
+            return NULL;
+        }
+        int32_t rel = (int32_t)(target - (a->patches[i].pos + 4));
+        memcpy(a->code + a->patches[i].pos, &rel, sizeof(rel));
+    }
+
+#if defined(__unix__)
+    size_t size = a->codeSize;
+    uint8_t* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        cleanupJitAssembler(a);
+        return NULL;
+    }
+    memcpy(mem, a->code, size);
+    mprotect(mem, size, PROT_READ | PROT_EXEC);
+
+    JitCode_t* code = mallocChk(sizeof(JitCode_t));
+    *code = (JitCode_t) {
+        .mem = mem,
+        .size = size,
+        .entry = (JitEntry_t)mem,
+        .addresses = mallocChk(a->numWords * sizeof(void*)),
+    };
+    for (uint32_t i = 0; i < a->numWords; i++) {
+        code->addresses[i] = a->labels[i] < 0 ? NULL : mem + a->labels[i];
+    }
+    cleanupJitAssembler(a);
+    return code;
+#else
+    cleanupJitAssembler(a);
+    return NULL;
+#endif
+}
+
+void cleanupJitCode(JitCode_t* code) {
+    if (!code) return;
+#if defined(__unix__)
+    munmap(code->mem, code->size);
+#endif
+    free(code->addresses);
+    free(code);
+}
@@ -0,0 +1,125 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+#include "vm.h"
+#include "code.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Machine code is only emitted for x86-64 Linux, anywhere else every
+// function stays interpreted
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#endif
+
+// Native code of a function, run with the vm and the error to fill in
+typedef void (*JitEntry_t)(Vm_t* vm, VmError_t* err);
+
+struct JitCode {
+    uint8_t* mem;
+    size_t size; // in bytes
+    JitEntry_t entry;
+    void** addresses; // native address of every instruction by its word index, for computed jumps
+};
+
+// Runtime helpers called from jitted code take the vm, the error to fill in
+// and two operands. They return true to leave the function, except the
+// ones passed to jitCallTest which return the condition to test.
+typedef bool (*JitHelper_t)(Vm_t* vm, VmError_t* err, int64_t a, int64_t b);
+// Returns the native address to continue at, NULL to leave the function
+typedef void* (*JitJumpHelper_t)(Vm_t* vm, VmError_t* err, int64_t a, int64_t b);
+
+// Labels 0 to numWords - 1 are the word indices of the function, the ones
+// created later are local to the templates
+typedef struct JitAssembler JitAssembler_t;
+
+JitAssembler_t* createJitAssembler(uint32_t numWords);
+void cleanupJitAssembler(JitAssembler_t* a);
+uint32_t jitNewLabel(JitAssembler_t* a);
+void jitBind(JitAssembler_t* a, uint32_t label);
+
+// Calls helper(vm, err, arg0, arg1) and leaves the function if it returns true
+void jitCall(JitAssembler_t* a, JitHelper_t helper, int64_t arg0, int64_t arg1);
+// Same, with arg0 taken from the result of the last integer template
+void jitCallWithResult(JitAssembler_t* a, JitHelper_t helper, int64_t arg1);
+// Calls helper(vm, err, arg0, arg1) and jumps to label if it returns false
+void jitCallTest(JitAssembler_t* a, JitHelper_t helper, int64_t arg0, int64_t arg1, uint32_t label);
+// Calls helper(vm, err, arg0, arg1) and jumps to the address it returns
+void jitCallJump(JitAssembler_t* a, JitJumpHelper_t helper, int64_t arg0, int64_t arg1);
+
+void jitJump(JitAssembler_t* a, uint32_t label);
+void jitExit(JitAssembler_t* a);
+
+// Unboxes the count (1 or 2) integers on top of the vm stack, jumps to slow
+// unless they all are integers
+void jitLoadIntegers(JitAssembler_t* a, uint32_t count, uint32_t slow);
+// Applies the integer form op (OP_*_I64 or OP_*_IMM, which take imm as right
+// operand) to the loaded integers. Comparisons result in 0 or 1, the
+// conditional jumps in their condition.
+void jitIntegerOperation(JitAssembler_t* a, OpCode_t op, int32_t imm);
+// Keeps the result across a helper call and jumps to label if it is 0
+void jitSaveResult(JitAssembler_t* a);
+void jitJumpIfSavedFalse(JitAssembler_t* a, uint32_t label);
+
+/* Slot instructions, used by the traces (see trace.h). Values live unboxed
+ * in 64 bit slots of the native stack frame, reserved by jitReserveSlots
+ * right after createJitAssembler. r13 holds the address of the first local
+ * of the current vm frame. */
+
+// A slot index or a constant
+typedef struct JitOperand {
+    bool constant;
+    int64_t value;
+} JitOperand_t;
+
+#define JIT_SLOT(s) ((JitOperand_t) { .constant = false, .value = (s) })
+#define JIT_CONSTANT(c) ((JitOperand_t) { .constant = true, .value = (c) })
+
+typedef enum JitCondition {
+    JIT_EQUAL,
+    JIT_NOT_EQUAL,
+    JIT_GREATER,
+    JIT_NOT_GREATER,
+} JitCondition_t;
+
+typedef enum JitArithmetic {
+    JIT_ADD,
+    JIT_SUB,
+    JIT_MUL,
+    JIT_DIV,    // truncated, the divisor must not be 0
+    JIT_NEG,    // of the left operand
+    JIT_NOT,    // flips the boolean left operand
+} JitArithmetic_t;
+
+// How jitLoadObject reads the object it checked
+typedef enum JitUnbox {
+    JIT_UNBOX_NONE,
+    JIT_UNBOX_INTEGER,
+    JIT_UNBOX_BOOLEAN,
+} JitUnbox_t;
+
+// Helper returning a value instead of a status
+typedef int64_t (*JitValueHelper_t)(Vm_t* vm, VmError_t* err, int64_t a, int64_t b);
+
+void jitReserveSlots(JitAssembler_t* a, uint32_t count);
+void jitMove(JitAssembler_t* a, uint32_t dst, JitOperand_t src);
+void jitArithmetic(JitAssembler_t* a, JitArithmetic_t op, uint32_t dst, JitOperand_t left, JitOperand_t right);
+// dst is set to 1 if the condition holds, 0 otherwise
+void jitCompare(JitAssembler_t* a, JitCondition_t cond, uint32_t dst, JitOperand_t left, JitOperand_t right);
+// Jumps to label unless the condition holds
+void jitGuard(JitAssembler_t* a, JitCondition_t cond, JitOperand_t left, JitOperand_t right, uint32_t label);
+// Sets r13 to the pointer helper(vm, err, 0, 0) returns
+void jitLoadBase(JitAssembler_t* a, JitValueHelper_t helper);
+// Checks the object r13[index] has the given type, jumps to label if it
+// doesn't (or if it is NULL). The unboxed value is stored to dst unless
+// unbox is JIT_UNBOX_NONE. With check false the type is trusted.
+void jitLoadObject(JitAssembler_t* a, int32_t index, int32_t type, JitUnbox_t unbox, uint32_t dst, bool check, uint32_t label);
+// Sets the first operand of the helpers to src, for jitCallWithResult
+void jitSetArgument(JitAssembler_t* a, JitOperand_t src);
+
+// Resolves the labels and copies the code to executable memory. The
+// assembler is consumed, returns NULL if the memory can't be mapped.
+JitCode_t* jitFinish(JitAssembler_t* a);
+void cleanupJitCode(JitCode_t* code);
+
+#endif
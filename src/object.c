@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include "object.h"
@@ -126,7 +127,7 @@ Integer_t* copyInteger(const Integer_t* obj) {
 }
 
 char* integerInspect(Integer_t* obj) {
-    return strFormat("%d", obj->value);
+    return strFormat("%lld", (long long)obj->value);
 }
 
 void gcCleanupInteger(Integer_t** obj) {
@@ -176,32 +177,168 @@ void gcMarkBoolean(Boolean_t* obj) {
  *     STRING OBJECT TYPE          *
  ************************************/
 
+// concatenations at least this long produce ropes instead of copying bytes
+#define ROPE_MIN_LENGTH 256
+
+DEFINE_VECTOR_TYPE(Strings, String_t*);
+IMPL_VECTOR_TYPE(Strings, String_t*);
+
+// Table of interned strings keyed by their bytes. The table does not keep 
+// strings alive, they are removed when collected. 
+static HashMap_t* internTable = NULL;
+
 String_t* createString(const char* value) {
+    return createStringWithLength(value, strlen(value));
+}
+
+String_t* createStringWithLength(const char* value, uint32_t len) {
+    String_t* ret = gcMalloc(sizeof(String_t) + len + 1);
+    *ret = (String_t) {
+        .type = OBJECT_STRING,
+        .len = len,
+        .hash = 0,
+        .left = NULL,
+        .right = NULL,
+        .interned = false
+    };
+    ret->value = ret->bytes;
+    memcpy(ret->bytes, value, len);
+    ret->bytes[len] = '\0';
+    return ret;
+}
+
+static String_t* createRope(String_t* left, String_t* right) {
+    gcSetRef(left, GC_REF_CONTAINER);
+    gcSetRef(right, GC_REF_CONTAINER);
+
     String_t* ret = gcMalloc(sizeof(String_t));
     *ret = (String_t) {
         .type = OBJECT_STRING,
-        .value = cloneString(value)
+        .len = left->len + right->len,
+        .hash = 0,
+        .value = NULL,
+        .left = left,
+        .right = right,
+        .interned = false
     };
     return ret;
 }
 
+String_t* createStringConcat(String_t* left, String_t* right) {
+    if (left->len == 0) return right;
+    if (right->len == 0) return left;
+    if (left->len + right->len >= ROPE_MIN_LENGTH) {
+        return createRope(left, right);
+    }
+
+    String_t* ret = createStringWithLength(stringGetValue(left), left->len + right->len);
+    memcpy(ret->bytes + left->len, stringGetValue(right), right->len);
+    return ret;
+}
+
 String_t* copyString(const String_t* obj) {
-    return createString(obj->value);
+    return createStringWithLength(stringGetValue((String_t*)obj), obj->len);
+}
+
+uint32_t stringGetLength(const String_t* obj) {
+    return obj->len;
+}
+
+uint64_t stringGetHash(String_t* obj) {
+    if (obj->hash == 0) {
+        obj->hash = hashMapHashKey(stringGetValue(obj));
+    }
+    return obj->hash;
+}
+
+bool stringIsRope(const String_t* obj) {
+    return obj->left != NULL;
+}
+
+static void stringFlatten(String_t* obj) {
+    char* buf = mallocChk(obj->len + 1);
+    uint32_t pos = 0;
+
+    // in order traversal with an explicit stack, ropes can be very deep
+    VectorStrings_t* pending = createVectorStrings();
+    vectorStringsAppend(pending, obj);
+    while (vectorStringsGetCount(pending) > 0) {
+        String_t* cur = vectorStringsPop(pending);
+        if (cur->value) {
+            memcpy(buf + pos, cur->value, cur->len);
+            pos += cur->len;
+        } else {
+            vectorStringsAppend(pending, cur->right);
+            vectorStringsAppend(pending, cur->left);
+        }
+    }
+    cleanupVectorStrings(&pending, NULL);
+    buf[pos] = '\0';
+
+    // children are no longer needed
+    obj->value = buf;
+    obj->left = NULL;
+    obj->right = NULL;
+}
+
+const char* stringGetValue(String_t* obj) {
+    if (!obj->value) {
+        stringFlatten(obj);
+    }
+    return obj->value;
+}
+
+bool stringEquals(String_t* left, String_t* right) {
+    if (left == right) return true;
+    // equal interned strings are always the same object
+    if (left->interned && right->interned) return false;
+    if (left->len != right->len) return false;
+    if (left->hash && right->hash && left->hash != right->hash) return false;
+    return memcmp(stringGetValue(left), stringGetValue(right), left->len) == 0;
+}
+
+String_t* stringIntern(String_t* obj) {
+    if (obj->interned) return obj;
+    if (!internTable) internTable = createHashMap();
+
+    String_t* existing = stringFindInterned(obj);
+    if (existing) return existing;
+
+    // bytes of flat and flattened strings never move, borrow them as key
+    hashMapInsertBorrowed(internTable, stringGetValue(obj), stringGetHash(obj), obj);
+    obj->interned = true;
+    return obj;
+}
+
+String_t* stringFindInterned(String_t* obj) {
+    if (obj->interned) return obj;
+    if (!internTable) return NULL;
+    return hashMapGetHashed(internTable, stringGetValue(obj), stringGetHash(obj));
 }
 
 char* stringInspect(String_t* obj) {
-    return cloneString(obj->value);
+    return cloneString(stringGetValue(obj));
 }
 
 void gcCleanupString(String_t** obj) {
     if (!(*obj)) return;
-    free((*obj)->value);
+    if ((*obj)->interned) {
+        hashMapRemoveHashed(internTable, (*obj)->value, (*obj)->hash);
+    }
+    // flattened ropes own a separate buffer 
+    if ((*obj)->value && (*obj)->value != (*obj)->bytes) {
+        free((*obj)->value);
+    }
     gcFree(*obj);
     *obj = NULL; 
 }
 
-void gcMarkString(Boolean_t* obj) {
-    // no objects owned by gc
+void gcMarkString(String_t* obj) {
+    // children are queued, deep ropes don't recurse
+    if (stringIsRope(obj)) {
+        gcMarkObject((Object_t*)obj->left);
+        gcMarkObject((Object_t*)obj->right);
+    }
 }
 /************************************ 
  *        NULL OBJECT TYPE          *
@@ -302,32 +439,65 @@ void gcMarkError(Error_t* err) {
 /************************************ 
  *  COMP FUNCTION OBJECT TYPE       *
  ************************************/
-CompiledFunction_t* createCompiledFunction(Instructions_t instr, uint32_t numLocals, uint32_t numParameters) {
-    CompiledFunction_t* obj = gcMalloc(sizeof(CompiledFunction_t));
+#define MAX_COMPILED_FUNCTION_HOOKS 4
+
+static CompiledFunctionHooks_t compiledFunctionHooks[MAX_COMPILED_FUNCTION_HOOKS];
+static uint32_t numCompiledFunctionHooks = 0;
+
+void compiledFunctionAddHooks(CompiledFunctionHooks_t hooks) {
+    for (uint32_t i = 0; i < numCompiledFunctionHooks; i++) {
+        if (compiledFunctionHooks[i].cleanup == hooks.cleanup) return;
+    }
+    assert(numCompiledFunctionHooks < MAX_COMPILED_FUNCTION_HOOKS);
+    compiledFunctionHooks[numCompiledFunctionHooks++] = hooks;
+}
+
+CompiledFunction_t* createCompiledFunction(Instructions_t instr, Object_t** constants, uint32_t numConstants, uint32_t numLocals, uint32_t numParameters) {
+    CompiledFunction_t* obj = gcMalloc(sizeof(CompiledFunction_t) + numConstants * sizeof(Object_t*));
     *obj = (CompiledFunction_t) {
         .type = OBJECT_COMPILED_FUNCTION,
         .instructions = instr,
+        .segment = NULL,
+        .code = NULL,
+        .codeLength = 0,
+        .threaded = NULL,
+        .numCalls = 0,
+        .jit = NULL,
+        .traces = NULL,
+        .native = NULL,
+        .constants = obj->pool,
+        .numConstants = numConstants,
         .numLocals = numLocals,
         .numParameters = numParameters
     };
+    if (numConstants > 0) memcpy(obj->pool, constants, numConstants * sizeof(Object_t*));
     return obj;
 }
 
 void gcCleanupCompiledFunction(CompiledFunction_t** obj) {
     if(!(*obj)) return;
-    
-    // cleanup owned attr.
+    for (uint32_t i = 0; i < numCompiledFunctionHooks; i++) {
+        compiledFunctionHooks[i].cleanup(*obj);
+    }
     cleanupSliceByte((*obj)->instructions);
-   
     gcFree(*obj);
     *obj = NULL;
 }
 void gcMarkCompiledFunction(CompiledFunction_t* obj) { 
-    // nothing to mark
+    gcMarkObject((Object_t*)obj->closure);
+    for (uint32_t i = 0; i < obj->numConstants; i++) {
+        gcMarkObject(obj->constants[i]);
+    }
 }
 
 CompiledFunction_t* copyCompiledFunction(const CompiledFunction_t* obj) {
-    return createCompiledFunction(copySliceByte(obj->instructions), obj->numLocals, obj->numParameters);
+    CompiledFunction_t* copy = createCompiledFunction(copySliceByte(obj->instructions), obj->constants, 
+        obj->numConstants, obj->numLocals, obj->numParameters);
+    copy->native = obj->native;
+    for (uint32_t i = 0; i < numCompiledFunctionHooks; i++) {
+        if (compiledFunctionHooks[i].copy) compiledFunctionHooks[i].copy(obj, copy);
+    }
+    return copy;
 }
 
 char* compiledFunctionInspect(CompiledFunction_t* obj) {
@@ -338,40 +508,45 @@ char* compiledFunctionInspect(CompiledFunction_t* obj) {
  *      CLOSURE OBJECT TYPE         *
  ************************************/
 
-Closure_t* createClosure(CompiledFunction_t *fn, VectorObjects_t* freeVars) {
-    Closure_t* obj = gcMalloc(sizeof(Closure_t));
+Closure_t* createClosure(CompiledFunction_t *fn, Object_t** freeVars, uint32_t numFree) {
+    Closure_t* obj = gcMalloc(sizeof(Closure_t) + numFree * sizeof(Object_t*));
     *obj = (Closure_t) {
         .type = OBJECT_CLOSURE,
         .fn = fn,
-        .free = freeVars, 
+        .numFree = numFree, 
     };
+    for (uint32_t i = 0; i < numFree; i++) {
+        gcSetRef(freeVars[i], GC_REF_CONTAINER);
+        obj->free[i] = freeVars[i];
+    }
     return obj;
 }
 
+Closure_t* compiledFunctionGetClosure(CompiledFunction_t* fn) {
+    if (!fn->closure) {
+        fn->closure = createClosure(fn, NULL, 0);
+    }
+    return fn->closure;
+}
+
 Closure_t* copyClosure(const Closure_t* obj) {
-    Closure_t* newObj = gcMalloc(sizeof(Closure_t)); 
-    *newObj = (Closure_t) {
-        .type = OBJECT_CLOSURE,
-        .fn = copyCompiledFunction(obj->fn),
-        .free = copyVectorObjects(obj->free, copyObject),
-    };
+    Closure_t* newObj = createClosure(copyCompiledFunction(obj->fn), (Object_t**)obj->free, obj->numFree);
+    for (uint32_t i = 0; i < obj->numFree; i++) {
+        newObj->free[i] = copyObject(obj->free[i]);
+        gcSetRef(newObj->free[i], GC_REF_CONTAINER);
+    }
     return newObj;    
 }
 
 void gcCleanupClosure(Closure_t** obj) {
     if(!(*obj)) return;
-
-    cleanupVectorObjects(&(*obj)->free, NULL); 
-
     gcFree(*obj);
     *obj = NULL;
 }
 void gcMarkClosure(Closure_t* obj) { 
     gcMarkObject((Object_t*)obj->fn);
-    uint32_t freeCnt = vectorObjectsGetCount(obj->free);
-    Object_t** freeObjs = vectorObjectsGetBuffer(obj->free);
-    for (uint32_t i = 0; i < freeCnt; i++) {
-        gcMarkObject(freeObjs[i]);
+    for (uint32_t i = 0; i < obj->numFree; i++) {
+        gcMarkObject(obj->free[i]);
     }
 }
 
@@ -384,18 +559,89 @@ char* closureInspect(Closure_t* obj) {
  *       ARRAY OBJECT TYPE          *
  ************************************/
 
+// inline capacity of arrays created without a size hint
+#define ARRAY_DEFAULT_CAPACITY 4
+
+static size_t arrayElementSize(ArrayKind_t kind) {
+    return kind == ARRAY_PACKED_INT ? sizeof(int64_t) : sizeof(Object_t*);
+}
+
+static bool arrayIsSpilled(Array_t* arr) {
+    return arr->data != (void*)arr->inlineData;
+}
+
+static void arrayGrow(Array_t* arr) {
+    uint32_t newCap = (3u * arr->cap) / 2 + 1;
+    size_t elemSize = arrayElementSize(arr->kind);
+    if (arrayIsSpilled(arr)) {
+        arr->data = realloc(arr->data, newCap * elemSize);
+        if (!arr->data) HANDLE_OOM();
+    } else {
+        // inline storage is exhausted, move elements to the heap
+        void* data = mallocChk(newCap * elemSize);
+        memcpy(data, arr->data, arr->count * elemSize);
+        arr->data = data;
+    }
+    arr->cap = newCap;
+}
+
 Array_t* createArray() {
-    Array_t* arr = gcMalloc(sizeof(Array_t));
+    return createArrayWithCapacity(ARRAY_DEFAULT_CAPACITY);
+}
+
+Array_t* createArrayWithCapacity(uint32_t cap) {
+    // empty arrays start out packed, the first non integer unpacks them.
+    // inline slots are sized for int64_t which also fits an Object_t*
+    Array_t* arr = gcMalloc(sizeof(Array_t) + cap * sizeof(uint64_t));
     *arr = (Array_t) {
         .type = OBJECT_ARRAY,
-        .elements = NULL
+        .kind = ARRAY_PACKED_INT,
+        .count = 0,
+        .cap = cap,
+        .offset = 0,
+        .source = NULL,
+        .data = NULL
     };
+    arr->data = arr->inlineData;
     return arr;
 }
 
+Array_t* createArrayView(Array_t* arr, uint32_t offset, uint32_t length) {
+    // views always reference the array owning the backing store
+    if (arr->source) {
+        offset += arr->offset;
+        arr = arr->source;
+    }
+    gcSetRef(arr, GC_REF_CONTAINER);
+
+    Array_t* view = gcMalloc(sizeof(Array_t));
+    *view = (Array_t) {
+        .type = OBJECT_ARRAY,
+        .kind = arr->kind,
+        .count = length,
+        .cap = 0,
+        .offset = offset,
+        .source = arr,
+        .data = arr->data
+    };
+    return view;
+}
+
 Array_t* copyArray(const Array_t* obj) {
-    Array_t* newArr = createArray();
-    newArr->elements = copyVectorObjects(obj->elements, copyObject);
+    uint32_t cnt = arrayGetElementCount((Array_t*)obj);
+    Array_t* newArr = createArrayWithCapacity(cnt);
+
+    if (arrayIsPacked((Array_t*)obj)) {
+        memcpy(newArr->data, arrayGetInts((Array_t*)obj), cnt * sizeof(int64_t));
+        newArr->count = cnt;
+        return newArr;
+    }
+
+    arrayUnpack(newArr);
+    Object_t** elems = arrayGetElements((Array_t*)obj);
+    for (uint32_t i = 0; i < cnt; i++) {
+        arrayAppend(newArr, copyObject(elems[i]));
+    }
     return newArr;
 }
 
@@ -404,9 +650,12 @@ char* arrayInspect(Array_t* obj) {
     
     strbufWrite(sbuf, "[");
     uint32_t cnt = arrayGetElementCount(obj);
-    Object_t** elems = arrayGetElements(obj);
     for (uint32_t i = 0; i < cnt; i++) {
-        strbufConsume(sbuf, objectInspect(elems[i]));
+        if (arrayIsPacked(obj)) {
+            strbufConsume(sbuf, strFormat("%lld", (long long)arrayGetInts(obj)[i]));
+        } else {
+            strbufConsume(sbuf, objectInspect(arrayGetElements(obj)[i]));
+        }
         if (i != (cnt - 1)) {
             strbufWrite(sbuf, ", ");
         }
@@ -415,30 +664,111 @@ char* arrayInspect(Array_t* obj) {
     return detachStrbuf(&sbuf);
 }
 
+bool arrayIsView(Array_t* obj) {
+    return obj->source != NULL;
+}
+
+bool arrayIsPacked(Array_t* obj) {
+    return obj->kind == ARRAY_PACKED_INT;
+}
+
 uint32_t arrayGetElementCount(Array_t* obj) {
-    return vectorObjectsGetCount(obj->elements);
+    return obj->count;
+}
+
+Object_t* arrayGetElement(Array_t* obj, uint32_t index) {
+    // packed elements are boxed on demand 
+    if (arrayIsPacked(obj)) {
+        return (Object_t*)createInteger(arrayGetInts(obj)[index]);
+    }
+    return arrayGetElements(obj)[index];
 }
 
 Object_t** arrayGetElements(Array_t* obj) {
-    return vectorObjectsGetBuffer(obj->elements);
+    assert(!arrayIsPacked(obj) && "Packed arrays hold no objects");
+    return (Object_t**)obj->data + obj->offset;
+}
+
+int64_t* arrayGetInts(Array_t* obj) {
+    assert(arrayIsPacked(obj) && "Generic arrays hold no ints");
+    return (int64_t*)obj->data + obj->offset;
 }
 
 void arrayAppend(Array_t* arr, Object_t* obj) {
-    vectorObjectsAppend(arr->elements, (void*) obj);
+    assert(!arrayIsView(arr) && "Views are read only");
+    if (arrayIsPacked(arr)) {
+        if (obj->type == OBJECT_INTEGER) {
+            arrayAppendInt(arr, ((Integer_t*)obj)->value);
+            return;
+        }
+        arrayUnpack(arr);
+    }
+
+    gcSetRef(obj, GC_REF_CONTAINER);
+    if (arr->count >= arr->cap) {
+        arrayGrow(arr);
+    }
+    ((Object_t**)arr->data)[arr->count++] = obj;
+}
+
+void arrayAppendInt(Array_t* arr, int64_t value) {
+    if (!arrayIsPacked(arr)) {
+        arrayAppend(arr, (Object_t*)createInteger(value));
+        return;
+    }
+
+    assert(!arrayIsView(arr) && "Views are read only");
+    if (arr->count >= arr->cap) {
+        arrayGrow(arr);
+    }
+    ((int64_t*)arr->data)[arr->count++] = value;
+}
+
+void arrayUnpack(Array_t* arr) {
+    assert(!arrayIsView(arr) && "Views are read only");
+    if (!arrayIsPacked(arr)) return;
+
+    arr->kind = ARRAY_GENERIC;
+    // nothing to box, the storage fits pointers as well
+    if (arr->count == 0) return;
+
+    uint32_t cap = arr->cap > arr->count ? arr->cap : arr->count + 1;
+    int64_t* ints = arr->data;
+    Object_t** elems = mallocChk(cap * sizeof(Object_t*));
+    for (uint32_t i = 0; i < arr->count; i++) {
+        elems[i] = (Object_t*)createInteger(ints[i]);
+        gcSetRef(elems[i], GC_REF_CONTAINER);
+    }
+    if (arrayIsSpilled(arr)) {
+        free(ints);
+    }
+    arr->data = elems;
+    arr->cap = cap;
 }
 
 void gcCleanupArray(Array_t** arr) {
     if (!(*arr)) return;
-    cleanupVectorObjects(&(*arr)->elements, NULL);
+    // backing store is owned by the source array
+    if (!arrayIsView(*arr) && arrayIsSpilled(*arr)) {
+        free((*arr)->data);
+    }
     gcFree(*arr);
     *arr = NULL;
 }
 
 void gcMarkArray(Array_t* arr) {
+    if (arrayIsView(arr)) {
+        // keep backing store alive (marks all elements) 
+        gcMarkObject((Object_t*)arr->source);
+        return;
+    }
+    // unboxed ints reference no objects 
+    if (arrayIsPacked(arr)) return;
+
     uint32_t cnt = arrayGetElementCount(arr);
     Object_t** elems = arrayGetElements(arr);
     for (uint32_t i = 0; i < cnt; i++) {
-        gcSetRef(elems[i], GC_REF_INTERNAL);
+        gcMarkObject(elems[i]);
     } 
 }
 
@@ -501,12 +831,32 @@ char* hashInspect(Hash_t* obj) {
 }
 
 void hashInsertPair(Hash_t* obj, HashPair_t* pair) {
+    if (pair->key->type == OBJECT_STRING) {
+        // string keys are interned and their bytes are borrowed as key 
+        String_t* str = stringIntern((String_t*)pair->key);
+        pair->key = (Object_t*)str;
+        gcSetRef(pair->key, GC_REF_CONTAINER);
+        gcSetRef(pair->value, GC_REF_CONTAINER);
+        hashMapInsertBorrowed(obj->pairs, str->value, stringGetHash(str), pair);
+        return;
+    }
+
+    gcSetRef(pair->key, GC_REF_CONTAINER);
+    gcSetRef(pair->value, GC_REF_CONTAINER);
+
     char* hashKey = objectGetHashKey(pair->key);
     hashMapInsert(obj->pairs, hashKey, pair);
     free(hashKey);
 }
 
 HashPair_t* hashGetPair(Hash_t* obj, Object_t* key) {
+    if (key->type == OBJECT_STRING) {
+        // all string keys are interned, a string without interned twin is no key
+        String_t* str = stringFindInterned((String_t*)key);
+        if (!str) return NULL;
+        return (HashPair_t*)hashMapGetHashed(obj->pairs, str->value, stringGetHash(str));
+    }
+
     char* hashKey = objectGetHashKey(key); 
     HashPair_t* ret = (HashPair_t*)hashMapGet(obj->pairs, hashKey);
     free(hashKey);
@@ -607,11 +957,27 @@ void gcCleanupObject(Object_t** obj) {
     }
 }
 
+// Marked objects whose children are still to be marked. The mark functions
+// of the types only queue the children, nesting can be deeper than the C stack.
+static VectorObjects_t markPending = {0};
+static bool marking = false;
+
 void gcMarkObject(Object_t* obj) {
     if (obj && 0 <= obj->type && obj->type < _OBJECT_TYPE_CNT) {
         ObjectGcMarkFn_t markFn = objectMarkFns[obj->type];
         if ( (!markFn) || (gcHasRef(obj, GC_REF_INTERNAL))) return;
         gcSetRef(obj, GC_REF_INTERNAL);
+        if (marking) {
+            vectorObjectsAppend(&markPending, obj);
+            return;
+        }
+
+        marking = true;
         markFn(obj);
+        while (vectorObjectsGetCount(&markPending) > 0) {
+            Object_t* next = vectorObjectsPop(&markPending);
+            objectMarkFns[next->type](next);
+        }
+        marking = false;
     }   
 }
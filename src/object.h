@@ -82,14 +82,36 @@ char* booleanInspect(Boolean_t* obj);
  *     STRING OBJECT TYPE          *
  ************************************/
 
+// Flat strings store their bytes inline (nul terminated) and value points to them. 
+// Ropes are concatenation nodes: left and right hold the operands and the bytes 
+// are only built on demand, value is NULL until then.
+// hash is computed on first use, 0 means not computed yet.
 typedef struct String {
     OBJECT_BASE_ATTRS;
+    uint32_t len;
+    uint64_t hash;
     char* value;
+    struct String* left;
+    struct String* right;
+    bool interned;
+    char bytes[];
 }String_t;
 
 String_t* createString(const char* value);
+String_t* createStringWithLength(const char* value, uint32_t len);
+String_t* createStringConcat(String_t* left, String_t* right);
 String_t* copyString(const String_t* obj);
 
+uint32_t stringGetLength(const String_t* obj);
+uint64_t stringGetHash(String_t* obj);
+const char* stringGetValue(String_t* obj);
+bool stringIsRope(const String_t* obj);
+bool stringEquals(String_t* left, String_t* right);
+
+// Interned strings are unique by value, equal interned strings are the same object. 
+String_t* stringIntern(String_t* obj);
+String_t* stringFindInterned(String_t* obj);
+
 char* stringInspect(String_t* obj);
 
 
@@ -141,14 +163,50 @@ char* errorInspect(Error_t* obj);
  *  COMP FUNCTION OBJECT TYPE       *
  ************************************/
 
+// The constant pool is stored inline. Linking decodes the instructions into
+// the code segment (see segment.h) and moves the pool next to them, the vm 
+// runs the decoded words.
+typedef struct Closure Closure_t;
+typedef struct CodeSegment CodeSegment_t;
+typedef struct JitCode JitCode_t;
+typedef struct TraceAnchor TraceAnchor_t;
+
+// C function of a program compiled ahead of time (see aot.h), base is where
+// the arguments start in the vm stack
+typedef Object_t* (*AotFunction_t)(Closure_t* cl, Object_t** args, uint32_t base);
+
 typedef struct CompiledFunction {
     OBJECT_BASE_ATTRS;
     Instructions_t instructions;
+    CodeSegment_t* segment; // NULL until linked
+    const CodeWord_t* code; // decoded instructions in the segment, followed by CODE_END_MARKER
+    uint32_t codeLength;
+    void** threaded; // handler addresses interleaved with the operands, built by the vm on first call
+    uint32_t numCalls; // counted until the function is jitted
+    JitCode_t* jit; // native code, NULL while interpreted
+    TraceAnchor_t* traces; // by word index, allocated by the vm when tracing first counts a hit
+    AotFunction_t native; // NULL unless compiled ahead of time
+    Object_t** constants; // the function's own constant pool, read only in the segment once linked, OP_CONSTANT, OP_CLOSURE and OP_SWITCH_TABLE index it
+    uint32_t numConstants;
     uint32_t numLocals;
     uint32_t numParameters;
+    Closure_t* closure; // shared by every evaluation when nothing is captured
+    Object_t* pool[];
 } CompiledFunction_t;
 
-CompiledFunction_t* createCompiledFunction(Instructions_t instr, uint32_t numLocals, uint32_t numParameters);
+// Lets the modules attaching state to functions (the linker, the vm) free it
+// together with them, so this module doesn't depend on them. cleanup runs
+// before a function is freed, copy, when not NULL, when it's copied.
+typedef struct CompiledFunctionHooks {
+    void (*cleanup)(CompiledFunction_t* fn);
+    void (*copy)(const CompiledFunction_t* fn, CompiledFunction_t* copy);
+} CompiledFunctionHooks_t;
+
+// Adding the same hooks again does nothing
+void compiledFunctionAddHooks(CompiledFunctionHooks_t hooks);
+
+// Takes over instr, the constants are copied
+CompiledFunction_t* createCompiledFunction(Instructions_t instr, Object_t** constants, uint32_t numConstants, uint32_t numLocals, uint32_t numParameters);
 CompiledFunction_t* copyCompiledFunction(const CompiledFunction_t* obj);
 
 char* compiledFunctionInspect(CompiledFunction_t* obj);
@@ -157,13 +215,17 @@ char* compiledFunctionInspect(CompiledFunction_t* obj);
  *      CLOSURE OBJECT TYPE         *
  ************************************/
 
-typedef struct Closure {
+struct Closure {
     OBJECT_BASE_ATTRS;
     CompiledFunction_t* fn;
-    VectorObjects_t* free;
-} Closure_t;
-
-Closure_t* createClosure(CompiledFunction_t *fn, VectorObjects_t* freeVars);
+    uint32_t numFree;
+    Object_t* free[];
+};
+
+Closure_t* createClosure(CompiledFunction_t *fn, Object_t** freeVars, uint32_t numFree);
+// The closure of a function capturing nothing, created on first use and kept
+// alive by the function
+Closure_t* compiledFunctionGetClosure(CompiledFunction_t* fn);
 Closure_t* copyClosure(const Closure_t* obj);
 
 char* closureInspect(Closure_t* obj);
@@ -173,18 +235,43 @@ char* closureInspect(Closure_t* obj);
  *       ARRAY OBJECT TYPE          *
  ************************************/
 
+// Arrays holding only integers keep them unboxed. Storing any other 
+// object turns the array into a generic one which holds boxed elements.
+typedef enum ArrayKind {
+    ARRAY_PACKED_INT,
+    ARRAY_GENERIC,
+} ArrayKind_t;
+
+// Elements are stored inline (int64_t or Object_t* depending on kind) and 
+// spill to a heap buffer once the array grows beyond its initial capacity. 
+// A view shares the elements of its source array: [offset, offset + count) 
+// selects the visible range of the source's data.
 typedef struct Array {
     OBJECT_BASE_ATTRS;
-    VectorObjects_t* elements;
+    ArrayKind_t kind;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t offset;
+    struct Array* source;
+    void* data;
+    uint64_t inlineData[];
 }Array_t;
 
 Array_t* createArray();
+Array_t* createArrayWithCapacity(uint32_t cap);
+Array_t* createArrayView(Array_t* arr, uint32_t offset, uint32_t length);
 Array_t* copyArray(const Array_t* obj);
 
 char* arrayInspect(Array_t* obj);
+bool arrayIsView(Array_t* obj);
+bool arrayIsPacked(Array_t* obj);
 uint32_t arrayGetElementCount(Array_t* obj);
+Object_t* arrayGetElement(Array_t* obj, uint32_t index);
 Object_t** arrayGetElements(Array_t* obj);
+int64_t* arrayGetInts(Array_t* obj);
 void arrayAppend(Array_t* arr, Object_t* obj);
+void arrayAppendInt(Array_t* arr, int64_t value);
+void arrayUnpack(Array_t* arr);
 
 /************************************ 
  *        HASH OBJECT TYPE          *
@@ -0,0 +1,362 @@
+#include <string.h>
+#include <stdint.h>
+#include "optimizer.h"
+#include "utils.h"
+
+static void foldStatements(VectorStatements_t** stmts);
+static void foldStatement(Statement_t* st);
+static void foldBlock(BlockStatement_t* block);
+
+static Expression_t* foldExpression(Expression_t* expr);
+static Expression_t* foldPrefixExpression(PrefixExpression_t* prefix);
+static Expression_t* foldInfixExpression(InfixExpression_t* infix);
+static Expression_t* foldIfExpression(IfExpression_t* ifExpr);
+
+static Expression_t* foldIntegerInfix(InfixExpression_t* infix, int64_t left, int64_t right);
+static Expression_t* foldBooleanInfix(InfixExpression_t* infix, bool left, bool right);
+static Expression_t* foldStringInfix(InfixExpression_t* infix, StringLiteral_t* left, StringLiteral_t* right);
+
+static Expression_t* createFoldedInteger(int64_t value);
+static Expression_t* createFoldedBoolean(bool value);
+static Expression_t* createFoldedString(const Token_t* tok, char* value);
+
+static bool isLiteral(const Expression_t* expr);
+static bool isTruthyLiteral(const Expression_t* expr);
+static bool isSplicableIf(const Statement_t* st);
+
+/* External API */
+
+void optimizerFoldConstants(Program_t* program) {
+    foldStatements(&program->statements);
+}
+
+/* Statements */
+
+// Folds every statement of the list. An if statement whose condition is
+// always true is replaced by the statements of its consequence, blocks
+// don't open a new scope so the bindings stay visible where they were.
+// The last statement gives the value of the list, an if there is kept.
+static void foldStatements(VectorStatements_t** stmts) {
+    VectorStatements_t* folded = createVectorStatements();
+
+    uint32_t stmtCnt = vectorStatementsGetCount(*stmts);
+    Statement_t** buf = vectorStatementsGetBuffer(*stmts);
+    for (uint32_t i = 0; i < stmtCnt; i++) {
+        foldStatement(buf[i]);
+
+        if (i + 1 == stmtCnt || !isSplicableIf(buf[i])) {
+            vectorStatementsAppend(folded, buf[i]);
+            continue;
+        }
+
+        IfExpression_t* ifExpr = (IfExpression_t*)((ExpressionStatement_t*)buf[i])->expression;
+        VectorStatements_t* live = ifExpr->consequence->statements;
+        for (uint32_t j = 0; j < vectorStatementsGetCount(live); j++) {
+            vectorStatementsAppend(folded, vectorStatementsGetBuffer(live)[j]);
+        }
+        // statements are moved, don't let the cleanup free them
+        live->cnt = 0;
+        cleanupStatement(&buf[i]);
+    }
+
+    // the old vector holds no owned statements anymore
+    cleanupVectorStatements(stmts, NULL);
+    *stmts = folded;
+}
+
+static void foldStatement(Statement_t* st) {
+    switch (st->type) {
+        case STATEMENT_LET: {
+            LetStatement_t* let = (LetStatement_t*)st;
+            let->value = foldExpression(let->value);
+            break;
+        }
+        case STATEMENT_RETURN: {
+            ReturnStatement_t* ret = (ReturnStatement_t*)st;
+            ret->returnValue = foldExpression(ret->returnValue);
+            break;
+        }
+        case STATEMENT_EXPRESSION: {
+            ExpressionStatement_t* exprSt = (ExpressionStatement_t*)st;
+            exprSt->expression = foldExpression(exprSt->expression);
+            break;
+        }
+        case STATEMENT_BLOCK:
+            foldBlock((BlockStatement_t*)st);
+            break;
+        case STATEMENT_ASSIGN: {
+            AssignStatement_t* assign = (AssignStatement_t*)st;
+            assign->value = foldExpression(assign->value);
+            break;
+        }
+        case STATEMENT_WHILE: {
+            WhileStatement_t* loop = (WhileStatement_t*)st;
+            loop->condition = foldExpression(loop->condition);
+            foldBlock(loop->body);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void foldBlock(BlockStatement_t* block) {
+    if (!block) return;
+    foldStatements(&block->statements);
+}
+
+/* Expressions */
+
+// Returns the folded expression, the passed one is consumed if replaced
+static Expression_t* foldExpression(Expression_t* expr) {
+    if (!expr) return NULL;
+
+    switch (expr->type) {
+        case EXPRESSION_PREFIX_EXPRESSION:
+            return foldPrefixExpression((PrefixExpression_t*)expr);
+        case EXPRESSION_INFIX_EXPRESSION:
+            return foldInfixExpression((InfixExpression_t*)expr);
+        case EXPRESSION_IF_EXPRESSION:
+            return foldIfExpression((IfExpression_t*)expr);
+        case EXPRESSION_ARRAY_LITERAL: {
+            ArrayLiteral_t* arr = (ArrayLiteral_t*)expr;
+            Expression_t** elems = arrayLiteralGetElements(arr);
+            for (uint32_t i = 0; i < arrayLiteralGetElementCount(arr); i++) {
+                elems[i] = foldExpression(elems[i]);
+            }
+            return expr;
+        }
+        case EXPRESSION_HASH_LITERAL: {
+            HashLiteral_t* hash = (HashLiteral_t*)expr;
+            for (uint32_t i = 0; i < hashLiteralGetPairsCount(hash); i++) {
+                hash->keys->buf[i] = foldExpression(hash->keys->buf[i]);
+                hash->values->buf[i] = foldExpression(hash->values->buf[i]);
+            }
+            return expr;
+        }
+        case EXPRESSION_INDEX_EXPRESSION: {
+            IndexExpression_t* index = (IndexExpression_t*)expr;
+            index->left = foldExpression(index->left);
+            index->right = foldExpression(index->right);
+            return expr;
+        }
+        case EXPRESSION_FUNCTION_LITERAL:
+            foldBlock(((FunctionLiteral_t*)expr)->body);
+            return expr;
+        case EXPRESSION_CALL_EXPRESSION: {
+            CallExpression_t* call = (CallExpression_t*)expr;
+            call->function = foldExpression(call->function);
+            Expression_t** args = callExpressionGetArguments(call);
+            for (uint32_t i = 0; i < callExpresionGetArgumentCount(call); i++) {
+                args[i] = foldExpression(args[i]);
+            }
+            return expr;
+        }
+        default:
+            return expr;
+    }
+}
+
+static Expression_t* foldPrefixExpression(PrefixExpression_t* prefix) {
+    prefix->right = foldExpression(prefix->right);
+    Expression_t* right = prefix->right;
+
+    Expression_t* folded = NULL;
+    if (strcmp(prefix->operator, "!") == 0 && isLiteral(right)) {
+        // mirrors the vm: only false is falsy among the literals
+        bool value = right->type == EXPRESSION_BOOLEAN_LITERAL && !((BooleanLiteral_t*)right)->value;
+        folded = createFoldedBoolean(value);
+    } else if (strcmp(prefix->operator, "-") == 0 && right->type == EXPRESSION_INTEGER_LITERAL) {
+        uint64_t value = ((IntegerLiteral_t*)right)->value;
+        folded = createFoldedInteger((int64_t)(0 - value));
+    }
+
+    if (!folded) return (Expression_t*)prefix;
+    cleanupPrefixExpression(&prefix);
+    return folded;
+}
+
+static Expression_t* foldInfixExpression(InfixExpression_t* infix) {
+    infix->left = foldExpression(infix->left);
+    infix->right = foldExpression(infix->right);
+    Expression_t* left = infix->left;
+    Expression_t* right = infix->right;
+
+    if (left->type != right->type)
+        return (Expression_t*)infix;
+
+    switch (left->type) {
+        case EXPRESSION_INTEGER_LITERAL:
+            return foldIntegerInfix(infix, ((IntegerLiteral_t*)left)->value, ((IntegerLiteral_t*)right)->value);
+        case EXPRESSION_BOOLEAN_LITERAL:
+            return foldBooleanInfix(infix, ((BooleanLiteral_t*)left)->value, ((BooleanLiteral_t*)right)->value);
+        case EXPRESSION_STRING_LITERAL:
+            return foldStringInfix(infix, (StringLiteral_t*)left, (StringLiteral_t*)right);
+        default:
+            return (Expression_t*)infix;
+    }
+}
+
+static Expression_t* foldIntegerInfix(InfixExpression_t* infix, int64_t left, int64_t right) {
+    const char* op = infix->operator;
+    Expression_t* folded = NULL;
+
+    // wrap around like the vm does instead of overflowing
+    if (strcmp(op, "+") == 0) {
+        folded = createFoldedInteger((int64_t)((uint64_t)left + (uint64_t)right));
+    } else if (strcmp(op, "-") == 0) {
+        folded = createFoldedInteger((int64_t)((uint64_t)left - (uint64_t)right));
+    } else if (strcmp(op, "*") == 0) {
+        folded = createFoldedInteger((int64_t)((uint64_t)left * (uint64_t)right));
+    } else if (strcmp(op, "/") == 0) {
+        // leave trapping divisions to the vm
+        if (right != 0 && !(left == INT64_MIN && right == -1)) {
+            folded = createFoldedInteger(left / right);
+        }
+    } else if (strcmp(op, "<") == 0) {
+        folded = createFoldedBoolean(left < right);
+    } else if (strcmp(op, ">") == 0) {
+        folded = createFoldedBoolean(left > right);
+    } else if (strcmp(op, "==") == 0) {
+        folded = createFoldedBoolean(left == right);
+    } else if (strcmp(op, "!=") == 0) {
+        folded = createFoldedBoolean(left != right);
+    }
+
+    if (!folded) return (Expression_t*)infix;
+    cleanupInfixExpression(&infix);
+    return folded;
+}
+
+static Expression_t* foldBooleanInfix(InfixExpression_t* infix, bool left, bool right) {
+    const char* op = infix->operator;
+    Expression_t* folded = NULL;
+
+    if (strcmp(op, "==") == 0) {
+        folded = createFoldedBoolean(left == right);
+    } else if (strcmp(op, "!=") == 0) {
+        folded = createFoldedBoolean(left != right);
+    }
+
+    if (!folded) return (Expression_t*)infix;
+    cleanupInfixExpression(&infix);
+    return folded;
+}
+
+static Expression_t* foldStringInfix(InfixExpression_t* infix, StringLiteral_t* left, StringLiteral_t* right) {
+    const char* op = infix->operator;
+    Expression_t* folded = NULL;
+
+    if (strcmp(op, "+") == 0) {
+        size_t leftLen = strlen(left->value);
+        size_t rightLen = strlen(right->value);
+        char* value = mallocChk(leftLen + rightLen + 1);
+        memcpy(value, left->value, leftLen);
+        memcpy(value + leftLen, right->value, rightLen + 1);
+        folded = createFoldedString(left->token, value);
+    } else if (strcmp(op, "==") == 0) {
+        folded = createFoldedBoolean(strcmp(left->value, right->value) == 0);
+    } else if (strcmp(op, "!=") == 0) {
+        folded = createFoldedBoolean(strcmp(left->value, right->value) != 0);
+    }
+
+    if (!folded) return (Expression_t*)infix;
+    cleanupInfixExpression(&infix);
+    return folded;
+}
+
+// With a literal condition only one branch is reachable. A branch made of a
+// single expression replaces the whole if, otherwise the dead branch is
+// dropped: the live one ends up as the consequence of an always true if.
+static Expression_t* foldIfExpression(IfExpression_t* ifExpr) {
+    ifExpr->condition = foldExpression(ifExpr->condition);
+    foldBlock(ifExpr->consequence);
+    foldBlock(ifExpr->alternative);
+
+    if (!isLiteral(ifExpr->condition))
+        return (Expression_t*)ifExpr;
+
+    bool truthy = isTruthyLiteral(ifExpr->condition);
+    BlockStatement_t* live = truthy ? ifExpr->consequence : ifExpr->alternative;
+
+    if (live && blockStatementGetStatementCount(live) == 1) {
+        Statement_t* st = blockStatementGetStatements(live)[0];
+        if (st->type == STATEMENT_EXPRESSION && ((ExpressionStatement_t*)st)->expression) {
+            Expression_t* expr = ((ExpressionStatement_t*)st)->expression;
+            ((ExpressionStatement_t*)st)->expression = NULL;
+            cleanupIfExpression(&ifExpr);
+            return expr;
+        }
+    }
+
+    if (truthy) {
+        cleanupBlockStatement(&ifExpr->alternative);
+    } else if (ifExpr->alternative) {
+        cleanupBlockStatement(&ifExpr->consequence);
+        ifExpr->consequence = ifExpr->alternative;
+        ifExpr->alternative = NULL;
+        cleanupExpression(&ifExpr->condition);
+        ifExpr->condition = createFoldedBoolean(true);
+    } else {
+        // the if evaluates to null, keep it but with an empty consequence
+        cleanupVectorStatementsContents(ifExpr->consequence->statements, cleanupStatement);
+    }
+
+    return (Expression_t*)ifExpr;
+}
+
+/* Helpers */
+
+static Expression_t* createFoldedInteger(int64_t value) {
+    char* literal = strFormat("%lld", (long long)value);
+    Token_t* tok = createToken(TOKEN_INT, literal, strlen(literal));
+
+    IntegerLiteral_t* il = createIntegerLiteral(tok);
+    il->value = value;
+
+    cleanupToken(&tok);
+    free(literal);
+    return (Expression_t*)il;
+}
+
+static Expression_t* createFoldedBoolean(bool value) {
+    const char* literal = value ? "true" : "false";
+    Token_t* tok = createToken(value ? TOKEN_TRUE : TOKEN_FALSE, literal, strlen(literal));
+
+    BooleanLiteral_t* bl = createBooleanLiteral(tok);
+    bl->value = value;
+
+    cleanupToken(&tok);
+    return (Expression_t*)bl;
+}
+
+// Takes ownership of value
+static Expression_t* createFoldedString(const Token_t* tok, char* value) {
+    StringLiteral_t* sl = createStringLiteral(tok);
+    sl->value = value;
+    return (Expression_t*)sl;
+}
+
+static bool isLiteral(const Expression_t* expr) {
+    return expr->type == EXPRESSION_INTEGER_LITERAL
+        || expr->type == EXPRESSION_BOOLEAN_LITERAL
+        || expr->type == EXPRESSION_STRING_LITERAL;
+}
+
+static bool isTruthyLiteral(const Expression_t* expr) {
+    if (expr->type == EXPRESSION_BOOLEAN_LITERAL)
+        return ((BooleanLiteral_t*)expr)->value;
+    return true;
+}
+
+static bool isSplicableIf(const Statement_t* st) {
+    if (st->type != STATEMENT_EXPRESSION) return false;
+
+    Expression_t* expr = ((ExpressionStatement_t*)st)->expression;
+    if (!expr || expr->type != EXPRESSION_IF_EXPRESSION) return false;
+
+    IfExpression_t* ifExpr = (IfExpression_t*)expr;
+    return isLiteral(ifExpr->condition)
+        && isTruthyLiteral(ifExpr->condition)
+        && !ifExpr->alternative;
+}
@@ -0,0 +1,16 @@
+#ifndef _OPTIMIZER_H_
+#define _OPTIMIZER_H_
+
+#include "ast.h"
+
+/*
+    AST level optimizations run on a parsed program before compilation.
+
+    Folds integer, boolean and string literal arithmetic and comparisons,
+    simplifies `!`/`-` on literals and removes unreachable if branches.
+    Operations failing at runtime (division by zero, mismatched types) are
+    left alone so that the error is still raised by the vm.
+*/
+void optimizerFoldConstants(Program_t* program);
+
+#endif
@@ -36,6 +36,8 @@ static PrecValue_t _precedences[_TOKEN_TYPE_CNT] = {
 static Statement_t* parserParseStatement(Parser_t* parser);
 static Statement_t* parserParseLetStatement(Parser_t* parser);
 static Statement_t* parserParseReturnStatement(Parser_t* parser);
+static Statement_t* parserParseAssignStatement(Parser_t* parser);
+static Statement_t* parserParseWhileStatement(Parser_t* parser);
 static Statement_t* parserParseExpressionStatement(Parser_t* parser);
 static BlockStatement_t* parserParseBlockStatement(Parser_t* parser);
 
@@ -161,6 +163,13 @@ static Statement_t* parserParseStatement(Parser_t* parser) {
             return parserParseLetStatement(parser);
         case TOKEN_RETURN: 
             return parserParseReturnStatement(parser);
+        case TOKEN_WHILE:
+            return parserParseWhileStatement(parser);
+        case TOKEN_IDENT:
+            if (parserPeekTokenIs(parser, TOKEN_ASSIGN)) {
+                return parserParseAssignStatement(parser);
+            }
+            return parserParseExpressionStatement(parser);
         default:
             return parserParseExpressionStatement(parser);
     }
@@ -182,6 +191,9 @@ static Statement_t* parserParseLetStatement(Parser_t* parser) {
     parserNextToken(parser);
 
     stmt->value = parserParseExpression(parser, PREC_LOWEST);
+    if (!stmt->value) {
+        goto cleanup;
+    }
 
     if (stmt->value->type == EXPRESSION_FUNCTION_LITERAL) {
        FunctionLiteral_t* fl = (FunctionLiteral_t*) stmt->value;
@@ -216,6 +228,57 @@ static Statement_t* parserParseReturnStatement(Parser_t* parser) {
 }
 
 
+static Statement_t* parserParseAssignStatement(Parser_t* parser) {
+    AssignStatement_t* stmt = createAssignStatement(parser->curToken);
+    stmt->name = createIdentifier(parser->curToken, parser->curToken->literal);
+
+    parserNextToken(parser);
+    parserNextToken(parser);
+
+    stmt->value = parserParseExpression(parser, PREC_LOWEST);
+
+    if (parserPeekTokenIs(parser, TOKEN_SEMICOLON))
+    {
+        parserNextToken(parser);
+    }
+
+    return (Statement_t*)stmt;
+}
+
+
+static Statement_t* parserParseWhileStatement(Parser_t* parser) {
+    WhileStatement_t* stmt = createWhileStatement(parser->curToken);
+
+    if (!parserExpectPeek(parser, TOKEN_LPAREN)) {
+        goto cleanup;
+    }
+
+    parserNextToken(parser);
+    stmt->condition = parserParseExpression(parser, PREC_LOWEST);
+
+    if (!parserExpectPeek(parser, TOKEN_RPAREN)) {
+        goto cleanup;
+    }
+
+    if (!parserExpectPeek(parser, TOKEN_LBRACE)) {
+        goto cleanup;
+    }
+
+    stmt->body = parserParseBlockStatement(parser);
+
+    if (parserPeekTokenIs(parser, TOKEN_SEMICOLON))
+    {
+        parserNextToken(parser);
+    }
+
+    return (Statement_t*)stmt;
+
+cleanup:
+    cleanupWhileStatement(&stmt);
+    return NULL;
+}
+
+
 static Statement_t* parserParseExpressionStatement(Parser_t* parser) {
     ExpressionStatement_t* stmt = createExpressionStatement(parser->curToken);
 
@@ -249,6 +312,11 @@ static BlockStatement_t* parserParseBlockStatement(Parser_t* parser) {
 static Expression_t* parserParseExpression(Parser_t* parser, PrecValue_t precedence) { 
     PrefixParseFn_t prefix = parser->prefixParseFns[parser->curToken->type];
     
+    if (parser->curToken->type == TOKEN_WHILE) {
+        parserAppendError(parser, cloneString("while is a statement, it has no value"));
+        return NULL;
+    }
+
     if( prefix == NULL) {
         parserNoPrefixParseFnError(parser, parser->curToken->type);
         return NULL;
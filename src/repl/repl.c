@@ -10,6 +10,8 @@
 #include "../vm.h"
 #include "../gc.h"
 #include "../builtin.h"
+#include "../optimizer.h"
+#include "../aot.h"
 
 #define PROMPT ">> "
 
@@ -22,17 +24,24 @@ static void printParserErrors(const char**err, uint32_t cnt){
     }
 }
 
-void evalInput(const char* input, SymbolTable_t* symTable, VectorObjects_t* constants,  Object_t** globals) {
+// Returns false when the input failed to parse, compile or run
+bool evalInput(const char* input, SymbolTable_t* symTable, VectorObjects_t* constants,  Object_t** globals, uint8_t optLevel, VmDispatch_t dispatch, uint32_t jitThreshold, uint32_t traceThreshold) {
     Lexer_t* lexer = createLexer(input);
     Parser_t* parser = createParser(lexer);
     Program_t* program = parserParseProgram(parser);
+    bool ok = false;
 
     if (parserGetErrorCount(parser) != 0) {
         printParserErrors(parserGetErrors(parser), parserGetErrorCount(parser));
         goto parser_err;
     }
+
+    if (optLevel > 0) {
+        optimizerFoldConstants(program);
+    }
     
     Compiler_t comp = createCompilerWithState(symTable, constants);
+    compilerSetOptLevel(&comp, optLevel);
     CompError_t compErr = compilerCompile(&comp, program);        
     if (compErr != COMP_NO_ERROR) {
         printf("Woops! Compilation failed:\n %d\n", compErr);
@@ -41,7 +50,13 @@ void evalInput(const char* input, SymbolTable_t* symTable, VectorObjects_t* cons
 
     Bytecode_t bytecode = compilerGetBytecode(&comp);
     Vm_t vm = createVmWithStore(&bytecode, globals);
+    vmSetDispatch(&vm, dispatch);
+    vmSetJitThreshold(&vm, jitThreshold);
+    vmSetTraceThreshold(&vm, traceThreshold);
     VmError_t vmErr = vmRun(&vm);
+    if (traceThreshold) {
+        fprintf(stderr, "trace coverage: %.1f%%\n", vmTraceCoverage(&vm));
+    }
     if (vmErr.code != VM_NO_ERROR) {
         printf("Woops! Executing bytecode failed:\n %s\n", vmErr.str);
         goto vm_err;
@@ -51,6 +66,7 @@ void evalInput(const char* input, SymbolTable_t* symTable, VectorObjects_t* cons
     char* res =  objectInspect(stackTop);
     printf("%s\n", res);
     free(res);
+    ok = true;
 
 vm_err:
     cleanupVmError(&vmErr);
@@ -61,6 +77,7 @@ parser_err:
     cleanupParser(&parser);
     cleanupProgram(&program);
     gcForceRun();
+    return ok;
 }
 
 SymbolTable_t* allocSymbolTable() {
@@ -85,11 +102,16 @@ void cleanupConstants(VectorObjects_t* constants) {
     cleanupVectorObjects(&constants, NULL);
 }
 
-void replMode() {
+void replMode(uint8_t optLevel, VmDispatch_t dispatch, uint32_t jitThreshold, uint32_t traceThreshold) {
     char inputBuffer[4096] = "";
     Object_t** globals = callocChk(GLOBALS_SIZE * sizeof(Object_t*));
     VectorObjects_t* constants = createVectorObjects();
     SymbolTable_t* symTable = allocSymbolTable();
+
+    // later inputs can call any global function, -O2 would assume they don't
+    if (optLevel > 1) {
+        optLevel = 1;
+    }
     while (true) {
         printf("%s", PROMPT);
         if(!fgets(inputBuffer, sizeof(inputBuffer), stdin))
@@ -98,7 +120,11 @@ void replMode() {
         if (strcmp(inputBuffer, "quit\n") == 0) 
             break;
             
-        evalInput(inputBuffer, symTable, constants, globals);
+        evalInput(inputBuffer, symTable, constants, globals, optLevel, dispatch, jitThreshold, traceThreshold);
+        
+        // code of finished inputs is gone, drop the constants only it used 
+        compilerCompactConstants(constants, globals, symTable->numDefinitions);
+        gcForceRun();
     }
 
     cleanupSymbolTable(symTable);
@@ -125,27 +151,124 @@ char* readEntireFile(char* filename) {
     return ret;
 }
 
-void fileExecMode(char* filename) {
+void fileExecMode(char* filename, uint8_t optLevel, VmDispatch_t dispatch, uint32_t jitThreshold, uint32_t traceThreshold) {
     char* input = readEntireFile(filename);
     Object_t** globals = mallocChk(GLOBALS_SIZE * sizeof(Object_t*));
     VectorObjects_t* constants = createVectorObjects();
     SymbolTable_t* symTable = allocSymbolTable();
 
-    evalInput(input, symTable, constants, globals);
+    bool ok = evalInput(input, symTable, constants, globals, optLevel, dispatch, jitThreshold, traceThreshold);
     
     cleanupSymbolTable(symTable);
     cleanupConstants(constants);
     free(globals);
     free(input);
+    // a failing program ends with an error, like its C translation
+    if (!ok) {
+        exit(EXIT_FAILURE);
+    }
 }
 
+// Writes the C translation of the file to stdout, see aot.h
+void emitCMode(char* filename, uint8_t optLevel) {
+    char* input = readEntireFile(filename);
+    Lexer_t* lexer = createLexer(input);
+    Parser_t* parser = createParser(lexer);
+    Program_t* program = parserParseProgram(parser);
+    VectorObjects_t* constants = createVectorObjects();
+    SymbolTable_t* symTable = allocSymbolTable();
+    int status = EXIT_FAILURE;
+
+    if (parserGetErrorCount(parser) != 0) {
+        printParserErrors(parserGetErrors(parser), parserGetErrorCount(parser));
+        goto parser_err;
+    }
+
+    if (optLevel > 0) {
+        optimizerFoldConstants(program);
+    }
+
+    Compiler_t comp = createCompilerWithState(symTable, constants);
+    compilerSetOptLevel(&comp, optLevel);
+    CompError_t compErr = compilerCompile(&comp, program);
+    if (compErr != COMP_NO_ERROR) {
+        printf("Woops! Compilation failed:\n %d\n", compErr);
+        goto comp_err;
+    }
+
+    Bytecode_t bytecode = compilerGetBytecode(&comp);
+    char* source = aotEmitC(&bytecode);
+    if (!source) {
+        fprintf(stderr, "Woops! The program has no C translation\n");
+        goto comp_err;
+    }
+    printf("%s", source);
+    free(source);
+    status = EXIT_SUCCESS;
+
+comp_err:
+    cleanupCompiler(&comp);
+parser_err:
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+    cleanupSymbolTable(symTable);
+    cleanupConstants(constants);
+    free(input);
+    gcForceRun();
+    if (status != EXIT_SUCCESS) {
+        exit(status);
+    }
+}
 
 int main(int argc, char**argv) {
-    if (argc == 1) {
-        // no parameters provided
-        replMode();
+    // -O0 compiles straight from the AST, -O1 optimizes on the IR and -O2
+    // (default) also types functions from their call sites in the whole file.
+    // --dispatch picks the run loop of the vm, to compare them. --jit compiles
+    // functions called often to machine code, --trace records and compiles
+    // the hot loops and recursions and reports the share of the instructions
+    // run in traces on stderr (both x86-64 Linux only). --emit-c prints the
+    // program translated to C instead of running it.
+    uint8_t optLevel = 2;
+    VmDispatch_t dispatch = VM_DEFAULT_DISPATCH;
+    uint32_t jitThreshold = VM_DEFAULT_JIT_THRESHOLD;
+    uint32_t traceThreshold = VM_DEFAULT_TRACE_THRESHOLD;
+    bool emitC = false;
+    char* filename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-O0") == 0) {
+            optLevel = 0;
+        } else if (strcmp(argv[i], "-O1") == 0) {
+            optLevel = 1;
+        } else if (strcmp(argv[i], "-O2") == 0) {
+            optLevel = 2;
+        } else if (strcmp(argv[i], "--dispatch=switch") == 0) {
+            dispatch = VM_DISPATCH_SWITCH;
+        } else if (strcmp(argv[i], "--dispatch=goto") == 0) {
+            dispatch = VM_DISPATCH_GOTO;
+        } else if (strcmp(argv[i], "--dispatch=threaded") == 0) {
+            dispatch = VM_DISPATCH_THREADED;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jitThreshold = VM_JIT_THRESHOLD;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            traceThreshold = VM_TRACE_THRESHOLD;
+        } else if (strcmp(argv[i], "--emit-c") == 0) {
+            emitC = true;
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    if (emitC) {
+        if (!filename) {
+            fprintf(stderr, "--emit-c needs a file\n");
+            return 1;
+        }
+        emitCMode(filename, optLevel);
+    } else if (!filename) {
+        // no file provided
+        replMode(optLevel, dispatch, jitThreshold, traceThreshold);
     } else {    
-        fileExecMode(argv[1]);
+        fileExecMode(filename, optLevel, dispatch, jitThreshold, traceThreshold);
     }
     return 0;
 }
\ No newline at end of file
@@ -37,7 +37,8 @@ char* detachStrbuf(Strbuf_t** sbuf) {
 }
 
 void strbufWrite(Strbuf_t* sbuf, const char* str) {
-    uint32_t tlen = sbuf->len + strlen(str);
+    uint32_t slen = strlen(str);
+    uint32_t tlen = sbuf->len + slen;
     
     if (sbuf->str == NULL) {
         sbuf->str = (char*) malloc(tlen + 1u);  
@@ -53,8 +54,9 @@ void strbufWrite(Strbuf_t* sbuf, const char* str) {
     if (sbuf->str == NULL){
         HANDLE_OOM();
     }
+    // append at the known end, strcat would rescan the whole buffer
+    memcpy(sbuf->str + sbuf->len, str, slen + 1);
     sbuf->len = tlen;
-    strcat(sbuf->str, str);
 }
 
 void strbufConsume(Strbuf_t* sbuf, char* str) {
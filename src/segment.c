@@ -0,0 +1,149 @@
+#if defined(__unix__)
+#define _DEFAULT_SOURCE
+#include <sys/mman.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "segment.h"
+#include "compiler.h"
+#include "utils.h"
+
+// Appends fn and then the functions its pool creates closures of
+static void segmentOrderFunctions(CodeSegment_t* segment, CompiledFunction_t* fn, CompiledFunction_t** order, uint32_t* count) {
+    if (fn->segment) return;
+    fn->segment = segment;
+    order[(*count)++] = fn;
+    for (uint32_t i = 0; i < fn->numConstants; i++) {
+        if (objectGetType(fn->constants[i]) == OBJECT_COMPILED_FUNCTION) {
+            segmentOrderFunctions(segment, (CompiledFunction_t*)fn->constants[i], order, count);
+        }
+    }
+}
+
+// The pool gets its own copy of every switch table, with word index targets
+static void segmentMoveSwitchTables(CompiledFunction_t* fn, const uint32_t* positionMap) {
+    Instructions_t ins = fn->instructions;
+    for (uint32_t pos = 0, len = 0; pos < sliceByteGetLen(ins); pos += len) {
+        OpCode_t op;
+        SliceInt_t operands = codeReadInstruction(ins, pos, &op, &len);
+        if (op == OP_SWITCH_TABLE) {
+            Array_t* table = copyArray((Array_t*)fn->constants[operands[0]]);
+            compilerMoveSwitchTable(table, positionMap);
+            fn->constants[operands[0]] = (Object_t*)table;
+        }
+        cleanupSliceInt(operands);
+    }
+}
+
+#define SEGMENT_POINTER_WORDS (sizeof(Object_t*) / sizeof(CodeWord_t))
+
+// Word offset where a pool starting at or after offset can be placed
+static size_t segmentAlignPool(size_t offset) {
+    return (offset + SEGMENT_POINTER_WORDS - 1) / SEGMENT_POINTER_WORDS * SEGMENT_POINTER_WORDS;
+}
+
+static CodeWord_t* segmentAlloc(size_t size) {
+#if defined(__unix__)
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) HANDLE_OOM();
+    return mem;
+#else
+    return mallocChk(size);
+#endif
+}
+
+static void segmentProtect(CodeSegment_t* segment) {
+#if defined(__unix__)
+    // code must never stay writable, fail like a failed allocation
+    if (mprotect(segment->mem, segment->size, PROT_READ) != 0) {
+        perror("SEGMENT ERROR: Failed to make code read only!");
+        exit(1);
+    }
+#endif
+}
+
+static void segmentCleanupFunction(CompiledFunction_t* fn) {
+    if (fn->segment) codeSegmentRelease(fn->segment);
+}
+
+// The decoded code is shared with copies
+static void segmentCopyFunction(const CompiledFunction_t* fn, CompiledFunction_t* copy) {
+    if (!fn->segment) return;
+    copy->segment = fn->segment;
+    copy->code = fn->code;
+    copy->codeLength = fn->codeLength;
+    fn->segment->numFunctions++;
+}
+
+CodeSegment_t* linkCodeSegment(CompiledFunction_t* main, VectorObjects_t* constants) {
+    uint32_t numConstants = vectorObjectsGetCount(constants);
+    Object_t** objs = vectorObjectsGetBuffer(constants);
+    CompiledFunction_t** order = mallocChk((numConstants + 1) * sizeof(CompiledFunction_t*));
+    uint32_t count = 0;
+
+    compiledFunctionAddHooks((CompiledFunctionHooks_t) {
+        .cleanup = segmentCleanupFunction,
+        .copy = segmentCopyFunction,
+    });
+    CodeSegment_t* segment = mallocChk(sizeof(CodeSegment_t));
+    segmentOrderFunctions(segment, main, order, &count);
+    for (uint32_t i = 0; i < numConstants; i++) {
+        if (objectGetType(objs[i]) == OBJECT_COMPILED_FUNCTION) {
+            segmentOrderFunctions(segment, (CompiledFunction_t*)objs[i], order, &count);
+        }
+    }
+    if (count == 0) {
+        free(segment);
+        free(order);
+        return NULL;
+    }
+
+    // every function is its pool, aligned for pointers, then its code and 
+    // an end marker word
+    size_t numWords = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        order[i]->codeLength = codeDecodedLength(order[i]->instructions);
+        numWords = segmentAlignPool(numWords) + order[i]->numConstants * SEGMENT_POINTER_WORDS;
+        numWords += order[i]->codeLength + 1;
+    }
+    *segment = (CodeSegment_t) {
+        .mem = segmentAlloc(numWords * sizeof(CodeWord_t)),
+        .size = numWords * sizeof(CodeWord_t),
+        .numFunctions = count,
+    };
+
+    size_t offset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        CompiledFunction_t* fn = order[i];
+        offset = segmentAlignPool(offset);
+        Object_t** pool = (Object_t**)(segment->mem + offset);
+        offset += fn->numConstants * SEGMENT_POINTER_WORDS;
+
+        uint32_t* positionMap = mallocChk((sliceByteGetLen(fn->instructions) + 1) * sizeof(uint32_t));
+        codeDecodeInstructions(fn->instructions, segment->mem + offset, positionMap);
+        segmentMoveSwitchTables(fn, positionMap);
+        free(positionMap);
+
+        // the inline pool stays behind unused, copies of fn start from it again
+        if (fn->numConstants > 0) memcpy(pool, fn->constants, fn->numConstants * sizeof(Object_t*));
+        fn->constants = pool;
+        fn->code = segment->mem + offset;
+        segment->mem[offset + fn->codeLength] = CODE_END_MARKER;
+        offset += fn->codeLength + 1;
+    }
+    segmentProtect(segment);
+
+    free(order);
+    return segment;
+}
+
+void codeSegmentRelease(CodeSegment_t* segment) {
+    if (--segment->numFunctions > 0) return;
+#if defined(__unix__)
+    munmap(segment->mem, segment->size);
+#else
+    free(segment->mem);
+#endif
+    free(segment);
+}
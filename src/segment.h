@@ -0,0 +1,29 @@
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+#include "object.h"
+#include "vector.h"
+#include <stdint.h>
+
+// Decoded instructions (see codeDecodeInstructions) of functions linked 
+// together, laid out back to back so functions calling each other share 
+// cache lines and pages. Each function's constant pool sits right before its
+// code. The memory is made read only once filled and lives as long as the
+// functions.
+struct CodeSegment {
+    CodeWord_t* mem;
+    size_t size; // in bytes
+    uint32_t numFunctions; // linked functions still alive
+};
+
+// Decodes the instructions of main and of the functions among constants 
+// that are not linked yet into a new segment. Functions are placed right 
+// after the first one creating closures of them, the remaining ones follow 
+// in constant order. Switch tables are replaced by copies targeting word 
+// indices, then the pools are moved into the segment. Returns NULL when 
+// there is nothing to link.
+CodeSegment_t* linkCodeSegment(CompiledFunction_t* main, VectorObjects_t* constants);
+
+// Drops the reference of a linked function, the last one frees the segment
+void codeSegmentRelease(CodeSegment_t* segment);
+
+#endif
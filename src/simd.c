@@ -0,0 +1,179 @@
+#include <string.h>
+
+#include "simd.h"
+
+/*
+    Kernels use GCC vector extensions, accumulation is done on unsigned lanes
+    so that overflow wraps. The 2 lane kernels compile to SSE2 on x86-64 and to
+    the vector unit of other targets. On x86 the 4 lane kernels are compiled
+    for AVX2 only and picked at runtime when the cpu supports it. Vectors stay
+    inside the kernels, as arguments or results they would change the ABI.
+    SIMD_SCALAR_ONLY builds the scalar loops alone.
+*/
+#if defined(__GNUC__) && !defined(SIMD_SCALAR_ONLY)
+#define SIMD_VECTOR_EXT
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_AVX2
+#endif
+#endif
+
+typedef struct SimdKernels {
+    int64_t (*sum)(const int64_t* buf, uint32_t cnt);
+    int64_t (*dot)(const int64_t* a, const int64_t* b, uint32_t cnt);
+    int64_t (*min)(const int64_t* buf, uint32_t cnt);
+    int64_t (*max)(const int64_t* buf, uint32_t cnt);
+} SimdKernels_t;
+
+/* Scalar kernels, also the tails of the vector ones */
+
+static int64_t simdSumScalar(const int64_t* buf, uint32_t cnt) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        sum += (uint64_t)buf[i];
+    }
+    return (int64_t)sum;
+}
+
+static int64_t simdDotScalar(const int64_t* a, const int64_t* b, uint32_t cnt) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        sum += (uint64_t)a[i] * (uint64_t)b[i];
+    }
+    return (int64_t)sum;
+}
+
+static int64_t simdMinScalar(const int64_t* buf, uint32_t cnt) {
+    int64_t min = buf[0];
+    for (uint32_t i = 1; i < cnt; i++) {
+        min = buf[i] < min ? buf[i] : min;
+    }
+    return min;
+}
+
+static int64_t simdMaxScalar(const int64_t* buf, uint32_t cnt) {
+    int64_t max = buf[0];
+    for (uint32_t i = 1; i < cnt; i++) {
+        max = buf[i] > max ? buf[i] : max;
+    }
+    return max;
+}
+
+/*
+    Vector kernels with LANES int64 lanes, each function gets the TARGET
+    attributes. Buffers come from the heap without any alignment guarantee,
+    lanes are loaded with memcpy.
+*/
+#define SIMD_DEFINE_KERNELS(NAME, LANES, TARGET)                                               \
+typedef uint64_t VecU64##NAME##_t __attribute__((vector_size(LANES * sizeof(uint64_t))));      \
+typedef int64_t VecI64##NAME##_t __attribute__((vector_size(LANES * sizeof(int64_t))));        \
+\
+TARGET static int64_t simdSum##NAME(const int64_t* buf, uint32_t cnt) {                        \
+    uint32_t i = 0;                                                                            \
+    VecU64##NAME##_t acc = {0};                                                                \
+    for (; i + LANES <= cnt; i += LANES) {                                                     \
+        VecU64##NAME##_t v;                                                                    \
+        memcpy(&v, &buf[i], sizeof(v));                                                        \
+        acc += v;                                                                              \
+    }                                                                                          \
+    uint64_t sum = (uint64_t)simdSumScalar(&buf[i], cnt - i);                                  \
+    for (uint32_t l = 0; l < LANES; l++) {                                                     \
+        sum += acc[l];                                                                         \
+    }                                                                                          \
+    return (int64_t)sum;                                                                       \
+}                                                                                              \
+\
+TARGET static int64_t simdDot##NAME(const int64_t* a, const int64_t* b, uint32_t cnt) {        \
+    uint32_t i = 0;                                                                            \
+    VecU64##NAME##_t acc = {0};                                                                \
+    for (; i + LANES <= cnt; i += LANES) {                                                     \
+        VecU64##NAME##_t va, vb;                                                               \
+        memcpy(&va, &a[i], sizeof(va));                                                        \
+        memcpy(&vb, &b[i], sizeof(vb));                                                        \
+        acc += va * vb;                                                                        \
+    }                                                                                          \
+    uint64_t sum = (uint64_t)simdDotScalar(&a[i], &b[i], cnt - i);                             \
+    for (uint32_t l = 0; l < LANES; l++) {                                                     \
+        sum += acc[l];                                                                         \
+    }                                                                                          \
+    return (int64_t)sum;                                                                       \
+}                                                                                              \
+\
+TARGET static int64_t simdMin##NAME(const int64_t* buf, uint32_t cnt) {                        \
+    if (cnt < LANES) return simdMinScalar(buf, cnt);                                           \
+    VecI64##NAME##_t acc;                                                                      \
+    memcpy(&acc, buf, sizeof(acc));                                                            \
+    uint32_t i = LANES;                                                                        \
+    for (; i + LANES <= cnt; i += LANES) {                                                     \
+        VecI64##NAME##_t v;                                                                    \
+        memcpy(&v, &buf[i], sizeof(v));                                                        \
+        VecI64##NAME##_t mask = v < acc;                                                       \
+        acc = (v & mask) | (acc & ~mask);                                                      \
+    }                                                                                          \
+    int64_t min = i < cnt ? simdMinScalar(&buf[i], cnt - i) : acc[0];                          \
+    for (uint32_t l = 0; l < LANES; l++) {                                                     \
+        min = acc[l] < min ? acc[l] : min;                                                     \
+    }                                                                                          \
+    return min;                                                                                \
+}                                                                                              \
+\
+TARGET static int64_t simdMax##NAME(const int64_t* buf, uint32_t cnt) {                        \
+    if (cnt < LANES) return simdMaxScalar(buf, cnt);                                           \
+    VecI64##NAME##_t acc;                                                                      \
+    memcpy(&acc, buf, sizeof(acc));                                                            \
+    uint32_t i = LANES;                                                                        \
+    for (; i + LANES <= cnt; i += LANES) {                                                     \
+        VecI64##NAME##_t v;                                                                    \
+        memcpy(&v, &buf[i], sizeof(v));                                                        \
+        VecI64##NAME##_t mask = v > acc;                                                       \
+        acc = (v & mask) | (acc & ~mask);                                                      \
+    }                                                                                          \
+    int64_t max = i < cnt ? simdMaxScalar(&buf[i], cnt - i) : acc[0];                          \
+    for (uint32_t l = 0; l < LANES; l++) {                                                     \
+        max = acc[l] > max ? acc[l] : max;                                                     \
+    }                                                                                          \
+    return max;                                                                                \
+}
+
+#ifdef SIMD_VECTOR_EXT
+SIMD_DEFINE_KERNELS(Vec2, 2, )
+#endif
+
+#ifdef SIMD_AVX2
+SIMD_DEFINE_KERNELS(Avx2, 4, __attribute__((target("avx2"))))
+#endif
+
+// Best kernels for the cpu, selected on first use
+static const SimdKernels_t* simdGetKernels(void) {
+    static const SimdKernels_t* selected = NULL;
+    if (selected) return selected;
+
+    static const SimdKernels_t scalar = {simdSumScalar, simdDotScalar, simdMinScalar, simdMaxScalar};
+    selected = &scalar;
+#ifdef SIMD_VECTOR_EXT
+    static const SimdKernels_t vec2 = {simdSumVec2, simdDotVec2, simdMinVec2, simdMaxVec2};
+    selected = &vec2;
+#endif
+#ifdef SIMD_AVX2
+    static const SimdKernels_t avx2 = {simdSumAvx2, simdDotAvx2, simdMinAvx2, simdMaxAvx2};
+    if (__builtin_cpu_supports("avx2")) {
+        selected = &avx2;
+    }
+#endif
+    return selected;
+}
+
+int64_t simdSumInt64(const int64_t* buf, uint32_t cnt) {
+    return simdGetKernels()->sum(buf, cnt);
+}
+
+int64_t simdDotInt64(const int64_t* a, const int64_t* b, uint32_t cnt) {
+    return simdGetKernels()->dot(a, b, cnt);
+}
+
+int64_t simdMinInt64(const int64_t* buf, uint32_t cnt) {
+    return simdGetKernels()->min(buf, cnt);
+}
+
+int64_t simdMaxInt64(const int64_t* buf, uint32_t cnt) {
+    return simdGetKernels()->max(buf, cnt);
+}
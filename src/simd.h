@@ -0,0 +1,18 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stdint.h>
+
+/*
+    Reduction kernels over packed int64 buffers. Arithmetic wraps on overflow, 
+    same as the scalar integer ops of the vm. 
+*/
+
+int64_t simdSumInt64(const int64_t* buf, uint32_t cnt);
+int64_t simdDotInt64(const int64_t* a, const int64_t* b, uint32_t cnt);
+
+// cnt must be > 0 
+int64_t simdMinInt64(const int64_t* buf, uint32_t cnt);
+int64_t simdMaxInt64(const int64_t* buf, uint32_t cnt);
+
+#endif
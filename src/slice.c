@@ -20,6 +20,16 @@ void* allocSlicePtr(size_t cnt, size_t elemSize) {
     return slicePtrGetData(header);  
 }
 
+size_t sliceAllocSize(size_t cnt, size_t elemSize) {
+    return sizeof(size_t) + cnt * elemSize;
+}
+
+void* sliceInitPtr(void* mem, size_t cnt) {
+    size_t* header = mem;
+    *header = cnt;
+    return slicePtrGetData(header);
+}
+
 void freeSlicePtr(void* ptr) {
     free(slicePtrGetHeader(ptr));
 }
@@ -47,6 +47,11 @@ void slice##NAME##Append(_SLICE_TYPE(NAME) *slicePtr, TYPE* buf, size_t len) {
     slicePtrAppend((void**)slicePtr, buf, len, sizeof(TYPE));                   \
 }
 
+/* Place a slice of cnt elements into caller provided memory of sliceAllocSize() bytes. 
+   Such slices are not owned by the slice functions and must not be cleaned up or resized. */
+size_t sliceAllocSize(size_t cnt, size_t elemSize);
+void* sliceInitPtr(void* mem, size_t cnt);
+
 /* Create a few standard definitions */
 DEF_SLICE_TYPE(Byte, uint8_t);
 DEF_SLICE_TYPE(Int, int);
@@ -21,7 +21,8 @@ Symbol_t* createSymbol(const char* name, SymbolScope_t scope, uint32_t index) {
     *sym = (Symbol_t) {
         .index = index,
         .name = cloneString(name),
-        .scope = scope
+        .scope = scope,
+        .constant = -1,
     };
     return sym;
 }
@@ -104,4 +105,11 @@ Symbol_t* symbolTableResolve(SymbolTable_t* symTable, const char* name) {
         return symbolTableDefineFree(symTable, sym);
     }
     return sym;
-}
\ No newline at end of file
+}
+
+void symbolTableUnbindConstants(SymbolTable_t* symTable) {
+    HashMapIter_t iter = createHashMapIter(symTable->store);
+    for (HashMapEntry_t* e = hashMapIterGetNext(symTable->store, &iter); e; e = hashMapIterGetNext(symTable->store, &iter)) {
+        ((Symbol_t*)e->value)->constant = -1;
+    }
+}
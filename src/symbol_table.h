@@ -19,6 +19,7 @@ typedef struct Symbol {
     char* name;
     SymbolScope_t scope;
     uint32_t index;
+    int32_t constant; // constant a global is bound to while its input is compiled, -1 if none
 } Symbol_t;
 
 Symbol_t* createSymbol(const char* name, SymbolScope_t scope, uint32_t index);
@@ -43,5 +44,6 @@ Symbol_t* symbolTableDefine(SymbolTable_t* symTable, const char* name);
 Symbol_t* symbolTableDefineBuiltin(SymbolTable_t* symTable, uint32_t index, const char* name);
 Symbol_t* symbolTableDefineFunctionName(SymbolTable_t* symTable, const char* name);
 Symbol_t* symbolTableResolve(SymbolTable_t* symTable, const char* name);
+void symbolTableUnbindConstants(SymbolTable_t* symTable);
 
 #endif
\ No newline at end of file
@@ -44,10 +44,12 @@ TokenType_t lookupIdent(const char* ident, uint32_t len)
         return TOKEN_ELSE;
     else if (strlen("return") == len && strncmp(ident, "return", len) == 0) 
         return TOKEN_RETURN;
+    else if (strlen("while") == len && strncmp(ident, "while", len) == 0) 
+        return TOKEN_WHILE;
     return TOKEN_IDENT;
 }
 /* C99 designated initializer abuse :) */
-static const char* TokenTypeStrings[32] = {
+static const char* TokenTypeStrings[_TOKEN_TYPE_CNT] = {
     [TOKEN_ILLEGAL]="TOKEN_ILLEGAL", [TOKEN_EOF]="TOKEN_EOF",
     [TOKEN_IDENT]="TOKEN_IDENT", [TOKEN_INT]="TOKEN_INT",
     [TOKEN_STRING]="TOKEN_STRING",
@@ -63,7 +65,7 @@ static const char* TokenTypeStrings[32] = {
     [TOKEN_FUNCTION]="TOKEN_FUNCTION", [TOKEN_LET]="TOKEN_LET",
     [TOKEN_TRUE]="TOKEN_TRUE", [TOKEN_FALSE]="TOKEN_FALSE",
     [TOKEN_IF]="TOKEN_IF",  [TOKEN_ELSE]="TOKEN_ELSE",
-    [TOKEN_RETURN]="TOKEN_RETURN", 
+    [TOKEN_RETURN]="TOKEN_RETURN", [TOKEN_WHILE]="TOKEN_WHILE",
 };
 
 const char * tokenTypeToStr(TokenType_t tokType)
@@ -46,6 +46,7 @@ typedef enum TokenType{
     TOKEN_IF, 
     TOKEN_ELSE,
     TOKEN_RETURN,
+    TOKEN_WHILE,
 
     _TOKEN_TYPE_CNT
 } TokenType_t; 
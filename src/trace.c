@@ -0,0 +1,1077 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "utils.h"
+
+/* Traces compile in two passes. The first one runs the recorded steps over
+ * abstract values: constants fold, locals live in slots, and only the values
+ * entering the trace are type checked and unboxed, once, in the head ahead
+ * of the body. It leaves a list of slot instructions, and a snapshot of the
+ * vm state for every guard to write back on exit. The second pass drops the
+ * instructions whose result is never read and emits the rest. */
+
+// Slots of the native frame, the locals follow, then the temporaries
+#define SLOT_EXECUTED 0 // steps run by the completed iterations
+#define SLOT_LOOPED 1   // an iteration completed, the locals it wrote are only in slots
+#define SLOT_LOCALS 2
+
+#define TRACE_NO_LABEL UINT32_MAX
+
+typedef struct TraceValue {
+    TraceValueKind_t kind;
+    JitOperand_t ref; // integers and booleans
+    uint32_t index; // function constant, builtin or local
+    ObjectType_t type; // of a local object
+    bool real; // entry still in the vm stack, unknown until loaded
+    bool loaded;
+} TraceValue_t;
+
+typedef enum TraceLocalState {
+    TRACE_LOCAL_UNREAD,
+    TRACE_LOCAL_LOADED,     // read before any write, checked in the head
+    TRACE_LOCAL_WRITTEN,
+    TRACE_LOCAL_MOVED,
+} TraceLocalState_t;
+
+typedef struct TraceLocal {
+    TraceLocalState_t state;
+    TraceValueKind_t kind;
+    JitOperand_t value;
+    ObjectType_t type;
+    bool readFirst;
+    TraceValueKind_t entryKind;
+    ObjectType_t entryType;
+} TraceLocal_t;
+
+typedef struct TraceWrite {
+    uint32_t local;
+    TraceValueKind_t kind;
+    bool moved;
+} TraceWrite_t;
+
+// Where an exit resumes and what it writes back
+typedef struct TraceSnapshot {
+    uint32_t step;
+    uint32_t ip;
+    uint32_t values; // first stack value in snapshotValues
+    uint32_t depth;
+    uint32_t realPrefix; // entries up to there are still the real ones
+    uint32_t numWrites;
+    uint32_t label;
+} TraceSnapshot_t;
+
+typedef struct TraceLoad {
+    int32_t index; // from the first local
+    ObjectType_t type;
+    JitUnbox_t unbox;
+    uint32_t dst;
+} TraceLoad_t;
+
+typedef enum TraceOp {
+    TRACE_OP_MOVE,
+    TRACE_OP_ARITHMETIC,
+    TRACE_OP_COMPARE,
+    TRACE_OP_GUARD,
+    TRACE_OP_LOOP,      // back to the body
+    TRACE_OP_CALL,      // calls and leaves
+    TRACE_OP_RECURSE,   // self call, loops into the callee
+    TRACE_OP_RETURN,    // returns and leaves
+    TRACE_OP_UNWIND,    // returns, loops if that lands on the anchor again
+    TRACE_OP_EXIT,      // reached another trace
+} TraceOp_t;
+
+typedef struct TraceIns {
+    TraceOp_t op;
+    uint8_t sub; // JitArithmetic_t or JitCondition_t
+    bool dead;
+    uint32_t dst;
+    JitOperand_t left;
+    JitOperand_t right;
+    uint32_t snapshot;
+    uint32_t step;
+} TraceIns_t;
+
+typedef struct TraceCompiler {
+    const TraceRecording_t* rec;
+    const TraceHelpers_t* helpers;
+    bool failed;
+
+    TraceValue_t* stack;
+    uint32_t depth;
+    uint32_t realPrefix;
+
+    TraceLocal_t* locals;
+    uint32_t numLocals;
+    uint32_t numSlots;
+
+    TraceLoad_t* loads;
+    uint32_t numLoads;
+    uint32_t loadCapacity;
+    TraceIns_t* body;
+    uint32_t numIns;
+    uint32_t insCapacity;
+    TraceWrite_t* writes;
+    uint32_t numWrites;
+    uint32_t writeCapacity;
+    TraceSnapshot_t* snapshots;
+    uint32_t numSnapshots;
+    uint32_t snapshotCapacity;
+    TraceValue_t* snapshotValues;
+    uint32_t numSnapshotValues;
+    uint32_t snapshotValueCapacity;
+
+    // comparison of the previous step, which a conditional jump turns into a guard
+    int32_t compare;
+    uint32_t compareStep;
+    uint32_t compareSnapshot;
+
+    uint32_t headLabel;
+    uint32_t bodyLabel;
+} TraceCompiler_t;
+
+// Makes room for one more element, returns its index
+static uint32_t traceGrow(void** buf, uint32_t* count, uint32_t* capacity, size_t size) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        *buf = realloc(*buf, *capacity * size);
+        if (!*buf) HANDLE_OOM();
+    }
+    return (*count)++;
+}
+
+static uint32_t traceLocalSlot(uint32_t local) {
+    return SLOT_LOCALS + local;
+}
+
+static uint32_t traceNewSlot(TraceCompiler_t* c) {
+    return c->numSlots++;
+}
+
+static bool traceIsTemporary(TraceCompiler_t* c, uint32_t slot) {
+    return slot >= SLOT_LOCALS + c->numLocals;
+}
+
+static TraceValue_t traceValue(TraceValueKind_t kind, JitOperand_t ref) {
+    return (TraceValue_t) {
+        .kind = kind,
+        .ref = ref,
+        .loaded = true,
+    };
+}
+
+static TraceValue_t traceObject(TraceValueKind_t kind, uint32_t index) {
+    return (TraceValue_t) {
+        .kind = kind,
+        .ref = JIT_CONSTANT(0),
+        .index = index,
+        .loaded = true,
+    };
+}
+
+// The conditions come in pairs, the lowest bit negates them
+static JitCondition_t traceNegate(JitCondition_t cond) {
+    return (JitCondition_t)(cond ^ 1);
+}
+
+static bool traceHolds(JitCondition_t cond, int64_t left, int64_t right) {
+    switch (cond) {
+        case JIT_EQUAL:
+            return left == right;
+        case JIT_NOT_EQUAL:
+            return left != right;
+        case JIT_GREATER:
+            return left > right;
+        default:
+            return left <= right;
+    }
+}
+
+static void traceEmit(TraceCompiler_t* c, TraceIns_t ins) {
+    uint32_t i = traceGrow((void**)&c->body, &c->numIns, &c->insCapacity, sizeof(TraceIns_t));
+    c->body[i] = ins;
+}
+
+static void traceAddLoad(TraceCompiler_t* c, int32_t index, ObjectType_t type, JitUnbox_t unbox, uint32_t dst) {
+    uint32_t i = traceGrow((void**)&c->loads, &c->numLoads, &c->loadCapacity, sizeof(TraceLoad_t));
+    c->loads[i] = (TraceLoad_t) {
+        .index = index,
+        .type = type,
+        .unbox = unbox,
+        .dst = dst,
+    };
+}
+
+static void traceAddWrite(TraceCompiler_t* c, uint32_t local, TraceValueKind_t kind, bool moved) {
+    uint32_t i = traceGrow((void**)&c->writes, &c->numWrites, &c->writeCapacity, sizeof(TraceWrite_t));
+    c->writes[i] = (TraceWrite_t) {
+        .local = local,
+        .kind = kind,
+        .moved = moved,
+    };
+}
+
+// State before step s, resuming at ip
+static uint32_t traceSnapshot(TraceCompiler_t* c, uint32_t s, uint32_t ip) {
+    uint32_t first = c->numSnapshotValues;
+    for (uint32_t i = 0; i < c->depth; i++) {
+        uint32_t v = traceGrow((void**)&c->snapshotValues, &c->numSnapshotValues, &c->snapshotValueCapacity, sizeof(TraceValue_t));
+        c->snapshotValues[v] = c->stack[i];
+    }
+
+    uint32_t i = traceGrow((void**)&c->snapshots, &c->numSnapshots, &c->snapshotCapacity, sizeof(TraceSnapshot_t));
+    c->snapshots[i] = (TraceSnapshot_t) {
+        .step = s,
+        .ip = ip,
+        .values = first,
+        .depth = c->depth,
+        .realPrefix = c->realPrefix,
+        .numWrites = c->numWrites,
+        .label = TRACE_NO_LABEL,
+    };
+    return i;
+}
+
+static uint32_t traceStepSnapshot(TraceCompiler_t* c, uint32_t s) {
+    return traceSnapshot(c, s, c->rec->steps[s].ip);
+}
+
+// Word the execution went to after step s
+static uint32_t traceNextIp(TraceCompiler_t* c, uint32_t s) {
+    if (s + 1 < c->rec->numSteps) return c->rec->steps[s + 1].ip;
+    return c->rec->closed ? c->rec->anchorIp : c->rec->endIp;
+}
+
+static void tracePush(TraceCompiler_t* c, TraceValue_t value) {
+    c->stack[c->depth++] = value;
+}
+
+static TraceValue_t tracePop(TraceCompiler_t* c) {
+    if (c->depth == 0) {
+        c->failed = true;
+        return traceValue(TRACE_INTEGER, JIT_CONSTANT(0));
+    }
+    c->depth--;
+    if (c->depth < c->realPrefix) c->realPrefix = c->depth;
+    return c->stack[c->depth];
+}
+
+// Pops a value, a real entry is unboxed in the head with the type it was
+// recorded with
+static TraceValue_t tracePopValue(TraceCompiler_t* c, ObjectType_t type) {
+    TraceValue_t value = tracePop(c);
+    if (c->failed || value.loaded) return value;
+
+    uint32_t slot = traceNewSlot(c);
+    switch (type) {
+        case OBJECT_INTEGER:
+            traceAddLoad(c, c->numLocals + c->depth, type, JIT_UNBOX_INTEGER, slot);
+            return traceValue(TRACE_INTEGER, JIT_SLOT(slot));
+        case OBJECT_BOOLEAN:
+            traceAddLoad(c, c->numLocals + c->depth, type, JIT_UNBOX_BOOLEAN, slot);
+            return traceValue(TRACE_BOOLEAN, JIT_SLOT(slot));
+        default:
+            c->failed = true;
+            return value;
+    }
+}
+
+static JitOperand_t tracePopInteger(TraceCompiler_t* c, ObjectType_t type) {
+    TraceValue_t value = tracePopValue(c, type);
+    if (value.kind != TRACE_INTEGER) c->failed = true;
+    return value.ref;
+}
+
+static TraceValue_t traceGetLocal(TraceCompiler_t* c, uint32_t index, ObjectType_t type) {
+    if (index >= c->numLocals || c->locals[index].state == TRACE_LOCAL_MOVED) {
+        c->failed = true;
+        return traceValue(TRACE_INTEGER, JIT_CONSTANT(0));
+    }
+
+    TraceLocal_t* local = &c->locals[index];
+    if (local->state == TRACE_LOCAL_UNREAD) {
+        switch (type) {
+            case OBJECT_INTEGER:
+                local->kind = TRACE_INTEGER;
+                traceAddLoad(c, index, type, JIT_UNBOX_INTEGER, traceLocalSlot(index));
+                break;
+            case OBJECT_BOOLEAN:
+                local->kind = TRACE_BOOLEAN;
+                traceAddLoad(c, index, type, JIT_UNBOX_BOOLEAN, traceLocalSlot(index));
+                break;
+            case TRACE_NO_TYPE:
+                c->failed = true;
+                return traceValue(TRACE_INTEGER, JIT_CONSTANT(0));
+            default:
+                // other objects are only passed around, from the vm slot
+                local->kind = TRACE_LOCAL;
+                traceAddLoad(c, index, type, JIT_UNBOX_NONE, 0);
+                break;
+        }
+        local->state = TRACE_LOCAL_LOADED;
+        local->value = JIT_SLOT(traceLocalSlot(index));
+        local->type = type;
+        local->readFirst = true;
+        local->entryKind = local->kind;
+        local->entryType = type;
+    }
+
+    if (local->kind == TRACE_LOCAL) {
+        TraceValue_t value = traceObject(TRACE_LOCAL, index);
+        value.type = local->type;
+        return value;
+    }
+    return traceValue(local->kind, local->value);
+}
+
+static void traceSetLocal(TraceCompiler_t* c, uint32_t s, uint32_t index, ObjectType_t type) {
+    TraceValue_t value = tracePopValue(c, type);
+    if (c->failed) return;
+    if (index >= c->numLocals || (value.kind != TRACE_INTEGER && value.kind != TRACE_BOOLEAN)) {
+        c->failed = true;
+        return;
+    }
+
+    // stack values read from the slot keep the old value
+    uint32_t slot = traceLocalSlot(index);
+    for (uint32_t i = 0; i < c->depth; i++) {
+        TraceValue_t* entry = &c->stack[i];
+        if (!entry->loaded || (entry->kind != TRACE_INTEGER && entry->kind != TRACE_BOOLEAN)) continue;
+        if (entry->ref.constant || entry->ref.value != slot) continue;
+
+        uint32_t copy = traceNewSlot(c);
+        traceEmit(c, (TraceIns_t) { .op = TRACE_OP_MOVE, .dst = copy, .left = entry->ref, .step = s });
+        entry->ref = JIT_SLOT(copy);
+    }
+
+    if (value.ref.constant || value.ref.value != slot) {
+        traceEmit(c, (TraceIns_t) { .op = TRACE_OP_MOVE, .dst = slot, .left = value.ref, .step = s });
+    }
+
+    TraceLocal_t* local = &c->locals[index];
+    local->state = TRACE_LOCAL_WRITTEN;
+    local->kind = value.kind;
+    local->value = value.ref.constant ? value.ref : JIT_SLOT(slot);
+    traceAddWrite(c, index, value.kind, false);
+}
+
+static void traceMoveLocal(TraceCompiler_t* c, uint32_t index, ObjectType_t type) {
+    TraceValue_t value = traceGetLocal(c, index, type);
+    if (c->failed) return;
+
+    tracePush(c, value);
+    c->locals[index].state = TRACE_LOCAL_MOVED;
+    traceAddWrite(c, index, value.kind, true);
+}
+
+static void traceConstant(TraceCompiler_t* c, uint32_t constIndex) {
+    CompiledFunction_t* fn = c->rec->fn;
+    Object_t* constant = constIndex < fn->numConstants ? fn->constants[constIndex] : NULL;
+    if (constant && constant->type == OBJECT_INTEGER) {
+        tracePush(c, traceValue(TRACE_INTEGER, JIT_CONSTANT(((Integer_t*)constant)->value)));
+    } else if (constant && constant->type == OBJECT_BOOLEAN) {
+        tracePush(c, traceValue(TRACE_BOOLEAN, JIT_CONSTANT(((Boolean_t*)constant)->value)));
+    } else {
+        c->failed = true;
+    }
+}
+
+// left op right, folded when the operands allow it
+static JitOperand_t traceArithmeticResult(TraceCompiler_t* c, uint32_t s, JitArithmetic_t op, JitOperand_t left, JitOperand_t right, uint32_t snapshot) {
+    // wraps around like the native instructions
+    uint64_t l = (uint64_t)left.value;
+    uint64_t r = (uint64_t)right.value;
+    bool unary = op == JIT_NEG || op == JIT_NOT;
+
+    if (left.constant && (unary || right.constant)) {
+        switch (op) {
+            case JIT_ADD:
+                return JIT_CONSTANT((int64_t)(l + r));
+            case JIT_SUB:
+                return JIT_CONSTANT((int64_t)(l - r));
+            case JIT_MUL:
+                return JIT_CONSTANT((int64_t)(l * r));
+            case JIT_NEG:
+                return JIT_CONSTANT((int64_t)(0 - l));
+            case JIT_NOT:
+                return JIT_CONSTANT(left.value ^ 1);
+            default:
+                if (right.value == 0 || (left.value == INT64_MIN && right.value == -1)) {
+                    c->failed = true;
+                    return left;
+                }
+                return JIT_CONSTANT(left.value / right.value);
+        }
+    }
+
+    bool rightIs = right.constant;
+    bool leftIs = left.constant;
+    switch (op) {
+        case JIT_ADD:
+            if (rightIs && right.value == 0) return left;
+            if (leftIs && left.value == 0) return right;
+            break;
+        case JIT_SUB:
+            if (rightIs && right.value == 0) return left;
+            break;
+        case JIT_MUL:
+            if (rightIs && right.value == 1) return left;
+            if (leftIs && left.value == 1) return right;
+            if ((rightIs && right.value == 0) || (leftIs && left.value == 0)) return JIT_CONSTANT(0);
+            break;
+        case JIT_DIV:
+            if (rightIs && right.value == 1) return left;
+            if (rightIs && right.value == 0) {
+                c->failed = true;
+                return left;
+            }
+            if (!rightIs) {
+                traceEmit(c, (TraceIns_t) {
+                    .op = TRACE_OP_GUARD, .sub = JIT_NOT_EQUAL, .left = right, .right = JIT_CONSTANT(0),
+                    .snapshot = snapshot, .step = s });
+            }
+            break;
+        default:
+            break;
+    }
+
+    uint32_t dst = traceNewSlot(c);
+    traceEmit(c, (TraceIns_t) {
+        .op = TRACE_OP_ARITHMETIC, .sub = op, .dst = dst, .left = left, .right = right, .step = s });
+    return JIT_SLOT(dst);
+}
+
+static void traceArithmetic(TraceCompiler_t* c, uint32_t s, JitArithmetic_t op) {
+    const TraceStep_t* step = &c->rec->steps[s];
+    bool immediate = step->op == OP_ADD_IMM || step->op == OP_SUB_IMM;
+    uint32_t snapshot = op == JIT_DIV ? traceStepSnapshot(c, s) : 0;
+
+    JitOperand_t right = immediate ? JIT_CONSTANT(step->operands[0]) : tracePopInteger(c, step->types[0]);
+    JitOperand_t left = tracePopInteger(c, immediate ? step->types[0] : step->types[1]);
+    if (c->failed) return;
+
+    tracePush(c, traceValue(TRACE_INTEGER, traceArithmeticResult(c, s, op, left, right, snapshot)));
+}
+
+static void traceMinus(TraceCompiler_t* c, uint32_t s) {
+    JitOperand_t operand = tracePopInteger(c, c->rec->steps[s].types[0]);
+    if (c->failed) return;
+
+    tracePush(c, traceValue(TRACE_INTEGER, traceArithmeticResult(c, s, JIT_NEG, operand, JIT_CONSTANT(0), 0)));
+}
+
+static void traceBang(TraceCompiler_t* c, uint32_t s) {
+    TraceValue_t operand = tracePopValue(c, c->rec->steps[s].types[0]);
+    if (c->failed) return;
+
+    switch (operand.kind) {
+        case TRACE_BOOLEAN:
+            tracePush(c, traceValue(TRACE_BOOLEAN, traceArithmeticResult(c, s, JIT_NOT, operand.ref, JIT_CONSTANT(0), 0)));
+            break;
+        case TRACE_LOCAL:
+            tracePush(c, traceValue(TRACE_BOOLEAN, JIT_CONSTANT(operand.type == OBJECT_NULL)));
+            break;
+        default:
+            tracePush(c, traceValue(TRACE_BOOLEAN, JIT_CONSTANT(false)));
+            break;
+    }
+}
+
+static void traceComparison(TraceCompiler_t* c, uint32_t s, JitCondition_t cond) {
+    const TraceStep_t* step = &c->rec->steps[s];
+    bool immediate = step->op == OP_GREATER_THAN_IMM;
+    uint32_t snapshot = traceStepSnapshot(c, s);
+
+    TraceValue_t right = immediate ? traceValue(TRACE_INTEGER, JIT_CONSTANT(step->operands[0])) : tracePopValue(c, step->types[0]);
+    TraceValue_t left = tracePopValue(c, immediate ? step->types[0] : step->types[1]);
+    if (c->failed) return;
+
+    // booleans only compare for equality
+    bool comparable = left.kind == right.kind &&
+        (left.kind == TRACE_INTEGER || (left.kind == TRACE_BOOLEAN && cond != JIT_GREATER));
+    if (!comparable) {
+        c->failed = true;
+        return;
+    }
+
+    if (left.ref.constant && right.ref.constant) {
+        tracePush(c, traceValue(TRACE_BOOLEAN, JIT_CONSTANT(traceHolds(cond, left.ref.value, right.ref.value))));
+        return;
+    }
+
+    uint32_t dst = traceNewSlot(c);
+    c->compare = c->numIns;
+    c->compareStep = s;
+    c->compareSnapshot = snapshot;
+    traceEmit(c, (TraceIns_t) {
+        .op = TRACE_OP_COMPARE, .sub = cond, .dst = dst, .left = left.ref, .right = right.ref, .step = s });
+    tracePush(c, traceValue(TRACE_BOOLEAN, JIT_SLOT(dst)));
+}
+
+// Keeps the execution on the recorded side of a jump not truthy
+static void traceJumpNotTruthy(TraceCompiler_t* c, uint32_t s) {
+    const TraceStep_t* step = &c->rec->steps[s];
+    bool taken = traceNextIp(c, s) == (uint32_t)step->operands[0];
+    uint32_t snapshot = traceStepSnapshot(c, s);
+
+    TraceValue_t condition = tracePopValue(c, step->types[0]);
+    if (c->failed) return;
+
+    bool truthy;
+    switch (condition.kind) {
+        case TRACE_BOOLEAN:
+            if (!condition.ref.constant) {
+                TraceIns_t* compare = c->compare >= 0 ? &c->body[c->compare] : NULL;
+                if (compare && c->compareStep + 1 == s && compare->dst == condition.ref.value) {
+                    // the comparison pushing the condition becomes the guard
+                    compare->op = TRACE_OP_GUARD;
+                    compare->sub = taken ? traceNegate(compare->sub) : compare->sub;
+                    compare->snapshot = c->compareSnapshot;
+                } else {
+                    traceEmit(c, (TraceIns_t) {
+                        .op = TRACE_OP_GUARD, .sub = taken ? JIT_EQUAL : JIT_NOT_EQUAL,
+                        .left = condition.ref, .right = JIT_CONSTANT(0), .snapshot = snapshot, .step = s });
+                }
+                return;
+            }
+            truthy = condition.ref.value != 0;
+            break;
+        case TRACE_LOCAL:
+            truthy = condition.type != OBJECT_NULL;
+            break;
+        default:
+            truthy = true;
+            break;
+    }
+
+    if (truthy == taken) c->failed = true;
+}
+
+// Jumps when cond doesn't hold
+static void traceJumpComparison(TraceCompiler_t* c, uint32_t s, JitCondition_t cond) {
+    const TraceStep_t* step = &c->rec->steps[s];
+    bool taken = traceNextIp(c, s) == (uint32_t)step->operands[0];
+    uint32_t snapshot = traceStepSnapshot(c, s);
+
+    JitOperand_t right = tracePopInteger(c, step->types[0]);
+    JitOperand_t left = tracePopInteger(c, step->types[1]);
+    if (c->failed) return;
+
+    JitCondition_t recorded = taken ? traceNegate(cond) : cond;
+    if (left.constant && right.constant) {
+        if (!traceHolds(recorded, left.value, right.value)) c->failed = true;
+        return;
+    }
+    traceEmit(c, (TraceIns_t) {
+        .op = TRACE_OP_GUARD, .sub = recorded, .left = left, .right = right, .snapshot = snapshot, .step = s });
+}
+
+static void traceCall(TraceCompiler_t* c, uint32_t s) {
+    const TraceRecording_t* rec = c->rec;
+    uint32_t numArgs = rec->steps[s].operands[0];
+    if (s + 1 != rec->numSteps || numArgs >= c->depth) {
+        c->failed = true;
+        return;
+    }
+
+    uint32_t snapshot = traceStepSnapshot(c, s);
+    if (!rec->closed) {
+        traceEmit(c, (TraceIns_t) { .op = TRACE_OP_CALL, .snapshot = snapshot, .step = s });
+        return;
+    }
+
+    // the callee must be this function again
+    TraceValue_t callee = c->stack[c->depth - 1 - numArgs];
+    if (rec->kind != TRACE_ENTRY || !callee.loaded || callee.kind != TRACE_CLOSURE ||
+        numArgs != rec->fn->numParameters) {
+        c->failed = true;
+        return;
+    }
+    traceEmit(c, (TraceIns_t) { .op = TRACE_OP_RECURSE, .snapshot = snapshot, .step = s });
+}
+
+static void traceReturn(TraceCompiler_t* c, uint32_t s) {
+    const TraceRecording_t* rec = c->rec;
+    if (s + 1 != rec->numSteps || (rec->closed && rec->kind != TRACE_RETURN)) {
+        c->failed = true;
+        return;
+    }
+
+    uint32_t snapshot = traceStepSnapshot(c, s);
+    traceEmit(c, (TraceIns_t) {
+        .op = rec->closed ? TRACE_OP_UNWIND : TRACE_OP_RETURN, .snapshot = snapshot, .step = s });
+}
+
+// Jumping back to the body needs everything the next iteration reads to
+// be where the head left it
+static void traceCloseLoop(TraceCompiler_t* c) {
+    uint32_t entryDepth = c->rec->entryDepth;
+    if (c->depth != entryDepth || c->realPrefix != entryDepth) {
+        c->failed = true;
+        return;
+    }
+
+    for (uint32_t i = 0; i < c->numLocals; i++) {
+        TraceLocal_t* local = &c->locals[i];
+        if (!local->readFirst) continue;
+        if (local->state == TRACE_LOCAL_MOVED || local->kind != local->entryKind) {
+            c->failed = true;
+            return;
+        }
+    }
+    traceEmit(c, (TraceIns_t) { .op = TRACE_OP_LOOP, .step = c->rec->numSteps });
+}
+
+static void traceStep(TraceCompiler_t* c, uint32_t s) {
+    const TraceStep_t* step = &c->rec->steps[s];
+    CodeWord_t operand = step->operands[0];
+
+    switch (step->op) {
+        case OP_CONSTANT:
+            traceConstant(c, operand);
+            break;
+        case OP_PUSH_INT8:
+        case OP_PUSH_INT16:
+            tracePush(c, traceValue(TRACE_INTEGER, JIT_CONSTANT(operand)));
+            break;
+        case OP_TRUE:
+        case OP_FALSE:
+            tracePush(c, traceValue(TRACE_BOOLEAN, JIT_CONSTANT(step->op == OP_TRUE)));
+            break;
+
+        case OP_ADD:
+        case OP_ADD_I64:
+        case OP_ADD_IMM:
+            traceArithmetic(c, s, JIT_ADD);
+            break;
+        case OP_SUB:
+        case OP_SUB_I64:
+        case OP_SUB_IMM:
+            traceArithmetic(c, s, JIT_SUB);
+            break;
+        case OP_MUL:
+        case OP_MUL_I64:
+            traceArithmetic(c, s, JIT_MUL);
+            break;
+        case OP_DIV:
+            traceArithmetic(c, s, JIT_DIV);
+            break;
+        case OP_MINUS:
+        case OP_MINUS_I64:
+            traceMinus(c, s);
+            break;
+        case OP_BANG:
+            traceBang(c, s);
+            break;
+
+        case OP_EQUAL:
+        case OP_EQUAL_I64:
+            traceComparison(c, s, JIT_EQUAL);
+            break;
+        case OP_NOT_EQUAL:
+        case OP_NOT_EQUAL_I64:
+            traceComparison(c, s, JIT_NOT_EQUAL);
+            break;
+        case OP_GREATER_THAN:
+        case OP_GREATER_THAN_I64:
+        case OP_GREATER_THAN_IMM:
+            traceComparison(c, s, JIT_GREATER);
+            break;
+
+        case OP_JUMP:
+            break;
+        case OP_JUMP_NOT_TRUTHY:
+            traceJumpNotTruthy(c, s);
+            break;
+        case OP_JUMP_NOT_EQUAL_I64:
+            traceJumpComparison(c, s, JIT_EQUAL);
+            break;
+        case OP_JUMP_NOT_GREATER_THAN_I64:
+            traceJumpComparison(c, s, JIT_GREATER);
+            break;
+
+        case OP_GET_LOCAL:
+            tracePush(c, traceGetLocal(c, operand, step->types[0]));
+            break;
+        case OP_SET_LOCAL:
+            traceSetLocal(c, s, operand, step->types[0]);
+            break;
+        case OP_MOVE_LOCAL:
+            traceMoveLocal(c, operand, step->types[0]);
+            break;
+        case OP_POP:
+            tracePop(c);
+            break;
+
+        case OP_CURRENT_CLOSURE:
+            tracePush(c, traceObject(TRACE_CLOSURE, 0));
+            break;
+        case OP_CLOSURE:
+            if (step->operands[1] != 0 || (uint32_t)operand >= c->rec->fn->numConstants ||
+                c->rec->fn->constants[operand]->type != OBJECT_COMPILED_FUNCTION) {
+                c->failed = true;
+                break;
+            }
+            tracePush(c, traceObject(TRACE_FUNCTION, operand));
+            break;
+        case OP_GET_BUILTIN:
+            tracePush(c, traceObject(TRACE_BUILTIN, operand));
+            break;
+        case OP_CALL:
+            traceCall(c, s);
+            break;
+        case OP_RETURN_VALUE:
+            traceReturn(c, s);
+            break;
+
+        default:
+            c->failed = true;
+            break;
+    }
+}
+
+static void traceMarkUsed(bool* used, JitOperand_t operand) {
+    if (!operand.constant) used[operand.value] = true;
+}
+
+static bool traceHasSnapshot(TraceOp_t op) {
+    return op != TRACE_OP_MOVE && op != TRACE_OP_ARITHMETIC && op != TRACE_OP_COMPARE && op != TRACE_OP_LOOP;
+}
+
+// Drops the temporaries nothing reads, like comparisons their jump turned
+// into a guard
+static void traceEliminateDeadCode(TraceCompiler_t* c) {
+    bool* used = callocChk(c->numSlots);
+    for (uint32_t i = c->numIns; i-- > 0; ) {
+        TraceIns_t* ins = &c->body[i];
+        if (!traceHasSnapshot(ins->op) && ins->op != TRACE_OP_LOOP &&
+            traceIsTemporary(c, ins->dst) && !used[ins->dst]) {
+            ins->dead = true;
+            continue;
+        }
+
+        traceMarkUsed(used, ins->left);
+        traceMarkUsed(used, ins->right);
+        if (traceHasSnapshot(ins->op)) {
+            const TraceSnapshot_t* snapshot = &c->snapshots[ins->snapshot];
+            for (uint32_t v = snapshot->realPrefix; v < snapshot->depth; v++) {
+                const TraceValue_t* value = &c->snapshotValues[snapshot->values + v];
+                if (value->kind == TRACE_INTEGER || value->kind == TRACE_BOOLEAN) traceMarkUsed(used, value->ref);
+            }
+        }
+    }
+    free(used);
+}
+
+// Whether the vm slot of a local still holds the object of its slot at the
+// snapshot, which pushing it again saves boxing
+static bool traceLocalIntact(TraceCompiler_t* c, uint32_t local, uint32_t numWrites) {
+    uint32_t count = c->rec->kind == TRACE_LOOP ? c->numWrites : numWrites;
+    for (uint32_t i = 0; i < count; i++) {
+        if (c->writes[i].local == local && !c->writes[i].moved) return false;
+    }
+    return true;
+}
+
+static void traceEmitPush(TraceCompiler_t* c, JitAssembler_t* a, const TraceValue_t* value, uint32_t numWrites) {
+    bool unboxed = value->kind == TRACE_INTEGER || value->kind == TRACE_BOOLEAN;
+    if (unboxed && !value->ref.constant && !traceIsTemporary(c, value->ref.value) &&
+        value->ref.value >= SLOT_LOCALS) {
+        uint32_t local = value->ref.value - SLOT_LOCALS;
+        if (traceLocalIntact(c, local, numWrites)) {
+            jitCall(a, c->helpers->push, 0, TRACE_LOCAL | (int64_t)local << 8);
+            return;
+        }
+    }
+
+    if (unboxed) {
+        jitSetArgument(a, value->ref);
+        jitCallWithResult(a, c->helpers->push, value->kind);
+    } else {
+        jitCall(a, c->helpers->push, 0, value->kind | (int64_t)value->index << 8);
+    }
+}
+
+static void traceEmitWrite(TraceCompiler_t* c, JitAssembler_t* a, const TraceWrite_t* write) {
+    if (write->moved) {
+        jitCall(a, c->helpers->clearLocal, 0, write->local);
+    } else {
+        jitSetArgument(a, JIT_SLOT(traceLocalSlot(write->local)));
+        jitCallWithResult(a, c->helpers->storeLocal, write->local | (int64_t)write->kind << 32);
+    }
+}
+
+/* Writes the locals back, the ones written before the snapshot and, if an
+ * iteration completed already, the ones it wrote later on. */
+static void traceEmitWriteBacks(TraceCompiler_t* c, JitAssembler_t* a, uint32_t numWrites) {
+    if (c->numWrites == 0) return;
+
+    int32_t* before = mallocChk(c->numLocals * sizeof(int32_t));
+    int32_t* after = mallocChk(c->numLocals * sizeof(int32_t));
+    for (uint32_t i = 0; i < c->numLocals; i++) {
+        before[i] = after[i] = -1;
+    }
+    for (uint32_t i = 0; i < c->numWrites; i++) {
+        if (i < numWrites) {
+            before[c->writes[i].local] = i;
+        } else {
+            after[c->writes[i].local] = i;
+        }
+    }
+
+    if (c->rec->kind == TRACE_LOOP) {
+        uint32_t skip = jitNewLabel(a);
+        bool pending = false;
+        for (uint32_t i = 0; i < c->numLocals; i++) {
+            if (before[i] >= 0 || after[i] < 0) continue;
+            if (!pending) {
+                jitGuard(a, JIT_NOT_EQUAL, JIT_SLOT(SLOT_LOOPED), JIT_CONSTANT(0), skip);
+                pending = true;
+            }
+            traceEmitWrite(c, a, &c->writes[after[i]]);
+        }
+        jitBind(a, skip);
+    }
+
+    for (uint32_t i = 0; i < c->numLocals; i++) {
+        if (before[i] >= 0) traceEmitWrite(c, a, &c->writes[before[i]]);
+    }
+    free(before);
+    free(after);
+}
+
+// Rebuilds the vm stack and locals of the snapshot
+static void traceEmitState(TraceCompiler_t* c, JitAssembler_t* a, const TraceSnapshot_t* snapshot) {
+    uint32_t dead = c->rec->entryDepth - snapshot->realPrefix;
+    if (dead > 0) jitCall(a, c->helpers->drop, dead, 0);
+
+    for (uint32_t i = snapshot->realPrefix; i < snapshot->depth; i++) {
+        traceEmitPush(c, a, &c->snapshotValues[snapshot->values + i], snapshot->numWrites);
+    }
+    traceEmitWriteBacks(c, a, snapshot->numWrites);
+}
+
+static void traceEmitCount(JitAssembler_t* a, uint32_t steps) {
+    jitArithmetic(a, JIT_ADD, SLOT_EXECUTED, JIT_SLOT(SLOT_EXECUTED), JIT_CONSTANT(steps));
+}
+
+static void traceEmitLeave(TraceCompiler_t* c, JitAssembler_t* a) {
+    jitSetArgument(a, JIT_SLOT(SLOT_EXECUTED));
+    jitCallWithResult(a, c->helpers->leave, 0);
+    jitExit(a);
+}
+
+static void traceEmitExit(TraceCompiler_t* c, JitAssembler_t* a, const TraceSnapshot_t* snapshot) {
+    traceEmitState(c, a, snapshot);
+    traceEmitCount(a, snapshot->step);
+    jitSetArgument(a, JIT_SLOT(SLOT_EXECUTED));
+    jitCallWithResult(a, c->helpers->exit, snapshot->ip);
+    jitExit(a);
+}
+
+static uint32_t traceExitLabel(TraceCompiler_t* c, JitAssembler_t* a, uint32_t snapshot) {
+    if (c->snapshots[snapshot].label == TRACE_NO_LABEL) {
+        c->snapshots[snapshot].label = jitNewLabel(a);
+    }
+    return c->snapshots[snapshot].label;
+}
+
+// Starts the next iteration in the callee, the arguments of the recorded
+// types are trusted
+static void traceEmitRecurse(TraceCompiler_t* c, JitAssembler_t* a, const TraceIns_t* ins) {
+    const TraceSnapshot_t* snapshot = &c->snapshots[ins->snapshot];
+    const TraceStep_t* step = &c->rec->steps[ins->step];
+    uint32_t numArgs = step->operands[0];
+
+    traceEmitState(c, a, snapshot);
+    jitCall(a, c->helpers->pushFrame, numArgs, step->ip);
+    traceEmitCount(a, c->rec->numSteps);
+    jitLoadBase(a, c->helpers->localsBase);
+
+    const TraceValue_t* args = &c->snapshotValues[snapshot->values + snapshot->depth - numArgs];
+    for (uint32_t i = 0; i < c->numLocals; i++) {
+        const TraceLocal_t* local = &c->locals[i];
+        if (!local->readFirst) continue;
+        bool unboxed = local->entryKind == TRACE_INTEGER || local->entryKind == TRACE_BOOLEAN;
+        if (i >= numArgs || !unboxed || args[i].kind != local->entryKind) {
+            jitJump(a, c->headLabel);
+            return;
+        }
+    }
+
+    for (uint32_t i = 0; i < c->numLoads; i++) {
+        const TraceLoad_t* load = &c->loads[i];
+        jitLoadObject(a, load->index, load->type, load->unbox, load->dst, false, 0);
+    }
+    jitJump(a, c->bodyLabel);
+}
+
+static void traceEmitUnwind(TraceCompiler_t* c, JitAssembler_t* a, const TraceIns_t* ins) {
+    uint32_t leave = jitNewLabel(a);
+
+    traceEmitState(c, a, &c->snapshots[ins->snapshot]);
+    jitCall(a, c->helpers->ret, 0, 0);
+    traceEmitCount(a, c->rec->numSteps);
+    jitCallTest(a, c->helpers->returnsTo, (int64_t)(intptr_t)c->rec->fn, c->rec->anchorIp, leave);
+    jitJump(a, c->headLabel);
+
+    jitBind(a, leave);
+    traceEmitLeave(c, a);
+}
+
+static void traceEmitBody(TraceCompiler_t* c, JitAssembler_t* a) {
+    for (uint32_t i = 0; i < c->numIns; i++) {
+        const TraceIns_t* ins = &c->body[i];
+        if (ins->dead) continue;
+
+        switch (ins->op) {
+            case TRACE_OP_MOVE:
+                jitMove(a, ins->dst, ins->left);
+                break;
+            case TRACE_OP_ARITHMETIC:
+                jitArithmetic(a, ins->sub, ins->dst, ins->left, ins->right);
+                break;
+            case TRACE_OP_COMPARE:
+                jitCompare(a, ins->sub, ins->dst, ins->left, ins->right);
+                break;
+            case TRACE_OP_GUARD:
+                jitGuard(a, ins->sub, ins->left, ins->right, traceExitLabel(c, a, ins->snapshot));
+                break;
+            case TRACE_OP_LOOP:
+                traceEmitCount(a, c->rec->numSteps);
+                jitMove(a, SLOT_LOOPED, JIT_CONSTANT(1));
+                jitJump(a, c->bodyLabel);
+                break;
+            case TRACE_OP_CALL:
+                traceEmitState(c, a, &c->snapshots[ins->snapshot]);
+                jitCall(a, c->helpers->call, c->rec->steps[ins->step].operands[0], c->rec->steps[ins->step].ip);
+                traceEmitCount(a, c->rec->numSteps);
+                traceEmitLeave(c, a);
+                break;
+            case TRACE_OP_RECURSE:
+                traceEmitRecurse(c, a, ins);
+                break;
+            case TRACE_OP_RETURN:
+                traceEmitState(c, a, &c->snapshots[ins->snapshot]);
+                jitCall(a, c->helpers->ret, 0, 0);
+                traceEmitCount(a, c->rec->numSteps);
+                traceEmitLeave(c, a);
+                break;
+            case TRACE_OP_UNWIND:
+                traceEmitUnwind(c, a, ins);
+                break;
+            case TRACE_OP_EXIT:
+                traceEmitExit(c, a, &c->snapshots[ins->snapshot]);
+                break;
+        }
+    }
+}
+
+static JitCode_t* traceAssemble(TraceCompiler_t* c, uint32_t entrySnapshot) {
+    JitAssembler_t* a = createJitAssembler(0);
+    jitReserveSlots(a, c->numSlots);
+    c->headLabel = jitNewLabel(a);
+    c->bodyLabel = jitNewLabel(a);
+
+    jitMove(a, SLOT_EXECUTED, JIT_CONSTANT(0));
+    jitMove(a, SLOT_LOOPED, JIT_CONSTANT(0));
+
+    jitBind(a, c->headLabel);
+    jitLoadBase(a, c->helpers->localsBase);
+    for (uint32_t i = 0; i < c->numLoads; i++) {
+        const TraceLoad_t* load = &c->loads[i];
+        jitLoadObject(a, load->index, load->type, load->unbox, load->dst, true, traceExitLabel(c, a, entrySnapshot));
+    }
+
+    jitBind(a, c->bodyLabel);
+    traceEmitBody(c, a);
+
+    // exit stubs, out of the way of the body
+    for (uint32_t i = 0; i < c->numSnapshots; i++) {
+        if (c->snapshots[i].label == TRACE_NO_LABEL) continue;
+        jitBind(a, c->snapshots[i].label);
+        traceEmitExit(c, a, &c->snapshots[i]);
+    }
+    return jitFinish(a);
+}
+
+static void cleanupTraceCompiler(TraceCompiler_t* c) {
+    free(c->stack);
+    free(c->locals);
+    free(c->loads);
+    free(c->body);
+    free(c->writes);
+    free(c->snapshots);
+    free(c->snapshotValues);
+}
+
+Trace_t* traceCompile(const TraceRecording_t* rec, const TraceHelpers_t* helpers) {
+    if (rec->numSteps == 0 || rec->fn->numLocals > TRACE_MAX_LOCALS) return NULL;
+
+    TraceCompiler_t c = {
+        .rec = rec,
+        .helpers = helpers,
+        .stack = mallocChk((rec->entryDepth + rec->numSteps + 1) * sizeof(TraceValue_t)),
+        .locals = callocChk((rec->fn->numLocals + 1) * sizeof(TraceLocal_t)),
+        .numLocals = rec->fn->numLocals,
+        .numSlots = SLOT_LOCALS + rec->fn->numLocals,
+        .compare = -1,
+    };
+    for (uint32_t i = 0; i < rec->entryDepth; i++) {
+        c.stack[i] = (TraceValue_t) { .real = true, .loaded = false };
+    }
+    c.depth = c.realPrefix = rec->entryDepth;
+
+    uint32_t entrySnapshot = traceSnapshot(&c, 0, rec->anchorIp);
+    for (uint32_t s = 0; s < rec->numSteps && !c.failed; s++) {
+        traceStep(&c, s);
+    }
+
+    if (!c.failed) {
+        OpCode_t last = rec->steps[rec->numSteps - 1].op;
+        if (last == OP_CALL || last == OP_RETURN_VALUE) {
+            // ended by the step
+        } else if (rec->closed) {
+            if (rec->kind == TRACE_LOOP) {
+                traceCloseLoop(&c);
+            } else {
+                c.failed = true;
+            }
+        } else {
+            uint32_t snapshot = traceSnapshot(&c, rec->numSteps, rec->endIp);
+            traceEmit(&c, (TraceIns_t) { .op = TRACE_OP_EXIT, .snapshot = snapshot, .step = rec->numSteps });
+        }
+    }
+
+    if (c.failed) {
+        cleanupTraceCompiler(&c);
+        return NULL;
+    }
+
+    traceEliminateDeadCode(&c);
+    JitCode_t* code = traceAssemble(&c, entrySnapshot);
+    cleanupTraceCompiler(&c);
+    if (!code) return NULL;
+
+    Trace_t* trace = mallocChk(sizeof(Trace_t));
+    *trace = (Trace_t) {
+        .kind = rec->kind,
+        .numSteps = rec->numSteps,
+        .code = code,
+    };
+    return trace;
+}
+
+void cleanupTrace(Trace_t* trace) {
+    if (!trace) return;
+    cleanupJitCode(trace->code);
+    free(trace);
+}
+
+void cleanupTraceAnchors(TraceAnchor_t* anchors, uint32_t count) {
+    if (!anchors) return;
+    for (uint32_t i = 0; i < count; i++) {
+        cleanupTrace(anchors[i].trace);
+    }
+    free(anchors);
+}
@@ -0,0 +1,98 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+#include "jit.h"
+#include "object.h"
+#include "code.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Tracing JIT. The interpreter counts the transfers of control landing on
+ * an anchor: the target of a backward jump, the start of a function called
+ * by itself, and the return point of a self call. Once an anchor is hot the
+ * instructions run from there are recorded until they come back to it,
+ * reach the anchor of another trace, or leave the frame through a call or a
+ * return. The recording is compiled to a linear piece of native code where
+ * integers and booleans stay unboxed in slots, with type guards only where
+ * values enter the trace and side exits writing the interpreter state back
+ * wherever the execution leaves the recorded path. */
+
+#define TRACE_MAX_STEPS 256
+#define TRACE_MAX_LOCALS 256
+
+// Failed recordings or compilations before an anchor is given up
+#define TRACE_MAX_FAILURES 3
+
+// Recorded in place of the type of a missing object
+#define TRACE_NO_TYPE _OBJECT_TYPE_CNT
+
+typedef enum TraceKind {
+    TRACE_LOOP,     // at the target of a backward jump, loops in its frame
+    TRACE_ENTRY,    // at the start of a self recursive function, loops through the self call
+    TRACE_RETURN,   // at the return point of a self call, loops through the return to the same point
+} TraceKind_t;
+
+typedef struct TraceStep {
+    uint32_t ip; // word index
+    OpCode_t op;
+    CodeWord_t operands[2];
+    ObjectType_t types[2]; // before the instruction: the local it reads, or the top two stack entries, top first
+} TraceStep_t;
+
+struct TraceRecording {
+    CompiledFunction_t* fn;
+    TraceKind_t kind;
+    uint32_t anchorIp;
+    uint32_t frameIndex; // of the anchor frame
+    uint32_t entryDepth; // stack entries above the locals at the anchor
+    bool closed; // the last step leads back to the anchor
+    uint32_t endIp; // next instruction after the last step, when it reaches another trace
+    uint32_t numSteps;
+    TraceStep_t steps[TRACE_MAX_STEPS];
+};
+
+typedef struct Trace {
+    TraceKind_t kind;
+    uint32_t numSteps;
+    JitCode_t* code;
+} Trace_t;
+
+// Hot counter of a word of a function, and the trace anchored there
+struct TraceAnchor {
+    uint32_t hits;
+    uint8_t failures;
+    Trace_t* trace;
+};
+
+// What the helpers box or push
+typedef enum TraceValueKind {
+    TRACE_INTEGER,
+    TRACE_BOOLEAN,
+    TRACE_CLOSURE,  // closure of the current frame
+    TRACE_FUNCTION, // closure of a function constant without free variables
+    TRACE_BUILTIN,
+    TRACE_LOCAL,    // object left in a local slot
+} TraceValueKind_t;
+
+/* Runtime helpers of the traces, implemented by the vm. Unless noted they
+ * return true to leave the trace with err set. */
+typedef struct TraceHelpers {
+    JitValueHelper_t localsBase;    // address of the first local of the current frame
+    JitHelper_t storeLocal;         // boxes a into local b & 0xffffffff, b >> 32 is the value kind
+    JitHelper_t clearLocal;         // local b was moved out
+    JitHelper_t drop;               // pops a entries
+    JitHelper_t push;               // pushes b & 0xff, a kind, a value or b >> 8 index
+    JitHelper_t call;               // calls with a arguments from the call at word b
+    JitHelper_t pushFrame;          // same, for a self call, without running the callee
+    JitHelper_t ret;                // returns the stack top from the current frame
+    JitHelper_t returnsTo;          // condition: the current frame is function a, right after the call ending at b - 1
+    JitHelper_t exit;               // a instructions ran in the trace, resumes at word b
+    JitHelper_t leave;              // a instructions ran in the trace, the frame is set already
+} TraceHelpers_t;
+
+// Optimizes the recording and emits its native code, NULL if it uses
+// something the traces don't support
+Trace_t* traceCompile(const TraceRecording_t* rec, const TraceHelpers_t* helpers);
+void cleanupTrace(Trace_t* trace);
+void cleanupTraceAnchors(TraceAnchor_t* anchors, uint32_t count);
+
+#endif
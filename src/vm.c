@@ -2,6 +2,9 @@
 #include "utils.h"
 #include "gc.h"
 #include "builtin.h"
+#include "segment.h"
+#include "jit.h"
+#include "trace.h"
 
 #define MAX_FRAMES 1024 
 
@@ -9,14 +12,31 @@ static void cleanupGlobals(Vm_t *vm);
 static void cleanupStack(Vm_t* vm);
 static void cleanupConstants(Vm_t *vm); 
 static void cleanupFrames(Vm_t* vm);
+static void cleanupImmediates(Vm_t *vm);
 
 static void vmPushFrame(Vm_t *vm, Frame_t *f);
 static Frame_t* vmCurrentFrame(Vm_t *vm);
 static Frame_t vmPopFrame(Vm_t *vm); 
 
-static Instructions_t vmGetInstructions(Vm_t* vm);
+static const CodeWord_t* vmGetCode(Vm_t* vm);
+static VmError_t vmInterpret(Vm_t* vm);
+static VmError_t vmRunSwitch(Vm_t* vm);
+
+#if defined(JIT_SUPPORTED)
+static bool vmJitReady(Vm_t* vm, CompiledFunction_t* fn);
+static VmError_t vmJitRun(Vm_t* vm, CompiledFunction_t* fn);
+static void vmTraceRecord(Vm_t* vm);
+static void vmTraceStop(Vm_t* vm, bool compile);
+static VmError_t vmTraceTransfer(Vm_t* vm, OpCode_t op, int32_t fromIp, uint32_t fromFrame);
+#endif
 
 static VmError_t vmExecuteOpConstant(Vm_t* vm, int32_t* ip); 
+static VmError_t vmPushConstant(Vm_t* vm, uint32_t constIndex);
+static Object_t* vmInteger(Vm_t* vm, int32_t value);
+static Object_t* vmImmediate(Vm_t* vm, int16_t value);
+static VmError_t vmExecuteOpPushInt(Vm_t* vm, OpCode_t op, int32_t* ip);
+static VmError_t vmExecuteImmediateOperation(Vm_t* vm, OpCode_t op, int32_t* ip);
+static VmError_t vmImmediateOperation(Vm_t* vm, OpCode_t op, int32_t right);
 static VmError_t vmExecuteBinaryOperation(Vm_t *vm, OpCode_t op);
 static VmError_t vmExecuteBinaryIntegerOperation(Vm_t *vm, OpCode_t op, Integer_t* left, Integer_t* right); 
 static VmError_t vmExecuteBinaryStringOperation(Vm_t *vm, OpCode_t op, String_t* left, String_t* right); 
@@ -26,39 +46,59 @@ static VmError_t vmExecuteOpNull(Vm_t* vm);
 static VmError_t vmExecuteComparison(Vm_t* vm, OpCode_t op);
 static VmError_t vmExecuteIntegerComparison(Vm_t* vm, OpCode_t op, Integer_t* left, Integer_t* right); 
 static VmError_t vmExecuteBooleanComparison(Vm_t* vm, OpCode_t op, Boolean_t* left, Boolean_t* right);
+static VmError_t vmExecuteStringComparison(Vm_t* vm, OpCode_t op, String_t* left, String_t* right);
 
 static VmError_t vmExecuteBangOperator(Vm_t *vm);
 static VmError_t vmExecuteMinusOperator(Vm_t *vm);
 
+static VmError_t vmExecuteIntegerOperation(Vm_t* vm, OpCode_t op);
+static VmError_t vmExecuteOpJumpIntegerComparison(Vm_t* vm, OpCode_t op, int32_t* ip);
+static VmError_t vmJumpIntegerComparison(Vm_t* vm, OpCode_t op, int32_t* ip, int32_t target);
+
 static VmError_t vmExecuteOpJump(Vm_t* vm, int32_t* ip);
 static VmError_t vmExecuteOpJumpNotTruthy(Vm_t* vm, int32_t* ip);
+static VmError_t vmJumpNotTruthy(Vm_t* vm, int32_t* ip, int32_t target);
+static VmError_t vmExecuteOpSwitchTable(Vm_t* vm, int32_t* ip);
+static VmError_t vmSwitchTable(Vm_t* vm, int32_t* ip, uint32_t constIndex);
 
 static VmError_t vmExecuteOpPop(Vm_t* vm); 
 static VmError_t vmExecuteOpSetGlobal(Vm_t* vm, int32_t* ip); 
+static VmError_t vmSetGlobal(Vm_t* vm, uint32_t globalIndex);
 static VmError_t vmExecuteOpGetGlobal(Vm_t* vm, int32_t* ip); 
+static VmError_t vmGetGlobal(Vm_t* vm, uint32_t globalIndex);
 
 static VmError_t vmExecuteOpArray(Vm_t* vm, int32_t* ip); 
-static Array_t* vmBuildArray(Vm_t* vm, uint16_t numElements);
+static Array_t* vmBuildArray(Vm_t* vm, uint32_t numElements);
 
 static VmError_t vmExecuteOpHash(Vm_t* vm, int32_t* ip); 
-static VmError_t vmBuildHash(Vm_t* vm, uint16_t numElements, Hash_t** hash); 
+static VmError_t vmPushHash(Vm_t* vm, uint32_t numElements);
+static VmError_t vmBuildHash(Vm_t* vm, uint32_t numElements, Hash_t** hash); 
 
 static VmError_t vmExecuteOpIndex(Vm_t* vm); 
 static VmError_t vmExecuteArrayIndex(Vm_t* vm, Array_t*array, Integer_t* index);
 static VmError_t vmExecuteHashIndex(Vm_t* vm, Hash_t* hash, Object_t* index); 
 
 static VmError_t vmExecuteOpCall(Vm_t* vm, int32_t* ip);
-static VmError_t vmCallClosure(Vm_t* vm, Closure_t* cl, uint8_t numArgs); 
-static VmError_t vmCallBuiltin(Vm_t* vm,Builtin_t* builtin, uint8_t numArgs); 
+static VmError_t vmCall(Vm_t* vm, uint32_t numArgs);
+static VmError_t vmCallClosure(Vm_t* vm, Closure_t* cl, uint32_t numArgs); 
+static VmError_t vmPushClosureFrame(Vm_t* vm, Closure_t* cl, uint32_t numArgs);
+static VmError_t vmCallBuiltin(Vm_t* vm,Builtin_t* builtin, uint32_t numArgs); 
 static VmError_t vmExecuteOpReturnValue(Vm_t* vm); 
 static VmError_t vmExecuteOpReturn(Vm_t* vm); 
 
 static VmError_t vmExecuteOpSetLocal(Vm_t* vm, int32_t* ip);
+static VmError_t vmSetLocal(Vm_t* vm, uint32_t localIndex);
 static VmError_t vmExecuteOpGetLocal(Vm_t* vm, int32_t* ip);
+static VmError_t vmGetLocal(Vm_t* vm, uint32_t localIndex);
+static VmError_t vmExecuteOpMoveLocal(Vm_t* vm, int32_t* ip);
+static VmError_t vmMoveLocal(Vm_t* vm, uint32_t localIndex);
 
 static VmError_t vmExecuteOpGetBuiltin(Vm_t* vm, int32_t* ip);
+static VmError_t vmGetBuiltin(Vm_t* vm, uint32_t builtinIndex);
 static VmError_t vmExecuteOpClosure(Vm_t* vm, int32_t* ip);
+static VmError_t vmPushClosure(Vm_t* vm, uint32_t constIndex, uint32_t numFree);
 static VmError_t vmExecuteOpGetFree(Vm_t* vm, int32_t* ip); 
+static VmError_t vmGetFree(Vm_t* vm, uint32_t freeIndex);
 
 static VmError_t vmExecuteOpCurrentClosure(Vm_t* vm);
 
@@ -67,7 +107,6 @@ static Object_t* vmPop(Vm_t* vm);
 
 static bool vmIsTruthy(Object_t* obj);
 static Object_t* nativeBoolToBooleanObject(bool val);
-static uint16_t readUint16BigEndian(uint8_t* ptr); 
 
 VmError_t createVmError(VmErrorCode_t code, char* str) {
     return (VmError_t) {
@@ -83,23 +122,33 @@ void cleanupVmError(VmError_t* err){
 
 
 
+// Frees what the vm attaches to a function when it runs
+static void vmCleanupFunction(CompiledFunction_t* fn) {
+    free(fn->threaded);
+    cleanupJitCode(fn->jit);
+    cleanupTraceAnchors(fn->traces, fn->codeLength + 1);
+}
+
 Vm_t createVm(Bytecode_t* bytecode) {
     return createVmWithStore(bytecode, NULL);
 } 
 
 Vm_t createVmWithStore(Bytecode_t* bytecode, Object_t** s)  {
+    compiledFunctionAddHooks((CompiledFunctionHooks_t) {.cleanup = vmCleanupFunction});
     Frame_t* frames = callocChk(MAX_FRAMES * sizeof(Frame_t));
-    CompiledFunction_t* mainFunction = createCompiledFunction(bytecode->instructions, 0, 0);
-    Closure_t* mainClosure = createClosure(mainFunction, createVectorObjects());
+    CompiledFunction_t* mainFunction = compilerCreateFunction(bytecode->constants, bytecode->instructions, bytecode->numLocals, 0);
+    linkCodeSegment(mainFunction, bytecode->constants);
+    Closure_t* mainClosure = createClosure(mainFunction, NULL, 0);
     gcSetRef(mainClosure, GC_REF_COMPILE_CONSTANT);
     frames[0] = createFrame(mainClosure, 0);
 
     Object_t** globals = (s == NULL) ? callocChk(GLOBALS_SIZE * sizeof(Object_t*)) : s;
     return (Vm_t) {
         .constants = bytecode->constants,
+        .immediates = NULL,
 
         .stack = callocChk(STACK_SIZE * sizeof(Object_t*)),
-        .sp = 0, 
+        .sp = bytecode->numLocals, 
         .lastPopped = NULL, 
 
         .externalStorage = (s != NULL),
@@ -107,17 +156,46 @@ Vm_t createVmWithStore(Bytecode_t* bytecode, Object_t** s)  {
         
         .frames = frames,
         .frameIndex = 1,
+
+        .dispatch = VM_DEFAULT_DISPATCH,
+
+        .jitThreshold = VM_DEFAULT_JIT_THRESHOLD,
+        .exitFrameIndex = 0,
+
+        .traceThreshold = VM_DEFAULT_TRACE_THRESHOLD,
+        .recording = NULL,
+        .tracedInstructions = 0,
+        .interpretedInstructions = 0,
     };
 }
 
+void vmSetDispatch(Vm_t* vm, VmDispatch_t dispatch) {
+    vm->dispatch = dispatch;
+}
+
+void vmSetJitThreshold(Vm_t* vm, uint32_t threshold) {
+    vm->jitThreshold = threshold;
+}
+
+void vmSetTraceThreshold(Vm_t* vm, uint32_t threshold) {
+    vm->traceThreshold = threshold;
+}
+
+double vmTraceCoverage(Vm_t* vm) {
+    uint64_t total = vm->tracedInstructions + vm->interpretedInstructions;
+    return total ? 100.0 * vm->tracedInstructions / total : 0;
+}
+
 void cleanupVm(Vm_t *vm) {
     if (!vm) return;
+    free(vm->recording);
 
     if (!vm->externalStorage) {
         cleanupGlobals(vm); 
         cleanupConstants(vm);
     }
 
+    cleanupImmediates(vm);
     cleanupStack(vm);
     cleanupFrames(vm);
 
@@ -133,6 +211,14 @@ static void cleanupConstants(Vm_t *vm) {
     cleanupVectorObjects(&vm->constants, NULL);
 }
 
+static void cleanupImmediates(Vm_t *vm) {
+    if (!vm->immediates) return;
+    for (uint32_t i = 0; i <= UINT16_MAX; i++) {
+        if (vm->immediates[i]) gcClearRef(vm->immediates[i], GC_REF_COMPILE_CONSTANT);
+    }
+    free(vm->immediates);
+}
+
 static void cleanupGlobals(Vm_t *vm) {
     uint16_t i = 0; 
     while (vm->globals[i] != NULL && i < GLOBALS_SIZE) {
@@ -171,8 +257,8 @@ static Frame_t vmPopFrame(Vm_t *vm) {
     return vm->frames[vm->frameIndex];
 } 
 
-static Instructions_t vmGetInstructions(Vm_t* vm) { 
-    return frameGetInstructions(vmCurrentFrame(vm));
+static const CodeWord_t* vmGetCode(Vm_t* vm) { 
+    return frameGetCode(vmCurrentFrame(vm));
 }
 
 Object_t* vmStackTop(Vm_t *vm) {
@@ -184,14 +270,81 @@ Object_t* vmLastPoppedStackElem(Vm_t *vm) {
     return vm->lastPopped;
 }
 
+#if defined(VM_LABEL_DISPATCH)
+// Builds the threaded code of fn on its first call: the handler address of
+// every instruction followed by its operands, and the end handler in place 
+// of the end marker. Linked code is read only, so it stays valid as long as
+// the function.
+static void** vmThreadCode(CompiledFunction_t* fn, void* const* labels) {
+    if (fn->threaded) return fn->threaded;
+
+    void** threaded = mallocChk((fn->codeLength + 1) * sizeof(void*));
+    for (uint32_t ip = 0; ip < fn->codeLength; ) {
+        OpCode_t op = fn->code[ip];
+        uint8_t argCount = opLookup(op)->argCount;
+        threaded[ip] = labels[op];
+        for (uint8_t i = 1; i <= argCount; i++) {
+            threaded[ip + i] = (void*)(intptr_t)fn->code[ip + i];
+        }
+        ip += 1 + argCount;
+    }
+    threaded[fn->codeLength] = labels[CODE_END_MARKER];
+
+    fn->threaded = threaded;
+    return threaded;
+}
+
+#define VM_LABELS_FN vmRunGoto
+#define VM_LABELS_THREADED 0
+#include "vm_labels.h"
+
+#define VM_LABELS_FN vmRunThreaded
+#define VM_LABELS_THREADED 1
+#include "vm_labels.h"
+#endif
+
 VmError_t vmRun(Vm_t *vm) {
+#if defined(JIT_SUPPORTED)
+    CompiledFunction_t* main = vmCurrentFrame(vm)->cl->fn;
+    if (vmJitReady(vm, main)) {
+        return vmJitRun(vm, main);
+    }
+#endif
+    return vmInterpret(vm);
+}
+
+// Runs the current frame until the end of main, or until a return leaves 
+// vm->exitFrameIndex frames
+static VmError_t vmInterpret(Vm_t *vm) {
+#if defined(VM_LABEL_DISPATCH)
+    // the tracing hooks are in the switch loop only
+    switch (vm->traceThreshold ? VM_DISPATCH_SWITCH : vm->dispatch) {
+        case VM_DISPATCH_GOTO:
+            return vmRunGoto(vm);
+        case VM_DISPATCH_THREADED:
+            return vmRunThreaded(vm);
+        default:
+            break;
+    }
+#endif
+    return vmRunSwitch(vm);
+}
+
+static VmError_t vmRunSwitch(Vm_t *vm) {
     VmError_t err = createVmError(VM_NO_ERROR, NULL);
     
-    while (vmCurrentFrame(vm)->ip < (int32_t)sliceByteGetLen(frameGetInstructions(vmCurrentFrame(vm))) - 1) {
+    while (vmCurrentFrame(vm)->ip < (int32_t)vmCurrentFrame(vm)->cl->fn->codeLength - 1) {
         vmCurrentFrame(vm)->ip++;
 
-        Instructions_t ins = vmGetInstructions(vm);
-        OpCode_t op = ins[vmCurrentFrame(vm)->ip];
+        OpCode_t op = vmGetCode(vm)[vmCurrentFrame(vm)->ip];
+#if defined(JIT_SUPPORTED)
+        int32_t fromIp = vmCurrentFrame(vm)->ip;
+        uint32_t fromFrame = vm->frameIndex;
+        if (vm->traceThreshold) {
+            vm->interpretedInstructions++;
+            if (vm->recording) vmTraceRecord(vm);
+        }
+#endif
          
         switch(op) {
             case OP_CONSTANT: 
@@ -240,6 +393,21 @@ VmError_t vmRun(Vm_t *vm) {
                 err = vmExecuteOpJumpNotTruthy(vm, &vmCurrentFrame(vm)->ip);
                 break;
 
+            case OP_SWITCH_TABLE:
+                err = vmExecuteOpSwitchTable(vm, &vmCurrentFrame(vm)->ip);
+                break;
+
+            case OP_PUSH_INT8:
+            case OP_PUSH_INT16:
+                err = vmExecuteOpPushInt(vm, op, &vmCurrentFrame(vm)->ip);
+                break;
+
+            case OP_ADD_IMM:
+            case OP_SUB_IMM:
+            case OP_GREATER_THAN_IMM:
+                err = vmExecuteImmediateOperation(vm, op, &vmCurrentFrame(vm)->ip);
+                break;
+
             case OP_SET_GLOBAL:
                 err = vmExecuteOpSetGlobal(vm, &vmCurrentFrame(vm)->ip);
                 break;
@@ -266,10 +434,12 @@ VmError_t vmRun(Vm_t *vm) {
 
             case OP_RETURN_VALUE:
                 err = vmExecuteOpReturnValue(vm);
+                if (vm->frameIndex == vm->exitFrameIndex) return err;
                 break;
 
             case OP_RETURN:
                 err = vmExecuteOpReturn(vm);
+                if (vm->frameIndex == vm->exitFrameIndex) return err;
                 break;
 
             case OP_SET_LOCAL:
@@ -280,6 +450,10 @@ VmError_t vmRun(Vm_t *vm) {
                 err = vmExecuteOpGetLocal(vm, &vmCurrentFrame(vm)->ip);
                 break;
 
+            case OP_MOVE_LOCAL:
+                err = vmExecuteOpMoveLocal(vm, &vmCurrentFrame(vm)->ip);
+                break;
+
             case OP_GET_BUILTIN:
                 err = vmExecuteOpGetBuiltin(vm, &vmCurrentFrame(vm)->ip);
                 break;
@@ -296,6 +470,21 @@ VmError_t vmRun(Vm_t *vm) {
                 err = vmExecuteOpCurrentClosure(vm);
                 break;
 
+            case OP_ADD_I64:
+            case OP_SUB_I64:
+            case OP_MUL_I64:
+            case OP_EQUAL_I64:
+            case OP_NOT_EQUAL_I64:
+            case OP_GREATER_THAN_I64:
+            case OP_MINUS_I64:
+                err = vmExecuteIntegerOperation(vm, op);
+                break;
+
+            case OP_JUMP_NOT_EQUAL_I64:
+            case OP_JUMP_NOT_GREATER_THAN_I64:
+                err = vmExecuteOpJumpIntegerComparison(vm, op, &vmCurrentFrame(vm)->ip);
+                break;
+
             default:
                 break;
         }
@@ -304,20 +493,625 @@ VmError_t vmRun(Vm_t *vm) {
             break;
         }
 
+#if defined(JIT_SUPPORTED)
+        if (vm->traceThreshold && (op == OP_JUMP || op == OP_CALL || op == OP_RETURN_VALUE)) {
+            err = vmTraceTransfer(vm, op, fromIp, fromFrame);
+            if (err.code != VM_NO_ERROR) break;
+            if (vm->frameIndex == vm->exitFrameIndex) return err;
+        }
+#endif
+
         //gcForceRun();
     }
+#if defined(JIT_SUPPORTED)
+    if (vm->recording) vmTraceStop(vm, false);
+#endif
+    return err;
+}
+
+#if defined(JIT_SUPPORTED)
+/* Baseline JIT: every instruction of a function becomes a call to one of 
+ * the helpers below, except for jumps and for the integer forms, which run
+ * inline when their operands pass the type guards. Jitted functions run to 
+ * their return natively, calls to interpreted functions run the 
+ * interpreter until these return. */
+
+static bool vmJitDone(VmError_t* err, VmError_t result) {
+    *err = result;
+    return result.code != VM_NO_ERROR;
+}
+
+#define VM_JIT_HELPER(name, expr) \
+static bool name(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) { \
+    (void)a; \
+    (void)b; \
+    return vmJitDone(err, expr); \
+}
+
+VM_JIT_HELPER(vmJitConstant, vmPushConstant(vm, a))
+VM_JIT_HELPER(vmJitBinary, vmExecuteBinaryOperation(vm, a))
+VM_JIT_HELPER(vmJitBoolean, vmExecuteOpBoolean(vm, a))
+VM_JIT_HELPER(vmJitNull, vmExecuteOpNull(vm))
+VM_JIT_HELPER(vmJitComparison, vmExecuteComparison(vm, a))
+VM_JIT_HELPER(vmJitMinus, vmExecuteMinusOperator(vm))
+VM_JIT_HELPER(vmJitBang, vmExecuteBangOperator(vm))
+VM_JIT_HELPER(vmJitGetGlobal, vmGetGlobal(vm, a))
+VM_JIT_HELPER(vmJitSetGlobal, vmSetGlobal(vm, a))
+VM_JIT_HELPER(vmJitArray, vmPush(vm, (Object_t*)vmBuildArray(vm, a)))
+VM_JIT_HELPER(vmJitHash, vmPushHash(vm, a))
+VM_JIT_HELPER(vmJitIndex, vmExecuteOpIndex(vm))
+VM_JIT_HELPER(vmJitReturnValue, vmExecuteOpReturnValue(vm))
+VM_JIT_HELPER(vmJitReturn, vmExecuteOpReturn(vm))
+VM_JIT_HELPER(vmJitGetLocal, vmGetLocal(vm, a))
+VM_JIT_HELPER(vmJitSetLocal, vmSetLocal(vm, a))
+VM_JIT_HELPER(vmJitMoveLocal, vmMoveLocal(vm, a))
+VM_JIT_HELPER(vmJitGetBuiltin, vmGetBuiltin(vm, a))
+VM_JIT_HELPER(vmJitClosure, vmPushClosure(vm, a, b))
+VM_JIT_HELPER(vmJitGetFree, vmGetFree(vm, a))
+VM_JIT_HELPER(vmJitCurrentClosure, vmExecuteOpCurrentClosure(vm))
+VM_JIT_HELPER(vmJitPop, vmExecuteOpPop(vm))
+VM_JIT_HELPER(vmJitPushInteger, vmPush(vm, vmInteger(vm, a)))
+
+// Replace the b operands of an inline integer template by its result a
+static bool vmJitIntegerResult(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    for (int64_t i = 0; i < b; i++) vmPop(vm);
+    return vmJitDone(err, vmPush(vm, (Object_t*)createInteger(a)));
+}
+
+static bool vmJitBooleanResult(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    for (int64_t i = 0; i < b; i++) vmPop(vm);
+    return vmJitDone(err, vmPush(vm, nativeBoolToBooleanObject(a)));
+}
+
+static bool vmJitDrop(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    for (int64_t i = 0; i < a; i++) vmPop(vm);
+    return false;
+}
+
+// Operands of an integer form failing the type guards take the checked 
+// operation, which fails like an untyped program would. a is the opcode, b
+// the immediate operand.
+static bool vmJitCheckedOperation(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    switch (a) {
+        case OP_ADD_I64:
+            return vmJitDone(err, vmExecuteBinaryOperation(vm, OP_ADD));
+        case OP_SUB_I64:
+            return vmJitDone(err, vmExecuteBinaryOperation(vm, OP_SUB));
+        case OP_MUL_I64:
+            return vmJitDone(err, vmExecuteBinaryOperation(vm, OP_MUL));
+        case OP_EQUAL_I64:
+        case OP_JUMP_NOT_EQUAL_I64:
+            return vmJitDone(err, vmExecuteComparison(vm, OP_EQUAL));
+        case OP_NOT_EQUAL_I64:
+            return vmJitDone(err, vmExecuteComparison(vm, OP_NOT_EQUAL));
+        case OP_GREATER_THAN_I64:
+        case OP_JUMP_NOT_GREATER_THAN_I64:
+            return vmJitDone(err, vmExecuteComparison(vm, OP_GREATER_THAN));
+        case OP_MINUS_I64:
+            return vmJitDone(err, vmExecuteMinusOperator(vm));
+        default:
+            return vmJitDone(err, vmImmediateOperation(vm, a, b));
+    }
+}
+
+// Condition helper, pops the value to test
+static bool vmJitTruthy(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    return vmIsTruthy(vmPop(vm));
+}
+
+// Runs the frames above frameIndex until the current one returns
+static VmError_t vmRunCallee(Vm_t* vm, uint32_t frameIndex) {
+    uint32_t exitFrameIndex = vm->exitFrameIndex;
+    vm->exitFrameIndex = frameIndex;
+    VmError_t err = vmInterpret(vm);
+    vm->exitFrameIndex = exitFrameIndex;
+    return err;
+}
+
+static bool vmJitCall(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    uint32_t frameIndex = vm->frameIndex;
+    if (vmJitDone(err, vmCall(vm, a))) return true;
+
+    // a jitted callee has returned already 
+    if (vm->frameIndex > frameIndex) {
+        return vmJitDone(err, vmRunCallee(vm, frameIndex));
+    }
+    return false;
+}
+
+static void* vmJitSwitchTable(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    int32_t last;
+    if (vmJitDone(err, vmSwitchTable(vm, &last, a))) return NULL;
+    return vmCurrentFrame(vm)->cl->fn->jit->addresses[last + 1];
+}
+
+static void vmJitIntegerTemplate(JitAssembler_t* a, OpCode_t op, int32_t imm) {
+    bool unary = op == OP_MINUS_I64 || op == OP_ADD_IMM || op == OP_SUB_IMM || op == OP_GREATER_THAN_IMM;
+    bool boolean = op == OP_EQUAL_I64 || op == OP_NOT_EQUAL_I64 || op == OP_GREATER_THAN_I64 || op == OP_GREATER_THAN_IMM;
+    uint32_t slow = jitNewLabel(a);
+    uint32_t done = jitNewLabel(a);
+
+    jitLoadIntegers(a, unary ? 1 : 2, slow);
+    jitIntegerOperation(a, op, imm);
+    jitCallWithResult(a, boolean ? vmJitBooleanResult : vmJitIntegerResult, unary ? 1 : 2);
+    jitJump(a, done);
+
+    jitBind(a, slow);
+    jitCall(a, vmJitCheckedOperation, op, imm);
+    jitBind(a, done);
+}
+
+static void vmJitIntegerJumpTemplate(JitAssembler_t* a, OpCode_t op, uint32_t target) {
+    uint32_t slow = jitNewLabel(a);
+    uint32_t done = jitNewLabel(a);
+
+    jitLoadIntegers(a, 2, slow);
+    jitIntegerOperation(a, op, 0);
+    jitSaveResult(a);
+    jitCall(a, vmJitDrop, 2, 0);
+    jitJumpIfSavedFalse(a, target);
+    jitJump(a, done);
+
+    jitBind(a, slow);
+    jitCall(a, vmJitCheckedOperation, op, 0);
+    jitCallTest(a, vmJitTruthy, 0, 0, target);
+    jitBind(a, done);
+}
+
+// Stitches the templates of the instructions of fn, NULL if it can't be 
+// compiled
+static JitCode_t* vmJitCompile(CompiledFunction_t* fn) {
+    JitAssembler_t* a = createJitAssembler(fn->codeLength + 1);
+    for (uint32_t ip = 0; ip < fn->codeLength; ip += 1 + opLookup(fn->code[ip])->argCount) {
+        OpCode_t op = fn->code[ip];
+        CodeWord_t operand = fn->code[ip + 1];
+        jitBind(a, ip);
+
+        switch (op) {
+            case OP_CONSTANT:
+                jitCall(a, vmJitConstant, operand, 0);
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+                jitCall(a, vmJitBinary, op, 0);
+                break;
+            case OP_TRUE:
+            case OP_FALSE:
+                jitCall(a, vmJitBoolean, op, 0);
+                break;
+            case OP_NULL:
+                jitCall(a, vmJitNull, 0, 0);
+                break;
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_GREATER_THAN:
+                jitCall(a, vmJitComparison, op, 0);
+                break;
+            case OP_MINUS:
+                jitCall(a, vmJitMinus, 0, 0);
+                break;
+            case OP_BANG:
+                jitCall(a, vmJitBang, 0, 0);
+                break;
+            case OP_JUMP_NOT_TRUTHY:
+                jitCallTest(a, vmJitTruthy, 0, 0, operand);
+                break;
+            case OP_JUMP:
+                jitJump(a, operand);
+                break;
+            case OP_GET_GLOBAL:
+                jitCall(a, vmJitGetGlobal, operand, 0);
+                break;
+            case OP_SET_GLOBAL:
+                jitCall(a, vmJitSetGlobal, operand, 0);
+                break;
+            case OP_ARRAY:
+                jitCall(a, vmJitArray, operand, 0);
+                break;
+            case OP_HASH:
+                jitCall(a, vmJitHash, operand, 0);
+                break;
+            case OP_INDEX:
+                jitCall(a, vmJitIndex, 0, 0);
+                break;
+            case OP_CALL:
+                jitCall(a, vmJitCall, operand, 0);
+                break;
+            case OP_RETURN_VALUE:
+                jitCall(a, vmJitReturnValue, 0, 0);
+                jitExit(a);
+                break;
+            case OP_RETURN:
+                jitCall(a, vmJitReturn, 0, 0);
+                jitExit(a);
+                break;
+            case OP_GET_LOCAL:
+                jitCall(a, vmJitGetLocal, operand, 0);
+                break;
+            case OP_SET_LOCAL:
+                jitCall(a, vmJitSetLocal, operand, 0);
+                break;
+            case OP_MOVE_LOCAL:
+                jitCall(a, vmJitMoveLocal, operand, 0);
+                break;
+            case OP_GET_BUILTIN:
+                jitCall(a, vmJitGetBuiltin, operand, 0);
+                break;
+            case OP_CLOSURE:
+                jitCall(a, vmJitClosure, operand, fn->code[ip + 2]);
+                break;
+            case OP_GET_FREE:
+                jitCall(a, vmJitGetFree, operand, 0);
+                break;
+            case OP_CURRENT_CLOSURE:
+                jitCall(a, vmJitCurrentClosure, 0, 0);
+                break;
+            case OP_POP:
+                jitCall(a, vmJitPop, 0, 0);
+                break;
+            case OP_ADD_I64:
+            case OP_SUB_I64:
+            case OP_MUL_I64:
+            case OP_EQUAL_I64:
+            case OP_NOT_EQUAL_I64:
+            case OP_GREATER_THAN_I64:
+            case OP_MINUS_I64:
+                vmJitIntegerTemplate(a, op, 0);
+                break;
+            case OP_ADD_IMM:
+            case OP_SUB_IMM:
+            case OP_GREATER_THAN_IMM:
+                vmJitIntegerTemplate(a, op, operand);
+                break;
+            case OP_JUMP_NOT_EQUAL_I64:
+            case OP_JUMP_NOT_GREATER_THAN_I64:
+                vmJitIntegerJumpTemplate(a, op, operand);
+                break;
+            case OP_SWITCH_TABLE:
+                jitCallJump(a, vmJitSwitchTable, operand, 0);
+                break;
+            case OP_PUSH_INT8:
+            case OP_PUSH_INT16:
+                jitCall(a, vmJitPushInteger, operand, 0);
+                break;
+            default:
+                cleanupJitAssembler(a);
+                return NULL;
+        }
+    }
+    jitBind(a, fn->codeLength);
+    jitExit(a);
+    return jitFinish(a);
+}
+
+// Counts the runs of fn, which is compiled on the one reaching the threshold
+static bool vmJitReady(Vm_t* vm, CompiledFunction_t* fn) {
+    if (vm->jitThreshold == 0) return false;
+    if (fn->jit) return true;
+    if (++fn->numCalls != vm->jitThreshold) return false;
+
+    fn->jit = vmJitCompile(fn);
+    return fn->jit != NULL;
+}
+
+static VmError_t vmJitRun(Vm_t* vm, CompiledFunction_t* fn) {
+    VmError_t err = createVmError(VM_NO_ERROR, NULL);
+    fn->jit->entry(vm, &err);
+    return err;
+}
+
+/* Tracing JIT (see trace.h). The switch loop counts the backward jumps, self
+ * calls and returns from self calls landing on an anchor, records from the
+ * hot ones and enters the traces compiled there. Trace exits landing on 
+ * another anchor go on with its trace. */
+
+static int64_t vmTraceLocalsBase(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    return (int64_t)(intptr_t)&vm->stack[vmCurrentFrame(vm)->basePointer];
+}
+
+// Integers in the immediate range share the boxes of the immediates
+static Object_t* vmTraceBox(Vm_t* vm, int64_t value, TraceValueKind_t kind) {
+    if (kind == TRACE_BOOLEAN) return nativeBoolToBooleanObject(value);
+    if (value >= IMMEDIATE_MIN && value <= IMMEDIATE_MAX) return vmImmediate(vm, value);
+    return (Object_t*)createInteger(value);
+}
+
+static bool vmTraceStoreLocal(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    if (vmJitDone(err, vmPush(vm, vmTraceBox(vm, a, b >> 32)))) return true;
+    return vmJitDone(err, vmSetLocal(vm, (uint32_t)b));
+}
+
+// The slot reference of a moved local goes away like in vmMoveLocal
+static bool vmTraceClearLocal(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    Object_t** slot = &vm->stack[vmCurrentFrame(vm)->basePointer + b];
+    if (*slot) gcClearRef(*slot, GC_REF_STACK);
+    *slot = NULL;
+    return false;
+}
+
+static bool vmTracePush(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    TraceValueKind_t kind = b & 0xff;
+    uint32_t index = (uint64_t)b >> 8;
+    switch (kind) {
+        case TRACE_INTEGER:
+        case TRACE_BOOLEAN:
+            return vmJitDone(err, vmPush(vm, vmTraceBox(vm, a, kind)));
+        case TRACE_CLOSURE:
+            return vmJitDone(err, vmExecuteOpCurrentClosure(vm));
+        case TRACE_FUNCTION:
+            return vmJitDone(err, vmPushClosure(vm, index, 0));
+        case TRACE_BUILTIN:
+            return vmJitDone(err, vmGetBuiltin(vm, index));
+        default:
+            return vmJitDone(err, vmGetLocal(vm, index));
+    }
+}
+
+// b is the word of the call instruction, the frame ip is its operand
+static bool vmTraceCall(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    vmCurrentFrame(vm)->ip = b + 1;
+    return vmJitDone(err, vmCall(vm, a));
+}
+
+static bool vmTracePushFrame(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    vmCurrentFrame(vm)->ip = b + 1;
+    Closure_t* cl = (Closure_t*)vm->stack[vm->sp - 1 - a];
+    return vmJitDone(err, vmPushClosureFrame(vm, cl, a));
+}
+
+static bool vmTraceReturnsTo(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    Frame_t* frame = vmCurrentFrame(vm);
+    return vm->frameIndex > vm->exitFrameIndex && 
+        frame->cl->fn == (CompiledFunction_t*)(intptr_t)a && frame->ip == b - 1;
+}
+
+static bool vmTraceExit(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    vmCurrentFrame(vm)->ip = b - 1;
+    vm->tracedInstructions += a;
+    return false;
+}
+
+static bool vmTraceLeave(Vm_t* vm, VmError_t* err, int64_t a, int64_t b) {
+    vm->tracedInstructions += a;
+    return false;
+}
+
+static const TraceHelpers_t vmTraceHelpers = {
+    .localsBase = vmTraceLocalsBase,
+    .storeLocal = vmTraceStoreLocal,
+    .clearLocal = vmTraceClearLocal,
+    .drop = vmJitDrop,
+    .push = vmTracePush,
+    .call = vmTraceCall,
+    .pushFrame = vmTracePushFrame,
+    .ret = vmJitReturnValue,
+    .returnsTo = vmTraceReturnsTo,
+    .exit = vmTraceExit,
+    .leave = vmTraceLeave,
+};
+
+static TraceAnchor_t* vmTraceAnchor(CompiledFunction_t* fn, int32_t ip) {
+    if (!fn->traces) {
+        fn->traces = callocChk((fn->codeLength + 1) * sizeof(TraceAnchor_t));
+    }
+    return &fn->traces[ip];
+}
+
+static ObjectType_t vmTraceType(Object_t* obj) {
+    return obj ? obj->type : TRACE_NO_TYPE;
+}
+
+static void vmTraceStart(Vm_t* vm, TraceKind_t kind) {
+    Frame_t* frame = vmCurrentFrame(vm);
+    TraceRecording_t* rec = mallocChk(sizeof(TraceRecording_t));
+    rec->fn = frame->cl->fn;
+    rec->kind = kind;
+    rec->anchorIp = frame->ip + 1;
+    rec->frameIndex = vm->frameIndex;
+    rec->entryDepth = vm->sp - frame->basePointer - rec->fn->numLocals;
+    rec->closed = false;
+    rec->endIp = 0;
+    rec->numSteps = 0;
+    vm->recording = rec;
+}
+
+// Compiles the recording or drops it, a failure counts against the anchor
+static void vmTraceStop(Vm_t* vm, bool compile) {
+    TraceRecording_t* rec = vm->recording;
+    TraceAnchor_t* anchor = vmTraceAnchor(rec->fn, rec->anchorIp);
+    anchor->trace = compile ? traceCompile(rec, &vmTraceHelpers) : NULL;
+    if (!anchor->trace) {
+        anchor->failures++;
+        anchor->hits = 0;
+    }
+    free(rec);
+    vm->recording = NULL;
+}
+
+// Appends the instruction about to run, unless the recording ends there
+static void vmTraceRecord(Vm_t* vm) {
+    TraceRecording_t* rec = vm->recording;
+    Frame_t* frame = vmCurrentFrame(vm);
+    CompiledFunction_t* fn = frame->cl->fn;
+    int32_t depth = (int32_t)vm->frameIndex - (int32_t)rec->frameIndex;
+
+    if (rec->numSteps > 0) {
+        int32_t loopDepth = rec->kind == TRACE_LOOP ? 0 : (rec->kind == TRACE_ENTRY ? 1 : -1);
+        OpCode_t last = rec->steps[rec->numSteps - 1].op;
+        if (fn == rec->fn && (uint32_t)frame->ip == rec->anchorIp && depth == loopDepth) {
+            rec->closed = true;
+            vmTraceStop(vm, true);
+            return;
+        }
+        if (last == OP_CALL || last == OP_RETURN_VALUE) {
+            vmTraceStop(vm, true);
+            return;
+        }
+        if (fn->traces && fn->traces[frame->ip].trace) {
+            rec->endIp = frame->ip;
+            vmTraceStop(vm, true);
+            return;
+        }
+    }
+    if (depth != 0 || rec->numSteps == TRACE_MAX_STEPS) {
+        vmTraceStop(vm, false);
+        return;
+    }
+
+    const CodeWord_t* code = &fn->code[frame->ip];
+    TraceStep_t* step = &rec->steps[rec->numSteps++];
+    step->ip = frame->ip;
+    step->op = code[0];
+    step->operands[0] = code[1];
+    step->operands[1] = opLookup(step->op)->argCount > 1 ? code[2] : 0;
+    if (step->op == OP_GET_LOCAL || step->op == OP_MOVE_LOCAL) {
+        step->types[0] = vmTraceType(vm->stack[frame->basePointer + code[1]]);
+        step->types[1] = TRACE_NO_TYPE;
+    } else {
+        step->types[0] = vm->sp > 0 ? vmTraceType(vm->stack[vm->sp - 1]) : TRACE_NO_TYPE;
+        step->types[1] = vm->sp > 1 ? vmTraceType(vm->stack[vm->sp - 2]) : TRACE_NO_TYPE;
+    }
+}
+
+// Runs trace, and on exit the trace at the anchor it exited to
+static VmError_t vmTraceRun(Vm_t* vm, Trace_t* trace) {
+    VmError_t err = createVmError(VM_NO_ERROR, NULL);
+    // traces pop nothing, the value the interpreter popped last would stay
+    // referenced and keep a moved array from being appended to in place
+    if (vm->lastPopped) {
+        gcClearRef(vm->lastPopped, GC_REF_STACK);
+        vm->lastPopped = NULL;
+    }
+    while (trace) {
+        uint64_t traced = vm->tracedInstructions;
+        trace->code->entry(vm, &err);
+        if (err.code != VM_NO_ERROR || vm->frameIndex == vm->exitFrameIndex || vm->tracedInstructions == traced) {
+            break;
+        }
+
+        Frame_t* frame = vmCurrentFrame(vm);
+        TraceAnchor_t* anchors = frame->cl->fn->traces;
+        trace = anchors ? anchors[frame->ip + 1].trace : NULL;
+    }
     return err;
 }
 
+// Called after the instructions transferring control, with the word and 
+// frame the instruction ran in
+static VmError_t vmTraceTransfer(Vm_t* vm, OpCode_t op, int32_t fromIp, uint32_t fromFrame) {
+    Frame_t* frame = vmCurrentFrame(vm);
+    CompiledFunction_t* fn = frame->cl->fn;
+    TraceKind_t kind;
+    bool self;
+
+    switch (op) {
+        case OP_JUMP:
+            if (frame->ip >= fromIp) return createVmError(VM_NO_ERROR, NULL);
+            kind = TRACE_LOOP;
+            self = true;
+            break;
+        case OP_CALL:
+            // builtins and jitted callees are done already
+            if (vm->frameIndex == fromFrame) return createVmError(VM_NO_ERROR, NULL);
+            kind = TRACE_ENTRY;
+            self = vm->frames[vm->frameIndex - 2].cl->fn == fn;
+            break;
+        default:
+            // the frame returned from is still in the array
+            kind = TRACE_RETURN;
+            self = vm->frames[fromFrame - 1].cl->fn == fn;
+            break;
+    }
+    if (vm->recording) return createVmError(VM_NO_ERROR, NULL);
+
+    TraceAnchor_t* anchor = vmTraceAnchor(fn, frame->ip + 1);
+    if (anchor->trace) {
+        return vmTraceRun(vm, anchor->trace);
+    }
+    if (self && anchor->failures < TRACE_MAX_FAILURES && ++anchor->hits >= vm->traceThreshold) {
+        vmTraceStart(vm, kind);
+    }
+    return createVmError(VM_NO_ERROR, NULL);
+}
+#endif
+
 static VmError_t vmExecuteOpConstant(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint16_t constIndex = readUint16BigEndian(&ins[*ip + 1]);
-    *ip += 2;
+    uint32_t constIndex = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmPushConstant(vm, constIndex);
+}
 
-    Object_t* constObj = vectorObjectsGetBuffer(vm->constants)[constIndex]; 
+static VmError_t vmPushConstant(Vm_t* vm, uint32_t constIndex) {
+    Object_t* constObj = frameGetConstants(vmCurrentFrame(vm))[constIndex]; 
     return vmPush(vm, constObj);
 }
 
+// Like constants, immediates are boxed once and live as long as the vm
+static Object_t* vmImmediate(Vm_t* vm, int16_t value) {
+    if (!vm->immediates) {
+        vm->immediates = callocChk((UINT16_MAX + 1) * sizeof(Object_t*));
+    }
+
+    Object_t** boxed = &vm->immediates[(uint16_t)value];
+    if (!*boxed) {
+        *boxed = (Object_t*)createInteger(value);
+        gcSetRef(*boxed, GC_REF_COMPILE_CONSTANT);
+    }
+    return *boxed;
+}
+
+static VmError_t vmExecuteOpPushInt(Vm_t* vm, OpCode_t op, int32_t* ip) {
+    int32_t value = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmPush(vm, vmInteger(vm, value));
+}
+
+// Integers past the immediate range only come from wide operands
+static Object_t* vmInteger(Vm_t* vm, int32_t value) {
+    if (value < IMMEDIATE_MIN || value > IMMEDIATE_MAX) {
+        return (Object_t*)createInteger(value);
+    }
+    return vmImmediate(vm, value);
+}
+
+// Anything but an integer on the left goes through the generic operation
+// with the boxed immediate, to concatenate or fail the same way
+static VmError_t vmExecuteImmediateOperation(Vm_t* vm, OpCode_t op, int32_t* ip) {
+    int32_t right = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmImmediateOperation(vm, op, right);
+}
+
+static VmError_t vmImmediateOperation(Vm_t* vm, OpCode_t op, int32_t right) {
+    if (vmStackTop(vm)->type != OBJECT_INTEGER) {
+        VmError_t err = vmPush(vm, vmInteger(vm, right));
+        if (err.code != VM_NO_ERROR) return err;
+
+        switch (op) {
+            case OP_ADD_IMM:
+                return vmExecuteBinaryOperation(vm, OP_ADD);
+            case OP_SUB_IMM:
+                return vmExecuteBinaryOperation(vm, OP_SUB);
+            default:
+                return vmExecuteComparison(vm, OP_GREATER_THAN);
+        }
+    }
+
+    int64_t left = ((Integer_t*)vmPop(vm))->value;
+    switch (op) {
+        case OP_ADD_IMM:
+            return vmPush(vm, (Object_t*)createInteger(left + right));
+        case OP_SUB_IMM:
+            return vmPush(vm, (Object_t*)createInteger(left - right));
+        default:
+            return vmPush(vm, nativeBoolToBooleanObject(left > right));
+    }
+}
 
 static VmError_t vmExecuteBinaryOperation(Vm_t *vm, OpCode_t op) {
     Object_t* right = vmPop(vm);
@@ -366,10 +1160,7 @@ static VmError_t vmExecuteBinaryStringOperation(Vm_t *vm, OpCode_t op, String_t*
         return createVmError(VM_UNSUPPORTED_OPERATOR, strFormat("unknown string operator: %d", op));
     }
 
-    char* concatStr = strFormat("%s%s", left->value, right->value);
-    String_t* strObj = createString(concatStr);
-    free(concatStr);
-    return vmPush(vm, (Object_t*) strObj);
+    return vmPush(vm, (Object_t*)createStringConcat(left, right));
 }
 
 static VmError_t vmExecuteComparison(Vm_t* vm, OpCode_t op) {
@@ -384,6 +1175,10 @@ static VmError_t vmExecuteComparison(Vm_t* vm, OpCode_t op) {
         return vmExecuteBooleanComparison(vm, op, (Boolean_t*)left, (Boolean_t*)right);
     }
 
+    if (left->type == OBJECT_STRING && right->type == OBJECT_STRING) {
+        return vmExecuteStringComparison(vm, op, (String_t*)left, (String_t*)right);
+    }
+
     return createVmError(VM_UNSUPPORTED_TYPES, strFormat("unknown operator: %d (%s %s)", 
         op, objectTypeToString(left->type), objectTypeToString(right->type))); 
 }
@@ -412,6 +1207,17 @@ static VmError_t vmExecuteBooleanComparison(Vm_t* vm, OpCode_t op, Boolean_t* le
     }
 }
 
+static VmError_t vmExecuteStringComparison(Vm_t* vm, OpCode_t op, String_t* left, String_t* right) {
+    switch(op) {
+        case OP_EQUAL:
+            return vmPush(vm, nativeBoolToBooleanObject(stringEquals(left, right)));
+        case OP_NOT_EQUAL:
+            return vmPush(vm, nativeBoolToBooleanObject(!stringEquals(left, right)));
+        default:
+            return createVmError(VM_UNSUPPORTED_OPERATOR, strFormat("unknown string operator: %d", op)); 
+    }
+}
+
 static VmError_t vmExecuteBangOperator(Vm_t *vm) {
     Object_t* operand = vmPop(vm);
 
@@ -437,26 +1243,74 @@ static VmError_t vmExecuteMinusOperator(Vm_t *vm) {
     return vmPush(vm, (Object_t*)createInteger(-value));
 }
 
+// The compiler only emits the I64 opcodes for operands it proved to be
+// integers, so the types are not checked again
+static VmError_t vmExecuteIntegerOperation(Vm_t* vm, OpCode_t op) {
+    int64_t right = ((Integer_t*)vmPop(vm))->value;
+    if (op == OP_MINUS_I64) {
+        return vmPush(vm, (Object_t*)createInteger(-right));
+    }
+
+    int64_t left = ((Integer_t*)vmPop(vm))->value;
+    switch(op) {
+        case OP_ADD_I64:
+            return vmPush(vm, (Object_t*)createInteger(left + right));
+        case OP_SUB_I64:
+            return vmPush(vm, (Object_t*)createInteger(left - right));
+        case OP_MUL_I64:
+            return vmPush(vm, (Object_t*)createInteger(left * right));
+        case OP_EQUAL_I64:
+            return vmPush(vm, nativeBoolToBooleanObject(left == right));
+        case OP_NOT_EQUAL_I64:
+            return vmPush(vm, nativeBoolToBooleanObject(left != right));
+        case OP_GREATER_THAN_I64:
+            return vmPush(vm, nativeBoolToBooleanObject(left > right));
+        default:
+            return createVmError(VM_UNSUPPORTED_OPERATOR, strFormat("unknown integer operator: %d", op));
+    }
+}
+
+static VmError_t vmExecuteOpJumpIntegerComparison(Vm_t* vm, OpCode_t op, int32_t* ip) {
+    int32_t target = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmJumpIntegerComparison(vm, op, ip, target);
+}
+
+static VmError_t vmJumpIntegerComparison(Vm_t* vm, OpCode_t op, int32_t* ip, int32_t target) {
+    int64_t right = ((Integer_t*)vmPop(vm))->value;
+    int64_t left = ((Integer_t*)vmPop(vm))->value;
+    bool condition = (op == OP_JUMP_NOT_EQUAL_I64) ? left == right : left > right;
+    if (!condition) {
+        *ip = target - 1;
+    }
+
+    return createVmError(VM_NO_ERROR, NULL);
+}
 
 static VmError_t vmExecuteOpArray(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint16_t numElements = readUint16BigEndian(&ins[*ip + 1]);
-    *ip += 2;
+    uint32_t numElements = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
 
     Array_t* array = vmBuildArray(vm, numElements);
     return vmPush(vm, (Object_t*)array);
 }
 
-static Array_t* vmBuildArray(Vm_t* vm, uint16_t numElements) {
+static Array_t* vmBuildArray(Vm_t* vm, uint32_t numElements) {
     // create array object using stack elements  
-    Array_t* arr = createArray();
-    arr->elements = createVectorObjects();
+    Array_t* arr = createArrayWithCapacity(numElements);
+    for (uint16_t i = vm->sp - numElements; i< vm->sp; i++) {
+        if (vm->stack[i]->type != OBJECT_INTEGER) {
+            arrayUnpack(arr);
+            break;
+        }
+    }
     for (uint16_t i = vm->sp - numElements; i< vm->sp; i++) {
         arrayAppend(arr, vm->stack[i]);
     }
 
     // remove elements from stack
-    for (uint16_t i = 0; i < numElements; i++) {
+    for (uint32_t i = 0; i < numElements; i++) {
         vmPop(vm);
     }
 
@@ -464,10 +1318,13 @@ static Array_t* vmBuildArray(Vm_t* vm, uint16_t numElements) {
 }
 
 static VmError_t vmExecuteOpHash(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint16_t numElements = readUint16BigEndian(&ins[*ip + 1]);
-    *ip += 2;
+    uint32_t numElements = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmPushHash(vm, numElements);
+}
 
+static VmError_t vmPushHash(Vm_t* vm, uint32_t numElements) {
     Hash_t* hash;
     VmError_t err = vmBuildHash(vm, numElements, &hash);
     if (err.code != VM_NO_ERROR) {
@@ -476,7 +1333,7 @@ static VmError_t vmExecuteOpHash(Vm_t* vm, int32_t* ip) {
     return vmPush(vm, (Object_t*)hash);
 }
 
-static VmError_t vmBuildHash(Vm_t* vm, uint16_t numElements, Hash_t** hash) {
+static VmError_t vmBuildHash(Vm_t* vm, uint32_t numElements, Hash_t** hash) {
     *hash = createHash();
     for(uint16_t i = vm->sp - numElements; i < vm->sp; i+= 2) {
         Object_t* key = vm->stack[i];
@@ -493,7 +1350,7 @@ static VmError_t vmBuildHash(Vm_t* vm, uint16_t numElements, Hash_t** hash) {
     }
     
     // cleanup stack vars 
-    for (uint16_t i = 0; i < numElements; i++) {
+    for (uint32_t i = 0; i < numElements; i++) {
         vmPop(vm);
     }
     return createVmError(VM_NO_ERROR, NULL);
@@ -521,8 +1378,7 @@ static VmError_t vmExecuteArrayIndex(Vm_t* vm, Array_t*array, Integer_t* index)
         return vmPush(vm, (Object_t*) createNull());
     }
 
-    Object_t** elems = arrayGetElements(array);
-    return vmPush(vm, elems[i]);
+    return vmPush(vm, arrayGetElement(array, i));
 }
 
 static VmError_t vmExecuteHashIndex(Vm_t* vm, Hash_t* hash, Object_t* index) {
@@ -553,36 +1409,91 @@ static VmError_t vmExecuteOpPop(Vm_t* vm) {
     return createVmError(VM_NO_ERROR, NULL);
 }
 
+// Jump operands are the word index of the target. The ip is advanced before
+// the next fetch, so a jump to the start of the function sets it to -1.
 static VmError_t vmExecuteOpJump(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint16_t pos = readUint16BigEndian(&(ins[*ip + 1]));
-    *ip = pos - 1;
+    *ip = vmGetCode(vm)[*ip + 1] - 1;
 
     return createVmError(VM_NO_ERROR, NULL); 
 }
 
 static VmError_t vmExecuteOpJumpNotTruthy(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint16_t pos = readUint16BigEndian(&(ins[*ip + 1]));
-    *ip += 2;
+    int32_t target = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmJumpNotTruthy(vm, ip, target);
+}
 
+static VmError_t vmJumpNotTruthy(Vm_t* vm, int32_t* ip, int32_t target) {
     Object_t* condition = vmPop(vm);
     if (!vmIsTruthy(condition)) {
-        *ip = pos - 1;
+        *ip = target - 1;
     }
 
     return createVmError(VM_NO_ERROR, NULL);
 }
 
+static VmError_t vmExecuteOpSwitchTable(Vm_t* vm, int32_t* ip) {
+    uint32_t constIndex = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmSwitchTable(vm, ip, constIndex);
+}
+
+// The table layout is described in compiler.h, linking made its targets 
+// word indices
+static VmError_t vmSwitchTable(Vm_t* vm, int32_t* ip, uint32_t constIndex) {
+    Object_t* value = vmPop(vm);
+    if (value->type != OBJECT_INTEGER) {
+        // same error as the first comparison of the if-else chain
+        return createVmError(VM_UNSUPPORTED_TYPES, strFormat("unknown operator: %d (%s %s)", 
+            OP_EQUAL, objectTypeToString(value->type), objectTypeToString(OBJECT_INTEGER))); 
+    }
+    int64_t key = ((Integer_t*)value)->value;
+
+    Array_t* table = (Array_t*)frameGetConstants(vmCurrentFrame(vm))[constIndex];
+    int64_t* entries = arrayGetInts(table);
+    uint32_t count = arrayGetElementCount(table);
+    int64_t target = entries[0];
+
+    if (entries[1] == SWITCH_TABLE_DENSE) {
+        uint64_t index = (uint64_t)key - (uint64_t)entries[2];
+        if (index < count - 3) {
+            target = entries[3 + index];
+        }
+    } else {
+        uint32_t low = 0, high = (count - 2) / 2;
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+            int64_t midKey = entries[2 + 2 * mid];
+            if (midKey == key) {
+                target = entries[3 + 2 * mid];
+                break;
+            }
+            if (midKey < key) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+    }
+
+    *ip = (int32_t)target - 1;
+    return createVmError(VM_NO_ERROR, NULL);
+}
+
 static VmError_t vmExecuteOpNull(Vm_t* vm) {
     return vmPush(vm, (Object_t*) createNull());
 }
 
 static VmError_t vmExecuteOpSetGlobal(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint16_t globalIndex = readUint16BigEndian(&(ins[*ip + 1]));
-    *ip += 2;
+    uint32_t globalIndex = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
 
+    return vmSetGlobal(vm, globalIndex);
+}
+
+static VmError_t vmSetGlobal(Vm_t* vm, uint32_t globalIndex) {
     if (vm->globals[globalIndex] != NULL)
         gcClearRef(vm->globals[globalIndex], GC_REF_GLOBAL);
 
@@ -592,18 +1503,25 @@ static VmError_t vmExecuteOpSetGlobal(Vm_t* vm, int32_t* ip) {
 }
 
 static VmError_t vmExecuteOpGetGlobal(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint16_t globalIndex = readUint16BigEndian(&(ins[*ip + 1]));
-    *ip += 2;
+    uint32_t globalIndex = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmGetGlobal(vm, globalIndex);
+}
 
+static VmError_t vmGetGlobal(Vm_t* vm, uint32_t globalIndex) {
     return vmPush(vm, vm->globals[globalIndex]);
 }
 
 
 static VmError_t vmExecuteOpCall(Vm_t* vm, int32_t* ip) {
-    uint8_t numArgs = vmGetInstructions(vm)[*ip+1];
+    uint32_t numArgs = vmGetCode(vm)[*ip + 1];
     *ip += 1;
 
+    return vmCall(vm, numArgs);
+}
+
+static VmError_t vmCall(Vm_t* vm, uint32_t numArgs) {
     Object_t* callee = vm->stack[vm->sp - 1 - numArgs];
 
     if (!callee) {
@@ -621,12 +1539,29 @@ static VmError_t vmExecuteOpCall(Vm_t* vm, int32_t* ip) {
     }
 }
 
-static VmError_t vmCallClosure(Vm_t* vm, Closure_t* cl, uint8_t numArgs) {
+static VmError_t vmCallClosure(Vm_t* vm, Closure_t* cl, uint32_t numArgs) {
+    VmError_t err = vmPushClosureFrame(vm, cl, numArgs);
+    if (err.code != VM_NO_ERROR) return err;
+
+#if defined(JIT_SUPPORTED)
+    // jitted functions run to their return
+    if (vmJitReady(vm, cl->fn)) {
+        return vmJitRun(vm, cl->fn);
+    }
+#endif
+    return err;
+}
+
+static VmError_t vmPushClosureFrame(Vm_t* vm, Closure_t* cl, uint32_t numArgs) {
     if (numArgs != cl->fn->numParameters) {
         return createVmError(VM_CALL_WRONG_PARAMS, strFormat("wrong number of arguments: want=%d, got=%d", 
             cl->fn->numParameters, numArgs));
     }
 
+    if ((uint32_t)vm->sp - numArgs + cl->fn->numLocals > STACK_SIZE) {
+        return createVmError(VM_STACK_OVERFLOW, strFormat("stack overflow sp(%d)", vm->sp));
+    }
+
     Frame_t frame = createFrame(cl, vm->sp - numArgs);
     vmPushFrame(vm, &frame);
 
@@ -636,13 +1571,12 @@ static VmError_t vmCallClosure(Vm_t* vm, Closure_t* cl, uint8_t numArgs) {
         vm->stack[i] = NULL;
     }     
     vm->sp = newSp;
-
     return createVmError(VM_NO_ERROR, NULL);
 }
 
-static VmError_t vmCallBuiltin(Vm_t* vm,Builtin_t* builtin, uint8_t numArgs) {
+static VmError_t vmCallBuiltin(Vm_t* vm,Builtin_t* builtin, uint32_t numArgs) {
     VectorObjects_t* args = createVectorObjects();
-    for (uint16_t i = 0; i < numArgs; i++) {
+    for (uint32_t i = 0; i < numArgs; i++) {
         vectorObjectsAppend(args, vm->stack[vm->sp - numArgs + i]);
     }
 
@@ -684,68 +1618,108 @@ static VmError_t vmExecuteOpReturn(Vm_t* vm) {
 }
 
 static VmError_t vmExecuteOpSetLocal(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint8_t localIndex = ins[*ip + 1];
+    uint32_t localIndex = vmGetCode(vm)[*ip + 1];
     *ip += 1;
 
+    return vmSetLocal(vm, localIndex);
+}
+
+static VmError_t vmSetLocal(Vm_t* vm, uint32_t localIndex) {
     Frame_t* frame = vmCurrentFrame(vm);
     uint16_t stackIndex = frame->basePointer + localIndex;
+    Object_t* old = vm->stack[stackIndex];
     vm->stack[stackIndex] = vmPop(vm);
     gcSetRef(vm->stack[stackIndex], GC_REF_STACK);
 
+    // a reassigned local lets go of its old value 
+    gcClearRef(old, GC_REF_STACK);
+
     return createVmError(VM_NO_ERROR, NULL); 
 }
 
 static VmError_t vmExecuteOpGetLocal(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint8_t localIndex = ins[*ip + 1];
+    uint32_t localIndex = vmGetCode(vm)[*ip + 1];
     *ip += 1;
 
+    return vmGetLocal(vm, localIndex);
+}
+
+static VmError_t vmGetLocal(Vm_t* vm, uint32_t localIndex) {
     Frame_t* frame = vmCurrentFrame(vm);
     return vmPush(vm, vm->stack[frame->basePointer + localIndex]);
 }
 
+static VmError_t vmExecuteOpMoveLocal(Vm_t* vm, int32_t* ip) {
+    uint32_t localIndex = vmGetCode(vm)[*ip + 1];
+    *ip += 1;
+
+    return vmMoveLocal(vm, localIndex);
+}
+
+static VmError_t vmMoveLocal(Vm_t* vm, uint32_t localIndex) {
+    // last use of the local, hand over the slot reference to the stack 
+    Frame_t* frame = vmCurrentFrame(vm);
+    uint16_t stackIndex = frame->basePointer + localIndex;
+    Object_t* obj = vm->stack[stackIndex];
+    vm->stack[stackIndex] = NULL;
+
+    VmError_t err = vmPush(vm, obj);
+    gcClearRef(obj, GC_REF_STACK);
+    return err;
+}
+
 static VmError_t vmExecuteOpGetBuiltin(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint8_t builtinIndex = ins[*ip + 1];
+    uint32_t builtinIndex = vmGetCode(vm)[*ip + 1];
     *ip += 1;
 
+    return vmGetBuiltin(vm, builtinIndex);
+}
+
+static VmError_t vmGetBuiltin(Vm_t* vm, uint32_t builtinIndex) {
     Builtin_t* builtin = createBuiltin(getBuiltinByIndex(builtinIndex));
     return vmPush(vm, (Object_t*)builtin);
 }
 
 static VmError_t vmExecuteOpClosure(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint16_t constIndex = readUint16BigEndian(&(ins[*ip + 1])); 
-    uint8_t numFree = ins[*ip + 3];
-    *ip += 3;
+    const CodeWord_t* code = vmGetCode(vm);
+    uint32_t constIndex = code[*ip + 1]; 
+    uint32_t numFree = code[*ip + 2];
+    *ip += 2;
+
+    return vmPushClosure(vm, constIndex, numFree);
+}
 
-    Object_t* constant = vectorObjectsGetBuffer(vm->constants)[constIndex];
+static VmError_t vmPushClosure(Vm_t* vm, uint32_t constIndex, uint32_t numFree) {
+    Object_t* constant = frameGetConstants(vmCurrentFrame(vm))[constIndex];
     if (constant->type != OBJECT_COMPILED_FUNCTION) {
         return createVmError(VM_CALL_NON_FUNCTION, strFormat("not a function: %d", constant->type));
     }
 
-    VectorObjects_t* freeVars = createVectorObjects();
-    for (uint8_t i = 0; i < numFree; i++) {
-        vectorObjectsAppend(freeVars, vm->stack[vm->sp - numFree + i]);
+    if (numFree == 0) {
+        return vmPush(vm, (Object_t*)compiledFunctionGetClosure((CompiledFunction_t*)constant));
     }
 
+    // free variables are copied from the stack into the closure
+    Closure_t* closure = createClosure((CompiledFunction_t*)constant, &vm->stack[vm->sp - numFree], numFree);
+
     // cleanup stack 
-    for (uint8_t i = 0; i < numFree; i++) {
+    for (uint32_t i = 0; i < numFree; i++) {
         vmPop(vm);
     }
 
-    Closure_t* closure = createClosure((CompiledFunction_t*)constant, freeVars);
     return vmPush(vm, (Object_t*)closure);
 }
 
 static VmError_t vmExecuteOpGetFree(Vm_t* vm, int32_t* ip) {
-    Instructions_t ins = vmGetInstructions(vm);
-    uint8_t freeIndex = ins[*ip + 1];
+    uint32_t freeIndex = vmGetCode(vm)[*ip + 1];
     *ip += 1;
 
+    return vmGetFree(vm, freeIndex);
+}
+
+static VmError_t vmGetFree(Vm_t* vm, uint32_t freeIndex) {
     Closure_t* currentClosure = vmCurrentFrame(vm)->cl;
-    return vmPush(vm, currentClosure->free->buf[freeIndex]);
+    return vmPush(vm, currentClosure->free[freeIndex]);
 }
 
 static VmError_t vmExecuteOpCurrentClosure(Vm_t* vm) {
@@ -780,7 +1754,3 @@ static bool vmIsTruthy(Object_t* obj) {
             return true;
     }
 }
-
-static uint16_t readUint16BigEndian(uint8_t* ptr) {
-    return (ptr[0] << 8) | ptr[1];
-}
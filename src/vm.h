@@ -28,9 +28,48 @@ typedef struct VmError {
 VmError_t createVmError(VmErrorCode_t code, char* str);
 void cleanupVmError(VmError_t* err); 
 
+// How the vm gets from one instruction to the next. The label based ones
+// need the GNU labels as values extension and fall back to the switch.
+typedef enum VmDispatch {
+    VM_DISPATCH_SWITCH,     // switch over the opcode
+    VM_DISPATCH_GOTO,       // computed goto through a table indexed by the opcode
+    VM_DISPATCH_THREADED,   // jump to the handler address stored in the threaded code of the function
+} VmDispatch_t;
+
+#if defined(__GNUC__)
+#define VM_LABEL_DISPATCH
+#define VM_DEFAULT_DISPATCH VM_DISPATCH_THREADED
+#else 
+#define VM_DEFAULT_DISPATCH VM_DISPATCH_SWITCH
+#endif
+
+typedef struct TraceRecording TraceRecording_t;
+
+// Runs of a function before it is jitted when the REPL is given --jit
+#define VM_JIT_THRESHOLD 100
+
+// VM_FORCE_JIT jits every function before it runs, to test the JIT
+#if defined(VM_FORCE_JIT)
+#define VM_DEFAULT_JIT_THRESHOLD 1
+#else
+#define VM_DEFAULT_JIT_THRESHOLD 0
+#endif
+
+// Hits of a loop or recursion anchor before it is traced when the REPL is
+// given --trace
+#define VM_TRACE_THRESHOLD 50
+
+// VM_FORCE_TRACE traces every anchor on its first hit, to test the traces
+#if defined(VM_FORCE_TRACE)
+#define VM_DEFAULT_TRACE_THRESHOLD 1
+#else
+#define VM_DEFAULT_TRACE_THRESHOLD 0
+#endif
+
 typedef struct Vm {
-// Compiled constants 
+// Compiled constants, owned here but read through the pool of the running function
     VectorObjects_t* constants;
+    Object_t** immediates; // boxed immediate operands by their 16 bit pattern, created on first use
 
 // Stack variables  
     Object_t** stack;
@@ -45,6 +84,18 @@ typedef struct Vm {
     Frame_t* frames;
     uint32_t frameIndex; 
 
+    VmDispatch_t dispatch;
+
+// Baseline JIT (see jit.h) 
+    uint32_t jitThreshold; // run on which functions are jitted, 0 keeps them interpreted
+    uint32_t exitFrameIndex; // the interpreter returns once a return leaves this many frames
+
+// Tracing JIT (see trace.h)
+    uint32_t traceThreshold; // hits of an anchor before it is recorded, 0 turns tracing off
+    TraceRecording_t* recording; // in progress, NULL if none
+    uint64_t tracedInstructions;
+    uint64_t interpretedInstructions; // while tracing
+
 } Vm_t;
 
 Vm_t createVm(Bytecode_t* bytecode);
@@ -52,6 +103,22 @@ Vm_t createVmWithStore(Bytecode_t* bytecode, Object_t** s);
 void cleanupVm(Vm_t *vm);
 
 
+void vmSetDispatch(Vm_t* vm, VmDispatch_t dispatch);
+
+// Functions, main included, are compiled to machine code on their 
+// threshold-th run, 1 jits everything before it runs. 0 turns the JIT off,
+// which is the default unless built with VM_FORCE_JIT. Has no effect where 
+// JIT_SUPPORTED isn't defined.
+void vmSetJitThreshold(Vm_t* vm, uint32_t threshold);
+
+// Loops and self recursions are traced once their anchor is hit threshold
+// times, 0 turns tracing off, which is the default unless built with 
+// VM_FORCE_TRACE. Tracing runs the interpreter with the switch dispatch. 
+// Has no effect where JIT_SUPPORTED isn't defined.
+void vmSetTraceThreshold(Vm_t* vm, uint32_t threshold);
+// Share of the instructions run while tracing that ran in traces, in percent
+double vmTraceCoverage(Vm_t* vm);
+
 Object_t* vmStackTop(Vm_t *vm);
 VmError_t vmRun(Vm_t *vm);
 Object_t* vmLastPoppedStackElem(Vm_t *vm); 
@@ -0,0 +1,323 @@
+/* Body of the label dispatched run loops, included by vm.c once per mode
+ * with VM_LABELS_FN set to the function name and VM_LABELS_THREADED to 1 for
+ * direct threading, 0 for computed goto on the opcode words. GCC won't
+ * inline a function containing a computed goto, so the two loops are
+ * expanded from the same text instead of sharing a helper.
+ *
+ * ip is the word index of the instruction being executed, not the last
+ * executed word the frames keep. It is stored to the frame before a call
+ * and loaded back after a call or return. */
+
+#ifndef VM_LABELS_FN
+#error "vm_labels.h is included by vm.c only"
+#endif
+
+static VmError_t VM_LABELS_FN(Vm_t* vm) {
+    static void* const labels[_OP_COUNT + 1] = {
+        [OP_CONSTANT] = &&op_constant,
+        [OP_ADD] = &&op_add,
+        [OP_SUB] = &&op_sub,
+        [OP_MUL] = &&op_mul,
+        [OP_DIV] = &&op_div,
+        [OP_TRUE] = &&op_true,
+        [OP_FALSE] = &&op_false,
+        [OP_NULL] = &&op_null,
+        [OP_EQUAL] = &&op_equal,
+        [OP_NOT_EQUAL] = &&op_not_equal,
+        [OP_GREATER_THAN] = &&op_greater_than,
+        [OP_MINUS] = &&op_minus,
+        [OP_BANG] = &&op_bang,
+        [OP_JUMP_NOT_TRUTHY] = &&op_jump_not_truthy,
+        [OP_JUMP] = &&op_jump,
+        [OP_GET_GLOBAL] = &&op_get_global,
+        [OP_SET_GLOBAL] = &&op_set_global,
+        [OP_ARRAY] = &&op_array,
+        [OP_HASH] = &&op_hash,
+        [OP_INDEX] = &&op_index,
+        [OP_CALL] = &&op_call,
+        [OP_RETURN_VALUE] = &&op_return_value,
+        [OP_RETURN] = &&op_return,
+        [OP_GET_LOCAL] = &&op_get_local,
+        [OP_SET_LOCAL] = &&op_set_local,
+        [OP_MOVE_LOCAL] = &&op_move_local,
+        [OP_GET_BUILTIN] = &&op_get_builtin,
+        [OP_CLOSURE] = &&op_closure,
+        [OP_GET_FREE] = &&op_get_free,
+        [OP_CURRENT_CLOSURE] = &&op_current_closure,
+        [OP_POP] = &&op_pop,
+        [OP_ADD_I64] = &&op_add_i64,
+        [OP_SUB_I64] = &&op_sub_i64,
+        [OP_MUL_I64] = &&op_mul_i64,
+        [OP_EQUAL_I64] = &&op_equal_i64,
+        [OP_NOT_EQUAL_I64] = &&op_not_equal_i64,
+        [OP_GREATER_THAN_I64] = &&op_greater_than_i64,
+        [OP_MINUS_I64] = &&op_minus_i64,
+        [OP_JUMP_NOT_EQUAL_I64] = &&op_jump_not_equal_i64,
+        [OP_JUMP_NOT_GREATER_THAN_I64] = &&op_jump_not_greater_than_i64,
+        [OP_SWITCH_TABLE] = &&op_switch_table,
+        [OP_PUSH_INT8] = &&op_push_int8,
+        [OP_PUSH_INT16] = &&op_push_int16,
+        [OP_ADD_IMM] = &&op_add_imm,
+        [OP_SUB_IMM] = &&op_sub_imm,
+        [OP_GREATER_THAN_IMM] = &&op_greater_than_imm,
+        // folded into the operands when decoding
+        [OP_WIDE] = &&op_end,
+        [CODE_END_MARKER] = &&op_end,
+    };
+
+    VmError_t err = createVmError(VM_NO_ERROR, NULL);
+    Frame_t* frame;
+    const CodeWord_t* code;
+#if VM_LABELS_THREADED
+    void** tc;
+#endif
+    int32_t ip;
+    int32_t last;
+
+#if VM_LABELS_THREADED
+#define OPERAND(n) ((CodeWord_t)(intptr_t)tc[ip + (n)])
+#define DISPATCH() goto *tc[ip]
+#define LOAD_CODE() \
+    (code = frame->cl->fn->code, tc = vmThreadCode(frame->cl->fn, labels))
+#else
+#define OPERAND(n) (code[ip + (n)])
+#define DISPATCH() goto *labels[code[ip]]
+#define LOAD_CODE() (code = frame->cl->fn->code)
+#endif
+
+#define LOAD_FRAME() do { \
+    frame = vmCurrentFrame(vm); \
+    LOAD_CODE(); \
+    ip = frame->ip + 1; \
+} while (0)
+
+// moves past an instruction with len words
+#define NEXT(len) do { \
+    if (err.code != VM_NO_ERROR) goto op_error; \
+    ip += (len); \
+    DISPATCH(); \
+} while (0)
+
+// the jump cores take the frame convention, last executed word
+#define JUMP_FROM_LAST() do { \
+    if (err.code != VM_NO_ERROR) goto op_error; \
+    ip = last + 1; \
+    DISPATCH(); \
+} while (0)
+
+    LOAD_FRAME();
+    (void)code;
+    DISPATCH();
+
+op_constant:
+    err = vmPushConstant(vm, OPERAND(1));
+    NEXT(2);
+
+op_add:
+    err = vmExecuteBinaryOperation(vm, OP_ADD);
+    NEXT(1);
+
+op_sub:
+    err = vmExecuteBinaryOperation(vm, OP_SUB);
+    NEXT(1);
+
+op_mul:
+    err = vmExecuteBinaryOperation(vm, OP_MUL);
+    NEXT(1);
+
+op_div:
+    err = vmExecuteBinaryOperation(vm, OP_DIV);
+    NEXT(1);
+
+op_true:
+    err = vmExecuteOpBoolean(vm, OP_TRUE);
+    NEXT(1);
+
+op_false:
+    err = vmExecuteOpBoolean(vm, OP_FALSE);
+    NEXT(1);
+
+op_null:
+    err = vmExecuteOpNull(vm);
+    NEXT(1);
+
+op_equal:
+    err = vmExecuteComparison(vm, OP_EQUAL);
+    NEXT(1);
+
+op_not_equal:
+    err = vmExecuteComparison(vm, OP_NOT_EQUAL);
+    NEXT(1);
+
+op_greater_than:
+    err = vmExecuteComparison(vm, OP_GREATER_THAN);
+    NEXT(1);
+
+op_minus:
+    err = vmExecuteMinusOperator(vm);
+    NEXT(1);
+
+op_bang:
+    err = vmExecuteBangOperator(vm);
+    NEXT(1);
+
+op_jump_not_truthy:
+    last = ip + 1;
+    err = vmJumpNotTruthy(vm, &last, OPERAND(1));
+    JUMP_FROM_LAST();
+
+op_jump:
+    ip = OPERAND(1);
+    DISPATCH();
+
+op_get_global:
+    err = vmGetGlobal(vm, OPERAND(1));
+    NEXT(2);
+
+op_set_global:
+    err = vmSetGlobal(vm, OPERAND(1));
+    NEXT(2);
+
+op_array:
+    err = vmPush(vm, (Object_t*)vmBuildArray(vm, OPERAND(1)));
+    NEXT(2);
+
+op_hash:
+    err = vmPushHash(vm, OPERAND(1));
+    NEXT(2);
+
+op_index:
+    err = vmExecuteOpIndex(vm);
+    NEXT(1);
+
+op_call:
+    frame->ip = ip + 1;
+    err = vmCall(vm, OPERAND(1));
+    if (err.code != VM_NO_ERROR) goto op_error;
+    LOAD_FRAME();
+    DISPATCH();
+
+op_return_value:
+    err = vmExecuteOpReturnValue(vm);
+    if (err.code != VM_NO_ERROR) goto op_error;
+    if (vm->frameIndex == vm->exitFrameIndex) return err;
+    LOAD_FRAME();
+    DISPATCH();
+
+op_return:
+    err = vmExecuteOpReturn(vm);
+    if (err.code != VM_NO_ERROR) goto op_error;
+    if (vm->frameIndex == vm->exitFrameIndex) return err;
+    LOAD_FRAME();
+    DISPATCH();
+
+op_get_local:
+    err = vmGetLocal(vm, OPERAND(1));
+    NEXT(2);
+
+op_set_local:
+    err = vmSetLocal(vm, OPERAND(1));
+    NEXT(2);
+
+op_move_local:
+    err = vmMoveLocal(vm, OPERAND(1));
+    NEXT(2);
+
+op_get_builtin:
+    err = vmGetBuiltin(vm, OPERAND(1));
+    NEXT(2);
+
+op_closure:
+    err = vmPushClosure(vm, OPERAND(1), OPERAND(2));
+    NEXT(3);
+
+op_get_free:
+    err = vmGetFree(vm, OPERAND(1));
+    NEXT(2);
+
+op_current_closure:
+    err = vmExecuteOpCurrentClosure(vm);
+    NEXT(1);
+
+op_pop:
+    err = vmExecuteOpPop(vm);
+    NEXT(1);
+
+op_add_i64:
+    err = vmExecuteIntegerOperation(vm, OP_ADD_I64);
+    NEXT(1);
+
+op_sub_i64:
+    err = vmExecuteIntegerOperation(vm, OP_SUB_I64);
+    NEXT(1);
+
+op_mul_i64:
+    err = vmExecuteIntegerOperation(vm, OP_MUL_I64);
+    NEXT(1);
+
+op_equal_i64:
+    err = vmExecuteIntegerOperation(vm, OP_EQUAL_I64);
+    NEXT(1);
+
+op_not_equal_i64:
+    err = vmExecuteIntegerOperation(vm, OP_NOT_EQUAL_I64);
+    NEXT(1);
+
+op_greater_than_i64:
+    err = vmExecuteIntegerOperation(vm, OP_GREATER_THAN_I64);
+    NEXT(1);
+
+op_minus_i64:
+    err = vmExecuteIntegerOperation(vm, OP_MINUS_I64);
+    NEXT(1);
+
+op_jump_not_equal_i64:
+    last = ip + 1;
+    err = vmJumpIntegerComparison(vm, OP_JUMP_NOT_EQUAL_I64, &last, OPERAND(1));
+    JUMP_FROM_LAST();
+
+op_jump_not_greater_than_i64:
+    last = ip + 1;
+    err = vmJumpIntegerComparison(vm, OP_JUMP_NOT_GREATER_THAN_I64, &last, OPERAND(1));
+    JUMP_FROM_LAST();
+
+op_switch_table:
+    last = ip + 1;
+    err = vmSwitchTable(vm, &last, OPERAND(1));
+    JUMP_FROM_LAST();
+
+op_push_int8:
+op_push_int16:
+    err = vmPush(vm, vmInteger(vm, OPERAND(1)));
+    NEXT(2);
+
+op_add_imm:
+    err = vmImmediateOperation(vm, OP_ADD_IMM, OPERAND(1));
+    NEXT(2);
+
+op_sub_imm:
+    err = vmImmediateOperation(vm, OP_SUB_IMM, OPERAND(1));
+    NEXT(2);
+
+op_greater_than_imm:
+    err = vmImmediateOperation(vm, OP_GREATER_THAN_IMM, OPERAND(1));
+    NEXT(2);
+
+op_end:
+    frame->ip = ip - 1;
+    return err;
+
+op_error:
+    frame->ip = ip;
+    return err;
+
+#undef OPERAND
+#undef DISPATCH
+#undef LOAD_CODE
+#undef LOAD_FRAME
+#undef NEXT
+#undef JUMP_FROM_LAST
+}
+
+#undef VM_LABELS_FN
+#undef VM_LABELS_THREADED
@@ -0,0 +1,275 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "unity.h"
+#include "utils.h"
+#include "sbuf.h"
+#include "lexer.h"
+#include "parser.h"
+#include "compiler.h"
+#include "gc.h"
+#include "aot.h"
+
+/* Every program is translated at each opt level, built with the system C
+ * compiler against the runtime objects and run. It has to print what
+ * capuchin prints for it, the value popped last or the vm error. */
+
+#define NUM_OPT_LEVELS 3
+
+typedef struct TestCase {
+    const char* input;
+    const char* output;
+} TestCase_t;
+
+// same as AOT_RUNTIME_OBJ in the Makefile
+static const char* runtimeObjects = "aot_runtime.o object.o gc.o builtin.o utils.o sbuf.o hmap.o slice.o simd.o";
+
+static char workDir[] = "/tmp/test_aot_XXXXXX";
+static char repoDir[4096];
+static bool haveRuntime = false;
+
+void setUp(void) {
+    // set stuff up here
+}
+
+void tearDown(void) {
+    // clean stuff up here
+}
+
+static bool buildRuntime(void) {
+    if (!getcwd(repoDir, sizeof(repoDir)) || !mkdtemp(workDir)) {
+        return false;
+    }
+    char* cmd = strFormat("cd %s && gcc -c -w -std=gnu99 -I%s/src %s/src/*.c 2> /dev/null", workDir, repoDir, repoDir);
+    int status = system(cmd);
+    free(cmd);
+    return status == 0;
+}
+
+static void removeWorkDir(void) {
+    char* cmd = strFormat("rm -rf %s", workDir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "failed to remove %s\n", workDir);
+    }
+    free(cmd);
+}
+
+static char* emitC(const char* input, uint8_t optLevel) {
+    Lexer_t* lexer = createLexer(input);
+    Parser_t* parser = createParser(lexer);
+    Program_t* program = parserParseProgram(parser);
+
+    Compiler_t compiler = createCompiler();
+    compilerSetOptLevel(&compiler, optLevel);
+    CompError_t compErr = compilerCompile(&compiler, program);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(COMP_NO_ERROR, compErr, input);
+
+    Bytecode_t bytecode = compilerGetBytecode(&compiler);
+    char* source = aotEmitC(&bytecode);
+    TEST_ASSERT_NOT_NULL_MESSAGE(source, input);
+
+    cleanupVectorObjects(&bytecode.constants, NULL);
+    cleanupCompiler(&compiler);
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+    gcForceRun();
+    return source;
+}
+
+// Builds and runs the translation, returns its output
+static char* runC(const char* source, const char* input, int* status) {
+    char* path = strFormat("%s/program.c", workDir);
+    FILE* f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fputs(source, f);
+    fclose(f);
+
+    char* cmd = strFormat("cd %s && gcc -O1 -w -std=c99 -I%s/src -o program %s %s", workDir, repoDir, path, runtimeObjects);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, system(cmd), input);
+    free(cmd);
+    free(path);
+
+    cmd = strFormat("%s/program", workDir);
+    FILE* out = popen(cmd, "r");
+    TEST_ASSERT_NOT_NULL(out);
+    Strbuf_t* sbuf = createStrbuf();
+    char chunk[256];
+    size_t len;
+    while ((len = fread(chunk, 1, sizeof(chunk) - 1, out)) > 0) {
+        chunk[len] = '\0';
+        strbufWrite(sbuf, chunk);
+    }
+    *status = pclose(out);
+    free(cmd);
+
+    // nothing written leaves no string
+    char* output = detachStrbuf(&sbuf);
+    return output ? output : cloneString("");
+}
+
+static void runAotTest(TestCase_t tc[], int numTestCases) {
+    if (!haveRuntime) {
+        TEST_IGNORE_MESSAGE("no C compiler to build the translations");
+    }
+
+    for (int i = 0; i < numTestCases * NUM_OPT_LEVELS; i++) {
+        TestCase_t* test = &tc[i / NUM_OPT_LEVELS];
+        char* source = emitC(test->input, i % NUM_OPT_LEVELS);
+
+        int status;
+        char* output = runC(source, test->input, &status);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(test->output, output, test->input);
+
+        // failing programs exit with an error, like capuchin running them
+        int expected = strncmp(test->output, "Woops!", 6) == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+        int exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        TEST_ASSERT_EQUAL_INT_MESSAGE(expected, exitStatus, test->input);
+
+        free(output);
+        free(source);
+    }
+}
+
+void testArithmetic(void) {
+    TestCase_t tests[] = {
+        {"1 + 2 * 3 - 4 / 2", "5\n"},
+        {"-(5 - 15) * 3", "30\n"},
+        {"let x = 9223372036854775807; x + 1", "-9223372036854775808\n"},
+        {"true == !false", "true\n"},
+        {"let a = 3; let b = 4; [a == b, a != b, a > b, b > a]", "[false, true, false, true]\n"},
+        {"", "\n"},
+    };
+    runAotTest(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+void testConditionals(void) {
+    TestCase_t tests[] = {
+        {"if (1 > 2) { 10 } else { 20 }", "20\n"},
+        {"if (false) { 10 }", "null\n"},
+        {"let g = fn(x) { if (x) { 1 } else { 2 } }; [g(true), g(false), g(0), g(g)]", "[1, 2, 1, 1]\n"},
+    };
+    runAotTest(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+void testStringsArraysHashes(void) {
+    TestCase_t tests[] = {
+        {"\"mon\" + \"key\"", "monkey\n"},
+        {"let s = \"tri??graph and \\ backslash\"; [s, len(s)]", "[tri??graph and \\ backslash, 26]\n"},
+        {"\"a\" == \"a\"", "true\n"},
+        {"[1, 2 + 3, \"x\", [true]]", "[1, 5, x, [true]]\n"},
+        {"[1, 2, 3][1] + [4, 5][9 - 8]", "7\n"},
+        {"[1, 2][5]", "null\n"},
+        {"let h = {\"one\": 1, 2: \"two\", true: [3]}; [h[\"one\"], h[2], h[true], h[\"none\"]]", "[1, two, [3], null]\n"},
+    };
+    runAotTest(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+void testFunctions(void) {
+    TestCase_t tests[] = {
+        {"let f = fn(a, b) { a * b }; f(6, 7)", "42\n"},
+        {"let f = fn() { return 5; 6 }; f() + 1", "6\n"},
+        {"let f = fn() { }; f()", "null\n"},
+        {"let c = fn(x) { fn(y) { fn(z) { x + y + z } } }; c(1)(2)(3)", "6\n"},
+        {"let counter = fn() { let c = 0; fn() { c + 1 } }; counter()()", "1\n"},
+        {"let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(20)", "6765\n"},
+    };
+    runAotTest(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+void testBuiltins(void) {
+    TestCase_t tests[] = {
+        {"len(\"four\") + len([1, 2])", "6\n"},
+        {"let a = [1]; let b = push(a, 2); [a, b, first(b), last(b), rest(b)]", "[[1], [1, 2], 1, 2, [2]]\n"},
+        {"puts(\"side\", 1); 2", "side\n1\n2\n"},
+    };
+    runAotTest(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+void testLoopsAndSwitches(void) {
+    TestCase_t tests[] = {
+        {"let i = 0; let s = 0; while (i < 10) { s = s + i; i = i + 1; } s", "45\n"},
+        {"let f = fn(n) { let i = 0; let s = 0; while (i < n) { if (i / 2 * 2 == i) { s = s + i } i = i + 1; } s }; f(100)", "2450\n"},
+        {"let f = fn() { let a = 1; let b = 2; let n = 0; while (n < 3) { let t = a; a = b; b = t; n = n + 1; } [a, b] }; f()", "[2, 1]\n"},
+        {"let i = 0; while (i < 3) { i = i + 1 }", "null\n"},
+        {"let f = fn(x) { if (x == 1) { \"a\" } else { if (x == 2) { \"b\" } else { if (x == 3) { \"c\" } else { \"?\" } } } }; "
+            "[f(1), f(2), f(3), f(4)]", "[a, b, c, ?]\n"},
+        {"let f = fn(x) { if (x == 1) { 10 } else { if (x == 500) { 20 } else { if (x == 90000) { 30 } else { 0 } } } }; "
+            "[f(1), f(500), f(90000), f(2)]", "[10, 20, 30, 0]\n"},
+    };
+    runAotTest(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+void testRuntimeErrors(void) {
+    TestCase_t tests[] = {
+        {"\"a\" - \"b\"", "Woops! Executing bytecode failed:\n unknown string operator: 2\n"},
+        {"1 + true", "Woops! Executing bytecode failed:\n unsupported types for binary operation: INTEGER BOOLEAN\n"},
+        {"-true", "Woops! Executing bytecode failed:\n unsupported type for negation: BOOLEAN\n"},
+        {"{[1]: 2}", "Woops! Executing bytecode failed:\n unusable as hash key: ARRAY\n"},
+        {"[1][true]", "Woops! Executing bytecode failed:\n index operator not supported: ARRAY\n"},
+        {"5(1)", "Woops! Executing bytecode failed:\n calling non function object: INTEGER\n"},
+        {"let f = fn(x) { x }; f(1, 2)", "Woops! Executing bytecode failed:\n wrong number of arguments: want=1, got=2\n"},
+        {"let f = fn(x) { if (x == 1) { 10 } else { if (x == 2) { 20 } else { if (x == 3) { 30 } else { 0 } } } }; f(\"a\")",
+            "Woops! Executing bytecode failed:\n unknown operator: 8 (STRING INTEGER)\n"},
+        {"let f = fn(n) { if (n == 0) { 0 } else { 1 + f(n - 1) } }; f(5000)", "Woops! Executing bytecode failed:\n stack overflow sp(2048)\n"},
+    };
+    runAotTest(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+void testDemos(void) {
+    const char* files[] = {"demos/fibonacci.mkey", "demos/loop.mkey", "demos/map.mkey", "demos/reduce.mkey"};
+    const char* outputs[] = {"832040\n", "hello\nhello\nhello\nhello\nhello\nnull\n", "[0, 4, 6, 8]\n", "15\n"};
+    char* inputs[4];
+    TestCase_t tests[4];
+    for (int i = 0; i < 4; i++) {
+        FILE* f = fopen(files[i], "rb");
+        TEST_ASSERT_NOT_NULL_MESSAGE(f, files[i]);
+        Strbuf_t* sbuf = createStrbuf();
+        char chunk[256];
+        size_t len;
+        while ((len = fread(chunk, 1, sizeof(chunk) - 1, f)) > 0) {
+            chunk[len] = '\0';
+            strbufWrite(sbuf, chunk);
+        }
+        fclose(f);
+        inputs[i] = detachStrbuf(&sbuf);
+        tests[i] = (TestCase_t){inputs[i], outputs[i]};
+    }
+    runAotTest(tests, 4);
+    for (int i = 0; i < 4; i++) {
+        free(inputs[i]);
+    }
+}
+
+void testUnboxedLocals(void) {
+    // the counter and the sum only ever hold integers
+    char* source = emitC("let f = fn(n) { let i = 0; let s = 0; while (i < n) { s = s + i; i = i + 1; } s }; f(10)", 2);
+    TEST_ASSERT_NOT_NULL(strstr(source, "int64_t l1 = 0;"));
+    TEST_ASSERT_NOT_NULL(strstr(source, "int64_t l2 = 0;"));
+    free(source);
+
+    // one holding integers and booleans stays an object
+    source = emitC("let f = fn(n) { let x = 0; let i = 0; while (i < n) { x = i > 2; i = i + 1; } x }; f(5)", 2);
+    TEST_ASSERT_NOT_NULL(strstr(source, "Object_t* l1 = NULL;"));
+    TEST_ASSERT_NOT_NULL(strstr(source, "int64_t l2 = 0;"));
+    free(source);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    haveRuntime = buildRuntime();
+    RUN_TEST(testArithmetic);
+    RUN_TEST(testConditionals);
+    RUN_TEST(testStringsArraysHashes);
+    RUN_TEST(testFunctions);
+    RUN_TEST(testBuiltins);
+    RUN_TEST(testLoopsAndSwitches);
+    RUN_TEST(testRuntimeErrors);
+    RUN_TEST(testDemos);
+    RUN_TEST(testUnboxedLocals);
+    removeWorkDir();
+    return UNITY_END();
+}
@@ -25,7 +25,16 @@ void testCodeMake() {
         {.op = OP_CONSTANT, .operands={65534}, .expLen=3, .expBytes={(uint8_t)OP_CONSTANT, 255, 254}},
         {.op = OP_ADD, .operands={}, .expLen=1, .expBytes={(uint8_t)OP_ADD}},
         {.op = OP_GET_LOCAL, .operands={255}, .expLen=2, .expBytes={(uint8_t)OP_GET_LOCAL, 255}},
-        {.op = OP_CLOSURE, .operands={65534, 255l}, .expLen=4, .expBytes={(uint8_t)OP_CLOSURE, 255, 254, 255}}
+        {.op = OP_CLOSURE, .operands={65534, 255l}, .expLen=4, .expBytes={(uint8_t)OP_CLOSURE, 255, 254, 255}},
+        {.op = OP_PUSH_INT8, .operands={-1}, .expLen=2, .expBytes={(uint8_t)OP_PUSH_INT8, 255}},
+        {.op = OP_ADD_IMM, .operands={-2}, .expLen=3, .expBytes={(uint8_t)OP_ADD_IMM, 255, 254}},
+        {.op = OP_JUMP, .operands={-3}, .expLen=3, .expBytes={(uint8_t)OP_JUMP, 255, 253}},
+        // operands past the narrow range switch to the prefixed encoding
+        {.op = OP_CONSTANT, .operands={65536}, .expLen=6, .expBytes={(uint8_t)OP_WIDE, (uint8_t)OP_CONSTANT, 0, 1, 0, 0}},
+        {.op = OP_GET_LOCAL, .operands={256}, .expLen=4, .expBytes={(uint8_t)OP_WIDE, (uint8_t)OP_GET_LOCAL, 1, 0}},
+        {.op = OP_CLOSURE, .operands={1, 256}, .expLen=8, .expBytes={(uint8_t)OP_WIDE, (uint8_t)OP_CLOSURE, 0, 0, 0, 1, 1, 0}},
+        {.op = OP_PUSH_INT8, .operands={128}, .expLen=4, .expBytes={(uint8_t)OP_WIDE, (uint8_t)OP_PUSH_INT8, 0, 128}},
+        {.op = OP_JUMP, .operands={-32769}, .expLen=6, .expBytes={(uint8_t)OP_WIDE, (uint8_t)OP_JUMP, 255, 255, 127, 255}},
     };
 
     int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
@@ -53,6 +62,9 @@ void testCodeReadOperands() {
         {.op = OP_CONSTANT, .numOperands=1, .operands={65535}, .bytesRead=2},
         {.op = OP_GET_LOCAL, .numOperands=1, .operands={255}, .bytesRead=1},
         {.op = OP_CLOSURE, .numOperands=2, .operands={65534, 255}, .bytesRead=3},
+        {.op = OP_PUSH_INT8, .numOperands=1, .operands={-128}, .bytesRead=1},
+        {.op = OP_PUSH_INT16, .numOperands=1, .operands={32767}, .bytesRead=2},
+        {.op = OP_SUB_IMM, .numOperands=1, .operands={-32768}, .bytesRead=2},
     };
     int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
 
@@ -75,6 +87,187 @@ void testCodeReadOperands() {
     }
 }
 
+void testCodeReadInstruction() {
+    typedef struct TestCase {
+        OpCode_t op;
+        int numOperands; 
+        int operands[OP_MAX_ARGS];
+        uint32_t len;
+    } TestCase_t;
+
+    TestCase_t testCases[] = {
+        {.op = OP_GET_LOCAL, .numOperands=1, .operands={3}, .len=2},
+        {.op = OP_GET_LOCAL, .numOperands=1, .operands={65535}, .len=4},
+        {.op = OP_CONSTANT, .numOperands=1, .operands={1 << 20}, .len=6},
+        {.op = OP_CLOSURE, .numOperands=2, .operands={70000, 300}, .len=8},
+        {.op = OP_ADD_IMM, .numOperands=1, .operands={-40000}, .len=6},
+        {.op = OP_JUMP_NOT_TRUTHY, .numOperands=1, .operands={-100000}, .len=6},
+    };
+    int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+
+    for (int i = 0; i < numTestCases; i++) {
+        SliceByte_t instruction = codeMake(testCases[i].op, testCases[i].operands);
+
+        OpCode_t op;
+        uint32_t len = 0;
+        SliceInt_t operandsRead = codeReadInstruction(instruction, 0, &op, &len);
+        TEST_INT(testCases[i].op, op, "wrong opcode");
+        TEST_INT(testCases[i].len, len, "wrong instruction length");
+        TEST_INT(testCases[i].len, sliceByteGetLen(instruction), "wrong encoded length");
+
+        for (int j = 0; j < testCases[i].numOperands; j++) {
+            TEST_INT(testCases[i].operands[j], operandsRead[j], "Operand wrong");
+        }
+
+        cleanupSliceByte(instruction);
+        cleanupSliceInt(operandsRead);
+    }
+}
+
+static Instructions_t concatInstructions(SliceByte_t* instructions, int count) {
+    Instructions_t concatted = createSliceByte(0);
+    for (int i = 0; i < count; i++) {
+        sliceByteAppend(&concatted, instructions[i], sliceByteGetLen(instructions[i]));
+        cleanupSliceByte(instructions[i]);
+    }
+    return concatted;
+}
+
+void testCodePatchOperand() {
+    SliceByte_t parts[] = {
+        codeMakeV(OP_JUMP_NOT_TRUTHY, 9999),
+        codeMakeV(OP_CONSTANT, 9999),
+        codeMakeV(OP_JUMP, 9999),
+    };
+    Instructions_t ins = concatInstructions(parts, 3);
+
+    TEST_INT(true, codePatchOperand(ins, 0, 9), "forward jump");
+    TEST_INT(true, codePatchOperand(ins, 3, 65535), "constant");
+    TEST_INT(true, codePatchOperand(ins, 6, 0), "backward jump");
+    TEST_INT(false, codePatchOperand(ins, 3, 65536), "constant too large");
+    TEST_INT(false, codePatchOperand(ins, 6, 40000), "jump too far");
+
+    char* res = instructionsToString(ins);
+    TEST_STRING("0000 OpJumpNotTruthy 9\n0003 OpConstant 65535\n0006 OpJump -6\n", res, "patched instructions");
+    free(res);
+    cleanupSliceByte(ins);
+}
+
+void testCodeRewriteOperands() {
+    // the skipped constant becomes wide, the jumps over it move along
+    SliceByte_t parts[] = {
+        codeMakeV(OP_JUMP_NOT_TRUTHY, 9),
+        codeMakeV(OP_CONSTANT, 0),
+        codeMakeV(OP_JUMP, -6),
+        codeMakeV(OP_NULL),
+    };
+    Instructions_t ins = concatInstructions(parts, 4);
+
+    uint32_t* map = NULL;
+    const uint32_t far[] = {3, 70000};
+    Instructions_t widened = codeRewriteOperands(ins, far, 1, &map);
+
+    char* res = instructionsToString(widened);
+    TEST_STRING("0000 OpJumpNotTruthy 12\n"
+                "0003 OpWide OpConstant 70000\n"
+                "0009 OpJump -9\n"
+                "0012 OpNull\n", res, "widened instructions");
+    TEST_INT(0, map[0], "position map");
+    TEST_INT(3, map[3], "position map");
+    TEST_INT(9, map[6], "position map");
+    TEST_INT(12, map[9], "position map");
+    TEST_INT(13, map[10], "position map");
+    free(res);
+    free(map);
+    cleanupSliceByte(widened);
+
+    cleanupSliceByte(ins);
+
+    // widening the constant pushes the end out of reach of the narrow jump
+    SliceByte_t farParts[] = {
+        codeMakeV(OP_JUMP, INT16_MAX),
+        codeMakeV(OP_CONSTANT, 0),
+    };
+    Instructions_t jumpOver = concatInstructions(farParts, 2);
+    while (sliceByteGetLen(jumpOver) < INT16_MAX) {
+        uint8_t null = OP_NULL;
+        sliceByteAppend(&jumpOver, &null, 1);
+    }
+
+    const uint32_t farConstant[] = {3, 65536};
+    widened = codeRewriteOperands(jumpOver, farConstant, 1, &map);
+    OpCode_t op;
+    uint32_t len = 0;
+    SliceInt_t operands = codeReadInstruction(widened, 0, &op, &len);
+    TEST_INT(OP_JUMP, op, "jump opcode");
+    TEST_INT(6, len, "jump became wide");
+    TEST_INT(INT16_MAX + 6, operands[0], "jump offset");
+    TEST_INT(INT16_MAX + 6, map[INT16_MAX], "end of code");
+
+    cleanupSliceInt(operands);
+    free(map);
+    cleanupSliceByte(widened);
+    cleanupSliceByte(jumpOver);
+
+    // a wide constant given a small index shrinks, jumps over it move back
+    SliceByte_t wideParts[] = {
+        codeMakeV(OP_JUMP_NOT_TRUTHY, 12),
+        codeMakeV(OP_CONSTANT, 70000),
+        codeMakeV(OP_JUMP, -9),
+        codeMakeV(OP_NULL),
+    };
+    ins = concatInstructions(wideParts, 4);
+
+    const uint32_t narrowConstant[] = {3, 1};
+    Instructions_t narrowed = codeRewriteOperands(ins, narrowConstant, 1, &map);
+    res = instructionsToString(narrowed);
+    TEST_STRING("0000 OpJumpNotTruthy 9\n"
+                "0003 OpConstant 1\n"
+                "0006 OpJump -6\n"
+                "0009 OpNull\n", res, "narrowed instructions");
+    TEST_INT(6, map[9], "position map");
+    TEST_INT(9, map[12], "position map");
+    free(res);
+    free(map);
+    cleanupSliceByte(narrowed);
+    cleanupSliceByte(ins);
+}
+
+void testCodeDecodeInstructions() {
+    // wide operands fold into their word, jumps hold the word index of their target
+    SliceByte_t parts[] = {
+        codeMakeV(OP_JUMP_NOT_TRUTHY, 12),
+        codeMakeV(OP_CONSTANT, 70000),
+        codeMakeV(OP_JUMP, -9),
+        codeMakeV(OP_CLOSURE, 1, 2),
+        codeMakeV(OP_PUSH_INT8, -1),
+    };
+    Instructions_t ins = concatInstructions(parts, 5);
+
+    const CodeWord_t expected[] = {
+        OP_JUMP_NOT_TRUTHY, 6,
+        OP_CONSTANT, 70000,
+        OP_JUMP, 0,
+        OP_CLOSURE, 1, 2,
+        OP_PUSH_INT8, -1,
+    };
+    uint32_t numWords = sizeof(expected) / sizeof(expected[0]);
+    TEST_INT(numWords, codeDecodedLength(ins), "decoded length");
+
+    CodeWord_t words[sizeof(expected) / sizeof(expected[0])];
+    uint32_t* map = malloc((sliceByteGetLen(ins) + 1) * sizeof(uint32_t));
+    codeDecodeInstructions(ins, words, map);
+    for (uint32_t i = 0; i < numWords; i++) {
+        TEST_INT(expected[i], words[i], "decoded word");
+    }
+    TEST_INT(2, map[3], "position map");
+    TEST_INT(6, map[12], "position map");
+    TEST_INT(numWords, map[sliceByteGetLen(ins)], "end of code");
+
+    free(map);
+    cleanupSliceByte(ins);
+}
+
 void testInstructionsString() {
     SliceByte_t instructions[] = {
         codeMakeV(OP_ADD), 
@@ -82,6 +275,12 @@ void testInstructionsString() {
         codeMakeV(OP_CONSTANT, 2),
         codeMakeV(OP_CONSTANT, 65535),
         codeMakeV(OP_CLOSURE, 65535, 255),
+        codeMakeV(OP_PUSH_INT8, -1),
+        codeMakeV(OP_PUSH_INT16, 1000),
+        codeMakeV(OP_GREATER_THAN_IMM, -300),
+        codeMakeV(OP_JUMP, -21),
+        codeMakeV(OP_CONSTANT, 65536),
+        codeMakeV(OP_CLOSURE, 1, 256),
     };
     int numInstructions = sizeof(instructions) / sizeof(instructions[0]);
 
@@ -89,7 +288,13 @@ void testInstructionsString() {
                         "0001 OpGetLocal 1\n"
                         "0003 OpConstant 2\n"
                         "0006 OpConstant 65535\n"
-                        "0009 OpClosure 65535 255\n";
+                        "0009 OpClosure 65535 255\n"
+                        "0013 OpPushInt8 -1\n"
+                        "0015 OpPushInt16 1000\n"
+                        "0018 OpGreaterThanImm -300\n"
+                        "0021 OpJump -21\n"
+                        "0024 OpWide OpConstant 65536\n"
+                        "0030 OpWide OpClosure 1 256\n";
 
     SliceByte_t concatted = createSliceByte(0);
     for (int i = 0; i < numInstructions; i++) {
@@ -112,5 +317,9 @@ int main(void) {
     RUN_TEST(testCodeMake);
     RUN_TEST(testInstructionsString);
     RUN_TEST(testCodeReadOperands);
+    RUN_TEST(testCodeReadInstruction);
+    RUN_TEST(testCodePatchOperand);
+    RUN_TEST(testCodeRewriteOperands);
+    RUN_TEST(testCodeDecodeInstructions);
     return UNITY_END();
 }
\ No newline at end of file
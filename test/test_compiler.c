@@ -34,6 +34,7 @@ void testConstants(GenericExpect_t expected[], VectorObjects_t *actual);
 void testIntegerObject(int64_t expected, Object_t *obj);
 void testStringObject(const char* str, Object_t *obj); 
 void testCompiledFunction(SliceByte_t intr[], Object_t*obj);
+void testIntegerArrayObject(GenericExpect_t expected[], Object_t* obj);
 void cleanupInstructions(Instructions_t instr[]);
 
 
@@ -42,28 +43,28 @@ void testCompilerBasic() {
     TestCase_t testCases[] = {
         {
             .input = "1 + 2",
-            .expConstants = {_INT(1), _INT(2), _END},
-            .expInstructions = { codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_ADD), codeMakeV(OP_POP), NULL }
+            .expConstants = {_END},
+            .expInstructions = { codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_ADD_IMM, 2), codeMakeV(OP_POP), NULL }
         },
         {
             .input = "1; 2",
-            .expConstants = {_INT(1), _INT(2), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_POP), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_POP), codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "1 - 2",
-            .expConstants = {_INT(1), _INT(2), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_SUB), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_SUB_IMM, 2), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "1 * 2",
-            .expConstants = {_INT(1), _INT(2), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_MUL), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_MUL), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "2 / 1",
-            .expConstants = {_INT(2), _INT(1), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_DIV), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_DIV), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "true",
@@ -77,23 +78,23 @@ void testCompilerBasic() {
         },
         {
             .input = "1 > 2",
-            .expConstants = {_INT(1), _INT(2), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_GREATER_THAN), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_GREATER_THAN_IMM, 2), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "1 < 2",
-            .expConstants = {_INT(2), _INT(1), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_GREATER_THAN), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_GREATER_THAN_IMM, 1), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "1 == 2",
-            .expConstants = {_INT(1), _INT(2), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_EQUAL), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_EQUAL), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "1 != 2",
-            .expConstants = {_INT(1), _INT(2), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_CONSTANT, 1), codeMakeV(OP_NOT_EQUAL), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_NOT_EQUAL), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "true == false",
@@ -107,8 +108,8 @@ void testCompilerBasic() {
         },
         {
             .input = "-1",
-            .expConstants = {_INT(1), _END},
-            .expInstructions = {codeMakeV(OP_CONSTANT, 0), codeMakeV(OP_MINUS), codeMakeV(OP_POP), NULL}
+            .expConstants = {_END},
+            .expInstructions = {codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_MINUS), codeMakeV(OP_POP), NULL}
         },
         {
             .input = "!true",
@@ -126,30 +127,30 @@ void testConditionals() {
     TestCase_t testCases[] = {
         {
             .input = "if (true) {10}; 3333;",
-            .expConstants = {_INT(10), _INT(3333), _END},
+            .expConstants = {_END},
             .expInstructions = {
                 codeMakeV(OP_TRUE),
-                codeMakeV(OP_JUMP_NOT_TRUTHY, 10),
-                codeMakeV(OP_CONSTANT, 0),
-                codeMakeV(OP_JUMP, 11),
+                codeMakeV(OP_JUMP_NOT_TRUTHY, 8),
+                codeMakeV(OP_PUSH_INT8, 10),
+                codeMakeV(OP_JUMP, 4),
                 codeMakeV(OP_NULL),
                 codeMakeV(OP_POP),
-                codeMakeV(OP_CONSTANT, 1),
+                codeMakeV(OP_PUSH_INT16, 3333),
                 codeMakeV(OP_POP),
                 NULL,
             }
         },
         {
             .input = "if (true) {10} else {20}; 3333;", 
-            .expConstants = {_INT(10), _INT(20), _INT(3333), _END}, 
+            .expConstants = {_END}, 
             .expInstructions = {
                 codeMakeV(OP_TRUE),
-                codeMakeV(OP_JUMP_NOT_TRUTHY, 10),
-                codeMakeV(OP_CONSTANT, 0),
-                codeMakeV(OP_JUMP, 13),
-                codeMakeV(OP_CONSTANT, 1),
+                codeMakeV(OP_JUMP_NOT_TRUTHY, 8),
+                codeMakeV(OP_PUSH_INT8, 10),
+                codeMakeV(OP_JUMP, 5),
+                codeMakeV(OP_PUSH_INT8, 20),
                 codeMakeV(OP_POP),
-                codeMakeV(OP_CONSTANT, 2),
+                codeMakeV(OP_PUSH_INT16, 3333),
                 codeMakeV(OP_POP),
                 NULL,
             }},
@@ -166,9 +167,9 @@ void testGlobalLetStatements() {
                   "let two = 2;",
          .expConstants = {_INT(1), _INT(2), _END},
          .expInstructions = {
-             codeMakeV(OP_CONSTANT, 0),
+             codeMakeV(OP_PUSH_INT8, 1),
              codeMakeV(OP_SET_GLOBAL, 0),
-             codeMakeV(OP_CONSTANT, 1),
+             codeMakeV(OP_PUSH_INT8, 2),
              codeMakeV(OP_SET_GLOBAL, 1),
              NULL,
          }},
@@ -176,9 +177,9 @@ void testGlobalLetStatements() {
                   "one;",
          .expConstants = {_INT(1), _END},
          .expInstructions = {
-             codeMakeV(OP_CONSTANT, 0),
+             codeMakeV(OP_PUSH_INT8, 1),
              codeMakeV(OP_SET_GLOBAL, 0),
-             codeMakeV(OP_GET_GLOBAL, 0),
+             codeMakeV(OP_PUSH_INT8, 1),
              codeMakeV(OP_POP),
              NULL,
          }},
@@ -187,11 +188,37 @@ void testGlobalLetStatements() {
                   "two;",
          .expConstants = {_INT(1), _END},
          .expInstructions = {
-             codeMakeV(OP_CONSTANT, 0),
+             codeMakeV(OP_PUSH_INT8, 1),
              codeMakeV(OP_SET_GLOBAL, 0),
-             codeMakeV(OP_GET_GLOBAL, 0),
+             codeMakeV(OP_PUSH_INT8, 1),
+             codeMakeV(OP_SET_GLOBAL, 1),
+             codeMakeV(OP_PUSH_INT8, 1),
+             codeMakeV(OP_POP),
+             NULL,
+         }},
+        {
+         // assigned globals and lets nested in blocks are always read
+         .input = "let one = 1;"
+                  "one = 2;"
+                  "if (true) { let two = 2; };"
+                  "one + two;",
+         .expConstants = {_END},
+         .expInstructions = {
+             codeMakeV(OP_PUSH_INT8, 1),
+             codeMakeV(OP_SET_GLOBAL, 0),
+             codeMakeV(OP_PUSH_INT8, 2),
+             codeMakeV(OP_SET_GLOBAL, 0),
+             codeMakeV(OP_TRUE),
+             codeMakeV(OP_JUMP_NOT_TRUTHY, 12),
+             codeMakeV(OP_PUSH_INT8, 2),
              codeMakeV(OP_SET_GLOBAL, 1),
+             codeMakeV(OP_NULL),
+             codeMakeV(OP_JUMP, 4),
+             codeMakeV(OP_NULL),
+             codeMakeV(OP_POP),
+             codeMakeV(OP_GET_GLOBAL, 0),
              codeMakeV(OP_GET_GLOBAL, 1),
+             codeMakeV(OP_ADD),
              codeMakeV(OP_POP),
              NULL,
          }}};
@@ -246,11 +273,11 @@ void testArrayLiterals() {
         },
         {
             .input = "[1, 2, 3]",
-            .expConstants = {_INT(1), _INT(2),_INT(3),_END},
+            .expConstants = {_END},
             .expInstructions = {
-                codeMakeV(OP_CONSTANT, 0),
-                codeMakeV(OP_CONSTANT, 1),
-                codeMakeV(OP_CONSTANT, 2),
+                codeMakeV(OP_PUSH_INT8, 1),
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_PUSH_INT8, 3),
                 codeMakeV(OP_ARRAY, 3),
                 codeMakeV(OP_POP),
                 NULL
@@ -258,20 +285,15 @@ void testArrayLiterals() {
         },
         {
             .input = "[1 + 2, 3 - 4, 5 * 6]",
-            .expConstants = {_INT(1), _INT(2),_INT(3), _INT(4), _INT(5), _INT(6), _END},
+            .expConstants = {_END},
             .expInstructions = {
-                codeMakeV(OP_CONSTANT, 0),
-                codeMakeV(OP_CONSTANT, 1),
-                codeMakeV(OP_ADD),
-
-                codeMakeV(OP_CONSTANT, 2),
-                codeMakeV(OP_CONSTANT, 3),
-                codeMakeV(OP_SUB),
-
-                codeMakeV(OP_CONSTANT, 4),
-                codeMakeV(OP_CONSTANT, 5),
+                codeMakeV(OP_PUSH_INT8, 1),
+                codeMakeV(OP_ADD_IMM, 2),
+                codeMakeV(OP_PUSH_INT8, 3),
+                codeMakeV(OP_SUB_IMM, 4),
+                codeMakeV(OP_PUSH_INT8, 5),
+                codeMakeV(OP_PUSH_INT8, 6),
                 codeMakeV(OP_MUL),
-
                 codeMakeV(OP_ARRAY, 3),
                 codeMakeV(OP_POP),
                 NULL
@@ -297,14 +319,14 @@ void testHashLiterals() {
         },
         {
             .input = "{1: 2, 3: 4, 5: 6}",
-            .expConstants = {_INT(1), _INT(2),_INT(3), _INT(4), _INT(5), _INT(6), _END},
+            .expConstants = {_END},
             .expInstructions = {
-                codeMakeV(OP_CONSTANT, 0),
-                codeMakeV(OP_CONSTANT, 1),
-                codeMakeV(OP_CONSTANT, 2),
-                codeMakeV(OP_CONSTANT, 3),
-                codeMakeV(OP_CONSTANT, 4),
-                codeMakeV(OP_CONSTANT, 5),
+                codeMakeV(OP_PUSH_INT8, 1),
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_PUSH_INT8, 3),
+                codeMakeV(OP_PUSH_INT8, 4),
+                codeMakeV(OP_PUSH_INT8, 5),
+                codeMakeV(OP_PUSH_INT8, 6),
                 codeMakeV(OP_HASH, 6),
                 codeMakeV(OP_POP),
                 NULL
@@ -312,19 +334,16 @@ void testHashLiterals() {
         },
         {
             .input = "{1: 2 + 3, 4: 5 * 6}",
-            .expConstants = {_INT(1), _INT(2),_INT(3), _INT(4), _INT(5), _INT(6), _END},
+            .expConstants = {_END},
             .expInstructions = {
-                codeMakeV(OP_CONSTANT, 0),
-                codeMakeV(OP_CONSTANT, 1),
-                codeMakeV(OP_CONSTANT, 2),
-                codeMakeV(OP_ADD),
-
-                codeMakeV(OP_CONSTANT, 3),
-                codeMakeV(OP_CONSTANT, 4),
-                codeMakeV(OP_CONSTANT, 5),
+                codeMakeV(OP_PUSH_INT8, 1),
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_ADD_IMM, 3),
+                codeMakeV(OP_PUSH_INT8, 4),
+                codeMakeV(OP_PUSH_INT8, 5),
+                codeMakeV(OP_PUSH_INT8, 6),
                 codeMakeV(OP_MUL),
-
-                codeMakeV(OP_HASH,  4),  
+                codeMakeV(OP_HASH, 4),
                 codeMakeV(OP_POP),
                 NULL
             }
@@ -336,20 +355,55 @@ void testHashLiterals() {
 }
 
 
+void testConstantDeduplication() {
+    TestCase_t testCases[] = {
+        {
+            .input = "100000 + 100000; 200000 * 100000",
+            .expConstants = {_INT(100000), _INT(200000), _END},
+            .expInstructions = {
+                codeMakeV(OP_CONSTANT, 0),
+                codeMakeV(OP_CONSTANT, 0),
+                codeMakeV(OP_ADD),
+                codeMakeV(OP_POP),
+                codeMakeV(OP_CONSTANT, 1),
+                codeMakeV(OP_CONSTANT, 0),
+                codeMakeV(OP_MUL),
+                codeMakeV(OP_POP),
+                NULL
+            }
+        },
+        {
+            .input = "\"100000\"; 100000; \"100000\"",
+            .expConstants = {_STRING("100000"), _INT(100000), _END},
+            .expInstructions = {
+                codeMakeV(OP_CONSTANT, 0),
+                codeMakeV(OP_POP),
+                codeMakeV(OP_CONSTANT, 1),
+                codeMakeV(OP_POP),
+                codeMakeV(OP_CONSTANT, 0),
+                codeMakeV(OP_POP),
+                NULL
+            }
+        },
+    };
+
+    int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    runCompilerTests(testCases, numTestCases);
+}
+
 void testIndexExpressions() {
 
     TestCase_t testCases[] = {
         {
             .input = "[1, 2, 3][1 + 1]",
-            .expConstants = {_INT(1), _INT(2),_INT(3),_INT(1),_INT(1), _END},
+            .expConstants = {_END},
             .expInstructions = {
-                codeMakeV(OP_CONSTANT, 0), 
-                codeMakeV(OP_CONSTANT, 1), 
-                codeMakeV(OP_CONSTANT, 2), 
-                codeMakeV(OP_ARRAY, 3), 
-                codeMakeV(OP_CONSTANT, 3), 
-                codeMakeV(OP_CONSTANT, 4), 
-                codeMakeV(OP_ADD, 0),
+                codeMakeV(OP_PUSH_INT8, 1),
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_PUSH_INT8, 3),
+                codeMakeV(OP_ARRAY, 3),
+                codeMakeV(OP_PUSH_INT8, 1),
+                codeMakeV(OP_ADD_IMM, 1),
                 codeMakeV(OP_INDEX),
                 codeMakeV(OP_POP),
                 NULL
@@ -357,14 +411,13 @@ void testIndexExpressions() {
         },
         {
             .input = "{1: 2}[2 - 1]",
-            .expConstants = {_INT(1), _INT(2), _INT(2), _INT(1), _END},
+            .expConstants = {_END},
             .expInstructions = {
-                codeMakeV(OP_CONSTANT, 0),
-                codeMakeV(OP_CONSTANT, 1),
+                codeMakeV(OP_PUSH_INT8, 1),
+                codeMakeV(OP_PUSH_INT8, 2),
                 codeMakeV(OP_HASH, 2),
-                codeMakeV(OP_CONSTANT, 2),
-                codeMakeV(OP_CONSTANT, 3),
-                codeMakeV(OP_SUB),
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_SUB_IMM, 1),
                 codeMakeV(OP_INDEX),
                 codeMakeV(OP_POP),
                 NULL
@@ -384,19 +437,16 @@ void testFunctions() {
         {
             .input = "fn() {return 5 + 10}",
             .expConstants = {
-                _INT(5), 
-                _INT(10),
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 0),
-                    codeMakeV(OP_CONSTANT, 1),
-                    codeMakeV(OP_ADD),
+                    codeMakeV(OP_PUSH_INT8, 5),
+                    codeMakeV(OP_ADD_IMM, 10),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 2, 0),
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_POP),
                 NULL
             }
@@ -404,19 +454,16 @@ void testFunctions() {
         {
             .input = "fn() {5 + 10}",
             .expConstants = {
-                _INT(5), 
-                _INT(10),
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 0),
-                    codeMakeV(OP_CONSTANT, 1),
-                    codeMakeV(OP_ADD),
+                    codeMakeV(OP_PUSH_INT8, 5),
+                    codeMakeV(OP_ADD_IMM, 10),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 2, 0),
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_POP),
                 NULL
             }
@@ -424,19 +471,17 @@ void testFunctions() {
         {
             .input = "fn() {1; 2}",
             .expConstants = {
-                _INT(1), 
-                _INT(2),
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 0),
+                    codeMakeV(OP_PUSH_INT8, 1),
                     codeMakeV(OP_POP),
-                    codeMakeV(OP_CONSTANT, 1),
+                    codeMakeV(OP_PUSH_INT8, 2),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 2, 0),
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_POP),
                 NULL
             }
@@ -506,16 +551,15 @@ void testFunctionCalls() {
         {
             .input = "fn() {24}();",
             .expConstants = {
-                _INT(24), 
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 0),
+                    codeMakeV(OP_PUSH_INT8, 24),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 1, 0),
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_CALL, 0),
                 codeMakeV(OP_POP),
                 NULL
@@ -524,18 +568,17 @@ void testFunctionCalls() {
         {
             .input = "let noArg = fn(){ 24 }; noArg();",
             .expConstants = {
-                _INT(24), 
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 0),
+                    codeMakeV(OP_PUSH_INT8, 24),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 1, 0),
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_SET_GLOBAL, 0),
-                codeMakeV(OP_GET_GLOBAL, 0), 
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_CALL, 0),
                 codeMakeV(OP_POP),
                 NULL
@@ -546,18 +589,17 @@ void testFunctionCalls() {
                      "oneArg(24);" ,
             .expConstants = {
                 _FUNC(
-                    codeMakeV(OP_GET_LOCAL, 0), 
+                    codeMakeV(OP_GET_LOCAL, 0),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
-                _INT(24),
                 _END
             },
             .expInstructions = {
                 codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_SET_GLOBAL, 0),
-                codeMakeV(OP_GET_GLOBAL, 0), 
-                codeMakeV(OP_CONSTANT, 1), 
+                codeMakeV(OP_CLOSURE, 0, 0),
+                codeMakeV(OP_PUSH_INT8, 24),
                 codeMakeV(OP_CALL, 1),
                 codeMakeV(OP_POP),
                 NULL
@@ -576,18 +618,15 @@ void testFunctionCalls() {
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
-                _INT(24),
-                _INT(25),
-                _INT(26),
                 _END
             },
             .expInstructions = {
                 codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_SET_GLOBAL, 0),
-                codeMakeV(OP_GET_GLOBAL, 0), 
-                codeMakeV(OP_CONSTANT, 1), 
-                codeMakeV(OP_CONSTANT, 2), 
-                codeMakeV(OP_CONSTANT, 3), 
+                codeMakeV(OP_CLOSURE, 0, 0),
+                codeMakeV(OP_PUSH_INT8, 24),
+                codeMakeV(OP_PUSH_INT8, 25),
+                codeMakeV(OP_PUSH_INT8, 26),
                 codeMakeV(OP_CALL, 3),
                 codeMakeV(OP_POP),
                 NULL
@@ -615,7 +654,7 @@ void testLetStatementScopes() {
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CONSTANT, 0),
+                codeMakeV(OP_PUSH_INT8, 55),
                 codeMakeV(OP_SET_GLOBAL, 0),
                 codeMakeV(OP_CLOSURE, 1, 0),
                 codeMakeV(OP_POP),
@@ -628,9 +667,8 @@ void testLetStatementScopes() {
                     "   num\n"
                     "}",
             .expConstants = {
-                _INT(55), 
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 0),
+                    codeMakeV(OP_PUSH_INT8, 55),
                     codeMakeV(OP_SET_LOCAL, 0),
                     codeMakeV(OP_GET_LOCAL, 0),
                     codeMakeV(OP_RETURN_VALUE),
@@ -639,7 +677,7 @@ void testLetStatementScopes() {
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 1, 0),
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_POP),
                 NULL
             }
@@ -651,12 +689,10 @@ void testLetStatementScopes() {
                     "   a + b\n"
                     "}",
             .expConstants = {
-                _INT(55), 
-                _INT(77), 
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 0),
+                    codeMakeV(OP_PUSH_INT8, 55),
                     codeMakeV(OP_SET_LOCAL, 0),
-                    codeMakeV(OP_CONSTANT, 1),
+                    codeMakeV(OP_PUSH_INT8, 77),
                     codeMakeV(OP_SET_LOCAL, 1),
                     codeMakeV(OP_GET_LOCAL, 0),
                     codeMakeV(OP_GET_LOCAL, 1),
@@ -667,7 +703,7 @@ void testLetStatementScopes() {
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 2, 0),
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_POP),
                 NULL
             }
@@ -684,7 +720,7 @@ void testBuiltins() {
         {
             .input = "len([]);"
                      "push([], 1);",
-            .expConstants = { _INT(1), _END },
+            .expConstants = { _END },
             .expInstructions = {
                 codeMakeV(OP_GET_BUILTIN, 0),
                 codeMakeV(OP_ARRAY, 0),
@@ -692,9 +728,9 @@ void testBuiltins() {
                 codeMakeV(OP_POP),
                 codeMakeV(OP_GET_BUILTIN, 5),
                 codeMakeV(OP_ARRAY, 0),
-                codeMakeV(OP_CONSTANT, 0),
+                codeMakeV(OP_PUSH_INT8, 1),
                 codeMakeV(OP_CALL, 2),
-                codeMakeV(OP_POP), 
+                codeMakeV(OP_POP),
                 NULL
             }
         },
@@ -724,6 +760,110 @@ void testBuiltins() {
 
 }
 
+void testLocalMoves() {
+    TestCase_t testCases[] = {
+        {
+            .input = "fn(a) { push(a, 1) }",
+            .expConstants = {
+                _FUNC(
+                    codeMakeV(OP_GET_BUILTIN, 5),
+                    codeMakeV(OP_MOVE_LOCAL, 0),
+                    codeMakeV(OP_PUSH_INT8, 1),
+                    codeMakeV(OP_CALL, 2),
+                    codeMakeV(OP_RETURN_VALUE),
+                    NULL
+                ),
+                _END
+            },
+            .expInstructions = {
+                codeMakeV(OP_CLOSURE, 0, 0),
+                codeMakeV(OP_POP),
+                NULL
+            }
+        },
+        {
+            .input = "fn(a) { push(a, 1); a }",
+            .expConstants = {
+                _FUNC(
+                    codeMakeV(OP_GET_BUILTIN, 5),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_PUSH_INT8, 1),
+                    codeMakeV(OP_CALL, 2),
+                    codeMakeV(OP_POP),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_RETURN_VALUE),
+                    NULL
+                ),
+                _END
+            },
+            .expInstructions = {
+                codeMakeV(OP_CLOSURE, 0, 0),
+                codeMakeV(OP_POP),
+                NULL
+            }
+        },
+        {
+            .input = "fn(a) { fn() { a }; push(a, 1) }",
+            .expConstants = {
+                _FUNC(
+                    codeMakeV(OP_GET_FREE, 0),
+                    codeMakeV(OP_RETURN_VALUE),
+                    NULL
+                ),
+                _FUNC(
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_CLOSURE, 0, 1),
+                    codeMakeV(OP_POP),
+                    codeMakeV(OP_GET_BUILTIN, 5),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_PUSH_INT8, 1),
+                    codeMakeV(OP_CALL, 2),
+                    codeMakeV(OP_RETURN_VALUE),
+                    NULL
+                ),
+                _END
+            },
+            .expInstructions = {
+                codeMakeV(OP_CLOSURE, 1, 0),
+                codeMakeV(OP_POP),
+                NULL
+            }
+        },
+        {
+            // stored back right after the call, the next iteration loads the new array
+            .input = "fn(a, b) { while (true) { a = push(a, 1); b = push(a, 2) } }",
+            .expConstants = {
+                _FUNC(
+                    codeMakeV(OP_TRUE),
+                    codeMakeV(OP_JUMP_NOT_TRUTHY, 26),
+                    codeMakeV(OP_GET_BUILTIN, 5),
+                    codeMakeV(OP_MOVE_LOCAL, 0),
+                    codeMakeV(OP_PUSH_INT8, 1),
+                    codeMakeV(OP_CALL, 2),
+                    codeMakeV(OP_SET_LOCAL, 0),
+                    codeMakeV(OP_GET_BUILTIN, 5),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_PUSH_INT8, 2),
+                    codeMakeV(OP_CALL, 2),
+                    codeMakeV(OP_SET_LOCAL, 1),
+                    codeMakeV(OP_JUMP, -24),
+                    codeMakeV(OP_RETURN),
+                    NULL
+                ),
+                _END
+            },
+            .expInstructions = {
+                codeMakeV(OP_CLOSURE, 0, 0),
+                codeMakeV(OP_POP),
+                NULL
+            }
+        },
+   };
+
+    int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    runCompilerTests(testCases, numTestCases);
+}
+
 void testClosures() {
 
     TestCase_t testCases[] = {
@@ -782,7 +922,7 @@ void testClosures() {
                 ),
                 _FUNC(
                     codeMakeV(OP_GET_LOCAL, 0),
-                    codeMakeV(OP_CLOSURE, 1, 1),
+                    codeMakeV(OP_CLOSURE, 0, 1),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
@@ -808,11 +948,8 @@ void testClosures() {
                      "}",
             .expConstants = {
                 _INT(55),
-                _INT(66),
-                _INT(77),
-                _INT(88),
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 3),
+                    codeMakeV(OP_PUSH_INT8, 88),
                     codeMakeV(OP_SET_LOCAL, 0),
                     codeMakeV(OP_GET_GLOBAL, 0),
                     codeMakeV(OP_GET_FREE, 0),
@@ -825,28 +962,28 @@ void testClosures() {
                     NULL
                 ),
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 2),
+                    codeMakeV(OP_PUSH_INT8, 77),
                     codeMakeV(OP_SET_LOCAL, 0),
                     codeMakeV(OP_GET_FREE, 0),
                     codeMakeV(OP_GET_LOCAL, 0),
-                    codeMakeV(OP_CLOSURE, 4, 2),
+                    codeMakeV(OP_CLOSURE, 0, 2),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
                 _FUNC(
-                    codeMakeV(OP_CONSTANT, 1),
+                    codeMakeV(OP_PUSH_INT8, 66),
                     codeMakeV(OP_SET_LOCAL, 0),
                     codeMakeV(OP_GET_LOCAL, 0),
-                    codeMakeV(OP_CLOSURE, 5, 1),
+                    codeMakeV(OP_CLOSURE, 0, 1),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CONSTANT, 0),
-                codeMakeV(OP_SET_GLOBAL, 0), 
-                codeMakeV(OP_CLOSURE, 6, 0),
+                codeMakeV(OP_PUSH_INT8, 55),
+                codeMakeV(OP_SET_GLOBAL, 0),
+                codeMakeV(OP_CLOSURE, 3, 0),
                 codeMakeV(OP_POP),
                 NULL
             }
@@ -864,24 +1001,21 @@ void testRecursiveFunctions() {
             .input = "let countDown = fn(x) { countDown(x - 1); };"
                      "countDown(1);",
             .expConstants = {
-                _INT(1),
                 _FUNC(
                     codeMakeV(OP_CURRENT_CLOSURE),
                     codeMakeV(OP_GET_LOCAL, 0),
-                    codeMakeV(OP_CONSTANT, 0),
-                    codeMakeV(OP_SUB),
+                    codeMakeV(OP_SUB_IMM, 1),
                     codeMakeV(OP_CALL, 1),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
-                _INT(1), 
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 1, 0),
+                codeMakeV(OP_CLOSURE, 0, 0),
                 codeMakeV(OP_SET_GLOBAL, 0),
-                codeMakeV(OP_GET_GLOBAL, 0),
-                codeMakeV(OP_CONSTANT, 2),
+                codeMakeV(OP_CLOSURE, 0, 0),
+                codeMakeV(OP_PUSH_INT8, 1),
                 codeMakeV(OP_CALL, 1),
                 codeMakeV(OP_POP),
                 NULL
@@ -894,22 +1028,19 @@ void testRecursiveFunctions() {
                      "};"
                      "wrapper();",
             .expConstants = {
-                _INT(1),
                 _FUNC(
                     codeMakeV(OP_CURRENT_CLOSURE),
                     codeMakeV(OP_GET_LOCAL, 0),
-                    codeMakeV(OP_CONSTANT, 0),
-                    codeMakeV(OP_SUB),
+                    codeMakeV(OP_SUB_IMM, 1),
                     codeMakeV(OP_CALL, 1),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
                 ),
-                _INT(1), 
                 _FUNC(
-                    codeMakeV(OP_CLOSURE, 1, 0),
+                    codeMakeV(OP_CLOSURE, 0, 0),
                     codeMakeV(OP_SET_LOCAL, 0),
-                    codeMakeV(OP_GET_LOCAL, 0), 
-                    codeMakeV(OP_CONSTANT, 2),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_PUSH_INT8, 1),
                     codeMakeV(OP_CALL, 1),
                     codeMakeV(OP_RETURN_VALUE),
                     NULL
@@ -917,9 +1048,9 @@ void testRecursiveFunctions() {
                 _END
             },
             .expInstructions = {
-                codeMakeV(OP_CLOSURE, 3, 0),
+                codeMakeV(OP_CLOSURE, 1, 0),
                 codeMakeV(OP_SET_GLOBAL, 0),
-                codeMakeV(OP_GET_GLOBAL, 0),
+                codeMakeV(OP_CLOSURE, 1, 0),
                 codeMakeV(OP_CALL, 0),
                 codeMakeV(OP_POP),
                 NULL
@@ -933,6 +1064,211 @@ void testRecursiveFunctions() {
 }
 
 
+void testWhileLoops() {
+
+    TestCase_t testCases[] = {
+        {
+            // the condition is evaluated again by jumping back to its start,
+            // the main program leaves null rather than the condition
+            .input = "let i = 0; while (i < 2) { i = i + 1 }",
+            .expConstants = {_END},
+            .expInstructions = {
+                codeMakeV(OP_PUSH_INT8, 0),
+                codeMakeV(OP_SET_GLOBAL, 0),
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_GET_GLOBAL, 0),
+                codeMakeV(OP_GREATER_THAN),
+                codeMakeV(OP_JUMP_NOT_TRUTHY, 15),
+                codeMakeV(OP_GET_GLOBAL, 0),
+                codeMakeV(OP_ADD_IMM, 1),
+                codeMakeV(OP_SET_GLOBAL, 0),
+                codeMakeV(OP_JUMP, -18),
+                codeMakeV(OP_NULL),
+                codeMakeV(OP_POP),
+                NULL,
+            }
+        },
+        {
+            .input = "fn(n) { while (n > 0) { n = n - 1 } }",
+            .expConstants = {
+                _FUNC(
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_GREATER_THAN_IMM, 0),
+                    codeMakeV(OP_JUMP_NOT_TRUTHY, 13),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_SUB_IMM, 1),
+                    codeMakeV(OP_SET_LOCAL, 0),
+                    codeMakeV(OP_JUMP, -15),
+                    codeMakeV(OP_RETURN),
+                    NULL
+                ),
+                _END
+            },
+            .expInstructions = {
+                codeMakeV(OP_CLOSURE, 0, 0),
+                codeMakeV(OP_POP),
+                NULL,
+            }
+        },
+    };
+    int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    runCompilerTests(testCases, numTestCases);
+}
+
+void testSwitchTables() {
+    TestCase_t testCases[] = {
+        {
+            // the missing key 3 jumps to the default target
+            .input = "let x = 2; if (x == 1) { 10 } else { if (x == 2) { 20 } else { if (x == 4) { 40 } } }",
+            .expConstants = {
+                _INT(2),
+                _ARRAY(_INT(25), _INT(SWITCH_TABLE_DENSE), _INT(1), _INT(10), _INT(15), _INT(25), _INT(20), _END),
+                _END
+            },
+            .expInstructions = {
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_SET_GLOBAL, 0),
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_SWITCH_TABLE, 1),
+                codeMakeV(OP_PUSH_INT8, 10),
+                codeMakeV(OP_JUMP, 14),
+                codeMakeV(OP_PUSH_INT8, 20),
+                codeMakeV(OP_JUMP, 9),
+                codeMakeV(OP_PUSH_INT8, 40),
+                codeMakeV(OP_JUMP, 4),
+                codeMakeV(OP_NULL),
+                codeMakeV(OP_POP),
+                NULL,
+            }
+        },
+        {
+            .input = "let x = 2; if (x == 100) { 10 } else { if (x == 2) { 20 } else { if (x == -7) { 40 } else { 0 } } }",
+            .expConstants = {
+                _INT(2),
+                _ARRAY(_INT(25), _INT(SWITCH_TABLE_SPARSE), _INT(-7), _INT(20), _INT(2), _INT(15), _INT(100), _INT(10), _END),
+                _END
+            },
+            .expInstructions = {
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_SET_GLOBAL, 0),
+                codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_SWITCH_TABLE, 1),
+                codeMakeV(OP_PUSH_INT8, 10),
+                codeMakeV(OP_JUMP, 15),
+                codeMakeV(OP_PUSH_INT8, 20),
+                codeMakeV(OP_JUMP, 10),
+                codeMakeV(OP_PUSH_INT8, 40),
+                codeMakeV(OP_JUMP, 5),
+                codeMakeV(OP_PUSH_INT8, 0),
+                codeMakeV(OP_POP),
+                NULL,
+            }
+        },
+    };
+    int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    runCompilerTests(testCases, numTestCases);
+}
+
+void testImmediates() {
+    TestCase_t testCases[] = {
+        {
+            // only integers outside the 16 bit range go to the pool
+            .input = "127; 128; -1000; 32768",
+            .expConstants = {_INT(32768), _END},
+            .expInstructions = {
+                codeMakeV(OP_PUSH_INT8, 127),
+                codeMakeV(OP_POP),
+                codeMakeV(OP_PUSH_INT16, 128),
+                codeMakeV(OP_POP),
+                codeMakeV(OP_PUSH_INT16, 1000),
+                codeMakeV(OP_MINUS),
+                codeMakeV(OP_POP),
+                codeMakeV(OP_CONSTANT, 0),
+                codeMakeV(OP_POP),
+                NULL,
+            }
+        },
+        {
+            // the swapped operands of < put the literal on the left
+            .input = "fn(x) { [x + 1000 > 0, 0 < x, 1 < x, x - 100000] }",
+            .expConstants = {
+                _INT(100000),
+                _FUNC(
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_ADD_IMM, 1000),
+                    codeMakeV(OP_GREATER_THAN_IMM, 0),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_GREATER_THAN_IMM, 0),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_GREATER_THAN_IMM, 1),
+                    codeMakeV(OP_GET_LOCAL, 0),
+                    codeMakeV(OP_CONSTANT, 0),
+                    codeMakeV(OP_SUB),
+                    codeMakeV(OP_ARRAY, 4),
+                    codeMakeV(OP_RETURN_VALUE),
+                    NULL
+                ),
+                _END
+            },
+            .expInstructions = {
+                codeMakeV(OP_CLOSURE, 1, 0),
+                codeMakeV(OP_POP),
+                NULL,
+            }
+        },
+    };
+
+    int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+    runCompilerTests(testCases, numTestCases);
+}
+
+void testFunctionConstantPools() {
+    // the literals of main push the constants of the function past the 16 bit range
+    const uint32_t numLiterals = 70000;
+    char* input = mallocChk(numLiterals * 8 + 64);
+    char* pos = input;
+    for (uint32_t i = 0; i < numLiterals; i++) {
+        pos += sprintf(pos, "%u;", 100000 + i);
+    }
+    sprintf(pos, "fn() { [200000, 100000, 200000] }");
+
+    Lexer_t* lexer = createLexer(input);
+    Parser_t* parser = createParser(lexer);
+    Program_t* program = parserParseProgram(parser);
+
+    Compiler_t compiler = createCompiler();
+    TEST_INT(COMP_NO_ERROR, compilerCompile(&compiler, program), "Compiler error");
+    Bytecode_t bytecode = compilerGetBytecode(&compiler);
+
+    uint32_t count = vectorObjectsGetCount(bytecode.constants);
+    TEST_INT(numLiterals + 2, count, "Wrong number of constants");
+    Object_t* obj = vectorObjectsGetBuffer(bytecode.constants)[count - 1];
+    TEST_INT(OBJECT_COMPILED_FUNCTION, objectGetType(obj), "Not a function");
+
+    // the pool follows the order of the program wide constants
+    CompiledFunction_t* fn = (CompiledFunction_t*)obj;
+    TEST_INT(2, fn->numConstants, "Wrong pool size");
+    testIntegerObject(100000, fn->constants[0]);
+    testIntegerObject(200000, fn->constants[1]);
+
+    SliceByte_t expInstructions[] = {
+        codeMakeV(OP_CONSTANT, 1),
+        codeMakeV(OP_CONSTANT, 0),
+        codeMakeV(OP_CONSTANT, 1),
+        codeMakeV(OP_ARRAY, 3),
+        codeMakeV(OP_RETURN_VALUE),
+        NULL
+    };
+    testCompiledFunction(expInstructions, obj);
+
+    cleanupBytecode(&bytecode);
+    cleanupCompiler(&compiler);
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+    free(input);
+    gcForceRun();
+}
+
 void runCompilerTests(TestCase_t *tc, int numTc)
 {
     for (int i = 0; i < numTc; i++)
@@ -1021,6 +1357,9 @@ void testConstants(GenericExpect_t expected[], VectorObjects_t *actual)
         case EXPECT_COMPILED_FUNCTION:
             testCompiledFunction(expected[i].fl, objects[i]);
             break;
+        case EXPECT_ARRAY:
+            testIntegerArrayObject(expected[i].al, objects[i]);
+            break;
         default:
             TEST_ABORT();
         }
@@ -1042,10 +1381,23 @@ void testStringObject(const char* expected, Object_t *obj) {
     TEST_NOT_NULL(obj, "Object is null");
     TEST_INT(OBJECT_STRING, obj->type, "Object type not OBJECT_STRING");
     String_t *strObj = (String_t *)obj;
-    TEST_STRING(expected, strObj->value, "Object value is not correct");
+    TEST_STRING(expected, stringGetValue(strObj), "Object value is not correct");
 }
 
 
+void testIntegerArrayObject(GenericExpect_t expected[], Object_t* obj) {
+    TEST_INT(OBJECT_ARRAY, obj->type, "Object type not OBJECT_ARRAY");
+    Array_t* arr = (Array_t*)obj;
+    TEST_ASSERT_MESSAGE(arrayIsPacked(arr), "Array not packed");
+
+    uint32_t numExpected = 0;
+    while (expected[numExpected].type != EXPECT_END) numExpected++;
+    TEST_INT(numExpected, arrayGetElementCount(arr), "wrong number of elements");
+    for (uint32_t i = 0; i < numExpected; i++) {
+        TEST_INT(expected[i].il, arrayGetInts(arr)[i], "wrong element");
+    }
+}
+
 void testCompiledFunction(SliceByte_t expInstr[], Object_t*obj) {
     TEST_NOT_NULL(obj, "Object is null");
     TEST_INT(OBJECT_COMPILED_FUNCTION, obj->type, "Object type not OBJECT_COMPILED_FUNCTION");
@@ -1067,12 +1419,18 @@ int main(void)
     RUN_TEST(testArrayLiterals);
     RUN_TEST(testHashLiterals);
     RUN_TEST(testIndexExpressions);
+    RUN_TEST(testConstantDeduplication);
     RUN_TEST(testCompilerScopes);
     RUN_TEST(testFunctions);
     RUN_TEST(testFunctionCalls);
     RUN_TEST(testLetStatementScopes);
     RUN_TEST(testBuiltins);
+    RUN_TEST(testLocalMoves);
     RUN_TEST(testClosures);
     RUN_TEST(testRecursiveFunctions);
+    RUN_TEST(testWhileLoops);
+    RUN_TEST(testSwitchTables);
+    RUN_TEST(testImmediates);
+    RUN_TEST(testFunctionConstantPools);
     return UNITY_END();
 }
\ No newline at end of file
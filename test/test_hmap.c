@@ -68,11 +68,58 @@ void hashMapTestSetInsert() {
     cleanupHashMap(&map, NULL);
 }
 
+void hashMapTestHashed() {
+    HashMap_t* map = createHashMap();
+    uint64_t hash = hashMapHashKey("hello");
+    hashMapInsertHashed(map, "hello", hash, cloneString("my value"));
+    for (int i = 0; i < 10; i++) {
+        char* key = strFormat("key%d", i);
+        hashMapInsert(map, key, cloneString(key));
+        free(key);
+    }
+
+    // survives resizing, both lookup variants agree 
+    TEST_ASSERT_EQUAL_STRING("my value", hashMapGetHashed(map, "hello", hash)); 
+    TEST_ASSERT_EQUAL_STRING("my value", hashMapGet(map, "hello")); 
+    TEST_ASSERT_EQUAL_STRING("key7", hashMapGetHashed(map, "key7", hashMapHashKey("key7"))); 
+    TEST_ASSERT_NULL(hashMapGetHashed(map, "hello", hash + 1)); 
+
+    cleanupHashMap(&map, (HashMapElemCleanupFn_t)cleanupStr);
+}
+
+void hashMapTestBorrowed() {
+    HashMap_t* map = createHashMap();
+    char key[] = "borrowed";
+    uint64_t hash = hashMapHashKey(key);
+    hashMapInsertBorrowed(map, key, hash, cloneString("my value"));
+    hashMapInsert(map, "owned", cloneString("my value 2"));
+
+    TEST_ASSERT_EQUAL_STRING("my value", hashMapGetHashed(map, key, hash)); 
+    TEST_ASSERT_EQUAL_STRING("my value", hashMapGet(map, "borrowed")); 
+
+    // reinserting with an owned key drops the borrowed one 
+    free(hashMapInsert(map, "borrowed", cloneString("my value 3")));
+    TEST_ASSERT_TRUE(map->itemCnt == 2);
+    key[0] = 'x';
+    TEST_ASSERT_EQUAL_STRING("my value 3", hashMapGet(map, "borrowed")); 
+
+    char* removed = hashMapRemoveHashed(map, "borrowed", hash);
+    TEST_ASSERT_EQUAL_STRING("my value 3", removed); 
+    free(removed);
+    TEST_ASSERT_NULL(hashMapGet(map, "borrowed")); 
+    TEST_ASSERT_NULL(hashMapRemoveHashed(map, "borrowed", hash)); 
+    TEST_ASSERT_TRUE(map->itemCnt == 1);
+
+    cleanupHashMap(&map, (HashMapElemCleanupFn_t)cleanupStr);
+}
+
 // not needed when using generate_test_runner.rb
 int main(void) {
    UNITY_BEGIN();
    RUN_TEST(hashMapTestBasic);
    RUN_TEST(hashMapTestInsert);
    RUN_TEST(hashMapTestSetInsert);
+   RUN_TEST(hashMapTestHashed);
+   RUN_TEST(hashMapTestBorrowed);
    return UNITY_END();
 }
\ No newline at end of file
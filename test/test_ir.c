@@ -0,0 +1,325 @@
+#include "unity.h"
+#include "utils.h"
+#include "compiler.h"
+#include "ir.h"
+#include "lexer.h"
+#include "parser.h"
+#include "test_helper.h"
+#include "gc.h"
+
+void setUp(void) {
+    // set stuff up here
+}
+
+void tearDown(void) {
+    // clean stuff up here
+}
+
+#define MAX_INSTRUCTIONS 32
+
+typedef struct TestCase {
+    const char* input;
+    const char* expected;
+} TestCase_t;
+
+typedef struct LoweringTestCase {
+    const char* input;
+    SliceByte_t expInstructions[MAX_INSTRUCTIONS];
+} LoweringTestCase_t;
+
+// Compares the optimized IR of the main program
+void runIrTests(TestCase_t* tc, int numTc) {
+    for (int i = 0; i < numTc; i++) {
+        Lexer_t* lexer = createLexer(tc[i].input);
+        Parser_t* parser = createParser(lexer);
+        Program_t* program = parserParseProgram(parser);
+        TEST_INT(0, parserGetErrorCount(parser), "Parser errors");
+
+        Compiler_t compiler = createCompiler();
+        CompError_t err = COMP_NO_ERROR;
+        IrFunction_t* fn = irBuildProgram(&compiler, program, &err);
+        TEST_INT(COMP_NO_ERROR, err, "Compiler error");
+
+        irOptimize(&compiler, fn);
+        char* actual = irFunctionToString(fn);
+        TEST_STRING(tc[i].expected, actual, tc[i].input);
+        free(actual);
+
+        cleanupIrFunction(&fn);
+        cleanupCompiler(&compiler);
+        cleanupParser(&parser);
+        cleanupProgram(&program);
+        gcForceRun();
+    }
+}
+
+// Compares the bytecode of the first function literal compiled at -O2
+void runLoweringTests(LoweringTestCase_t* tc, int numTc) {
+    for (int i = 0; i < numTc; i++) {
+        Lexer_t* lexer = createLexer(tc[i].input);
+        Parser_t* parser = createParser(lexer);
+        Program_t* program = parserParseProgram(parser);
+        TEST_INT(0, parserGetErrorCount(parser), "Parser errors");
+
+        Compiler_t compiler = createCompiler();
+        compilerSetOptLevel(&compiler, 2);
+        TEST_INT(COMP_NO_ERROR, compilerCompile(&compiler, program), "Compiler error");
+
+        CompiledFunction_t* fn = NULL;
+        Object_t** constants = vectorObjectsGetBuffer(compiler.constants);
+        for (uint32_t c = 0; c < vectorObjectsGetCount(compiler.constants) && !fn; c++) {
+            if (objectGetType(constants[c]) == OBJECT_COMPILED_FUNCTION) {
+                fn = (CompiledFunction_t*)constants[c];
+            }
+        }
+        TEST_ASSERT_TRUE(fn != NULL);
+
+        SliceByte_t expected = createSliceByte(0);
+        for (int j = 0; tc[i].expInstructions[j]; j++) {
+            sliceByteAppend(&expected, tc[i].expInstructions[j], sliceByteGetLen(tc[i].expInstructions[j]));
+            cleanupSliceByte(tc[i].expInstructions[j]);
+        }
+        char* expStr = instructionsToString(expected);
+        char* actualStr = instructionsToString(fn->instructions);
+        TEST_STRING(expStr, actualStr, tc[i].input);
+        free(expStr);
+        free(actualStr);
+        cleanupSliceByte(expected);
+
+        cleanupCompiler(&compiler);
+        cleanupParser(&parser);
+        cleanupProgram(&program);
+        gcForceRun();
+    }
+}
+
+void testPhis() {
+    TestCase_t testCases[] = {
+        {
+            "let g = fn() { return true; }; let c = g(); if (c) { 1 } else { 2 }",
+            "b0:\n"
+            "\tv0 = closure 0\n"
+            "\tsetglobal 0 v0\n"
+            "\tv2 = closure 0\n"
+            "\tv3 = call v2\n"
+            "\tsetglobal 1 v3\n"
+            "\tv5 = getglobal 1\n"
+            "\tbranch v5 b1 b2\n"
+            "b1: b0\n"
+            "\tv7 = const 1\n"
+            "\tjump b3\n"
+            "b2: b0\n"
+            "\tv9 = const 2\n"
+            "\tjump b3\n"
+            "b3: b1 b2\n"
+            "\tv11 = phi v7 v9\n"
+            "\tpop v11\n"
+            "\tend\n"
+        },
+    };
+    runIrTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+void testFoldingThroughGlobals() {
+    TestCase_t testCases[] = {
+        {
+            // loads of the stored constants fold the condition and the dead branch goes
+            "let x = 2; let y = x * 3; if (y > 5) { y } else { 0 }",
+            "b0:\n"
+            "\tv0 = const 0\n"
+            "\tsetglobal 0 v0\n"
+            "\tv4 = const 4\n"
+            "\tsetglobal 1 v4\n"
+            "\tpop v4\n"
+            "\tend\n"
+        },
+        {
+            "1 / 0",
+            "b0:\n"
+            "\tv0 = const 0\n"
+            "\tv1 = const 1\n"
+            "\tv2 = div v0 v1\n"
+            "\tpop v2\n"
+            "\tend\n"
+        },
+    };
+    runIrTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+void testInlining() {
+    TestCase_t testCases[] = {
+        {
+            // the call is replaced by the folded body, the closure is still stored
+            "let double = fn(x) { x * 2 }; double(3)",
+            "b0:\n"
+            "\tv0 = closure 1\n"
+            "\tsetglobal 0 v0\n"
+            "\tv4 = const 3\n"
+            "\tpop v4\n"
+            "\tend\n"
+        },
+        {
+            // recursive functions are called
+            "let f = fn(x) { if (x > 0) { f(x - 1) } else { 0 } }; f(3)",
+            "b0:\n"
+            "\tv0 = closure 2\n"
+            "\tsetglobal 0 v0\n"
+            "\tv2 = closure 2\n"
+            "\tv3 = const 3\n"
+            "\tv4 = call v2 v3\n"
+            "\tpop v4\n"
+            "\tend\n"
+        },
+    };
+    runIrTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+void testLowering() {
+    LoweringTestCase_t testCases[] = {
+        {
+            // the common subexpression gets a slot after the parameters
+            .input = "fn(a, b) { let t = a + b; let u = a + b; t * u }",
+            .expInstructions = {
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_ADD),
+                codeMakeV(OP_SET_LOCAL, 2), codeMakeV(OP_GET_LOCAL, 2), codeMakeV(OP_GET_LOCAL, 2),
+                codeMakeV(OP_MUL), codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // the if value stays on the stack as first operand of the multiplication
+            .input = "fn(x) { if (x > 1) { x } else { 0 } * 2 }",
+            .expInstructions = {
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_GREATER_THAN_IMM, 1), codeMakeV(OP_JUMP_NOT_TRUTHY, 8),
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_JUMP, 5), codeMakeV(OP_PUSH_INT8, 0),
+                codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_MUL), codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // unused array is dropped, the last use of the parameter is a move
+            .input = "fn(a) { let unused = [a, a]; puts(a) }",
+            .expInstructions = {
+                codeMakeV(OP_GET_BUILTIN, 1), codeMakeV(OP_MOVE_LOCAL, 0), codeMakeV(OP_CALL, 1),
+                codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // the captured parameter of the caller is passed as a second argument
+            .input = "fn(a) { let g = fn(x) { a + x }; g(1) }",
+            .expInstructions = {
+                codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_ADD),
+                codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            .input = "fn(x) { if (x) { return 1; } else { 2 } }",
+            .expInstructions = {
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_JUMP_NOT_TRUTHY, 6), codeMakeV(OP_PUSH_INT8, 1),
+                codeMakeV(OP_RETURN_VALUE), codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // the loop variable keeps its slot, the latch jumps back to the condition
+            .input = "fn(n) { let i = 0; while (i < n) { i = i + 1 } i }",
+            .expInstructions = {
+                codeMakeV(OP_PUSH_INT8, 0), codeMakeV(OP_SET_LOCAL, 1), codeMakeV(OP_GET_LOCAL, 0),
+                codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_GREATER_THAN), codeMakeV(OP_JUMP_NOT_TRUTHY, 13),
+                codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_ADD_IMM, 1), codeMakeV(OP_SET_LOCAL, 1),
+                codeMakeV(OP_JUMP, -15), codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // the bound global is a constant integer, so is the loop condition
+            .input = "let limit = 1000; let f = fn(n) { let i = 0; while (i < limit) { i = i + n; } i }; f(1)",
+            .expInstructions = {
+                codeMakeV(OP_PUSH_INT8, 0), codeMakeV(OP_SET_LOCAL, 1), codeMakeV(OP_PUSH_INT16, 1000),
+                codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_JUMP_NOT_GREATER_THAN_I64, 13), codeMakeV(OP_GET_LOCAL, 1),
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_ADD_I64), codeMakeV(OP_SET_LOCAL, 1),
+                codeMakeV(OP_JUMP, -15), codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // the compared keys are left in the pool, the table is the only constant of the function
+            .input = "fn(x) { if (x == 1) { 10 } else { if (x == 2) { 20 } else { if (x == 3) { 30 } else { 0 } } } }",
+            .expInstructions = {
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_SWITCH_TABLE, 0), codeMakeV(OP_PUSH_INT8, 10),
+                codeMakeV(OP_JUMP, 15), codeMakeV(OP_PUSH_INT8, 20), codeMakeV(OP_JUMP, 10),
+                codeMakeV(OP_PUSH_INT8, 30), codeMakeV(OP_JUMP, 5), codeMakeV(OP_PUSH_INT8, 0),
+                codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // the swap reads every phi input before storing any of them, the
+            // back edge stores them again so they are moved
+            .input = "fn(n) { let a = 1; let b = 2; while (n > 0) { let t = a; a = b; b = t; n = n - 1 } a }",
+            .expInstructions = {
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_PUSH_INT8, 1), codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_SET_LOCAL, 3), codeMakeV(OP_SET_LOCAL, 2), codeMakeV(OP_SET_LOCAL, 1),
+                codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_GREATER_THAN_IMM, 0), codeMakeV(OP_JUMP_NOT_TRUTHY, 21),
+                codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_SUB_IMM, 1), codeMakeV(OP_MOVE_LOCAL, 3),
+                codeMakeV(OP_MOVE_LOCAL, 2), codeMakeV(OP_SET_LOCAL, 3), codeMakeV(OP_SET_LOCAL, 2),
+                codeMakeV(OP_SET_LOCAL, 1), codeMakeV(OP_JUMP, -23), codeMakeV(OP_GET_LOCAL, 2),
+                codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // the back edge stores the accumulator before it is loaded again,
+            // so push gets it moved and the result is moved into its slot
+            .input = "fn(n) { let acc = []; let i = 0; while (i < n) { acc = push(acc, i); i = i + 1 } acc }",
+            .expInstructions = {
+                codeMakeV(OP_ARRAY, 0), codeMakeV(OP_PUSH_INT8, 0), codeMakeV(OP_SET_LOCAL, 2),
+                codeMakeV(OP_SET_LOCAL, 1), codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_GET_LOCAL, 2),
+                codeMakeV(OP_GREATER_THAN), codeMakeV(OP_JUMP_NOT_TRUTHY, 27), codeMakeV(OP_GET_BUILTIN, 5),
+                codeMakeV(OP_MOVE_LOCAL, 1), codeMakeV(OP_GET_LOCAL, 2), codeMakeV(OP_CALL, 2),
+                codeMakeV(OP_SET_LOCAL, 3), codeMakeV(OP_MOVE_LOCAL, 3), codeMakeV(OP_GET_LOCAL, 2),
+                codeMakeV(OP_ADD_IMM, 1), codeMakeV(OP_SET_LOCAL, 2), codeMakeV(OP_SET_LOCAL, 1),
+                codeMakeV(OP_JUMP, -29), codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+    };
+    runLoweringTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+void testIntegerSpecialization() {
+    LoweringTestCase_t testCases[] = {
+        {
+            // only ever called with integers, the comparison jumps directly
+            .input = "let fib = fn(n) { if (n < 2) { return n; } fib(n - 1) + fib(n - 2) }; fib(10)",
+            .expInstructions = {
+                codeMakeV(OP_PUSH_INT8, 2), codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_JUMP_NOT_GREATER_THAN_I64, 6),
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_RETURN_VALUE),
+                codeMakeV(OP_CURRENT_CLOSURE), codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_SUB_IMM, 1),
+                codeMakeV(OP_CALL, 1),
+                codeMakeV(OP_CURRENT_CLOSURE), codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_SUB_IMM, 2),
+                codeMakeV(OP_CALL, 1),
+                codeMakeV(OP_ADD_I64), codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // the string argument keeps the generic addition
+            .input = "let add = fn(a, b) { return a + b; }; add(1, 2); add(\"a\", \"b\")",
+            .expInstructions = {
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_GET_LOCAL, 1), codeMakeV(OP_ADD),
+                codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+        {
+            // subtraction only succeeds on integers whatever the parameter is
+            .input = "let f = fn(x) { return (x - 1) * 2; }; f",
+            .expInstructions = {
+                codeMakeV(OP_GET_LOCAL, 0), codeMakeV(OP_SUB_IMM, 1), codeMakeV(OP_PUSH_INT8, 2),
+                codeMakeV(OP_MUL_I64), codeMakeV(OP_RETURN_VALUE), NULL
+            }
+        },
+    };
+    runLoweringTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(testPhis);
+    RUN_TEST(testFoldingThroughGlobals);
+    RUN_TEST(testInlining);
+    RUN_TEST(testLowering);
+    RUN_TEST(testIntegerSpecialization);
+    return UNITY_END();
+}
@@ -0,0 +1,160 @@
+#include "unity.h"
+#include "parser.h"
+#include "optimizer.h"
+#include "compiler.h"
+#include "vm.h"
+#include "gc.h"
+#include "utils.h"
+#include "test_helper.h"
+
+void setUp(void) {
+    // set stuff up here
+}
+
+void tearDown(void) {
+    // clean stuff up here
+}
+
+typedef struct TestCase {
+    const char* input;
+    const char* expected;
+} TestCase_t;
+
+void runOptimizerTests(TestCase_t* tc, int numTc) {
+    for (int i = 0; i < numTc; i++) {
+        Lexer_t* lexer = createLexer(tc[i].input);
+        Parser_t* parser = createParser(lexer);
+        Program_t* program = parserParseProgram(parser);
+        TEST_INT(0, parserGetErrorCount(parser), "Parser errors");
+
+        optimizerFoldConstants(program);
+
+        char* actual = programToString(program);
+        TEST_STRING(tc[i].expected, actual, tc[i].input);
+        free(actual);
+
+        cleanupParser(&parser);
+        cleanupProgram(&program);
+    }
+}
+
+void testFoldIntegers() {
+    TestCase_t testCases[] = {
+        {"2 * 60 * 60", "7200"},
+        {"1 + 2 * 3 - 4 / 2", "5"},
+        {"-(2 + 3)", "-5"},
+        {"--5", "5"},
+        {"x * (2 + 3)", "(x * 5)"},
+        {"1 < 2", "true"},
+        {"1 > 2", "false"},
+        {"3 == 3", "true"},
+        {"3 != 3", "false"},
+        {"9223372036854775807 + 1", "-9223372036854775808"},
+    };
+    runOptimizerTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+void testFoldBooleansAndStrings() {
+    TestCase_t testCases[] = {
+        {"!true", "false"},
+        {"!!false", "false"},
+        {"!5", "false"},
+        {"true == false", "false"},
+        {"true != false", "true"},
+        {"\"foo\" + \"bar\"", "foobar"},
+        {"\"foo\" == \"foo\"", "true"},
+        {"\"foo\" != \"foo\"", "false"},
+        {"[1 + 1, \"a\" + \"b\"]", "[2, ab]"},
+        {"{1 + 1: 2 * 2}[2]", "({2:4}[2])"},
+        {"fn(x) { x + (1 + 1) }", "fn(x)\t(x + 2)"},
+        {"f(1 + 2, 3)", "f(3, 3)"},
+    };
+    runOptimizerTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+void testRuntimeErrorsPreserved() {
+    TestCase_t testCases[] = {
+        {"1 / 0", "(1 / 0)"},
+        {"10 / (5 - 5)", "(10 / 0)"},
+        {"-true", "(-true)"},
+        {"1 + true", "(1 + true)"},
+        {"true + false", "(true + false)"},
+        {"\"a\" - \"b\"", "(a - b)"},
+        {"1 == true", "(1 == true)"},
+    };
+    runOptimizerTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+void testDeadBranches() {
+    TestCase_t testCases[] = {
+        {"if (true) { 10 } else { 20 }", "10"},
+        {"if (1 > 2) { 10 } else { 20 }", "20"},
+        {"if (\"x\") { 10 }", "10"},
+        {"let a = if (1 < 2) { let b = 1; b } else { 20 };", "let a = iftrue \tlet b = 1;\n\tb;"},
+        {"let a = if (false) { 10 } else { let b = 1; b };", "let a = iftrue \tlet b = 1;\n\tb;"},
+        {"let a = if (false) { 10 };", "let a = iffalse ;"},
+        {"if (true) { let b = 1; b } else { 20 }; b", "let b = 1;\nb\nb"},
+        {"if (x) { 1 + 1 } else { 2 * 2 }", "ifx \t2else \t4"},
+    };
+    runOptimizerTests(testCases, sizeof(testCases) / sizeof(testCases[0]));
+}
+
+// Runs the program like the REPL does, folded first at -O1
+static char* runProgram(const char* input, bool fold) {
+    Lexer_t* lexer = createLexer(input);
+    Parser_t* parser = createParser(lexer);
+    Program_t* program = parserParseProgram(parser);
+    TEST_INT(0, parserGetErrorCount(parser), "Parser errors");
+    if (fold) {
+        optimizerFoldConstants(program);
+    }
+
+    Compiler_t compiler = createCompiler();
+    compilerSetOptLevel(&compiler, fold ? 1 : 0);
+    CompError_t compErr = compilerCompile(&compiler, program);
+    TEST_INT(COMP_NO_ERROR, compErr, "Compiler error");
+
+    Bytecode_t bytecode = compilerGetBytecode(&compiler);
+    Vm_t vm = createVm(&bytecode);
+    VmError_t vmErr = vmRun(&vm);
+    TEST_INT(VM_NO_ERROR, vmErr.code, vmErr.str);
+    char* result = objectInspect(vmLastPoppedStackElem(&vm));
+
+    cleanupVmError(&vmErr);
+    cleanupVm(&vm);
+    cleanupCompiler(&compiler);
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+    gcForceRun();
+    return result;
+}
+
+void testFoldingKeepsResults() {
+    const char* inputs[] = {
+        "if (true) { let q = 3; }",
+        "7; if (true) {}",
+        "if (1 > 0) { }",
+        "if (true) { 5 }",
+        "if (true) { let q = 3; } q",
+        "let f = fn() { if (true) { let q = 3; } }; f()",
+        "let f = fn() { 7; if (1 < 2) { } }; f()",
+        "let f = fn() { if (true) { if (true) { 4 } } }; f()",
+    };
+    for (uint32_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        char* expected = runProgram(inputs[i], false);
+        char* actual = runProgram(inputs[i], true);
+        TEST_STRING(expected, actual, inputs[i]);
+        free(expected);
+        free(actual);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(testFoldIntegers);
+    RUN_TEST(testFoldBooleansAndStrings);
+    RUN_TEST(testRuntimeErrorsPreserved);
+    RUN_TEST(testDeadBranches);
+    RUN_TEST(testFoldingKeepsResults);
+    return UNITY_END();
+}
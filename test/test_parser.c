@@ -388,6 +388,57 @@ void parserTestIfElseStatement() {
 }
 
 
+void parserTestWhileStatement() {
+    const char* input = "while (x < y) { x = x + 1; }";
+
+    Lexer_t* lexer = createLexer(input);
+    Parser_t* parser = createParser(lexer);
+
+    Program_t* program = parserParseProgram(parser);
+
+    checkParserErrors(parser);
+    TEST_ASSERT_NOT_NULL_MESSAGE(program, "ParserParseProgram returned NULL!");
+
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1u, programGetStatementCount(program), "Program does not contain 1 statement!");
+    Statement_t* stmt = programGetStatements(program)[0];
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(STATEMENT_WHILE, stmt->type, "Statement type not STATEMENT_WHILE");
+    WhileStatement_t* whileStmt = (WhileStatement_t*) stmt;
+
+    testInifxExpression(whileStmt->condition, (GenericExpect_t)_STRING("x"), "<", (GenericExpect_t)_STRING("y"));
+
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1u, blockStatementGetStatementCount(whileStmt->body), "Body block does not contain 1 statement!");
+    Statement_t* bodyStmt = blockStatementGetStatements(whileStmt->body)[0];
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(STATEMENT_ASSIGN, bodyStmt->type, "Body statement type not STATEMENT_ASSIGN");
+    AssignStatement_t* assignStmt = (AssignStatement_t*) bodyStmt;
+
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("x", assignStmt->name->value, "Wrong assigned name");
+    testInifxExpression(assignStmt->value, (GenericExpect_t)_STRING("x"), "+", (GenericExpect_t)_INT(1));
+
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+}
+
+void parserTestWhileIsNotAValue() {
+    const char* inputs[] = {
+        "let r = while (false) {};",
+        "return while (x) { 1 };",
+        "x = while (x) { 1 };",
+        "f(while (x) { 1 });",
+    };
+    for (uint32_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        Lexer_t* lexer = createLexer(inputs[i]);
+        Parser_t* parser = createParser(lexer);
+        Program_t* prog = parserParseProgram(parser);
+
+        TEST_ASSERT_TRUE(parserGetErrorCount(parser) > 0);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE("while is a statement, it has no value", parserGetErrors(parser)[0], inputs[i]);
+        cleanupParser(&parser);
+        cleanupProgram(&prog);
+    }
+}
+
 void parserTestIdentifierExpression() {
     const char* input = "foobar;";
 
@@ -858,6 +909,8 @@ int main(void) {
     RUN_TEST(parserTestOperatorPrecedenceParsing);
     RUN_TEST(parserTestIfStatement);
     RUN_TEST(parserTestIfElseStatement);
+    RUN_TEST(parserTestWhileStatement);
+    RUN_TEST(parserTestWhileIsNotAValue);
     RUN_TEST(parserTestFunctionLiteral);
     RUN_TEST(parserTestFunctionParameterParsing);
     RUN_TEST(parserTestCallExpressionParsing);
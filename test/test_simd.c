@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include "unity.h"
+#include "simd.h"
+
+void setUp(void) {
+    // set stuff up here
+}
+
+void tearDown(void) {
+    // clean stuff up here
+}
+
+void simdTestSum() {
+    int64_t buf[11] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    TEST_ASSERT_EQUAL_INT64(0, simdSumInt64(buf, 0));
+    TEST_ASSERT_EQUAL_INT64(6, simdSumInt64(buf, 3));
+    TEST_ASSERT_EQUAL_INT64(36, simdSumInt64(buf, 8));
+    TEST_ASSERT_EQUAL_INT64(66, simdSumInt64(buf, 11));
+
+    // overflow wraps 
+    int64_t big[2] = {INT64_MAX, 1};
+    TEST_ASSERT_EQUAL_INT64(INT64_MIN, simdSumInt64(big, 2));
+}
+
+void simdTestDot() {
+    int64_t a[9] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    int64_t b[9] = {9, 8, 7, 6, 5, 4, 3, 2, -1};
+    TEST_ASSERT_EQUAL_INT64(0, simdDotInt64(a, b, 0));
+    TEST_ASSERT_EQUAL_INT64(9 + 16 + 21, simdDotInt64(a, b, 3));
+    TEST_ASSERT_EQUAL_INT64(147, simdDotInt64(a, b, 9));
+}
+
+void simdTestMinMax() {
+    int64_t buf[10] = {5, -3, 8, 12, 0, 7, -20, 4, 3, 30};
+    TEST_ASSERT_EQUAL_INT64(5, simdMinInt64(buf, 1));
+    TEST_ASSERT_EQUAL_INT64(-3, simdMinInt64(buf, 4));
+    TEST_ASSERT_EQUAL_INT64(-20, simdMinInt64(buf, 10));
+    TEST_ASSERT_EQUAL_INT64(5, simdMaxInt64(buf, 1));
+    TEST_ASSERT_EQUAL_INT64(12, simdMaxInt64(buf, 9));
+    TEST_ASSERT_EQUAL_INT64(30, simdMaxInt64(buf, 10));
+
+    int64_t extremes[5] = {0, INT64_MIN, INT64_MAX, 1, -1};
+    TEST_ASSERT_EQUAL_INT64(INT64_MIN, simdMinInt64(extremes, 5));
+    TEST_ASSERT_EQUAL_INT64(INT64_MAX, simdMaxInt64(extremes, 5));
+}
+
+void simdTestAllLengths() {
+    // every split between the vector loops and the tails 
+    int64_t a[37], b[37];
+    for (int i = 0; i < 37; i++) {
+        a[i] = (i * 7919) % 61 - 30;
+        b[i] = INT64_MAX - i * 3;
+    }
+    for (uint32_t cnt = 1; cnt <= 37; cnt++) {
+        uint64_t sum = 0, dot = 0;
+        int64_t min = a[0], max = a[0];
+        for (uint32_t i = 0; i < cnt; i++) {
+            sum += (uint64_t)b[i];
+            dot += (uint64_t)a[i] * (uint64_t)b[i];
+            min = a[i] < min ? a[i] : min;
+            max = a[i] > max ? a[i] : max;
+        }
+        TEST_ASSERT_EQUAL_INT64((int64_t)sum, simdSumInt64(b, cnt));
+        TEST_ASSERT_EQUAL_INT64((int64_t)dot, simdDotInt64(a, b, cnt));
+        TEST_ASSERT_EQUAL_INT64(min, simdMinInt64(a, cnt));
+        TEST_ASSERT_EQUAL_INT64(max, simdMaxInt64(a, cnt));
+    }
+}
+
+// not needed when using generate_test_runner.rb
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(simdTestSum);
+    RUN_TEST(simdTestDot);
+    RUN_TEST(simdTestMinMax);
+    RUN_TEST(simdTestAllLengths);
+    return UNITY_END();
+}
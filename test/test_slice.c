@@ -45,11 +45,28 @@ void sliceTestAppend() {
     cleanupSliceByte(sb);
 }
 
+void sliceTestInitPtr() {
+    size_t mem[4];
+    TEST_ASSERT_EQUAL_size_t(sizeof(size_t) + 10, sliceAllocSize(10, sizeof(uint8_t)));
+
+    SliceByte_t placed = sliceInitPtr(mem, 10);
+    TEST_ASSERT_EQUAL_size_t(10, sliceByteGetLen(placed));
+    for (int i = 0; i < 10; i++) {
+        placed[i] = i;
+    }
+
+    SliceByte_t copy = copySliceByte(placed);
+    TEST_ASSERT_EQUAL_size_t(10, sliceByteGetLen(copy));
+    TEST_ASSERT_EQUAL_UINT8(9, copy[9]);
+    cleanupSliceByte(copy);
+}
+
 // not needed when using generate_test_runner.rb
 int main(void) {
    UNITY_BEGIN();
    RUN_TEST(sliceTestBasic);
    RUN_TEST(sliceTestGetLen);
    RUN_TEST(sliceTestAppend);
+   RUN_TEST(sliceTestInitPtr);
    return UNITY_END();
 }
\ No newline at end of file
@@ -1,11 +1,18 @@
+#include <time.h>
+
 #include "unity.h"
 #include "test_helper.h"
 #include "utils.h"
+#include "sbuf.h"
 #include "lexer.h"
 #include "parser.h"
 #include "compiler.h"
 #include "vm.h"
 #include "gc.h"
+#include "builtin.h"
+#include "segment.h"
+#include "jit.h"
+#include "trace.h"
 
 void setUp(void) {
     // set stuff up here
@@ -31,25 +38,45 @@ void testArrayObject(GenericExpect_t *al, Object_t* obj);
 void testHashObject(GenericHash_t hl, Object_t* obj); 
 void testErrorObject(const char* expected, Object_t *obj); 
 
+// Every case runs straight from the AST and through the optimizing IR 
+#define NUM_OPT_LEVELS 3
+
+// and under every dispatch of the run loop, then jitted and traced
+#define NUM_DISPATCH_MODES 3
+#define NUM_VM_MODES (NUM_DISPATCH_MODES + 2)
+
+static void setVmMode(Vm_t* vm, int mode) {
+    if (mode < NUM_DISPATCH_MODES) {
+        vmSetDispatch(vm, mode);
+    } else if (mode == NUM_DISPATCH_MODES) {
+        vmSetJitThreshold(vm, 1);
+    } else {
+        vmSetTraceThreshold(vm, 1);
+    }
+}
+
 void runVmTest(TestCase_t tc[], int numTestCases) {
 
-    for(int i = 0; i < numTestCases; i++) {
-        Lexer_t* lexer = createLexer(tc[i].input);
+    for(int i = 0; i < numTestCases * NUM_OPT_LEVELS * NUM_VM_MODES; i++) {
+        int testIndex = i / (NUM_OPT_LEVELS * NUM_VM_MODES);
+        Lexer_t* lexer = createLexer(tc[testIndex].input);
         Parser_t* parser = createParser(lexer);
         Program_t* program = parserParseProgram(parser);
 
         Compiler_t compiler = createCompiler();
+        compilerSetOptLevel(&compiler, i / NUM_VM_MODES % NUM_OPT_LEVELS);
         CompError_t compErr = compilerCompile(&compiler, program); 
         TEST_INT(COMP_NO_ERROR, compErr, "Compiler error");
 
         Bytecode_t bytecode = compilerGetBytecode(&compiler);   
         Vm_t vm = createVm(&bytecode);
+        setVmMode(&vm, i % NUM_VM_MODES);
         VmError_t vmErr = vmRun(&vm); 
         TEST_INT(VM_NO_ERROR, vmErr.code, vmErr.str); 
 
         Object_t* stackElem = vmLastPoppedStackElem(&vm);
 
-        testExpectedObject(&tc[i].exp, stackElem);
+        testExpectedObject(&tc[testIndex].exp, stackElem);
 
         cleanupVmError(&vmErr);
         cleanupVm(&vm);
@@ -94,12 +121,11 @@ void testArrayObject(GenericExpect_t *al, Object_t* obj) {
     TEST_ASSERT_EQUAL_INT_MESSAGE(OBJECT_ARRAY, obj->type, "Object type not OBJECT_ARRAY");
 
     Array_t* arrObj = (Array_t*) obj;
-    Object_t** elems = arrayGetElements(arrObj);   
     uint32_t elemCnt = arrayGetElementCount(arrObj); 
     uint32_t cnt = 0;
 
     while (al && al->type != EXPECT_END && cnt < elemCnt) {
-        testExpectedObject(al, elems[cnt]);
+        testExpectedObject(al, arrayGetElement(arrObj, cnt));
         al++;
         cnt++;        
     }
@@ -147,7 +173,7 @@ void testStringObject(const char* expected, Object_t *obj) {
     TEST_NOT_NULL(obj, "Object is null");
     TEST_INT(OBJECT_STRING, obj->type, "Object type not OBJECT_STRING");
     String_t *strObj = (String_t *)obj;
-    TEST_STRING(expected, strObj->value, "Object value is not correct");
+    TEST_STRING(expected, stringGetValue(strObj), "Object value is not correct");
 }
 
 void testNullObject(Object_t* obj) {
@@ -254,12 +280,87 @@ void testStringExpressions() {
         {"\"monkey\"", _STRING("monkey")},
         {"\"mon\" + \"key\"", _STRING("monkey")},
         {"\"mon\" + \"key\" + \"banana\"", _STRING("monkeybanana")},
+        {"\"\" + \"key\"", _STRING("key")},
+        {"len(\"mon\" + \"key\")", _INT(6)},
+        {
+            "let d = fn(s) { s + s };"
+            "len(d(d(d(d(d(d(d(\"abcd\"))))))))",
+            _INT(512)
+        },
+        {
+            "let d = fn(s) { s + s };"
+            "let k = d(d(d(d(d(d(d(\"abcd\")))))));"
+            "{k: 1}[d(d(d(d(d(d(d(\"abcd\")))))))]",
+            _INT(1)
+        },
+        {"\"abc\" == \"abc\"", _BOOL(true)},
+        {"\"ab\" + \"c\" == \"abc\"", _BOOL(true)},
+        {"\"abc\" == \"ab\"", _BOOL(false)},
+        {"\"abc\" != \"abd\"", _BOOL(true)},
+        {"intern(\"ab\" + \"c\") == \"abc\"", _BOOL(true)},
+        {"intern(1)", _ERROR("argument to `intern` must be STRING, got INTEGER")},
+        {
+            "let d = fn(s) { s + s };"
+            "d(d(d(d(d(d(d(\"abcd\"))))))) == d(d(d(d(d(d(d(\"ab\" + \"cd\")))))))",
+            _BOOL(true)
+        },
     };
 
     int numTestCases = sizeof(vmTestCases) / sizeof(vmTestCases[0]);
     runVmTest(vmTestCases, numTestCases);
 }
 
+void testRopes() {
+    String_t* piece = createString("0123456789");
+    String_t* str = createString("");
+    char expected[10001] = "";
+    for (int i = 0; i < 1000; i++) {
+        str = createStringConcat(str, piece);
+        strcat(expected, "0123456789");
+    }
+    TEST_ASSERT_TRUE(stringIsRope(str));
+    TEST_INT(10000, stringGetLength(str), "Wrong rope length");
+
+    // intermediate nodes must survive a collection 
+    gcSetRef(str, GC_REF_GLOBAL);
+    gcForceRun();
+    TEST_STRING(expected, stringGetValue(str), "Wrong rope value");
+    TEST_ASSERT_FALSE(stringIsRope(str));
+    gcClearRef(str, GC_REF_GLOBAL);
+    gcForceRun();
+}
+
+void testDeepRopesSurviveGc() {
+    String_t* piece = createString("ab");
+    String_t* str = createString("");
+    for (int i = 0; i < 300000; i++) {
+        str = createStringConcat(piece, str);
+    }
+    TEST_ASSERT_TRUE(stringIsRope(str));
+
+    // prepending builds right deep ropes
+    gcSetRef(str, GC_REF_GLOBAL);
+    gcForceRun();
+    TEST_INT(600000, stringGetLength(str), "Wrong rope length");
+    const char* value = stringGetValue(str);
+    TEST_ASSERT_TRUE(value[0] == 'a' && value[599999] == 'b');
+    gcClearRef(str, GC_REF_GLOBAL);
+    gcForceRun();
+}
+
+void testStringInterning() {
+    String_t* a = stringIntern(createString("interned"));
+    String_t* b = stringIntern(createString("interned"));
+    TEST_ASSERT_TRUE(a == b);
+    TEST_ASSERT_TRUE(stringFindInterned(createString("interned")) == a);
+    TEST_ASSERT_NULL(stringFindInterned(createString("other")));
+
+    // collected strings leave the intern table 
+    gcForceRun();
+    TEST_ASSERT_NULL(stringFindInterned(createString("interned")));
+    gcForceRun();
+}
+
 void testArrayLiterals() {
     TestCase_t vmTestCases[] = {
         {"[]", _ARRAY(_END)},
@@ -300,6 +401,11 @@ void testIndexExpression() {
         {"{1: 1, 2: 2}[2]", _INT(2)},
         {"{1: 1}[0]", _NIL},
         {"{}[0]", _NIL},
+        {"{\"one\": 1, \"two\": 2}[\"two\"]", _INT(2)},
+        {"{\"onetwo\": 12}[\"one\" + \"two\"]", _INT(12)},
+        {"{\"one\": 1}[\"two\"]", _NIL},
+        {"{\"one\": 1}[\"o\" + \"ne\"]", _INT(1)},
+        {"{\"a\": 1, \"a\": 2}[\"a\"]", _INT(2)},
     };
 
     int numTestCases = sizeof(vmTestCases) / sizeof(vmTestCases[0]);
@@ -496,23 +602,36 @@ void testCallingFunctionsWithWrongArguments() {
         {
             .input = "fn(a, b) {a + b;}(1);",
             .expected = "wrong number of arguments: want=2, got=1"
+        },
+        {
+            // not inlined at -O1, the vm still reports the call
+            .input = "let f = fn(a) {a;}; f(1, 2);",
+            .expected = "wrong number of arguments: want=1, got=2"
+        },
+        {
+            // nor lifted, the count doesn't include the captured value
+            .input = "fn(a) { let g = fn(x) { a + x }; g(1, 2) }(1);",
+            .expected = "wrong number of arguments: want=1, got=2"
         }
     };
 
     int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
-    for (int i = 0; i < numTestCases; i++) {
-        Lexer_t* lexer = createLexer(testCases[i].input);
+    for (int i = 0; i < numTestCases * NUM_OPT_LEVELS * NUM_VM_MODES; i++) {
+        int testIndex = i / (NUM_OPT_LEVELS * NUM_VM_MODES);
+        Lexer_t* lexer = createLexer(testCases[testIndex].input);
         Parser_t* parser = createParser(lexer);
         Program_t* program = parserParseProgram(parser);
 
         Compiler_t compiler = createCompiler();
+        compilerSetOptLevel(&compiler, i / NUM_VM_MODES % NUM_OPT_LEVELS);
         CompError_t compErr = compilerCompile(&compiler, program); 
         TEST_INT(COMP_NO_ERROR, compErr, "Compiler error");
 
         Bytecode_t bytecode = compilerGetBytecode(&compiler);   
         Vm_t vm = createVm(&bytecode);
+        setVmMode(&vm, i % NUM_VM_MODES);
         VmError_t vmErr = vmRun(&vm); 
-        TEST_STRING(testCases[i].expected, vmErr.str, "wrong VM error");
+        TEST_STRING(testCases[testIndex].expected, vmErr.str, "wrong VM error");
 
         cleanupVmError(&vmErr);
         cleanupVm(&vm);
@@ -544,12 +663,470 @@ void testBuiltinFunctions() {
         {"rest([])", _NIL},
         {"push([], 1)", _ARRAY(_INT(1), _END)},
         {"push(1, 1)", _ERROR("argument to `push` must be ARRAY, got INTEGER")},
+        {"rest(rest([1, 2, 3]))", _ARRAY(_INT(3), _END)},
+        {"rest(rest(rest([1, 2, 3])))", _ARRAY(_END)},
+        {"first(rest([1, 2, 3]))", _INT(2)},
+        {"last(rest([1, 2, 3]))", _INT(3)},
+        {"len(rest([1, 2, 3]))", _INT(2)},
+        {"rest([1, 2, 3])[1]", _INT(3)},
+        {"rest([1, 2, 3])[2]", _NIL},
+        {"push(rest([1, 2, 3]), 4)", _ARRAY(_INT(2), _INT(3), _INT(4), _END)},
+        {"slice([1, 2, 3, 4], 1, 3)", _ARRAY(_INT(2), _INT(3), _END)},
+        {"slice([1, 2, 3], -1, 10)", _ARRAY(_INT(1), _INT(2), _INT(3), _END)},
+        {"slice([1, 2, 3], 2, 1)", _ARRAY(_END)},
+        {"slice(rest([1, 2, 3, 4]), 1, 3)", _ARRAY(_INT(3), _INT(4), _END)},
+        {"last(slice([1, 2, 3, 4], 0, 2))", _INT(2)},
+        {"slice(1, 0, 1)", _ERROR("argument to `slice` must be ARRAY, got INTEGER")},
+        {"slice([1], \"a\", 1)", _ERROR("bounds of `slice` must be INTEGER, got STRING INTEGER")},
+        {"sum([1, 2, 3, 4, 5])", _INT(15)},
+        {"sum([])", _INT(0)},
+        {"sum(rest([1, 2, 3]))", _INT(5)},
+        {"sum(1)", _ERROR("argument to `sum` must be ARRAY, got INTEGER")},
+        {"sum([1, \"a\"])", _ERROR("elements of `sum` must be INTEGER, got STRING")},
+        {"min([4, -2, 7, 1, 9])", _INT(-2)},
+        {"min([])", _NIL},
+        {"max([4, -2, 7, 1, 9])", _INT(9)},
+        {"max(slice([4, -2, 7, 1, 9], 0, 2))", _INT(4)},
+        {"dot([1, 2, 3], [4, 5, 6])", _INT(32)},
+        {"dot([1, 2], [1])", _ERROR("arguments to `dot` must have the same length, got 2 1")},
+        {"range(4)", _ARRAY(_INT(0), _INT(1), _INT(2), _INT(3), _END)},
+        {"range(2, 4)", _ARRAY(_INT(2), _INT(3), _END)},
+        {"range(4, 2)", _ARRAY(_END)},
+        {"range(\"a\")", _ERROR("argument to `range` must be INTEGER, got STRING")},
+        {"range(0, 4294967296)", _ERROR("`range` too long: 4294967296 elements, want at most 4294967295")},
+        {"range(-9223372036854775807, 9223372036854775807)",
+            _ERROR("`range` too long: 18446744073709551614 elements, want at most 4294967295")},
+        {"range(9223372036854775806, 9223372036854775807)", _ARRAY(_INT(9223372036854775806), _END)},
+        {"sum(range(101))", _INT(5050)},
+        {"push([1, 2], \"a\")", _ARRAY(_INT(1), _INT(2), _STRING("a"), _END)},
+        {"[1, \"a\", 3][2]", _INT(3)},
+        {"first(push([], 1))", _INT(1)},
     };
 
     int numTestCases = sizeof(vmTestCases) / sizeof(vmTestCases[0]);
     runVmTest(vmTestCases, numTestCases);
 }
 
+void testPushValueSemantics() {
+    TestCase_t vmTestCases[] = {
+        {
+            "let f = fn(a) { push(a, 4) };"
+            "f([1, 2, 3])",
+            _ARRAY(_INT(1), _INT(2), _INT(3), _INT(4), _END)
+        },
+        {
+            "let f = fn(a) { let b = push(a, 4); a };"
+            "f([1, 2, 3])",
+            _ARRAY(_INT(1), _INT(2), _INT(3), _END)
+        },
+        {
+            "let f = fn(a) { push(a, 4) };"
+            "let x = [1];"
+            "let y = f(x);"
+            "x",
+            _ARRAY(_INT(1), _END)
+        },
+        {
+            "let f = fn(a) { push(a, 2) };"
+            "let g = fn() { let outer = [[1]]; let r = f(outer[0]); outer };"
+            "g()",
+            _ARRAY(_ARRAY(_INT(1), _END), _END)
+        },
+        {
+            "let f = fn(a) { let g = fn() { a }; let b = push(a, 2); g() };"
+            "f([1])",
+            _ARRAY(_INT(1), _END)
+        },
+        {
+            "let f = fn(a) { let v = rest(a); let b = push(a, 4); v };"
+            "f([1, 2, 3])",
+            _ARRAY(_INT(2), _INT(3), _END)
+        },
+        {
+            "let f = fn(a) { push(a, a) };"
+            "f([1])",
+            _ARRAY(_INT(1), _ARRAY(_INT(1), _END), _END)
+        },
+        {
+            "let map = fn(arr, f) {"
+            "    let iter = fn(arr, accumulated) {"
+            "        if (len(arr) == 0) {"
+            "            accumulated"
+            "        } else {"
+            "            iter(rest(arr), push(accumulated, f(first(arr))));"
+            "        }"
+            "    };"
+            "    iter(arr, []);"
+            "};"
+            "map([1, 2, 3], fn(x) { x * 2 })",
+            _ARRAY(_INT(2), _INT(4), _INT(6), _END)
+        },
+    };
+
+    int numTestCases = sizeof(vmTestCases) / sizeof(vmTestCases[0]);
+    runVmTest(vmTestCases, numTestCases);
+}
+
+void testPushInPlace() {
+    BuiltinFn_t push = getBuiltinByName("push");
+    VectorObjects_t* args = createVectorObjects();
+    Array_t* arr = createArray();
+    vectorObjectsAppend(args, (Object_t*)arr);
+    vectorObjectsAppend(args, (Object_t*)createInteger(1));
+
+    // only one stack entry holds the array, it grows in place
+    gcSetRef(arr, GC_REF_STACK);
+    TEST_ASSERT_TRUE(push(args) == (Object_t*)arr);
+    TEST_INT(1, arrayGetElementCount(arr), "Wrong length after push in place");
+
+    // a global or a second stack entry sees it too
+    gcSetRef(arr, GC_REF_GLOBAL);
+    Object_t* copy = push(args);
+    TEST_ASSERT_TRUE(copy != (Object_t*)arr);
+    gcClearRef(arr, GC_REF_GLOBAL);
+    gcSetRef(arr, GC_REF_STACK);
+    TEST_ASSERT_TRUE(push(args) != (Object_t*)arr);
+    gcClearRef(arr, GC_REF_STACK);
+    TEST_INT(1, arrayGetElementCount(arr), "Shared array was changed");
+
+    // views are read only
+    Array_t* view = createArrayView(arr, 0, 1);
+    gcSetRef(view, GC_REF_STACK);
+    args->buf[0] = (Object_t*)view;
+    TEST_ASSERT_TRUE(push(args) != (Object_t*)view);
+    TEST_INT(1, arrayGetElementCount(arr), "Viewed array was changed");
+
+    gcClearRef(view, GC_REF_STACK);
+    gcClearRef(arr, GC_REF_STACK);
+    cleanupVectorObjects(&args, NULL);
+    gcForceRun();
+}
+
+void testPushInLoops() {
+    TestCase_t vmTestCases[] = {
+        {"let f = fn(n) { let acc = []; let i = 0; while (i < n) { acc = push(acc, i); i = i + 1; } acc }; f(3)",
+            _ARRAY(_INT(0), _INT(1), _INT(2), _END)},
+        // the old array is still seen through b
+        {"let f = fn() { let acc = []; let b = []; let i = 0; while (i < 3) { b = acc; acc = push(acc, i); i = i + 1; } [acc, b] }; f()",
+            _ARRAY(_ARRAY(_INT(0), _INT(1), _INT(2), _END), _ARRAY(_INT(0), _INT(1), _END), _END)},
+        // base is set before the loop and read on every iteration
+        {"let f = fn() { let base = [1]; let r = []; let i = 0; while (i < 3) { r = push(base, i); i = i + 1; } [base, r] }; f()",
+            _ARRAY(_ARRAY(_INT(1), _END), _ARRAY(_INT(1), _INT(2), _END), _END)},
+        {"let f = fn() { let acc = []; let i = 0; while (i < 3) { acc = push(acc, len(acc)); i = i + 1; } acc }; f()",
+            _ARRAY(_INT(0), _INT(1), _INT(2), _END)},
+        {"let f = fn() { let acc = []; let i = 0; while (i < 2) { let j = 0; while (j < 2) { acc = push(acc, j); j = j + 1; } i = i + 1; } acc }; f()",
+            _ARRAY(_INT(0), _INT(1), _INT(0), _INT(1), _END)},
+        {"let f = fn() { let acc = [0]; let s = 0; let i = 0; while (i < 3) { acc = push(acc, i); s = s + len(acc); i = i + 1; } [s, len(acc)] }; f()",
+            _ARRAY(_INT(9), _INT(4), _END)},
+        {"let f = fn() { let outer = []; let i = 0; while (i < 2) { let inner = [i]; outer = push(outer, push(inner, i)); i = i + 1; } outer }; f()",
+            _ARRAY(_ARRAY(_INT(0), _INT(0), _END), _ARRAY(_INT(1), _INT(1), _END), _END)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+
+    // copying the accumulator on every push takes seconds for each run, 
+    // appending in place a few milliseconds
+    TestCase_t growCases[] = {
+        {"let grow = fn(n) { let acc = []; let i = 0; while (i < n) { acc = push(acc, i); i = i + 1; } len(acc) }; grow(40000)",
+            _INT(40000)},
+    };
+    clock_t start = clock();
+    runVmTest(growCases, 1);
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    TEST_ASSERT_TRUE(seconds < 0.5 * NUM_OPT_LEVELS * NUM_VM_MODES);
+}
+
+void testArrayViewsSurviveGc() {
+    Object_t** globals = callocChk(GLOBALS_SIZE * sizeof(Object_t*));
+    VectorObjects_t* constants = createVectorObjects();
+    SymbolTable_t* symTable = createSymbolTable();
+    symbolTableDefineBuiltin(symTable, 4, "rest");
+
+    Lexer_t* lexer = createLexer("let a = rest(rest([1, 2, 3, 4]));");
+    Parser_t* parser = createParser(lexer);
+    Program_t* program = parserParseProgram(parser);
+
+    Compiler_t compiler = createCompilerWithState(symTable, constants);
+    CompError_t compErr = compilerCompile(&compiler, program); 
+    TEST_INT(COMP_NO_ERROR, compErr, "Compiler error");
+
+    Bytecode_t bytecode = compilerGetBytecode(&compiler);   
+    Vm_t vm = createVmWithStore(&bytecode, globals);
+    VmError_t vmErr = vmRun(&vm); 
+    TEST_INT(VM_NO_ERROR, vmErr.code, vmErr.str); 
+
+    cleanupVmError(&vmErr);
+    cleanupVm(&vm);
+    cleanupCompiler(&compiler);
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+
+    // only the view is referenced, the backing store must survive 
+    gcForceRun();
+    testArrayObject(_ARRAY(_INT(3), _INT(4), _END).al, globals[0]);
+
+    gcClearRef(globals[0], GC_REF_GLOBAL);
+    uint32_t count = vectorObjectsGetCount(constants);
+    for (uint32_t i = 0; i < count; i++) {
+        gcClearRef(constants->buf[i], GC_REF_COMPILE_CONSTANT);
+    }
+    cleanupVectorObjects(&constants, NULL);
+    cleanupSymbolTable(symTable);
+    free(globals);
+    gcForceRun();
+}
+
+void testDeepArraysSurviveGc() {
+    Array_t* arr = createArray();
+    for (int i = 0; i < 300000; i++) {
+        Array_t* outer = createArray();
+        arrayAppend(outer, (Object_t*)arr);
+        arr = outer;
+    }
+
+    // marking must not recurse once per nesting level
+    gcSetRef(arr, GC_REF_GLOBAL);
+    gcForceRun();
+    uint32_t depth = 0;
+    for (Array_t* cur = arr; arrayGetElementCount(cur) > 0; cur = (Array_t*)arrayGetElement(cur, 0)) {
+        depth++;
+    }
+    TEST_INT(300000, depth, "Wrong nesting depth");
+    gcClearRef(arr, GC_REF_GLOBAL);
+    gcForceRun();
+}
+
+void testImmediates() {
+    TestCase_t vmTestCases[] = {
+        {"let f = fn(x) { [x + 1, x - 1, x > 0, 0 < x, x + -200, x - 32767] }; f(5)",
+            _ARRAY(_INT(6), _INT(4), _BOOL(true), _BOOL(true), _INT(-195), _INT(-32762), _END)},
+        {"let f = fn(x) { [x + 1, x - 1, x > 0] }; f(-5)", _ARRAY(_INT(-4), _INT(-6), _BOOL(false), _END)},
+        {"[127 + 128, -128 - 32768, 32767 + 32768, 100000 > 99999]", _ARRAY(_INT(255), _INT(-32896), _INT(65535), _BOOL(true), _END)},
+        {"let f = fn(n) { let s = 0; while (n > 0) { s = s + 1000; n = n - 1; } s }; f(4)", _INT(4000)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+
+    // non-integer operands fail like the generic operations
+    const char* inputs[][2] = {
+        {"let f = fn(x) { x + 1 }; f(\"a\")", "unsupported types for binary operation: STRING INTEGER"},
+        {"let f = fn(x) { x - 1 }; f(true)", "unsupported types for binary operation: BOOLEAN INTEGER"},
+        {"let f = fn(x) { x > 0 }; f(\"a\")", "unknown operator: 10 (STRING INTEGER)"},
+    };
+    for (uint32_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        for (int optLevel = 0; optLevel < NUM_OPT_LEVELS; optLevel++) {
+            Lexer_t* lexer = createLexer(inputs[i][0]);
+            Parser_t* parser = createParser(lexer);
+            Program_t* program = parserParseProgram(parser);
+
+            Compiler_t compiler = createCompiler();
+            compilerSetOptLevel(&compiler, optLevel);
+            TEST_INT(COMP_NO_ERROR, compilerCompile(&compiler, program), "Compiler error");
+
+            Bytecode_t bytecode = compilerGetBytecode(&compiler);
+            Vm_t vm = createVm(&bytecode);
+            VmError_t vmErr = vmRun(&vm);
+            TEST_STRING(inputs[i][1], vmErr.str, "wrong VM error");
+
+            cleanupVmError(&vmErr);
+            cleanupVm(&vm);
+            cleanupCompiler(&compiler);
+            cleanupParser(&parser);
+            cleanupProgram(&program);
+            gcForceRun();
+        }
+    }
+}
+
+// Identifiers can't have digits
+static char* letterName(char prefix, int i) {
+    return strFormat("%c%c%c", prefix, 'a' + i / 26, 'a' + i % 26);
+}
+
+// Programs past the narrow operand ranges, as generated code gets them
+void testWideOperands() {
+    // 300 parameters and arguments
+    Strbuf_t* params = createStrbuf();
+    Strbuf_t* args = createStrbuf();
+    for (int i = 0; i < 300; i++) {
+        if (i) strbufWrite(params, ", ");
+        strbufConsume(params, letterName('p', i));
+        strbufConsume(args, strFormat(i ? ", %d" : "%d", i));
+    }
+    char* paramList = detachStrbuf(&params);
+    char* argList = detachStrbuf(&args);
+    char* manyArgs = strFormat("let f = fn(%s) { pln - pab }; f(%s)", paramList, argList);
+
+    // 300 locals, the last ones only reachable with wide operands 
+    Strbuf_t* lets = createStrbuf();
+    for (int i = 0; i < 300; i++) {
+        char* name = letterName('a', i);
+        strbufConsume(lets, strFormat("let %s = n + %d; ", name, i));
+        free(name);
+    }
+    strbufWrite(lets, "[aaa, afu, id(aln)] }; f(1)");
+    char* body = detachStrbuf(&lets);
+    char* manyLocals = strFormat("let id = fn(x) { x }; let f = fn(n) { %s", body);
+
+    // a loop body past the reach of narrow jumps at every level
+    Strbuf_t* loop = createStrbuf();
+    strbufWrite(loop, "let f = fn(n) { let s = 0; while (n > 0) { ");
+    for (int i = 0; i < 12000; i++) {
+        strbufWrite(loop, "s = s + n; ");
+    }
+    strbufWrite(loop, "n = n - 1; } if (s > 0) { s } else { 0 } }; f(2)");
+    char* longLoop = detachStrbuf(&loop);
+
+    // more than UINT16_MAX constants ahead of the function, its switch table and strings
+    Strbuf_t* consts = createStrbuf();
+    strbufWrite(consts, "let s = \"start\"; ");
+    for (int i = 0; i < 70000; i++) {
+        strbufConsume(consts, strFormat("s = \"k%d\"; ", i));
+    }
+    strbufWrite(consts, "let g = fn(x) { if (x == 1) { \"one\" } else { if (x == 2) { \"two\" } else { if (x == 3) { s } else { \"many\" } } } }; ");
+    strbufWrite(consts, "[g(1), g(2), g(3), g(4)]");
+    char* manyConstants = detachStrbuf(&consts);
+
+    TestCase_t vmTestCases[] = {
+        {manyArgs, _INT(298)},
+        {manyLocals, _ARRAY(_INT(1), _INT(151), _INT(300), _END)},
+        {longLoop, _INT(36000)},
+        {manyConstants, _ARRAY(_STRING("one"), _STRING("two"), _STRING("k69999"), _STRING("many"), _END)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+
+    free(paramList);
+    free(argList);
+    free(manyArgs);
+    free(body);
+    free(manyLocals);
+    free(longLoop);
+    free(manyConstants);
+}
+
+// Runs one input against shared REPL state and checks the last popped object 
+static void runReplInput(const char* input, GenericExpect_t exp, SymbolTable_t* symTable, VectorObjects_t* constants, Object_t** globals, uint8_t optLevel) {
+    Lexer_t* lexer = createLexer(input);
+    Parser_t* parser = createParser(lexer);
+    Program_t* program = parserParseProgram(parser);
+
+    Compiler_t compiler = createCompilerWithState(symTable, constants);
+    compilerSetOptLevel(&compiler, optLevel);
+    CompError_t compErr = compilerCompile(&compiler, program); 
+    TEST_INT(COMP_NO_ERROR, compErr, "Compiler error");
+
+    Bytecode_t bytecode = compilerGetBytecode(&compiler);   
+    Vm_t vm = createVmWithStore(&bytecode, globals);
+    VmError_t vmErr = vmRun(&vm); 
+    TEST_INT(VM_NO_ERROR, vmErr.code, vmErr.str); 
+    testExpectedObject(&exp, vmLastPoppedStackElem(&vm));
+
+    cleanupVmError(&vmErr);
+    cleanupVm(&vm);
+    cleanupCompiler(&compiler);
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+}
+
+void testConstantCompaction() {
+    Object_t** globals = callocChk(GLOBALS_SIZE * sizeof(Object_t*));
+    VectorObjects_t* constants = createVectorObjects();
+    SymbolTable_t* symTable = createSymbolTable();
+
+    runReplInput("1000000; 2000000; let f = fn(x) { x + 100000 }; 1000000 + 2000000", _INT(3000000), symTable, constants, globals, 0);
+    TEST_ASSERT_EQUAL_INT(4, vectorObjectsGetCount(constants));
+
+    // only 100000 and the function survive, f reads it through its own pool
+    TEST_ASSERT_EQUAL_INT(2, compilerCompactConstants(constants, globals, symTable->numDefinitions));
+    TEST_ASSERT_EQUAL_INT(2, vectorObjectsGetCount(constants));
+    gcForceRun();
+    runReplInput("f(5)", _INT(100005), symTable, constants, globals, 0);
+
+    // repeated literals reuse the surviving constants 
+    runReplInput("f(50000) + 100000", _INT(250000), symTable, constants, globals, 0);
+    TEST_ASSERT_EQUAL_INT(3, vectorObjectsGetCount(constants));
+    compilerCompactConstants(constants, globals, symTable->numDefinitions);
+    TEST_ASSERT_EQUAL_INT(2, vectorObjectsGetCount(constants));
+
+    gcClearRef(globals[0], GC_REF_GLOBAL);
+    uint32_t count = vectorObjectsGetCount(constants);
+    for (uint32_t i = 0; i < count; i++) {
+        gcClearRef(constants->buf[i], GC_REF_COMPILE_CONSTANT);
+    }
+    cleanupVectorObjects(&constants, NULL);
+    cleanupSymbolTable(symTable);
+    free(globals);
+    gcForceRun();
+}
+
+// A later input assigning a global bound to a constant is seen by the
+// functions compiled before it
+void testConstantGlobalsAcrossInputs() {
+    for (uint8_t optLevel = 0; optLevel < 2; optLevel++) {
+        Object_t** globals = callocChk(GLOBALS_SIZE * sizeof(Object_t*));
+        VectorObjects_t* constants = createVectorObjects();
+        SymbolTable_t* symTable = createSymbolTable();
+
+        runReplInput("let x = 1; let f = fn() { x }; [x, f()]", _ARRAY(_INT(1), _INT(1), _END), symTable, constants, globals, optLevel);
+        compilerCompactConstants(constants, globals, symTable->numDefinitions);
+        gcForceRun();
+        runReplInput("x = 2; [x, f()]", _ARRAY(_INT(2), _INT(2), _END), symTable, constants, globals, optLevel);
+        runReplInput("let x = 3; [x, f()]", _ARRAY(_INT(3), _INT(2), _END), symTable, constants, globals, optLevel);
+
+        for (uint32_t i = 0; i < symTable->numDefinitions; i++) {
+            gcClearRef(globals[i], GC_REF_GLOBAL);
+        }
+        uint32_t count = vectorObjectsGetCount(constants);
+        for (uint32_t i = 0; i < count; i++) {
+            gcClearRef(constants->buf[i], GC_REF_COMPILE_CONSTANT);
+        }
+        cleanupVectorObjects(&constants, NULL);
+        cleanupSymbolTable(symTable);
+        free(globals);
+        gcForceRun();
+    }
+}
+
+void testPackedArrays() {
+    Array_t* arr = createArray();
+    TEST_ASSERT_TRUE(arrayIsPacked(arr));
+    arrayAppend(arr, (Object_t*)createInteger(1));
+    arrayAppendInt(arr, 2);
+    TEST_ASSERT_TRUE(arrayIsPacked(arr));
+
+    Array_t* view = createArrayView(arr, 1, 1);
+    TEST_ASSERT_TRUE(arrayIsPacked(view));
+    TEST_INT(2, arrayGetInts(view)[0], "Wrong view element");
+
+    // storing a non integer unpacks the elements 
+    Array_t* mixed = copyArray(arr);
+    arrayAppend(mixed, (Object_t*)createString("a"));
+    TEST_ASSERT_FALSE(arrayIsPacked(mixed));
+    testArrayObject(_ARRAY(_INT(1), _INT(2), _STRING("a"), _END).al, (Object_t*)mixed);
+    testArrayObject(_ARRAY(_INT(1), _INT(2), _END).al, (Object_t*)arr);
+    gcForceRun();
+}
+
+void testArraySpill() {
+    // grows past the inline capacity, then unpacks the spilled ints 
+    Array_t* arr = createArrayWithCapacity(2);
+    for (int64_t i = 0; i < 5; i++) {
+        arrayAppendInt(arr, i);
+    }
+    TEST_ASSERT_TRUE(arrayIsPacked(arr));
+    testArrayObject(_ARRAY(_INT(0), _INT(1), _INT(2), _INT(3), _INT(4), _END).al, (Object_t*)arr);
+
+    arrayAppend(arr, (Object_t*)createString("a"));
+    arrayAppendInt(arr, 5);
+    TEST_ASSERT_FALSE(arrayIsPacked(arr));
+    testArrayObject(_ARRAY(_INT(0), _INT(1), _INT(2), _INT(3), _INT(4), 
+                           _STRING("a"), _INT(5), _END).al, (Object_t*)arr);
+
+    // empty arrays switch to generic without leaving inline storage 
+    Array_t* empty = createArrayWithCapacity(1);
+    arrayAppend(empty, (Object_t*)createString("b"));
+    testArrayObject(_ARRAY(_STRING("b"), _END).al, (Object_t*)empty);
+    gcForceRun();
+}
+
 void testClosures() {
     TestCase_t vmTestCases[] = {
         {
@@ -664,12 +1241,347 @@ void testRecursiveFunctions() {
     int numTestCases = sizeof(vmTestCases) / sizeof(vmTestCases[0]);
     runVmTest(vmTestCases, numTestCases);
 }
+// runVmTest compares -O1 and -O2, where these calls are inlined, against -O0
+void testInlining() {
+    TestCase_t vmTestCases[] = {
+        {"let double = fn(x) { x * 2 }; double(3) + double(4)", _INT(14)},
+        {"let sq = fn(x) { x * x }; let sum = fn(a, b) { sq(a) + sq(b) }; sum(3, 4)", _INT(25)},
+        {"let f = fn(a) { let b = a + 1; let c = b * 2; c - a }; fn(x) { f(x) }(5)", _INT(7)},
+        {"let mk = fn(a) { fn(b) { a + b } }; let inc = mk(1); inc(mk(2)(3))", _INT(6)},
+        {"let first = fn(arr) { len(arr) + arr[0] }; first([4, 5])", _INT(6)},
+        {"let pick = fn(c, a, b) { if (c) { a } else { b } }; pick(true, 1, 2) + pick(false, 10, 20)", _INT(21)},
+        {"let noop = fn(x) { }; noop(1)", _NIL},
+        {"let a = 1; let f = fn() { a }; let a = 5; f() + a", _INT(6)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+}
+
+// At -O2 parameters only ever bound to integers use the unchecked opcodes
+void testTypeInference() {
+    TestCase_t vmTestCases[] = {
+        {"let fib = fn(n) { if (n < 2) { return n; } fib(n - 1) + fib(n - 2) }; fib(15)", _INT(610)},
+        {"let countDown = fn(x) { if (x == 0) { return 0; } countDown(x - 1) }; countDown(10)", _INT(0)},
+        {"let add = fn(a, b) { return a + b; }; let s = add(\"a\", \"b\"); len(s) + add(1, 2)", _INT(5)},
+        {"let same = fn(a, b) { return a == b; }; let call = fn(f, x) { return f(x, x); }; [same(1, 2), call(same, \"a\")]",
+            _ARRAY(_BOOL(false), _BOOL(true), _END)},
+        {"let pick = fn(c) { if (c) { return 1; } 2 }; pick(true) + pick(false)", _INT(3)},
+        {"let neg = fn(x) { return -x; }; let twice = fn(x) { return neg(neg(x)) * 2; }; twice(4)", _INT(8)},
+        {"let dec = fn(y) { return y - 1; }; let big = fn(x) { return dec(x) > 1; }; big(5)", _BOOL(true)},
+        {"let f = fn(x) { return x; }; let g = fn() { f(1) + f(2) }; [g(), f(\"s\")]", _ARRAY(_INT(3), _STRING("s"), _END)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+}
+
+void testLambdaLifting() {
+    TestCase_t vmTestCases[] = {
+        {
+            "let reduce = fn(arr, initial, f) {"
+            "   let iter = fn(arr, result) {"
+            "       if (len(arr) == 0) { result } else { iter(rest(arr), f(result, first(arr))) }"
+            "   };"
+            "   iter(arr, initial)"
+            "};"
+            "reduce([1, 2, 3, 4, 5], 0, fn(acc, el) { acc + el })",
+            _INT(15),
+        },
+        {"let f = fn(a, b) { let g = fn(x) { a * x + b }; g(1) + g(2) }; f(3, 4)", _INT(17)},
+        {"let f = fn(a) { let g = fn(x) { fn() { a + x } }; g(1)() }; f(2)", _INT(3)},
+        {"let f = fn(a) { let g = fn() { a }; [g, g()] }; f(5)[0]()", _INT(5)},
+        {"let f = fn(a) { let g = fn(c) { if (c) { a } else { 0 } }; g(true) + g(false) }; f(7)", _INT(7)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+}
+
+// Evaluating a literal that captures nothing always gives the same closure
+void testCaptureFreeClosuresAreShared() {
+    const char* input = "let make = fn() { return fn(x) { x }; }; [make(), make()]";
+    for (int level = 0; level < NUM_OPT_LEVELS; level++) {
+        Lexer_t* lexer = createLexer(input);
+        Parser_t* parser = createParser(lexer);
+        Program_t* program = parserParseProgram(parser);
+
+        Compiler_t compiler = createCompiler();
+        compilerSetOptLevel(&compiler, level);
+        TEST_INT(COMP_NO_ERROR, compilerCompile(&compiler, program), "Compiler error");
+
+        Bytecode_t bytecode = compilerGetBytecode(&compiler);
+        Vm_t vm = createVm(&bytecode);
+        VmError_t vmErr = vmRun(&vm);
+        TEST_INT(VM_NO_ERROR, vmErr.code, vmErr.str);
+
+        Array_t* arr = (Array_t*)vmLastPoppedStackElem(&vm);
+        TEST_INT(OBJECT_ARRAY, arr->type, "Object type not OBJECT_ARRAY");
+        TEST_ASSERT_TRUE(arrayGetElement(arr, 0) == arrayGetElement(arr, 1));
+
+        cleanupVmError(&vmErr);
+        cleanupVm(&vm);
+        cleanupCompiler(&compiler);
+        cleanupParser(&parser);
+        cleanupProgram(&program);
+        gcForceRun();
+    }
+}
+
+// Loop variables live in phis at -O1 and above, closures still capture the value of each iteration
+void testWhileLoops() {
+    TestCase_t vmTestCases[] = {
+        {"let i = 0; let s = 0; while (i < 10) { s = s + i; i = i + 1; } s", _INT(45)},
+        {"let f = fn(n) { let i = 0; let s = 0; while (i < n) { s = s + i; i = i + 1; } s }; f(100)", _INT(4950)},
+        {"let f = fn() { let a = 1; let b = 2; let n = 0; while (n < 3) { let t = a; a = b; b = t; n = n + 1; } [a, b] }; f()",
+            _ARRAY(_INT(2), _INT(1), _END)},
+        {"let f = fn(n) { let i = 0; let e = 0; while (i < n) { if (i / 2 * 2 == i) { e = e + 1 } i = i + 1; } e }; f(10)", _INT(5)},
+        {"let f = fn(n) { while (true) { if (n > 5) { return n; } n = n + 1; } }; f(0)", _INT(6)},
+        {"let f = fn(n) { let i = 0; let fs = []; while (i < n) { fs = push(fs, fn() { i }); i = i + 1; } fs[1]() + fs[2]() }; f(3)", _INT(3)},
+        {"let f = fn(n) { let i = 0; let t = 0; while (i < n) { let j = 0; while (j < i) { t = t + j; j = j + 1; } i = i + 1; } t }; f(5)", _INT(10)},
+        {"let s = \"\"; let i = 0; while (i < 3) { s = s + \"a\"; i = i + 1; } s", _STRING("aaa")},
+        {"let f = fn(arr) { let i = 0; let out = 0; while (i < 3) { out = out + len(arr); i = i + 1; } out }; f([1, 2, 3])", _INT(9)},
+        {"let f = fn() { let x = 0; while (false) { x = 1 } x }; f()", _INT(0)},
+        {"let f = fn(n) { let i = 0; while (i < n) { i = i + 1 } }; f(3)", _NIL},
+        {"let g = fn(a) { let i = 0; while (len(a) > i) { i = i + 1; } i }; g([1, 2, 3])", _INT(3)},
+        {"let i = 0; while (i < 3) { i = i + 1; }", _NIL},
+        {"while (false) {};", _NIL},
+        {"7; while (false) {}", _NIL},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+}
+
+// Globals set once by a top level let to a literal or a function are loaded as constants
+void testConstantGlobals() {
+    TestCase_t vmTestCases[] = {
+        {"let limit = 10; let f = fn(n) { n + limit }; f(1)", _INT(11)},
+        {"let s = \"a\"; let f = fn() { s + \"b\" }; f()", _STRING("ab")},
+        {"let f = fn(x) { x * 2 }; let g = f; g(4)", _INT(8)},
+        {"let x = 1; let f = fn() { x }; let x = 2; [f(), x]", _ARRAY(_INT(1), _INT(2), _END)},
+        {"let x = 1; let g = fn() { x = x + 5 }; g(); x", _INT(6)},
+        {"if (true) { let y = 1 }; y", _INT(1)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+}
+
+// Reassigned globals are never inlined nor typed from their first value
+void testAssignments() {
+    TestCase_t vmTestCases[] = {
+        {"let x = 1; let g = fn() { x = x + 1; x }; g(); g(); x", _INT(3)},
+        {"let f = fn(x) { x }; f = fn(x) { x + 1 }; f(1)", _INT(2)},
+        {"let g = fn() { 1 }; let h = fn() { g() }; g = fn() { 2 }; h()", _INT(2)},
+        {"let f = fn(n) { let x = 0; while (n > 0) { x = n; n = n - 1; } x }; f(3)", _INT(1)},
+        {"let f = fn(x) { if (x) { x = 2 } else { 0 } }; [f(1), f(false)]", _ARRAY(_NIL, _INT(0), _END)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+}
+
+void testInvalidAssignments() {
+    typedef struct TestCase {
+        const char* input;
+        CompError_t expErr;
+    } TestCase_t;
+
+    TestCase_t testCases[] = {
+        {"y = 1", COMP_UNDEFINED_VARIABLE},
+        {"len = 1", COMP_NOT_ASSIGNABLE},
+        {"fn(a) { fn() { a = 1 } }", COMP_NOT_ASSIGNABLE},
+        {"let f = fn() { f = 1 }; 1", COMP_NOT_ASSIGNABLE},
+    };
+    int numTestCases = sizeof(testCases) / sizeof(testCases[0]);
+
+    for (int i = 0; i < numTestCases * NUM_OPT_LEVELS; i++) {
+        Lexer_t* lexer = createLexer(testCases[i / NUM_OPT_LEVELS].input);
+        Parser_t* parser = createParser(lexer);
+        Program_t* program = parserParseProgram(parser);
+
+        Compiler_t compiler = createCompiler();
+        compilerSetOptLevel(&compiler, i % NUM_OPT_LEVELS);
+        TEST_INT(testCases[i / NUM_OPT_LEVELS].expErr, compilerCompile(&compiler, program), testCases[i / NUM_OPT_LEVELS].input);
+
+        cleanupCompiler(&compiler);
+        cleanupParser(&parser);
+        cleanupProgram(&program);
+        gcForceRun();
+    }
+}
+
+// Chains of three or more integer comparisons on one value go through OP_SWITCH_TABLE
+void testSwitchTables() {
+    TestCase_t vmTestCases[] = {
+        {"let f = fn(x) { if (x == 1) { 10 } else { if (x == 2) { 20 } else { if (x == 3) { 30 } else { 0 } } } }; [f(1), f(2), f(3), f(4), f(-1)]",
+            _ARRAY(_INT(10), _INT(20), _INT(30), _INT(0), _INT(0), _END)},
+        {"let f = fn(x) { if (x == 100) { 10 } else { if (x == 2) { 20 } else { if (x == -50) { 30 } } } }; [f(100), f(2), f(-50), f(3)]",
+            _ARRAY(_INT(10), _INT(20), _INT(30), _NIL, _END)},
+        // the second comparison with 1 is unreachable, the chain stops before it
+        {"let f = fn(x) { if (x == 1) { 10 } else { if (x == 2) { 20 } else { if (x == 1) { 30 } else { 40 } } } }; [f(1), f(2)]",
+            _ARRAY(_INT(10), _INT(20), _END)},
+        {"let f = fn(x) { if (x == 1) { return 10; } else { if (x == 2) { 20 } else { if (x == 3) { 30 } } }; 0 }; [f(1), f(2), f(3)]",
+            _ARRAY(_INT(10), _INT(0), _INT(0), _END)},
+        {"let f = fn(n) { let i = 0; let s = 0; while (i < n) { if (i == 0) { s = s + 1 } else { if (i == 1) { s = s + 10 } else { if (i == 2) { s = s + 100 } else { s = s + 1000 } } } i = i + 1; } s }; f(5)",
+            _INT(2111)},
+        {"let x = 2; if (x == 1) { 10 } else { if (x == 2) { 20 } else { if (x == 4) { 40 } } }", _INT(20)},
+    };
+    runVmTest(vmTestCases, sizeof(vmTestCases) / sizeof(vmTestCases[0]));
+
+    // a non-integer value fails like the comparison it replaces
+    const char* input = "let f = fn(x) { if (x == 1) { 10 } else { if (x == 2) { 20 } else { if (x == 3) { 30 } } } }; f(\"a\")";
+    for (int optLevel = 0; optLevel < NUM_OPT_LEVELS; optLevel++) {
+        Lexer_t* lexer = createLexer(input);
+        Parser_t* parser = createParser(lexer);
+        Program_t* program = parserParseProgram(parser);
+
+        Compiler_t compiler = createCompiler();
+        compilerSetOptLevel(&compiler, optLevel);
+        TEST_INT(COMP_NO_ERROR, compilerCompile(&compiler, program), "Compiler error");
+
+        Bytecode_t bytecode = compilerGetBytecode(&compiler);
+        Vm_t vm = createVm(&bytecode);
+        VmError_t vmErr = vmRun(&vm);
+        TEST_STRING("unknown operator: 8 (STRING INTEGER)", vmErr.str, "wrong VM error");
+
+        cleanupVmError(&vmErr);
+        cleanupVm(&vm);
+        cleanupCompiler(&compiler);
+        cleanupParser(&parser);
+        cleanupProgram(&program);
+        gcForceRun();
+    }
+}
+
+void testCodeSegment() {
+    const char* input = "let h = fn() { 2 }; let f = fn() { let g = fn() { 1 }; g() }; f() + h()";
+    for (uint8_t optLevel = 0; optLevel < NUM_OPT_LEVELS; optLevel++) {
+        Lexer_t* lexer = createLexer(input);
+        Parser_t* parser = createParser(lexer);
+        Program_t* program = parserParseProgram(parser);
+
+        Compiler_t compiler = createCompiler();
+        compilerSetOptLevel(&compiler, optLevel);
+        TEST_INT(COMP_NO_ERROR, compilerCompile(&compiler, program), "Compiler error");
+
+        Bytecode_t bytecode = compilerGetBytecode(&compiler);
+        Vm_t vm = createVm(&bytecode);
+
+        // every function is linked into the segment of main with its pool right
+        // before its code, g follows f which creates it
+        CompiledFunction_t* main = vm.frames[0].cl->fn;
+        CompiledFunction_t* f = NULL;
+        CompiledFunction_t* g = NULL;
+        TEST_ASSERT_NOT_NULL(main->segment);
+        Object_t** constants = vectorObjectsGetBuffer(bytecode.constants);
+        for (uint32_t i = 0; i < vectorObjectsGetCount(bytecode.constants); i++) {
+            if (objectGetType(constants[i]) != OBJECT_COMPILED_FUNCTION) continue;
+            CompiledFunction_t* fn = (CompiledFunction_t*)constants[i];
+            TEST_ASSERT_TRUE(fn->segment == main->segment);
+            TEST_ASSERT_TRUE(fn->code >= main->segment->mem);
+            TEST_ASSERT_TRUE((uint8_t*)(fn->code + fn->codeLength) < (uint8_t*)main->segment->mem + main->segment->size);
+            TEST_INT(CODE_END_MARKER, fn->code[fn->codeLength], "end marker");
+            TEST_ASSERT_TRUE((const CodeWord_t*)(fn->constants + fn->numConstants) == fn->code);
+            if (fn->numConstants > 0 && objectGetType(fn->constants[0]) == OBJECT_COMPILED_FUNCTION) {
+                f = fn;
+                g = (CompiledFunction_t*)fn->constants[0];
+            }
+        }
+        if (f) {
+            size_t gap = (uint8_t*)g->constants - (uint8_t*)(f->code + f->codeLength + 1);
+            TEST_ASSERT_TRUE(gap < sizeof(Object_t*));
+        }
+
+        VmError_t vmErr = vmRun(&vm);
+        TEST_INT(VM_NO_ERROR, vmErr.code, vmErr.str);
+        testIntegerObject(3, vmLastPoppedStackElem(&vm));
+
+        cleanupVmError(&vmErr);
+        cleanupVm(&vm);
+        cleanupCompiler(&compiler);
+        cleanupParser(&parser);
+        cleanupProgram(&program);
+        gcForceRun();
+    }
+}
+
+// f is jitted on its third call, main runs once and stays interpreted
+void testJitThreshold() {
+#if defined(JIT_SUPPORTED)
+    Lexer_t* lexer = createLexer("let f = fn(x) { x * 2 }; f(1) + f(2) + f(3)");
+    Parser_t* parser = createParser(lexer);
+    Program_t* program = parserParseProgram(parser);
+
+    Compiler_t compiler = createCompiler();
+    TEST_INT(COMP_NO_ERROR, compilerCompile(&compiler, program), "Compiler error");
+
+    Bytecode_t bytecode = compilerGetBytecode(&compiler);
+    Vm_t vm = createVm(&bytecode);
+    vmSetJitThreshold(&vm, 3);
+    VmError_t vmErr = vmRun(&vm);
+    TEST_INT(VM_NO_ERROR, vmErr.code, vmErr.str);
+    testIntegerObject(12, vmLastPoppedStackElem(&vm));
+
+    CompiledFunction_t* f = ((Closure_t*)vm.globals[0])->fn;
+    TEST_INT(3, f->numCalls, "calls of f");
+    TEST_ASSERT_NOT_NULL(f->jit);
+    TEST_ASSERT_NULL(vm.frames[0].cl->fn->jit);
+
+    cleanupVmError(&vmErr);
+    cleanupVm(&vm);
+    cleanupCompiler(&compiler);
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+    gcForceRun();
+#else
+    TEST_IGNORE_MESSAGE("no JIT on this platform");
+#endif
+}
+
+// The inner loop is traced on its second iteration, its exits resume the 
+// outer loop which runs interpreted
+void testTraceCoverage() {
+#if defined(JIT_SUPPORTED)
+    Lexer_t* lexer = createLexer(
+        "let f = fn(n) { let total = 0; let k = 0;"
+        "  while (k < n) { let i = 0; while (i < 100) { total = total + i; i = i + 1; } k = k + 1; }"
+        "  total };"
+        "f(10)");
+    Parser_t* parser = createParser(lexer);
+    Program_t* program = parserParseProgram(parser);
+
+    Compiler_t compiler = createCompiler();
+    TEST_INT(COMP_NO_ERROR, compilerCompile(&compiler, program), "Compiler error");
+
+    Bytecode_t bytecode = compilerGetBytecode(&compiler);
+    Vm_t vm = createVm(&bytecode);
+    vmSetJitThreshold(&vm, 0);
+    vmSetTraceThreshold(&vm, 2);
+    VmError_t vmErr = vmRun(&vm);
+    TEST_INT(VM_NO_ERROR, vmErr.code, vmErr.str);
+    testIntegerObject(49500, vmLastPoppedStackElem(&vm));
+
+    CompiledFunction_t* f = ((Closure_t*)vm.globals[0])->fn;
+    TEST_ASSERT_NOT_NULL(f->traces);
+    uint32_t numTraces = 0;
+    for (uint32_t ip = 0; ip <= f->codeLength; ip++) {
+        if (f->traces[ip].trace) numTraces++;
+    }
+    TEST_ASSERT_TRUE(numTraces > 0);
+    TEST_ASSERT_TRUE(vm.tracedInstructions > 0);
+    TEST_ASSERT_TRUE(vmTraceCoverage(&vm) > 90.0);
+
+    cleanupVmError(&vmErr);
+    cleanupVm(&vm);
+    cleanupCompiler(&compiler);
+    cleanupParser(&parser);
+    cleanupProgram(&program);
+    gcForceRun();
+#else
+    TEST_IGNORE_MESSAGE("no JIT on this platform");
+#endif
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(testIntegerArithmetic);
     RUN_TEST(testBooleanExpressions);
     RUN_TEST(testConditionals);
     RUN_TEST(testGlobalLetStatements);
+    RUN_TEST(testStringExpressions);
+    RUN_TEST(testRopes);
+    RUN_TEST(testDeepRopesSurviveGc);
+    RUN_TEST(testStringInterning);
     RUN_TEST(testArrayLiterals);
     RUN_TEST(testHashLiterals);
     RUN_TEST(testIndexExpression);
@@ -681,7 +1593,30 @@ int main(void) {
     RUN_TEST(testCallingFunctionsWithWrongArguments);
     RUN_TEST(testFirstClassFunctions);
     RUN_TEST(testBuiltinFunctions);
+    RUN_TEST(testArrayViewsSurviveGc);
+    RUN_TEST(testDeepArraysSurviveGc);
+    RUN_TEST(testConstantCompaction);
+    RUN_TEST(testConstantGlobalsAcrossInputs);
+    RUN_TEST(testPushValueSemantics);
+    RUN_TEST(testPushInPlace);
+    RUN_TEST(testPushInLoops);
+    RUN_TEST(testPackedArrays);
+    RUN_TEST(testArraySpill);
     RUN_TEST(testClosures);
     RUN_TEST(testRecursiveFunctions);
+    RUN_TEST(testInlining);
+    RUN_TEST(testTypeInference);
+    RUN_TEST(testLambdaLifting);
+    RUN_TEST(testCaptureFreeClosuresAreShared);
+    RUN_TEST(testWhileLoops);
+    RUN_TEST(testAssignments);
+    RUN_TEST(testInvalidAssignments);
+    RUN_TEST(testSwitchTables);
+    RUN_TEST(testImmediates);
+    RUN_TEST(testWideOperands);
+    RUN_TEST(testConstantGlobals);
+    RUN_TEST(testCodeSegment);
+    RUN_TEST(testJitThreshold);
+    RUN_TEST(testTraceCoverage);
     return UNITY_END();
 }
\ No newline at end of file